@@ -12,416 +12,288 @@
 #include <math.h>
 #include <ctype.h>
 #include <string.h>
+#include <pthread.h>
 #include "KDArray.h"
-#include "SPPoint.h"
+#include "SPFeatureStore.h"
 #include "SPLogger.h"
 
 #define DOUBLE_ARRAY_SIZE 2
+// kd-arrays smaller than this are split by one thread, the threads would cost more than they save
+#define KD_ARRAY_PARALLEL_MIN_SIZE 8192
 
 //this data type will be used for sorting purposes
 struct augmented_point {
-	SPPoint point;
-	int index; // indicates the index of the point in array of points
-	int rowNumInMat; // indicates the coordinate which the points will be sorted by
+	double value; // the coordinate which the points will be sorted by
+	int index; // the offset of the point in the feature store
 };
-//represents our kd-array
+
+//the index matrix shared by a kd-array and all the kd-arrays split from it
+typedef struct kd_array_data {
+	int* rows; // dimension rows of capacity offsets, one allocation
+	int capacity;
+	bool* isLeft; // Split: true for the offsets that go to the left kd-array
+	int views; // number of kd-arrays that refer to the data
+	pthread_mutex_t lock; // guards views, kd-arrays are split by several threads
+} KDArrayData;
+
+//represents our kd-array, a range of the shared index matrix
 struct kd_array {
-	SPPoint* arrayOfPoints;
+	SPFeatureStore store; // holds the coordinates, shared by all kd-arrays
+	KDArrayData* data;
 	int size;
-	int** mat;
+	int** mat; // mat[i] - the offsets of the points sorted by coordinate i
 };
 
-bool equalDimensionForAllPoints(SPPoint* arr, int size);
-void destroyMat(int** mat, int index);
+//the work of one thread of SplitParallel: the rows first to last - 1 of the mat
+typedef struct split_task_t {
+	SPKDArray kdArr;
+	int coor; // the row that is already partitioned
+	int middle; // the size of the left kd-array
+	int* right; // room for the offsets of the right kd-array
+	int first;
+	int last;
+} SplitTask;
 
 int cmp(const void * a, const void * b);
-void fillXArray(int * x, SPKDArray kdArr, int coor, int middle);
-void destroyAuxArrays(int * x, SPKDArray *doubleKdArray, int * map1, int * map2);
-void destroyAugPoints(AUGPoint * augPointsArray, int index);
 
-SPKDArray Init(SPPoint* arr, int size) {
-	AUGPoint * augPointsArray = NULL;
-	SPKDArray kdArray = NULL;
-	int dimension = 0;
-	if (arr == NULL || size <= 0) {
-		return NULL;
-	}
-	//make sure all the Dimensions are the same
-	if (!equalDimensionForAllPoints(arr, size)) {
-		spLoggerPrintError("different dimensions to points", __FILE__, __func__,
-		__LINE__);
-		return NULL;
-	}
-	if (arr[0] != NULL)
-		dimension = spPointGetDimension(arr[0]);
-	else {
-		spLoggerPrintError("no points in arr, arr[0] = NULL", __FILE__,
-				__func__, __LINE__);
-		return NULL;
-	}
-
-	// Allocations
-	kdArray = (SPKDArray) malloc(sizeof(*kdArray));
+/** a kd-array of the size points of data from position first of every row **/
+static SPKDArray allocKDArray(SPFeatureStore store, KDArrayData* data,
+		int first, int size) {
+	int dimension = spFeatureStoreGetDimension(store);
+	SPKDArray kdArray = (SPKDArray) malloc(sizeof(*kdArray));
 	if (kdArray == NULL) {
 		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
 		return NULL;
 	}
-	augPointsArray = (AUGPoint*) malloc(size * sizeof(*augPointsArray));
-	if (augPointsArray == NULL) {
-		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
-		free(kdArray);
-		return NULL;
-	}
-	//alloc memory for points
-	kdArray->arrayOfPoints = (SPPoint*) malloc(
-			size * sizeof(*kdArray->arrayOfPoints));
-	if (kdArray->arrayOfPoints == NULL) {
-		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
-		free(kdArray);
-		free(augPointsArray);
-		return NULL;
-	}
-
-	kdArray->size = size;
-	//alloc memory for our Marix
 	kdArray->mat = (int **) malloc(dimension * sizeof(int*));
 	if (kdArray->mat == NULL) {
 		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
-		destroyArrayOfPoints(kdArray->arrayOfPoints, kdArray->size);
 		free(kdArray);
-		free(augPointsArray);
 		return NULL;
 	}
+	kdArray->store = store;
+	kdArray->data = data;
+	kdArray->size = size;
 	for (int i = 0; i < dimension; i++) {
-		kdArray->mat[i] = (int *) malloc(size * sizeof(int));
-		if (kdArray->mat[i] == NULL) {
-			spLoggerPrintError("Allocation Failure", __FILE__, __func__,
-			__LINE__);
-			destroyMat(kdArray->mat, i);
-			free(kdArray->arrayOfPoints);
-			free(kdArray);
-			free(augPointsArray);
-			return NULL;
-		}
+		kdArray->mat[i] = data->rows + (size_t) i * data->capacity + first;
 	}
-	//copy the given points to our kd_array struct and AUGPoint struct
-	for (int i = 0; i < size; i++) {
-		kdArray->arrayOfPoints[i] = spPointCopy(arr[i]);
-		if (kdArray->arrayOfPoints[i] == NULL) {
-			spLoggerPrintError("Allocation Failure", __FILE__, __func__,
-			__LINE__);
-			destroyMat(kdArray->mat, dimension);
-			destroyArrayOfPoints(kdArray->arrayOfPoints, i);
-			destroyAugPoints(augPointsArray, i);
-			free(kdArray);
-			return NULL;
-		}
-		augPointsArray[i].point = spPointCopy(arr[i]);
-		if (augPointsArray[i].point == NULL) {
-			spLoggerPrintError("Allocation Failure", __FILE__, __func__,
-			__LINE__);
-			destroyMat(kdArray->mat, dimension);
-			destroyArrayOfPoints(kdArray->arrayOfPoints, i + 1);
-			destroyAugPoints(augPointsArray, i);
-			free(kdArray);
-			return NULL;
-		}
-		augPointsArray[i].index = i;
-	}
-
-	//filling our Mat
-	for (int i = 0; i < dimension; i++) {
-		//changing the coordinate that we gonna sort by
-		for (int j = 0; j < size; j++) {
-			augPointsArray[j].rowNumInMat = i;
-		}
-		//sort via rowNumInMat coordinate
-		qsort(augPointsArray, size, sizeof(struct augmented_point), cmp);
-
-		//filling the indexes
-		for (int j = 0; j < size; j++) {
-			kdArray->mat[i][j] = augPointsArray[j].index;
-		}
-	}
-	destroyAugPoints(augPointsArray, size);
+	pthread_mutex_lock(&data->lock);
+	data->views++;
+	pthread_mutex_unlock(&data->lock);
 	return kdArray;
 }
 
-SPKDArray * Split(SPKDArray kdArr, int coor) {
-	if (kdArr == NULL
-			|| coor
-					< 0|| getMat(kdArr) == NULL || getArrayOfPoints(kdArr) == NULL) {
-		spLoggerPrintError("Split method - INVALID ARGUMENTS", __FILE__,
-				__func__, __LINE__);
-		return NULL;
-	}
-	SPKDArray *doubleKdArray = NULL;
-	SPKDArray kdLeft = NULL;
-	SPKDArray kdRight = NULL;
-	int l = 0;	// counter for LeftKDArray
-	int r = 0;	// counter for rightKDArray
-	int* map1 = NULL;
-	int* map2 = NULL;
-	int dimension = 0;
-	int middle = (int) ceil((double) kdArr->size / 2); // index of the middle
-	int *x = (int *) malloc(kdArr->size * sizeof(int));
-	if (x == NULL) {
-		spLoggerPrintError("Split method - Allocation Failure", __FILE__,
-				__func__, __LINE__);
-		return NULL;
-	}
-	doubleKdArray = (SPKDArray *) malloc(DOUBLE_ARRAY_SIZE * sizeof(SPKDArray));
-	if (doubleKdArray == NULL) {
-		spLoggerPrintError("Split method - Allocation Failure", __FILE__,
-				__func__, __LINE__);
-		destroyAuxArrays(x, NULL, NULL, NULL);
+/** allocates the shared data of size points, with no kd-array referring to it **/
+static KDArrayData* allocKDArrayData(SPFeatureStore store, int size) {
+	KDArrayData* data = (KDArrayData*) malloc(sizeof(*data));
+	if (data == NULL)
 		return NULL;
-	}
-	map1 = (int *) malloc(kdArr->size * sizeof(int));
-	if (map1 == NULL) {
-		spLoggerPrintError("Split method - Allocation Failure", __FILE__,
-				__func__, __LINE__);
-		destroyAuxArrays(x, doubleKdArray, NULL, NULL);
-		return NULL;
-	}
-	map2 = (int *) malloc(kdArr->size * sizeof(int));
-	if (map1 == NULL) {
-		spLoggerPrintError("Split method - Allocation Failure", __FILE__,
-				__func__, __LINE__);
-		destroyAuxArrays(x, doubleKdArray, map1, NULL);
+	data->capacity = size;
+	data->views = 0;
+	data->rows = (int*) malloc(
+			(size_t) spFeatureStoreGetDimension(store) * size * sizeof(int));
+	data->isLeft = (bool*) calloc(spFeatureStoreGetSize(store), sizeof(bool));
+	if (data->rows == NULL || data->isLeft == NULL
+			|| pthread_mutex_init(&data->lock, NULL) != 0) {
+		free(data->rows);
+		free(data->isLeft);
+		free(data);
 		return NULL;
 	}
-	//initialize map1 & map2 with -1
-	for (int i = 0; i < kdArr->size; i++) {
-		map1[i] = -1;
-		map2[i] = -1;
-	}
+	return data;
+}
 
-	//alloc left kd-Array
-	kdLeft = (SPKDArray) malloc(sizeof(*kdLeft));
-	if (kdLeft == NULL) {
-		spLoggerPrintError("Split method - Allocation Failure", __FILE__,
-				__func__, __LINE__);
-		destroyAuxArrays(x, doubleKdArray, map1, map2);
-		return NULL;
-	}
+static void destroyKDArrayData(KDArrayData* data) {
+	pthread_mutex_destroy(&data->lock);
+	free(data->rows);
+	free(data->isLeft);
+	free(data);
+}
 
-	kdLeft->arrayOfPoints = (SPPoint*) malloc(middle * sizeof(SPPoint));
-	if (kdLeft->arrayOfPoints == NULL) {
-		spLoggerPrintError("Split method - Allocation Failure", __FILE__,
-				__func__, __LINE__);
-		destroyAuxArrays(x, doubleKdArray, map1, map2);
-		free(kdLeft);
-		return NULL;
-	}
-	kdLeft->size = middle;
-	//alloc the Mats of kdLeft and kdright
-	if (kdArr->arrayOfPoints[0] != NULL)
-		dimension = spPointGetDimension(kdArr->arrayOfPoints[0]);
-	else {
-		spLoggerPrintError("No points in kdArr.", __FILE__, __func__, __LINE__);
-		destroyAuxArrays(x, doubleKdArray, map1, map2);
-		free(kdLeft);
+SPKDArray Init(SPFeatureStore store, const int* offsets, int size) {
+	AUGPoint * augPointsArray = NULL;
+	KDArrayData* data = NULL;
+	SPKDArray kdArray = NULL;
+	int dimension = 0;
+	if (store == NULL || size <= 0) {
 		return NULL;
 	}
-	kdLeft->mat = (int **) malloc(dimension * sizeof(int*));
-	if (kdLeft->mat == NULL) {
-		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
-		destroyAuxArrays(x, doubleKdArray, map1, map2);
-		destroyArrayOfPoints(kdLeft->arrayOfPoints, kdLeft->size);
-		free(kdLeft);
+	if (offsets == NULL && size > spFeatureStoreGetSize(store)) {
+		spLoggerPrintError("not enough points in the feature store", __FILE__,
+				__func__, __LINE__);
 		return NULL;
 	}
-	for (int i = 0; i < dimension; i++) {
-		kdLeft->mat[i] = (int *) malloc(middle * sizeof(int));
-		if (kdLeft->mat[i] == NULL) {
-			spLoggerPrintError("Allocation Failure", __FILE__, __func__,
-			__LINE__);
-			destroyAuxArrays(x, doubleKdArray, map1, map2);
-			destroyArrayOfPoints(kdLeft->arrayOfPoints, kdLeft->size);
-			destroyMat(kdLeft->mat, i);
-			free(kdLeft);
-			return NULL;
-		}
-	}
+	dimension = spFeatureStoreGetDimension(store);
 
-	kdRight = (SPKDArray) malloc(sizeof(*kdRight));
-	if (kdRight == NULL) {
+	// Allocations
+	data = allocKDArrayData(store, size);
+	if (data == NULL) {
 		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
-		destroyAuxArrays(x, doubleKdArray, map1, map2);
-		destroyArrayOfPoints(kdLeft->arrayOfPoints, kdLeft->size);
-		destroyMat(kdLeft->mat, kdLeft->size);
-		free(kdLeft);
 		return NULL;
 	}
-	kdRight->size = kdArr->size - middle;
-	kdRight->arrayOfPoints = (SPPoint*) malloc(kdRight->size * sizeof(SPPoint));
-	if (kdRight->arrayOfPoints == NULL) {
-		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
-		destroyAuxArrays(x, doubleKdArray, map1, map2);
-		destroyArrayOfPoints(kdLeft->arrayOfPoints, kdLeft->size);
-		destroyMat(kdLeft->mat, kdLeft->size);
-		free(kdLeft);
-		free(kdRight);
+	kdArray = allocKDArray(store, data, 0, size);
+	if (kdArray == NULL) {
+		destroyKDArrayData(data);
 		return NULL;
 	}
-	kdRight->mat = (int **) malloc(dimension * sizeof(int*));
-	if (kdRight->mat == NULL) {
+	augPointsArray = (AUGPoint*) malloc(size * sizeof(*augPointsArray));
+	if (augPointsArray == NULL) {
 		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
-		destroyAuxArrays(x, doubleKdArray, map1, map2);
-		destroyArrayOfPoints(kdLeft->arrayOfPoints, kdLeft->size);
-		destroyArrayOfPoints(kdRight->arrayOfPoints, kdRight->size);
-		destroyMat(kdLeft->mat, dimension);
-		free(kdLeft);
-		free(kdRight);
+		destroyKDArray(kdArray);
 		return NULL;
 	}
+
+	//filling our Mat, our kd_array refers to the points by their offset in the store
 	for (int i = 0; i < dimension; i++) {
-		kdRight->mat[i] = (int *) malloc(kdRight->size * sizeof(int));
-		if (kdRight->mat[i] == NULL) {
-			spLoggerPrintError("Allocation Failure", __FILE__, __func__,
-			__LINE__);
-			destroyAuxArrays(x, doubleKdArray, map1, map2);
-			destroyArrayOfPoints(kdLeft->arrayOfPoints, kdLeft->size);
-			destroyArrayOfPoints(kdRight->arrayOfPoints, kdRight->size);
-			destroyMat(kdLeft->mat, dimension);
-			free(kdLeft);
-			destroyMat(kdLeft->mat, i);
-			free(kdRight);
-			return NULL;
+		//changing the coordinate that we gonna sort by
+		for (int j = 0; j < size; j++) {
+			augPointsArray[j].index = (offsets == NULL) ? j : offsets[j];
+			augPointsArray[j].value = spFeatureStoreGetAxisCoor(store,
+					augPointsArray[j].index, i);
 		}
-	}
-
-	// fill x array according to coordinate coor
-	fillXArray(x, kdArr, coor, middle);
+		//sort via the i coordinate
+		qsort(augPointsArray, size, sizeof(struct augmented_point), cmp);
 
-	for (int i = 0; i < kdArr->size; i++) {
-		if (x[i] == 0) {
-			kdLeft->arrayOfPoints[l] = spPointCopy(kdArr->arrayOfPoints[i]);
-			if (kdLeft->arrayOfPoints[l] == NULL) {
-				spLoggerPrintError("point = NULL", __FILE__, __func__,
-				__LINE__);
-				destroyAuxArrays(x, doubleKdArray, map1, map2);
-				destroyArrayOfPoints(kdLeft->arrayOfPoints, l);
-				free(kdLeft);
-				destroyArrayOfPoints(kdRight->arrayOfPoints, r);
-				free(kdRight);
-				return NULL;
-			}
-			map1[i] = l; // map1[k] = -1, default for k where x[k] != 0
-			l++;
-		}
-		//x[i]==1
-		else {
-			kdRight->arrayOfPoints[r] = spPointCopy(kdArr->arrayOfPoints[i]);
-			if (kdRight->arrayOfPoints[r] == NULL) {
-				spLoggerPrintError("point = NULL", __FILE__, __func__,
-				__LINE__);
-				destroyAuxArrays(x, doubleKdArray, map1, map2);
-				destroyArrayOfPoints(kdLeft->arrayOfPoints, l);
-				free(kdLeft);
-				destroyArrayOfPoints(kdRight->arrayOfPoints, r);
-				free(kdRight);
-				return NULL;
-			}
-			map2[i] = r;
-			r++;
+		//filling the offsets
+		for (int j = 0; j < size; j++) {
+			kdArray->mat[i][j] = augPointsArray[j].index;
 		}
 	}
-	//filling the Mats of kdLeft and kdRight
-	for (int i = 0; i < dimension; i++) {
-		l = r = 0;
-		for (int j = 0; j < kdArr->size; j++) {
-			if (x[kdArr->mat[i][j]] == 0) {
-				kdLeft->mat[i][l] = map1[kdArr->mat[i][j]];
+	free(augPointsArray);
+	return kdArray;
+}
+
+/** partitions the rows task->first to task->last - 1, the left points first, keeping their order **/
+static void* partitionRows(void* arg) {
+	SplitTask* task = (SplitTask*) arg;
+	const bool* isLeft = task->kdArr->data->isLeft;
+	for (int i = task->first; i < task->last; i++) {
+		int* row = task->kdArr->mat[i];
+		int l = 0;	// counter for the left points
+		int r = 0;	// counter for the right points
+		if (i == task->coor)
+			continue;
+		for (int j = 0; j < task->kdArr->size; j++) {
+			if (isLeft[row[j]]) {
+				row[l] = row[j];
 				l++;
-			}
-			//x[kdArr->mat[i][j]]==1
-			else {
-				kdRight->mat[i][r] = map2[kdArr->mat[i][j]];
+			} else {
+				task->right[r] = row[j];
 				r++;
 			}
 		}
+		memcpy(row + task->middle, task->right, r * sizeof(int));
 	}
-	doubleKdArray[0] = kdLeft;
-	doubleKdArray[1] = kdRight;
-	destroyAuxArrays(x, NULL, map1, map2);
-	destroyArrayOfPoints(kdArr->arrayOfPoints, kdArr->size);
-	destroyMat(kdArr->mat, dimension);
-	free(kdArr);
-	return doubleKdArray;
-
+	return NULL;
 }
 
-/** filling x array according to the coordinate coor sorting **/
-void fillXArray(int * x, SPKDArray kdArr, int coor, int middle) {
-	for (int i = 0; i < middle; i++) {
-		x[kdArr->mat[coor][i]] = 0;
-	}
-	for (int i = middle; i < kdArr->size; i++) {
-		x[kdArr->mat[coor][i]] = 1;
-	}
+SPKDArray * Split(SPKDArray kdArr, int coor) {
+	return SplitParallel(kdArr, coor, 1);
 }
 
-/** check if all points have equal dimension **/
-bool equalDimensionForAllPoints(SPPoint* arr, int size) {
-	if (arr == NULL)
-		printf("%s", "arr = null");
-	for (int i = 0; i < size - 1; i++) {
-		if (arr[i] != NULL && arr[i + 1] != NULL)
-			if (spPointGetDimension(arr[i])
-					!= spPointGetDimension(arr[i + 1])) {
-				return false;
-			}
+SPKDArray * SplitParallel(SPKDArray kdArr, int coor, int threads) {
+	if (kdArr == NULL || coor < 0
+			|| coor >= spFeatureStoreGetDimension(kdArr->store)) {
+		spLoggerPrintError("Split method - INVALID ARGUMENTS", __FILE__,
+				__func__, __LINE__);
+		return NULL;
 	}
-	return true;
-}
+	SPKDArray *doubleKdArray = NULL;
+	SPKDArray kdLeft = NULL;
+	SPKDArray kdRight = NULL;
+	int* right = NULL;
+	int dimension = spFeatureStoreGetDimension(kdArr->store);
+	int middle = (int) ceil((double) kdArr->size / 2); // index of the middle
+	int first = (int) (kdArr->mat[0] - kdArr->data->rows); // position of the kd-array in every row
+	SplitTask tasks[KD_ARRAY_MAX_THREADS];
+	pthread_t workers[KD_ARRAY_MAX_THREADS];
+	bool started[KD_ARRAY_MAX_THREADS];
+	if (threads > dimension)
+		threads = dimension;
+	if (threads > KD_ARRAY_MAX_THREADS)
+		threads = KD_ARRAY_MAX_THREADS;
+	if (threads < 1 || kdArr->size < KD_ARRAY_PARALLEL_MIN_SIZE)
+		threads = 1;
 
-/** free mat until the index we reached. **/
-void destroyMat(int** mat, int index) {
-	for (int i = 0; i < index; i++) {
-		free(mat[i]);
+	//alloc left and right kd-Arrays, every row is partitioned in place
+	doubleKdArray = (SPKDArray *) malloc(DOUBLE_ARRAY_SIZE * sizeof(SPKDArray));
+	right = (int*) malloc(
+			((size_t) threads * (kdArr->size - middle) + 1) * sizeof(int));
+	kdLeft = allocKDArray(kdArr->store, kdArr->data, first, middle);
+	kdRight = allocKDArray(kdArr->store, kdArr->data, first + middle,
+			kdArr->size - middle);
+	if (doubleKdArray == NULL || right == NULL || kdLeft == NULL
+			|| kdRight == NULL) {
+		spLoggerPrintError("Split method - Allocation Failure", __FILE__,
+				__func__, __LINE__);
+		free(doubleKdArray);
+		free(right);
+		destroyKDArray(kdLeft);
+		destroyKDArray(kdRight);
+		return NULL;
 	}
-	free(mat);
-}
 
-/** free resources in array of SPPoints **/
-void destroyArrayOfPoints(SPPoint* arr, int index) {
-	for (int i = 0; i < index; i++) {
-		spPointDestroy(arr[i]);
+	// the first middle points with respect to coor go left
+	for (int i = 0; i < kdArr->size; i++) {
+		kdArr->data->isLeft[kdArr->mat[coor][i]] = i < middle;
 	}
-	free(arr);
-}
 
-/** free resources in augPoints array **/
-void destroyAugPoints(AUGPoint * augPointsArray, int index) {
-	for (int i = 0; i < index; i++) {
-		spPointDestroy(augPointsArray[i].point);
+	//partitioning the rows, every thread partitions some of them
+	for (int t = 0; t < threads; t++) {
+		tasks[t].kdArr = kdArr;
+		tasks[t].coor = coor;
+		tasks[t].middle = middle;
+		tasks[t].right = right + (size_t) t * (kdArr->size - middle);
+		tasks[t].first = t * dimension / threads;
+		tasks[t].last = (t + 1) * dimension / threads;
+		// the rows of a thread that failed to start are partitioned by this one
+		started[t] = t > 0
+				&& pthread_create(&workers[t], NULL, partitionRows, &tasks[t])
+						== 0;
+	}
+	for (int t = 0; t < threads; t++) {
+		if (!started[t])
+			partitionRows(&tasks[t]);
+	}
+	for (int t = 1; t < threads; t++) {
+		if (started[t])
+			pthread_join(workers[t], NULL);
 	}
-	free(augPointsArray);
+	doubleKdArray[0] = kdLeft;
+	doubleKdArray[1] = kdRight;
+	free(right);
+	destroyKDArray(kdArr);
+	return doubleKdArray;
+
 }
 
-/** free resources in the helper arrays we used **/
-void destroyAuxArrays(int * x, SPKDArray *doubleKdArray, int * map1, int * map2) {
-	if (x != NULL)
-		free(x);
-	if (doubleKdArray != NULL)
-		free(doubleKdArray);
-	if (map1 != NULL)
-		free(map1);
-	if (map2 != NULL)
-		free(map2);
+/** free all the resources of the kd-array, the feature store is not freed **/
+void destroyKDArray(SPKDArray kdArray) {
+	if (kdArray == NULL)
+		return;
+	KDArrayData* data = kdArray->data;
+	pthread_mutex_lock(&data->lock);
+	int views = --data->views;
+	pthread_mutex_unlock(&data->lock);
+	// the matrix is freed with the last kd-array that refers to it
+	if (views == 0)
+		destroyKDArrayData(data);
+	free(kdArray->mat);
+	free(kdArray);
 }
 
-/** compare function for SPPoint, allows us to sort the points **/
+/** compare function for AUGPoint, allows us to sort the points **/
 int cmp(const void * a, const void * b) {
 	const struct augmented_point *elem1 = (struct augmented_point *) a;
 	const struct augmented_point *elem2 = (struct augmented_point *) b;
-	if (spPointGetAxisCoor(elem1->point, elem1->rowNumInMat)
-			> spPointGetAxisCoor(elem2->point, elem2->rowNumInMat))
+	if (elem1->value > elem2->value)
+		return 1;
+	else if (elem1->value < elem2->value)
+		return -1;
+	// equal coordinates are kept in the order of their offsets
+	else if (elem1->index > elem2->index)
 		return 1;
-	else if (spPointGetAxisCoor(elem1->point, elem1->rowNumInMat)
-			< spPointGetAxisCoor(elem2->point, elem2->rowNumInMat))
+	else if (elem1->index < elem2->index)
 		return -1;
 	else
 		return 0;
@@ -429,10 +301,10 @@ int cmp(const void * a, const void * b) {
 
 /** getters **/
 
-SPPoint* getArrayOfPoints(SPKDArray kdArray) {
+int* getArrayOfPoints(SPKDArray kdArray) {
 	if (kdArray == NULL)
 		return NULL;
-	return kdArray->arrayOfPoints;
+	return kdArray->mat[0];
 }
 int getSize(SPKDArray kdArray) {
 	if (kdArray == NULL)
@@ -444,4 +316,8 @@ int** getMat(SPKDArray kdArray) {
 		return NULL;
 	return kdArray->mat;
 }
-
+SPFeatureStore getStore(SPKDArray kdArray) {
+	if (kdArray == NULL)
+		return NULL;
+	return kdArray->store;
+}
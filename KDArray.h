@@ -8,7 +8,7 @@
 #ifndef KDARRAY_H_
 #define KDARRAY_H_
 
-#include "SPPoint.h"
+#include "SPFeatureStore.h"
 
 /** type used to define a point in array of points**/
 typedef struct augmented_point AUGPoint;
@@ -18,33 +18,58 @@ typedef struct kd_array* SPKDArray;
 
 /**
  *
- * Initializes the kd-array with the data given by arr.
-
+ * Initializes the kd-array with the features of store given by offsets.
+ * The kd-array refers to the features by their offset in the store, the
+ * store itself is not copied and must outlive the kd-array. Its matrix
+ * holds one row per coordinate: the offsets sorted by that coordinate.
+ *
+ * @param store - the feature store holding the points
+ * @param offsets - the offsets of the points in the store, if NULL the
+ * 		first size features of the store are used
+ * @param size - the number of points
  * @return
- * 	NULL - If arr=NULL or allocations failed or size<=0
- * 	or not all the dimensions of the points are equal.
+ * 	NULL - If store=NULL or allocations failed or size<=0
+ * 	or offsets=NULL and the store holds less than size features.
  * 	A new KDArray in case of success.
  */
-SPKDArray Init(SPPoint* arr, int size);
+SPKDArray Init(SPFeatureStore store, const int* offsets, int size);
 
 /**
  *
  * Returns two kd-arrays (kdLeft, kdRight) such that the first
  * n/2 points with respect to the coordinate coor are in kdLeft ,
  * and the rest of the points are in kdRight.
+ * kdArr is destroyed in case of success.
+ * Nothing is copied: every row of the matrix of kdArr is partitioned in
+ * place (keeping the sorted order of both halves), and kdLeft and kdRight
+ * refer to its two ranges. The matrix is freed with the last kd-array.
  * @return
- * NULL - If kdArr=NULL or allocations failed or coor<0
+ * NULL - If kdArr=NULL or allocations failed or coor<0 or coor>=dimension
  * SPKDArray array of size two in case of success.
  */
 SPKDArray * Split(SPKDArray kdArr, int coor);
 
-/** getters **/
-SPPoint* getArrayOfPoints(SPKDArray kdArray);
+/** The largest number of threads SplitParallel uses **/
+#define KD_ARRAY_MAX_THREADS 64
+
+/**
+ *
+ * Same as Split, the rows of the sorted matrix (one per coordinate) are
+ * partitioned by up to threads threads. The result does not depend on the
+ * number of threads, small kd-arrays are split by the calling thread.
+ */
+SPKDArray * SplitParallel(SPKDArray kdArr, int coor, int threads);
+
+/**
+ * getters (the points are offsets in the feature store, row i of the mat
+ * holds them sorted by coordinate i, the array of points is row 0)
+ **/
+int* getArrayOfPoints(SPKDArray kdArray);
 int getSize(SPKDArray kdArray);
 int** getMat(SPKDArray kdArray);
+SPFeatureStore getStore(SPKDArray kdArray);
 
 /** free resources functions **/
-void destroyArrayOfPoints(SPPoint* arr, int index);
-void destroyMat(int** mat, int index);
+void destroyKDArray(SPKDArray kdArray);
 
 #endif /* KDARRAY_H_ */
@@ -7,100 +7,631 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <math.h>
 #include <ctype.h>
 #include <string.h>
+#include <pthread.h>
+#include <limits.h>
 #include "KDArray.h"
 #include "KDTreeNode.h"
 #include "SPPoint.h"
+#include "SPFeatureStore.h"
+#include "SPDistance.h"
+#include "SPTopKFixed.h"
 #include "SPConfig.h"
 #include "SPBPriorityQueue.h"
 #include "SPLogger.h"
 
+/**
+ * A node of the finalized tree, 16 bytes. The nodes of a tree are stored in
+ * one array: the root first and the two children of every internal node
+ * next to each other, at this + child and this + child + 1.
+ **/
 struct kd_tree_node_t {
-	int dim; //splitting dimension
-	double val; // median value of the splitting dimension
-	struct kd_tree_node_t* left;
-	struct kd_tree_node_t* right;
-	SPPoint data;
+	union {
+		struct {
+			float low; // the largest coordinate of the left subtree, rounded up
+			float high; // the smallest coordinate of the right subtree, rounded down
+		} split;
+		struct {
+			int data; // offset of the first point in the feature store
+			int count; // number of points (at consecutive offsets)
+		} leaf;
+	} u;
+	int dim; //splitting dimension, -1 for a leaf
+	int child; // distance (in nodes) to the left child, 0 for a leaf
 };
 
-KDTreeNode* InitKDTree(SPKDArray kdArray, KDTreeSplitMethod splitMethod,
-		int dimensions, int incrementalCurrentDimension) {
-	if (kdArray == NULL || dimensions <= 0|| incrementalCurrentDimension < 0 ||
-	getMat(kdArray) == NULL || getArrayOfPoints(kdArray) == NULL) {
+/**
+ * the largest depth of a tree: the subtrees of a node differ in size by at
+ * most one point, so a tree of n points has at most log2(n) + 1 levels
+ **/
+#define KD_TREE_MAX_DEPTH 64
+
+// subtrees smaller than this are built by one thread, the threads would cost more than they save
+#define KD_TREE_PARALLEL_MIN_SIZE 16384
+
+#if defined(__GNUC__)
+#define SP_KD_TREE_PREFETCH(node) __builtin_prefetch(node)
+#else
+#define SP_KD_TREE_PREFETCH(node) ((void) (node))
+#endif
+
+/** a subtree waiting to be searched by kNearestNeighbors **/
+typedef struct kd_tree_stack_entry_t {
+	KDTreeNode* node;
+	double distance; // lower bound of the squared distance from the query to the cell of node
+	int axis; // the splitting axis of the parent of node
+	double offset; // the distance from the query to the cell of node along axis
+} KDTreeStackEntry;
+
+/** a change of one offset of the query to the current cell, undone on the way back **/
+typedef struct kd_tree_trail_entry_t {
+	int height; // the stack height the change was made at
+	int axis;
+	double offset; // the offset before the change
+} KDTreeTrailEntry;
+
+/**
+ * a subtree waiting to be searched by bestBinFirstNeighbors, the branches
+ * are kept in a binary min-heap by distance
+ **/
+typedef struct kd_tree_branch_t {
+	KDTreeNode* node;
+	double distance; // lower bound of the squared distance from the query to the cell of node
+	int change; // the last offset change on the way to node, -1 if none
+	int tree; // the tree of node in a forest, 0 for a single tree
+} KDTreeBranch;
+
+/**
+ * an offset of the query to a cell that differs from the one of the parent
+ * cell. The changes on the way from the root to a cell form a chain that
+ * gives all the offsets of the query to that cell.
+ **/
+typedef struct kd_tree_offset_change_t {
+	int axis;
+	double offset; // the offset after the change
+	int previous; // the change before this one on the way from the root, -1 if none
+} KDTreeOffsetChange;
+
+/** the branches and offset changes of one best-bin-first search **/
+typedef struct kd_tree_bbf_t {
+	KDTreeBranch* branches;
+	int branchCount;
+	int branchCapacity;
+	KDTreeOffsetChange* changes;
+	int changeCount;
+	int changeCapacity;
+} KDTreeBestBinFirst;
+
+// the initial capacity of the branch heap and the change array of a search
+#define KD_TREE_BBF_INITIAL_CAPACITY 256
+
+/**
+ * the queries of one kNearestNeighborsBatch search. Every query keeps its
+ * offsets to the current cell as in kNearestNeighbors and its k nearest
+ * points sorted in the output arrays (offset -1 and distance HUGE_VAL in
+ * the places not found yet). The lists of queries that enter the
+ * nodes on the current path are kept per depth: groups holds the queries of
+ * the node at that depth with the left child near first and those with the
+ * right child near last, children the queries that enter the child being
+ * searched (with their offset and distance to restore on the way back).
+ **/
+typedef struct kd_tree_batch_t {
+	SPFeatureStore store;
+	SPFeatureQuery* queries;
+	int count;
+	int k;
+	int dimension;
+	SPTopKInsert insert; // the collector specialized for k, NULL if none
+	int* offsets; // the output, k per query
+	double* distances; // the output, k per query
+	double* cellOffsets; // dimension per query
+	double* cellDistances; // lower bound of the squared distance to the current cell
+	int* groups; // count per depth
+	int* children; // count per depth, and the queries of the root last
+	double* savedOffsets; // count per depth
+	double* savedDistances; // count per depth
+} KDTreeBatch;
+
+// a forest tree splits one of this many dimensions of the largest variance (as FLANN)
+#define KD_FOREST_TOP_DIMENSIONS 5
+// the largest number of points the variances of a forest node are estimated from
+#define KD_FOREST_SAMPLE_SIZE 100
+// the seed of the RANDOM split and of the forest, fixed so a build is reproducible
+#define KD_TREE_RANDOM_SEED 0x5EEDu
+
+/**
+ * randomized kd-trees over the same features: the points of the first tree
+ * are at consecutive offsets of the store (as a single tree), every other
+ * tree keeps the offsets of its points in leaf order
+ **/
+struct kd_forest_t {
+	int trees;
+	KDTreeNode** roots;
+	int** orders; // orders[0] is NULL, the leaf data of tree t indexes orders[t]
+};
+
+/** the number of nodes of a tree of size points **/
+static int countNodes(int size, int leafSize) {
+	if (size <= leafSize)
+		return 1;
+	int middle = (int) ceil((double) size / 2); // the size of the left subtree (see Split)
+	return 1 + countNodes(middle, leafSize) + countNodes(size - middle, leafSize);
+}
+
+/** the largest float not greater than value **/
+static float floatBelow(double value) {
+	float rounded = (float) value;
+	return (double) rounded > value ? nextafterf(rounded, -HUGE_VALF) : rounded;
+}
+
+/** the smallest float not less than value **/
+static float floatAbove(double value) {
+	float rounded = (float) value;
+	return (double) rounded < value ? nextafterf(rounded, HUGE_VALF) : rounded;
+}
+
+/** the constant parameters of a build, shared by all its threads **/
+typedef struct kd_tree_build_t {
+	SPFeatureStore store;
+	KDTreeSplitMethod splitMethod;
+	int dimensions;
+	int leafSize;
+	unsigned int randomSeed; // RANDOM: mixed with the index of every node
+	bool randomized; // forest: the dimension is drawn from the ones of the largest variance
+	KDTreeNode* nodes;
+	int* order; // the offsets of the points of the leaves, in leaf order
+	double* keys; // selection build: the split coordinate of every point of order, NULL otherwise
+} KDTreeBuild;
+
+/** the arguments of a subtree built by another thread **/
+typedef struct kd_tree_build_task_t {
+	const KDTreeBuild* build;
+	SPKDArray kdArray; // NULL for the selection build
+	int size;
+	int incrementalCurrentDimension;
+	int index;
+	int firstChild;
+	int first;
+	int threads;
+	bool built;
+} KDTreeBuildTask;
+
+static void* buildKDTreeTask(void* arg);
+
+/** a well mixed number that depends only on seed and index **/
+static unsigned int mixSeed(unsigned int seed, int index) {
+	unsigned int x = seed ^ ((unsigned int) index * 0x9E3779B9u);
+	x ^= x >> 16;
+	x *= 0x7FEB352Du;
+	x ^= x >> 15;
+	x *= 0x846CA68Bu;
+	x ^= x >> 16;
+	return x;
+}
+
+/**
+ * builds the subtree of kdArray at build->nodes[index], the children of
+ * every internal node are next to each other: the children of the root of
+ * the subtree at firstChild and firstChild + 1, then the descendants of the
+ * left child, then those of the right child (the order of a depth-first
+ * build). The points of the subtree are written to build->order from
+ * order[first], leaf after leaf, so they can be moved to consecutive
+ * offsets. Every position is known before the build, so subtrees of at
+ * least KD_TREE_PARALLEL_MIN_SIZE points are built by threads threads
+ * without changing the tree.
+ * kdArray is consumed, returns false on failure
+ **/
+static bool buildKDTree(const KDTreeBuild* build, SPKDArray kdArray,
+		int incrementalCurrentDimension, int index, int firstChild, int first,
+		int threads) {
+	KDTreeNode* node = build->nodes + index;
+	int size = getSize(kdArray);
+	int splitCoor = 0;
+	if (size <= build->leafSize) {
+		memcpy(build->order + first, getArrayOfPoints(kdArray),
+				size * sizeof(int));
+		node->u.leaf.data = first; // the offset after the points are reordered
+		node->u.leaf.count = size;
+		node->dim = -1;
+		node->child = 0;
+		destroyKDArray(kdArray);
+		return true;
+	}
+	splitCoor = findDimension(kdArray, build->splitMethod, build->dimensions,
+			incrementalCurrentDimension, mixSeed(build->randomSeed, index));
+	node->dim = splitCoor;
+	node->u.split.high = floatBelow(getMedianValue(kdArray, size, splitCoor));
+	SPFeatureStore store = getStore(kdArray);
+	SPKDArray * doubleArray = SplitParallel(kdArray, splitCoor, threads);
+	if (doubleArray == NULL) {
+		spLoggerPrintError("SPKDArrays returned from split equals to NULL",
+				__FILE__, __func__, __LINE__);
+		destroyKDArray(kdArray);
+		return false;
+	}
+	SPKDArray left = doubleArray[0];
+	int leftSize = getSize(left);
+	int lastLeft = getMat(left)[splitCoor][leftSize - 1];
+	node->u.split.low = floatAbove(
+			spFeatureStoreGetAxisCoor(store, lastLeft, splitCoor));
+	node->child = firstChild - index;
+	int rightFirstChild = firstChild + 2
+			+ countNodes(leftSize, build->leafSize) - 1;
+
+	// double Array
+
+	// the left subtree by another thread if it is large enough
+	KDTreeBuildTask task;
+	pthread_t worker;
+	bool started = false;
+	task.build = build;
+	task.kdArray = doubleArray[0];
+	task.size = leftSize;
+	task.incrementalCurrentDimension = splitCoor;
+	task.index = firstChild;
+	task.firstChild = firstChild + 2;
+	task.first = first;
+	task.threads = threads / 2;
+	task.built = false;
+	if (threads > 1 && size >= KD_TREE_PARALLEL_MIN_SIZE) {
+		started = pthread_create(&worker, NULL, buildKDTreeTask, &task) == 0;
+		if (started)
+			threads -= task.threads;
+	}
+	if (!started)
+		buildKDTreeTask(&task);
+	bool built = buildKDTree(build, doubleArray[1], splitCoor, firstChild + 1,
+			rightFirstChild, first + leftSize, threads);
+	if (started)
+		pthread_join(worker, NULL);
+	free(doubleArray);
+	return built && task.built;
+}
+
+/** true if the point (keyA, pointA) comes before (keyB, pointB), equal keys by offset **/
+static bool pointBefore(double keyA, int pointA, double keyB, int pointB) {
+	return keyA < keyB || (keyA == keyB && pointA < pointB);
+}
+
+static void swapPoints(double* keys, int* points, int i, int j) {
+	double key = keys[i];
+	int point = points[i];
+	keys[i] = keys[j];
+	points[i] = points[j];
+	keys[j] = key;
+	points[j] = point;
+}
+
+/**
+ * reorders the size points (and their keys) so that the point at position
+ * k is the k-th in the order of pointBefore, the points before it come
+ * before it and the rest after it (quickselect, median of three pivots)
+ **/
+static void selectPoint(double* keys, int* points, int size, int k) {
+	int low = 0;
+	int high = size - 1;
+	while (high > low) {
+		int mid = low + (high - low) / 2;
+		// the median of low, mid and high becomes the pivot at high
+		if (pointBefore(keys[mid], points[mid], keys[low], points[low]))
+			swapPoints(keys, points, mid, low);
+		if (pointBefore(keys[high], points[high], keys[low], points[low]))
+			swapPoints(keys, points, high, low);
+		if (pointBefore(keys[mid], points[mid], keys[high], points[high]))
+			swapPoints(keys, points, mid, high);
+		int store = low;
+		for (int i = low; i < high; i++) {
+			if (pointBefore(keys[i], points[i], keys[high], points[high])) {
+				swapPoints(keys, points, i, store);
+				store++;
+			}
+		}
+		swapPoints(keys, points, store, high);
+		if (store == k)
+			return;
+		if (k < store)
+			high = store - 1;
+		else
+			low = store + 1;
+	}
+}
+
+/**
+ * a random dimension (by randomSeed) among the KD_FOREST_TOP_DIMENSIONS of
+ * the largest variance of the size points, estimated from a sample of them
+ **/
+static int findRandomizedDimension(const KDTreeBuild* build,
+		const int* points, int size, unsigned int randomSeed) {
+	int top[KD_FOREST_TOP_DIMENSIONS];
+	double topVariance[KD_FOREST_TOP_DIMENSIONS];
+	int topCount = 0;
+	int step = size > KD_FOREST_SAMPLE_SIZE ? size / KD_FOREST_SAMPLE_SIZE : 1;
+	for (int i = 0; i < build->dimensions; i++) {
+		double sum = 0;
+		double sumSquares = 0;
+		int samples = 0;
+		for (int j = 0; j < size; j += step) {
+			double coor = spFeatureStoreGetAxisCoor(build->store, points[j], i);
+			sum += coor;
+			sumSquares += coor * coor;
+			samples++;
+		}
+		double variance = sumSquares / samples
+				- (sum / samples) * (sum / samples);
+		// insert i to the dimensions of the largest variance, kept sorted
+		int j = topCount < KD_FOREST_TOP_DIMENSIONS ? topCount++ : topCount;
+		while (j > 0 && topVariance[j - 1] < variance) {
+			if (j < KD_FOREST_TOP_DIMENSIONS) {
+				top[j] = top[j - 1];
+				topVariance[j] = topVariance[j - 1];
+			}
+			j--;
+		}
+		if (j < KD_FOREST_TOP_DIMENSIONS) {
+			top[j] = i;
+			topVariance[j] = variance;
+		}
+	}
+	return top[randomSeed % topCount];
+}
+
+/** the splitting dimension of the size points, MAX_SPREAD measures the spread of the points **/
+static int findRangeDimension(const KDTreeBuild* build, const int* points,
+		int size, int incrementalCurrentDimension, unsigned int randomSeed) {
+	if (build->randomized)
+		return findRandomizedDimension(build, points, size, randomSeed);
+	if (build->splitMethod != MAX_SPREAD)
+		return findDimension(NULL, build->splitMethod, build->dimensions,
+				incrementalCurrentDimension, randomSeed);
+	double maxSpread = -1;
+	int coorMaxSpread = 0;
+	for (int i = 0; i < build->dimensions; i++) {
+		double min = HUGE_VAL;
+		double max = -HUGE_VAL;
+		for (int j = 0; j < size; j++) {
+			double coor = spFeatureStoreGetAxisCoor(build->store, points[j], i);
+			if (coor < min)
+				min = coor;
+			if (coor > max)
+				max = coor;
+		}
+		if (maxSpread < max - min) {
+			maxSpread = max - min;
+			coorMaxSpread = i;
+		}
+	}
+	return coorMaxSpread;
+}
+
+/**
+ * the selection build: same as buildKDTree for the size points at
+ * build->order[first], without a kd-array. The points are partitioned in
+ * place around the median of the splitting coordinate (the same halves
+ * Split makes, so the tree is the same), the order is done with the leaves
+ **/
+static bool selectKDTree(const KDTreeBuild* build, int size,
+		int incrementalCurrentDimension, int index, int firstChild, int first,
+		int threads) {
+	KDTreeNode* node = build->nodes + index;
+	int* points = build->order + first;
+	double* keys = build->keys + first;
+	if (size <= build->leafSize) {
+		node->u.leaf.data = first; // the offset after the points are reordered
+		node->u.leaf.count = size;
+		node->dim = -1;
+		node->child = 0;
+		return true;
+	}
+	int splitCoor = findRangeDimension(build, points, size,
+			incrementalCurrentDimension, mixSeed(build->randomSeed, index));
+	int middle = (int) ceil((double) size / 2); // the size of the left subtree
+	for (int j = 0; j < size; j++)
+		keys[j] = spFeatureStoreGetAxisCoor(build->store, points[j], splitCoor);
+	selectPoint(keys, points, size, middle);
+	double low = keys[0];
+	for (int j = 1; j < middle; j++) {
+		if (keys[j] > low)
+			low = keys[j];
+	}
+	node->dim = splitCoor;
+	node->u.split.high = floatBelow(keys[middle]);
+	node->u.split.low = floatAbove(low);
+	node->child = firstChild - index;
+	int rightFirstChild = firstChild + 2 + countNodes(middle, build->leafSize)
+			- 1;
+
+	// the left subtree by another thread if it is large enough
+	KDTreeBuildTask task;
+	pthread_t worker;
+	bool started = false;
+	task.build = build;
+	task.kdArray = NULL;
+	task.size = middle;
+	task.incrementalCurrentDimension = splitCoor;
+	task.index = firstChild;
+	task.firstChild = firstChild + 2;
+	task.first = first;
+	task.threads = threads / 2;
+	task.built = false;
+	if (threads > 1 && size >= KD_TREE_PARALLEL_MIN_SIZE) {
+		started = pthread_create(&worker, NULL, buildKDTreeTask, &task) == 0;
+		if (started)
+			threads -= task.threads;
+	}
+	if (!started)
+		buildKDTreeTask(&task);
+	bool built = selectKDTree(build, size - middle, splitCoor, firstChild + 1,
+			rightFirstChild, first + middle, threads);
+	if (started)
+		pthread_join(worker, NULL);
+	return built && task.built;
+}
+
+/** buildKDTree (or selectKDTree) with the arguments of a KDTreeBuildTask **/
+static void* buildKDTreeTask(void* arg) {
+	KDTreeBuildTask* task = (KDTreeBuildTask*) arg;
+	int threads = task->threads < 1 ? 1 : task->threads;
+	if (task->build->keys != NULL)
+		task->built = selectKDTree(task->build, task->size,
+				task->incrementalCurrentDimension, task->index,
+				task->firstChild, task->first, threads);
+	else
+		task->built = buildKDTree(task->build, task->kdArray,
+				task->incrementalCurrentDimension, task->index,
+				task->firstChild, task->first, threads);
+	return NULL;
+}
+
+/** checks the arguments of a build, prints an error if they are invalid **/
+static bool checkBuildArguments(KDTreeSplitMethod splitMethod, int dimensions,
+		int incrementalCurrentDimension, int leafSize, int threads) {
+	if (dimensions <= 0 || incrementalCurrentDimension < 0 || leafSize < 1
+			|| threads < 1) {
 		spLoggerPrintError("InitKDTree - Invalid arguments", __FILE__, __func__,
 				__LINE__);
-		return NULL;
+		return false;
 	}
 	if (splitMethod != MAX_SPREAD && splitMethod != RANDOM
 			&& splitMethod != INCREMENTAL) {
 		spLoggerPrintError("InitKDTree - Invalid splitMethod argument",
 				__FILE__, __func__, __LINE__);
-		return NULL;
+		return false;
 	}
-	KDTreeNode* node = (KDTreeNode*) malloc(sizeof(*node));
-	if (node == NULL) {
+	return true;
+}
+
+/** allocates the nodes and the order of a tree of size points, false on failure **/
+static bool allocBuild(KDTreeBuild* build, SPFeatureStore store,
+		KDTreeSplitMethod splitMethod, int dimensions, int leafSize, int size,
+		bool select) {
+	build->store = store;
+	build->splitMethod = splitMethod;
+	build->dimensions = dimensions;
+	build->leafSize = leafSize;
+	build->randomSeed = KD_TREE_RANDOM_SEED;
+	build->randomized = false;
+	build->nodes = (KDTreeNode*) malloc(
+			countNodes(size, leafSize) * sizeof(KDTreeNode));
+	build->order = (int*) malloc(spFeatureStoreGetSize(store) * sizeof(int));
+	build->keys = select ? (double*) malloc(size * sizeof(double)) : NULL;
+	if (build->nodes == NULL || build->order == NULL
+			|| (select && build->keys == NULL)) {
 		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
-		return NULL;
+		free(build->nodes);
+		free(build->order);
+		free(build->keys);
+		return false;
 	}
-	int size = getSize(kdArray);
-	int splitCoor = 0;
-	node->dim = -1;
-	node->val = -1;
-	node->left = NULL;
-	node->right = NULL;
-	node->data = NULL;
-	if (size == 1) {
-		node->data = spPointCopy(getArrayOfPoints(kdArray)[0]);
-		destroyArrayOfPoints(getArrayOfPoints(kdArray), size);
-		destroyMat(getMat(kdArray), dimensions);
-		free(kdArray);
-		if (node->data == NULL) {
-			spLoggerPrintError("Error while copying a point to node->data",
+	return true;
+}
+
+/**
+ * moves the size points of the tree (build->order) to the first offsets
+ * of the store, frees the build and returns the root (NULL on failure)
+ **/
+static KDTreeNode* finishBuild(KDTreeBuild* build, int size) {
+	KDTreeNode* root = build->nodes;
+	int storeSize = spFeatureStoreGetSize(build->store);
+	bool* inTree = (bool*) calloc(storeSize, sizeof(bool));
+	if (inTree == NULL) {
+		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
+		free(root);
+		root = NULL;
+	} else {
+		// the features that are not in the tree keep their order after its points
+		for (int i = 0; i < size; i++)
+			inTree[build->order[i]] = true;
+		for (int offset = 0; offset < storeSize; offset++) {
+			if (!inTree[offset])
+				build->order[size++] = offset;
+		}
+		if (spFeatureStorePermute(build->store, build->order)
+				!= SP_FEATURE_STORE_SUCCESS) {
+			spLoggerPrintError("InitKDTree - Reordering the features failed",
 					__FILE__, __func__, __LINE__);
-			destroy(node);
-			return NULL;
+			free(root);
+			root = NULL;
 		}
-		return node;
 	}
-	splitCoor = findDimension(kdArray, splitMethod, dimensions,
-			incrementalCurrentDimension);
-	node->dim = splitCoor;
-	node->val = getMedianValue(kdArray, size, splitCoor);
-	SPKDArray * doubleArray = Split(kdArray, splitCoor);
-	if (doubleArray == NULL) {
-		spLoggerPrintError("SPKDArrays returned from split equals to NULL",
-				__FILE__, __func__, __LINE__);
-		destroy(node);
+	free(build->order);
+	free(build->keys);
+	free(inTree);
+	return root;
+}
+
+KDTreeNode* InitKDTree(SPKDArray kdArray, KDTreeSplitMethod splitMethod,
+		int dimensions, int incrementalCurrentDimension, int leafSize,
+		int threads) {
+	KDTreeBuild build;
+	if (kdArray == NULL || getMat(kdArray) == NULL
+			|| getArrayOfPoints(kdArray) == NULL) {
+		spLoggerPrintError("InitKDTree - Invalid arguments", __FILE__, __func__,
+				__LINE__);
 		return NULL;
 	}
+	if (!checkBuildArguments(splitMethod, dimensions,
+			incrementalCurrentDimension, leafSize, threads))
+		return NULL;
+	int size = getSize(kdArray);
+	if (!allocBuild(&build, getStore(kdArray), splitMethod, dimensions,
+			leafSize, size, false)) {
+		destroyKDArray(kdArray);
+		return NULL;
+	}
+	if (!buildKDTree(&build, kdArray, incrementalCurrentDimension, 0, 1, 0,
+			threads)) {
+		free(build.nodes);
+		free(build.order);
+		return NULL;
+	}
+	return finishBuild(&build, size);
+}
 
-	// double Array
-
-	node->left = InitKDTree(doubleArray[0], splitMethod, dimensions, splitCoor);
-	node->right = InitKDTree(doubleArray[1], splitMethod, dimensions,
-			splitCoor);
-	node->data = NULL;
-	free(doubleArray);
-	return node;
+KDTreeNode* InitKDTreeSelect(SPFeatureStore store, const int* offsets,
+		int size, KDTreeSplitMethod splitMethod, int dimensions,
+		int incrementalCurrentDimension, int leafSize, int threads) {
+	KDTreeBuild build;
+	if (store == NULL || size <= 0
+			|| (offsets == NULL && size > spFeatureStoreGetSize(store))) {
+		spLoggerPrintError("InitKDTree - Invalid arguments", __FILE__, __func__,
+				__LINE__);
+		return NULL;
+	}
+	if (!checkBuildArguments(splitMethod, dimensions,
+			incrementalCurrentDimension, leafSize, threads))
+		return NULL;
+	if (!allocBuild(&build, store, splitMethod, dimensions, leafSize, size,
+			true))
+		return NULL;
+	for (int i = 0; i < size; i++)
+		build.order[i] = (offsets == NULL) ? i : offsets[i];
+	if (!selectKDTree(&build, size, incrementalCurrentDimension, 0, 1, 0,
+			threads)) {
+		free(build.nodes);
+		free(build.order);
+		free(build.keys);
+		return NULL;
+	}
+	return finishBuild(&build, size);
 }
 int findDimension(SPKDArray kdArray, KDTreeSplitMethod splitMethod,
-		int dimensions, int incrementalCurrentDimension) {
+		int dimensions, int incrementalCurrentDimension,
+		unsigned int randomSeed) {
 	if (splitMethod == MAX_SPREAD) {
 		int** mat = getMat(kdArray);
 		double maxSpread = -1;
 		int coorMaxSpread = 0;
-		SPPoint* arrayOfPoints = getArrayOfPoints(kdArray);
+		SPFeatureStore store = getStore(kdArray);
 		for (int i = 0; i < dimensions; i++) {
 			// mat is sorted
-			int minPointIndex = mat[i][0];
-			int maxPointIndex = mat[i][getSize(kdArray) - 1];
-			double diff = spPointGetAxisCoor(arrayOfPoints[maxPointIndex], i)
-					- spPointGetAxisCoor(arrayOfPoints[minPointIndex], i);
+			int minPoint = mat[i][0];
+			int maxPoint = mat[i][getSize(kdArray) - 1];
+			double diff = spFeatureStoreGetAxisCoor(store, maxPoint, i)
+					- spFeatureStoreGetAxisCoor(store, minPoint, i);
 			if (maxSpread < diff) {
 				maxSpread = diff;
 				coorMaxSpread = i;
@@ -108,9 +639,8 @@ int findDimension(SPKDArray kdArray, KDTreeSplitMethod splitMethod,
 		}
 		return coorMaxSpread;
 	} else if (splitMethod == RANDOM) {
-		// random number between 0 to dimensions-1
-		srand(time(NULL));
-		return rand() % dimensions;
+		// random number between 0 to dimensions-1, the same for the same seed
+		return (int) (randomSeed % (unsigned int) dimensions);
 	} else { // splitMethod = INCREMENTAL
 		return (incrementalCurrentDimension + 1) % dimensions;
 	}
@@ -119,55 +649,683 @@ int findDimension(SPKDArray kdArray, KDTreeSplitMethod splitMethod,
 double getMedianValue(SPKDArray kdArray, int size, int splitCoor) {
 	int middle = (int) ceil((double) size / 2);
 	int** mat = getMat(kdArray);
-	int pointIndex = mat[splitCoor][middle];
-	return spPointGetAxisCoor(getArrayOfPoints(kdArray)[pointIndex], splitCoor);
+	return spFeatureStoreGetAxisCoor(getStore(kdArray), mat[splitCoor][middle],
+			splitCoor);
 }
 
-void kNearestNeighbors(KDTreeNode* curr, SPBPQueue *bpq, SPPoint p) {
-	int lastState = 0; //0-left 1-right
-	SPListElement element = NULL;
+/** the largest distance that can still enter bpq **/
+static double queueBound(SPBPQueue bpq) {
+	return spBPQueueIsFull(bpq) ? spBPQueueMaxValue(bpq) : HUGE_VAL;
+}
+
+/**
+ * enqueue offset to bpq unless it is farther than the current bound, or
+ * unique and bpq already holds it (the trees of a forest share points)
+ **/
+static void enqueueFeature(SPBPQueue bpq, int offset, double distance,
+		bool unique) {
+	if (distance > queueBound(bpq)
+			|| (unique && spBPQueueContainsValue(bpq, offset, distance)))
+		return;
+	// cannot fail, queueBound above already needs a non-NULL bpq
+	spBPQueueEnqueueValue(bpq, offset, distance);
+}
+
+/**
+ * enqueue the features at offsets first to first + count - 1 of store to
+ * bpq, a block at a time if the blocks of store are built. The features of
+ * the images excluded (if not NULL) marks are skipped.
+ **/
+static void scanFeatures(SPFeatureStore store, int first, int count,
+		SPBPQueue bpq, SPFeatureQuery query, bool unique,
+		const bool* excluded) {
+	double distances[SP_DISTANCE_BLOCK];
+	int end = first + count;
+	if (!spFeatureStoreHasBlocks(store)) {
+		for (int offset = first; offset < end; offset++) {
+			if (excluded != NULL
+					&& excluded[spFeatureStoreGetIndex(store, offset)])
+				continue;
+			enqueueFeature(bpq, offset,
+					spFeatureStoreQueryDistanceBounded(store, offset, query,
+							queueBound(bpq)), unique);
+		}
+		return;
+	}
+	for (int block = first / SP_DISTANCE_BLOCK;
+			block * SP_DISTANCE_BLOCK < end; block++) {
+		int base = block * SP_DISTANCE_BLOCK;
+		spFeatureStoreQueryDistanceBlock(store, block, query, queueBound(bpq),
+				distances);
+		for (int j = 0; j < SP_DISTANCE_BLOCK; j++) {
+			if (base + j >= first && base + j < end
+					&& (excluded == NULL
+							|| !excluded[spFeatureStoreGetIndex(store, base + j)]))
+				enqueueFeature(bpq, base + j, distances[j], unique);
+		}
+	}
+}
+
+/** enqueue the count features at the offsets points of store to bpq, each once **/
+static void scanIndexedFeatures(SPFeatureStore store, const int* points,
+		int count, SPBPQueue bpq, SPFeatureQuery query) {
+	for (int i = 0; i < count; i++)
+		enqueueFeature(bpq, points[i],
+				spFeatureStoreQueryDistanceBounded(store, points[i], query,
+						queueBound(bpq)), true);
+}
+
+void bruteForceNeighbors(SPFeatureStore store, SPBPQueue bpq,
+		SPFeatureQuery query) {
+	if (store == NULL || bpq == NULL || query == NULL)
+		return;
+	scanFeatures(store, 0, spFeatureStoreGetSize(store), bpq, query, false,
+			NULL);
+}
+
+/**
+ * the search of kNearestNeighbors, the features of the images excluded (if
+ * not NULL) marks are skipped
+ **/
+static void searchKDTree(KDTreeNode* curr, SPFeatureStore store,
+		SPBPQueue *bpq, SPFeatureQuery query, const bool* excluded) {
+	// the far children skipped on the way down, searched after the near side
+	KDTreeStackEntry stack[KD_TREE_MAX_DEPTH];
+	KDTreeTrailEntry trail[2 * KD_TREE_MAX_DEPTH];
+	int top = 0;
+	int trailTop = 0;
+	double distance = 0; // sum of the squared offsets, a lower bound of the distance to the cell
+	KDTreeNode* node = curr;
 	//if NULL do nothing
-	if (curr == NULL || p == NULL) {
+	if (curr == NULL || store == NULL || query == NULL) {
+		return;
+	}
+	// the distance from query to the current cell along every axis
+	// (Arya & Mount incremental distance), zero at the root
+	int dimension = spFeatureStoreGetDimension(store);
+	double offsets[dimension];
+	for (int i = 0; i < dimension; i++)
+		offsets[i] = 0;
+	while (node != NULL) {
+		//Descend to the leaf on the side of every splitting plane that
+		//contains the test point, while the cell may hold a better point
+		while (node->dim >= 0
+				&& (!spBPQueueIsFull(*bpq)
+						|| distance < spBPQueueMaxValue(*bpq))) {
+			KDTreeNode* left = node + node->child;
+			int axis = node->dim;
+			double coor = spFeatureQueryGetAxisCoor(query, axis);
+			double old = offsets[axis];
+			double nearOffset = 0;
+			double farOffset = 0;
+			assert(top < KD_TREE_MAX_DEPTH);
+			if (coor <= node->u.split.high) {
+				nearOffset = coor > node->u.split.low ?
+						coor - node->u.split.low : 0;
+				farOffset = node->u.split.high - coor;
+				stack[top].node = left + 1;
+				node = left;
+			} else {
+				farOffset = coor > node->u.split.low ?
+						coor - node->u.split.low : 0;
+				stack[top].node = left;
+				node = left + 1;
+			}
+			SP_KD_TREE_PREFETCH(stack[top].node);
+			// a child cell is inside its parent, its offsets only grow
+			farOffset = farOffset > old ? farOffset : old;
+			stack[top].distance = distance - old * old + farOffset * farOffset;
+			stack[top].axis = axis;
+			stack[top].offset = farOffset;
+			top++;
+			if (nearOffset > old) {
+				assert(trailTop < 2 * KD_TREE_MAX_DEPTH);
+				trail[trailTop].height = top;
+				trail[trailTop].axis = axis;
+				trail[trailTop].offset = old;
+				trailTop++;
+				offsets[axis] = nearOffset;
+				distance += nearOffset * nearOffset - old * old;
+			}
+		}
+		//Add the points of the leaf to the BPQ
+		if (node->dim < 0
+				&& (!spBPQueueIsFull(*bpq)
+						|| distance < spBPQueueMaxValue(*bpq))) {
+			scanFeatures(store, node->u.leaf.data, node->u.leaf.count, *bpq,
+					query, false, excluded);
+		}
+		//Continue with the last far cell the candidate hypersphere
+		//still crosses
+		node = NULL;
+		while (top > 0 && node == NULL) {
+			top--;
+			if (!spBPQueueIsFull(*bpq)
+					|| stack[top].distance < spBPQueueMaxValue(*bpq))
+				node = stack[top].node;
+		}
+		if (node == NULL)
+			break;
+		// back to the offsets of the parent of node, then into its cell
+		while (trailTop > 0 && trail[trailTop - 1].height > top) {
+			trailTop--;
+			offsets[trail[trailTop].axis] = trail[trailTop].offset;
+		}
+		assert(trailTop < 2 * KD_TREE_MAX_DEPTH);
+		trail[trailTop].height = top;
+		trail[trailTop].axis = stack[top].axis;
+		trail[trailTop].offset = offsets[stack[top].axis];
+		trailTop++;
+		offsets[stack[top].axis] = stack[top].offset;
+		distance = stack[top].distance;
+	}
+}
+
+void kNearestNeighbors(KDTreeNode* curr, SPFeatureStore store, SPBPQueue *bpq,
+		SPFeatureQuery query) {
+	searchKDTree(curr, store, bpq, query, NULL);
+}
+
+void kNearestNeighborsExcluding(KDTreeNode* curr, SPFeatureStore store,
+		SPBPQueue *bpq, SPFeatureQuery query, const bool* excludedImages) {
+	searchKDTree(curr, store, bpq, query, excludedImages);
+}
+
+/** the largest distance that can still enter the neighbors of query q **/
+static double batchBound(const KDTreeBatch* batch, int q) {
+	return batch->distances[(size_t) q * batch->k + batch->k - 1];
+}
+
+/** adds offset to the neighbors of query q, ordered as in an SPBPQueue **/
+static void addBatchNeighbor(KDTreeBatch* batch, int q, int offset,
+		double distance) {
+	int* offsets = batch->offsets + (size_t) q * batch->k;
+	double* distances = batch->distances + (size_t) q * batch->k;
+	int i = batch->k - 1;
+	if (batch->insert != NULL) {
+		batch->insert(offsets, distances, offset, distance);
+		return;
+	}
+	if (distance > distances[i]
+			|| (distance == distances[i] && offset >= offsets[i]))
+		return;
+	while (i > 0
+			&& (distances[i - 1] > distance
+					|| (distances[i - 1] == distance && offsets[i - 1] > offset))) {
+		offsets[i] = offsets[i - 1];
+		distances[i] = distances[i - 1];
+		i--;
+	}
+	offsets[i] = offset;
+	distances[i] = distance;
+}
+
+/** adds the points of a leaf to the neighbors of query q, as scanFeatures **/
+static void scanBatchLeaf(KDTreeBatch* batch, KDTreeNode* leaf, int q) {
+	double distances[SP_DISTANCE_BLOCK];
+	SPFeatureQuery query = batch->queries[q];
+	int first = leaf->u.leaf.data;
+	int end = first + leaf->u.leaf.count;
+	if (!spFeatureStoreHasBlocks(batch->store)) {
+		for (int offset = first; offset < end; offset++) {
+			double distance = spFeatureStoreQueryDistanceBounded(batch->store,
+					offset, query, batchBound(batch, q));
+			if (distance <= batchBound(batch, q))
+				addBatchNeighbor(batch, q, offset, distance);
+		}
 		return;
 	}
-	//if leaf Add the current point to the BPQ
-	if (isLeaf(curr)) {
-		element = spListElementCreate(spPointGetIndex(curr->data),
-				spPointL2SquaredDistance(curr->data, p));
-		if (spBPQueueEnqueue(*bpq, element) != SP_BPQUEUE_SUCCESS) {
-			//print message
+	for (int block = first / SP_DISTANCE_BLOCK;
+			block * SP_DISTANCE_BLOCK < end; block++) {
+		int base = block * SP_DISTANCE_BLOCK;
+		spFeatureStoreQueryDistanceBlock(batch->store, block, query,
+				batchBound(batch, q), distances);
+		for (int j = 0; j < SP_DISTANCE_BLOCK; j++) {
+			if (base + j >= first && base + j < end
+					&& distances[j] <= batchBound(batch, q))
+				addBatchNeighbor(batch, q, base + j, distances[j]);
 		}
-		spListElementDestroy(element);
+	}
+}
+
+static void searchBatchNode(KDTreeBatch* batch, KDTreeNode* node,
+		const int* queries, int count, int depth);
+
+/**
+ * searches a child of node (the right one if right) with the given queries
+ * that the cell of the child may hold a better point for. The offsets of
+ * every query to the cell change as kNearestNeighbors changes them for a
+ * near child (the queries from nearFirst to nearEnd - 1) or a far one.
+ **/
+static void searchBatchChild(KDTreeBatch* batch, KDTreeNode* node, bool right,
+		const int* queries, int count, int nearFirst, int nearEnd, int depth) {
+	int* children = batch->children + (size_t) depth * batch->count;
+	double* savedOffsets = batch->savedOffsets + (size_t) depth * batch->count;
+	double* savedDistances = batch->savedDistances
+			+ (size_t) depth * batch->count;
+	int axis = node->dim;
+	int entered = 0;
+	for (int i = 0; i < count; i++) {
+		int q = queries[i];
+		double* offset = batch->cellOffsets + (size_t) q * batch->dimension
+				+ axis;
+		double coor = spFeatureQueryGetAxisCoor(batch->queries[q], axis);
+		double old = *offset;
+		double distance = batch->cellDistances[q];
+		double childOffset = 0;
+		if (right)
+			childOffset = coor < node->u.split.high ?
+					node->u.split.high - coor : 0;
+		else
+			childOffset = coor > node->u.split.low ?
+					coor - node->u.split.low : 0;
+		// a child cell is inside its parent, its offsets only grow
+		if (i >= nearFirst && i < nearEnd) {
+			if (childOffset > old)
+				distance += childOffset * childOffset - old * old;
+		} else {
+			childOffset = childOffset > old ? childOffset : old;
+			distance = distance - old * old + childOffset * childOffset;
+		}
+		if (!(distance < batchBound(batch, q)))
+			continue;
+		children[entered] = q;
+		savedOffsets[entered] = old;
+		savedDistances[entered] = batch->cellDistances[q];
+		entered++;
+		if (childOffset > old)
+			*offset = childOffset;
+		batch->cellDistances[q] = distance;
+	}
+	if (entered > 0)
+		searchBatchNode(batch, node + node->child + (right ? 1 : 0), children,
+				entered, depth + 1);
+	for (int i = 0; i < entered; i++) {
+		batch->cellOffsets[(size_t) children[i] * batch->dimension + axis] =
+				savedOffsets[i];
+		batch->cellDistances[children[i]] = savedDistances[i];
+	}
+}
+
+/**
+ * searches the subtree of node with the given queries. Every query searches
+ * its near child before its far one as in kNearestNeighbors, so it checks
+ * the same points, but the queries share the nodes: the left child is
+ * searched by the queries it is near to, then the right child by all the
+ * queries and then the left child by the queries it is far from.
+ **/
+static void searchBatchNode(KDTreeBatch* batch, KDTreeNode* node,
+		const int* queries, int count, int depth) {
+	if (node->dim < 0) {
+		for (int i = 0; i < count; i++)
+			scanBatchLeaf(batch, node, queries[i]);
 		return;
 	}
+	assert(depth < KD_TREE_MAX_DEPTH);
+	int* groups = batch->groups + (size_t) depth * batch->count;
+	int leftNear = 0;
+	int rightNear = count;
+	for (int i = 0; i < count; i++) {
+		int q = queries[i];
+		if (spFeatureQueryGetAxisCoor(batch->queries[q], node->dim)
+				<= node->u.split.high)
+			groups[leftNear++] = q;
+		else
+			groups[--rightNear] = q;
+	}
+	searchBatchChild(batch, node, false, groups, leftNear, 0, leftNear, depth);
+	searchBatchChild(batch, node, true, groups, count, leftNear, count, depth);
+	searchBatchChild(batch, node, false, groups + leftNear, count - leftNear,
+			0, 0, depth);
+}
 
-	//Recursively search the half of the tree that contains the test point
-	if (spPointGetAxisCoor(p, getDim(curr)) <= getVal(curr)) {
-		lastState = 0;
-		kNearestNeighbors(getLeftChild(curr), bpq, p);
+bool kNearestNeighborsBatch(KDTreeNode* curr, SPFeatureStore store,
+		SPFeatureQuery* queries, int count, int k, int* offsets,
+		double* distances) {
+	KDTreeBatch batch;
+	if (curr == NULL || store == NULL || queries == NULL || count <= 0
+			|| k <= 0 || offsets == NULL || distances == NULL)
+		return false;
+	batch.store = store;
+	batch.queries = queries;
+	batch.count = count;
+	batch.k = k;
+	batch.dimension = spFeatureStoreGetDimension(store);
+	batch.offsets = offsets;
+	batch.distances = distances;
+	batch.insert = spTopKFixedInsert(k); // a running minimum for k = 1
+	size_t lists = (size_t) (KD_TREE_MAX_DEPTH + 1) * count;
+	batch.cellOffsets = (double*) calloc((size_t) count * batch.dimension,
+			sizeof(double));
+	batch.cellDistances = (double*) calloc(count, sizeof(double));
+	batch.groups = (int*) malloc(lists * sizeof(int));
+	batch.children = (int*) malloc(lists * sizeof(int));
+	batch.savedOffsets = (double*) malloc(lists * sizeof(double));
+	batch.savedDistances = (double*) malloc(lists * sizeof(double));
+	bool allocated = batch.cellOffsets != NULL
+			&& batch.cellDistances != NULL && batch.groups != NULL
+			&& batch.children != NULL && batch.savedOffsets != NULL
+			&& batch.savedDistances != NULL;
+	if (!allocated) {
+		spLoggerPrintError("Memory allocation failure", __FILE__, __func__,
+				__LINE__);
 	} else {
-		lastState = 1;
-		kNearestNeighbors(getRightChild(curr), bpq, p);
+		int* all = batch.children + (size_t) KD_TREE_MAX_DEPTH * count;
+		for (int q = 0; q < count; q++)
+			all[q] = q;
+		// the places not found stay empty
+		for (size_t i = 0; i < (size_t) count * k; i++) {
+			offsets[i] = -1;
+			distances[i] = HUGE_VAL;
+		}
+		searchBatchNode(&batch, curr, all, count, 0);
+	}
+	free(batch.cellOffsets);
+	free(batch.cellDistances);
+	free(batch.groups);
+	free(batch.children);
+	free(batch.savedOffsets);
+	free(batch.savedDistances);
+	return allocated;
+}
+
+/** push branch (node, distance, change) to the heap of bbf, false if allocation failed **/
+static bool pushBranch(KDTreeBestBinFirst* bbf, KDTreeNode* node,
+		double distance, int change, int tree) {
+	int i = bbf->branchCount;
+	if (bbf->branchCount == bbf->branchCapacity) {
+		KDTreeBranch* branches = (KDTreeBranch*) realloc(bbf->branches,
+				2 * bbf->branchCapacity * sizeof(KDTreeBranch));
+		if (branches == NULL)
+			return false;
+		bbf->branches = branches;
+		bbf->branchCapacity *= 2;
+	}
+	bbf->branchCount++;
+	while (i > 0 && bbf->branches[(i - 1) / 2].distance > distance) {
+		bbf->branches[i] = bbf->branches[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	bbf->branches[i].node = node;
+	bbf->branches[i].distance = distance;
+	bbf->branches[i].change = change;
+	bbf->branches[i].tree = tree;
+	return true;
+}
+
+/** remove the branch of the smallest distance from the heap of bbf (not empty) **/
+static KDTreeBranch popBranch(KDTreeBestBinFirst* bbf) {
+	KDTreeBranch min = bbf->branches[0];
+	KDTreeBranch last = bbf->branches[--bbf->branchCount];
+	int i = 0;
+	while (2 * i + 1 < bbf->branchCount) {
+		int child = 2 * i + 1;
+		if (child + 1 < bbf->branchCount
+				&& bbf->branches[child + 1].distance
+						< bbf->branches[child].distance)
+			child++;
+		if (last.distance <= bbf->branches[child].distance)
+			break;
+		bbf->branches[i] = bbf->branches[child];
+		i = child;
+	}
+	if (bbf->branchCount > 0)
+		bbf->branches[i] = last;
+	return min;
+}
+
+/** append the change of axis to offset after previous, -2 if allocation failed **/
+static int addChange(KDTreeBestBinFirst* bbf, int axis, double offset,
+		int previous) {
+	if (bbf->changeCount == bbf->changeCapacity) {
+		KDTreeOffsetChange* changes = (KDTreeOffsetChange*) realloc(
+				bbf->changes,
+				2 * bbf->changeCapacity * sizeof(KDTreeOffsetChange));
+		if (changes == NULL)
+			return -2;
+		bbf->changes = changes;
+		bbf->changeCapacity *= 2;
+	}
+	bbf->changes[bbf->changeCount].axis = axis;
+	bbf->changes[bbf->changeCount].offset = offset;
+	bbf->changes[bbf->changeCount].previous = previous;
+	return bbf->changeCount++;
+}
+
+/** set offsets to the offsets of the query to the cell the chain of change leads to **/
+static void applyChanges(const KDTreeBestBinFirst* bbf, int change,
+		double* offsets, int dimension) {
+	int chain[KD_TREE_MAX_DEPTH];
+	int length = 0;
+	for (int i = 0; i < dimension; i++)
+		offsets[i] = 0;
+	// at most one change per level of the tree, the newest is applied last
+	for (; change >= 0; change = bbf->changes[change].previous) {
+		assert(length < KD_TREE_MAX_DEPTH);
+		chain[length++] = change;
 	}
-	//If the candidate hypersphere crosses this splitting plane, look on the
-	//other side of the plane by examining the other subtree
+	while (length > 0) {
+		length--;
+		offsets[bbf->changes[chain[length]].axis] =
+				bbf->changes[chain[length]].offset;
+	}
+}
+
+/**
+ * the best-bin-first search of the trees at roots, with one queue of
+ * branches for all of them. The leaf data of tree t indexes orders[t], or
+ * is an offset of store if orders is NULL or orders[t] is NULL.
+ **/
+static void bestBinFirstSearch(KDTreeNode** roots, int** orders, int trees,
+		SPFeatureStore store, SPBPQueue *bpq, SPFeatureQuery query,
+		int maxChecks) {
+	KDTreeBestBinFirst bbf;
+	int checks = 0;
+	bool failed = false;
+	int dimension = spFeatureStoreGetDimension(store);
+	double offsets[dimension];
+	bbf.branchCount = 0;
+	bbf.branchCapacity = KD_TREE_BBF_INITIAL_CAPACITY;
+	bbf.branches = (KDTreeBranch*) malloc(
+			bbf.branchCapacity * sizeof(KDTreeBranch));
+	bbf.changeCount = 0;
+	bbf.changeCapacity = KD_TREE_BBF_INITIAL_CAPACITY;
+	bbf.changes = (KDTreeOffsetChange*) malloc(
+			bbf.changeCapacity * sizeof(KDTreeOffsetChange));
+	if (bbf.branches == NULL || bbf.changes == NULL) {
+		spLoggerPrintError("Memory allocation failure", __FILE__, __func__,
+				__LINE__);
+		free(bbf.branches);
+		free(bbf.changes);
+		return;
+	}
+	for (int tree = 0; tree < trees && !failed; tree++)
+		failed = !pushBranch(&bbf, roots[tree], 0, -1, tree);
+	//Search the closest unexplored cell until maxChecks points were checked
+	//or no cell can hold a better point
+	while (!failed && bbf.branchCount > 0 && checks < maxChecks) {
+		KDTreeBranch branch = popBranch(&bbf);
+		KDTreeNode* node = branch.node;
+		double distance = branch.distance;
+		int change = branch.change;
+		int* order = orders != NULL ? orders[branch.tree] : NULL;
+		if (spBPQueueIsFull(*bpq) && distance >= spBPQueueMaxValue(*bpq))
+			break;
+		applyChanges(&bbf, change, offsets, dimension);
+		//Descend to the leaf of the cell of the query, queueing the far
+		//children with their distances
+		while (!failed && node->dim >= 0
+				&& (!spBPQueueIsFull(*bpq)
+						|| distance < spBPQueueMaxValue(*bpq))) {
+			KDTreeNode* left = node + node->child;
+			KDTreeNode* far = NULL;
+			int axis = node->dim;
+			double coor = spFeatureQueryGetAxisCoor(query, axis);
+			double old = offsets[axis];
+			double nearOffset = 0;
+			double farOffset = 0;
+			if (coor <= node->u.split.high) {
+				nearOffset = coor > node->u.split.low ?
+						coor - node->u.split.low : 0;
+				farOffset = node->u.split.high - coor;
+				far = left + 1;
+				node = left;
+			} else {
+				farOffset = coor > node->u.split.low ?
+						coor - node->u.split.low : 0;
+				far = left;
+				node = left + 1;
+			}
+			// a child cell is inside its parent, its offsets only grow
+			double farDistance = distance;
+			int farChange = change;
+			if (farOffset > old)
+				farDistance += farOffset * farOffset - old * old;
+			if (!spBPQueueIsFull(*bpq)
+					|| farDistance < spBPQueueMaxValue(*bpq)) {
+				if (farOffset > old)
+					farChange = addChange(&bbf, axis, farOffset, change);
+				failed = farChange < -1
+						|| !pushBranch(&bbf, far, farDistance, farChange,
+								branch.tree);
+			}
+			if (!failed && nearOffset > old) {
+				change = addChange(&bbf, axis, nearOffset, change);
+				failed = change < -1;
+				offsets[axis] = nearOffset;
+				distance += nearOffset * nearOffset - old * old;
+			}
+		}
+		//Add the points of the leaf to the BPQ
+		if (!failed && node->dim < 0
+				&& (!spBPQueueIsFull(*bpq)
+						|| distance < spBPQueueMaxValue(*bpq))) {
+			if (order == NULL)
+				scanFeatures(store, node->u.leaf.data, node->u.leaf.count,
+						*bpq, query, trees > 1, NULL);
+			else
+				scanIndexedFeatures(store, order + node->u.leaf.data,
+						node->u.leaf.count, *bpq, query);
+			checks += node->u.leaf.count;
+		}
+	}
+	if (failed) {
+		spLoggerPrintError("Memory allocation failure", __FILE__, __func__,
+				__LINE__);
+	}
+	free(bbf.branches);
+	free(bbf.changes);
+}
 
-	if (!spBPQueueIsFull(*bpq)
-			|| pow(getVal(curr) - spPointGetAxisCoor(p, getDim(curr)), 2)
-					< spBPQueueMaxValue(*bpq)) {
-		if (lastState == 0) {
-			kNearestNeighbors(getRightChild(curr), bpq, p);
+void bestBinFirstNeighbors(KDTreeNode* curr, SPFeatureStore store,
+		SPBPQueue *bpq, SPFeatureQuery query, int maxChecks) {
+	if (curr == NULL || store == NULL || query == NULL || maxChecks <= 0) {
+		return;
+	}
+	bestBinFirstSearch(&curr, NULL, 1, store, bpq, query, maxChecks);
+}
+
+KDForest* InitKDForest(SPFeatureStore store, int size, int trees,
+		int leafSize, int threads) {
+	KDTreeBuild build;
+	KDForest* forest = NULL;
+	bool built = true;
+	if (store == NULL || size <= 0 || size > spFeatureStoreGetSize(store)
+			|| trees < 1) {
+		spLoggerPrintError("InitKDForest - Invalid arguments", __FILE__,
+				__func__, __LINE__);
+		return NULL;
+	}
+	if (!checkBuildArguments(MAX_SPREAD, spFeatureStoreGetDimension(store), 0,
+			leafSize, threads))
+		return NULL;
+	forest = (KDForest*) malloc(sizeof(KDForest));
+	if (forest == NULL) {
+		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	forest->trees = 0;
+	forest->roots = (KDTreeNode**) malloc(trees * sizeof(KDTreeNode*));
+	forest->orders = (int**) malloc(trees * sizeof(int*));
+	if (forest->roots == NULL || forest->orders == NULL) {
+		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
+		destroyKDForest(forest);
+		return NULL;
+	}
+	// the first tree reorders the store, the others index the new offsets
+	while (built && forest->trees < trees) {
+		int tree = forest->trees;
+		built = allocBuild(&build, store, MAX_SPREAD,
+				spFeatureStoreGetDimension(store), leafSize, size, true);
+		if (!built)
+			break;
+		build.randomSeed = mixSeed(build.randomSeed, tree);
+		build.randomized = true;
+		for (int i = 0; i < size; i++)
+			build.order[i] = i;
+		built = selectKDTree(&build, size, 0, 0, 1, 0, threads);
+		if (!built) {
+			free(build.nodes);
+			free(build.order);
+			free(build.keys);
+		} else if (tree == 0) {
+			forest->roots[tree] = finishBuild(&build, size);
+			forest->orders[tree] = NULL;
+			built = forest->roots[tree] != NULL;
 		} else {
-			kNearestNeighbors(getLeftChild(curr), bpq, p);
+			free(build.keys);
+			forest->roots[tree] = build.nodes;
+			forest->orders[tree] = build.order;
 		}
+		if (built)
+			forest->trees++;
+	}
+	if (!built) {
+		destroyKDForest(forest);
+		return NULL;
 	}
+	return forest;
 }
 
-bool isLeaf(KDTreeNode* node) {
-	if (node->left == NULL && node->right == NULL) {
-		return true;
+void kdForestNeighbors(KDForest* forest, SPFeatureStore store, SPBPQueue *bpq,
+		SPFeatureQuery query, int maxChecks) {
+	if (forest == NULL || store == NULL || query == NULL || maxChecks <= 0) {
+		return;
+	}
+	bestBinFirstSearch(forest->roots, forest->orders, forest->trees, store,
+			bpq, query, maxChecks);
+}
+
+void destroyKDForest(KDForest* forest) {
+	if (forest == NULL)
+		return;
+	for (int tree = 0; tree < forest->trees; tree++) {
+		free(forest->roots[tree]);
+		free(forest->orders[tree]);
 	}
-	return false;
+	free(forest->roots);
+	free(forest->orders);
+	free(forest);
+}
+
+void rerankNeighbors(SPFeatureStore store, SPFeatureQuery query,
+		SPBPQueue candidates, SPBPQueue bpq) {
+	const SPBPQueueElement* elements = NULL;
+	int offset = 0;
+	if (store == NULL || query == NULL || candidates == NULL || bpq == NULL)
+		return;
+	elements = spBPQueueGetElements(candidates);
+	for (int i = 0; i < spBPQueueSize(candidates); i++) {
+		offset = elements[i].index;
+		// cannot fail, bpq was checked for NULL above
+		spBPQueueEnqueueValue(bpq, offset,
+				spFeatureStoreQueryExactDistance(store, offset, query));
+	}
+	spBPQueueReset(candidates);
+}
+
+bool isLeaf(KDTreeNode* node) {
+	return node->dim < 0;
 }
 
 int getDim(KDTreeNode* node) {
@@ -175,25 +1333,90 @@ int getDim(KDTreeNode* node) {
 }
 
 double getVal(KDTreeNode* node) {
-	return node->val;
+	return isLeaf(node) ? -1 : node->u.split.high;
 }
 
 KDTreeNode* getLeftChild(KDTreeNode* node) {
-	return node->left;
+	return isLeaf(node) ? NULL : node + node->child;
 }
 
 KDTreeNode* getRightChild(KDTreeNode* node) {
-	return node->right;
+	return isLeaf(node) ? NULL : node + node->child + 1;
+}
+int getPoint(KDTreeNode* node) {
+	return isLeaf(node) ? node->u.leaf.data : -1;
 }
-SPPoint getPoint(KDTreeNode* node) {
-	return node->data;
+
+int getLeafSize(KDTreeNode* node) {
+	return isLeaf(node) ? node->u.leaf.count : 0;
 }
 
 void destroy(KDTreeNode* node) {
-	if (node == NULL)
-		return;
-	destroy(node->left);
-	destroy(node->right);
-	spPointDestroy(node->data);
-	free(node);
+	free(node); // the nodes of the tree are one allocation
+}
+
+size_t getTreeBytes(KDTreeNode* root) {
+	KDTreeNode* stack[KD_TREE_MAX_DEPTH + 1];
+	int top = 0;
+	int last = 0; // the largest index of a node of the tree
+	if (root == NULL)
+		return 0;
+	stack[top++] = root;
+	while (top > 0) {
+		KDTreeNode* node = stack[--top];
+		if (node - root > last)
+			last = (int) (node - root);
+		if (node->dim >= 0) {
+			assert(top + 2 <= KD_TREE_MAX_DEPTH + 1);
+			stack[top++] = node + node->child;
+			stack[top++] = node + node->child + 1;
+		}
+	}
+	return (size_t) (last + 1) * sizeof(KDTreeNode);
+}
+
+KDTreeNode* mapKDTree(const char* nodes, size_t bytes, int dimension,
+		int storeSize) {
+	KDTreeNode* root = (KDTreeNode*) nodes;
+	int stack[KD_TREE_MAX_DEPTH + 1];
+	int depths[KD_TREE_MAX_DEPTH + 1];
+	int top = 0;
+	bool valid = true;
+	if (nodes == NULL || bytes == 0 || bytes % sizeof(KDTreeNode) != 0
+			|| bytes / sizeof(KDTreeNode) > INT_MAX)
+		return NULL;
+	int count = (int) (bytes / sizeof(KDTreeNode));
+	bool* reached = (bool*) calloc(count, sizeof(bool));
+	if (reached == NULL) {
+		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	// every node is reached once from the root, no deeper than the search stack
+	stack[top] = 0;
+	depths[top++] = 1;
+	while (valid && top > 0) {
+		top--;
+		int index = stack[top];
+		int depth = depths[top];
+		KDTreeNode* node = root + index;
+		valid = !reached[index];
+		reached[index] = true;
+		if (valid && node->dim < 0) {
+			valid = node->dim == -1 && node->u.leaf.count > 0
+					&& node->u.leaf.data >= 0
+					&& node->u.leaf.data <= storeSize - node->u.leaf.count;
+		} else if (valid) {
+			valid = node->dim < dimension && node->child > 0
+					&& node->child < count - index - 1
+					&& depth < KD_TREE_MAX_DEPTH;
+			if (valid) {
+				stack[top] = index + node->child + 1;
+				depths[top++] = depth + 1;
+				stack[top] = index + node->child;
+				depths[top++] = depth + 1;
+			}
+		}
+	}
+	free(reached);
+	return valid ? root : NULL;
 }
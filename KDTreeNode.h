@@ -17,27 +17,70 @@
 #include <string.h>
 #include "KDArray.h"
 #include "SPPoint.h"
+#include "SPFeatureStore.h"
 #include "SPConfig.h"
 #include "SPBPriorityQueue.h"
 
-/** type used to define KDTreeNode **/
+/**
+ * type used to define KDTreeNode, a node of a finalized (read-only) tree.
+ * All the nodes of a tree are packed in one array of 16-byte nodes that
+ * refer to their children by relative index, with float split values.
+ **/
 typedef struct kd_tree_node_t KDTreeNode;
 
+/**
+ * type used to define KDForest, randomized kd-trees over the same features
+ * of one store that are searched together (see kdForestNeighbors)
+ **/
+typedef struct kd_forest_t KDForest;
+
 /**
  *
  * Initializes the kdTreeNode with the data given by kdArray.
+ * kdArray is consumed by the build. A subtree of at most leafSize points
+ * becomes a leaf, and the features of the store of kdArray are reordered
+ * (see spFeatureStorePermute) so the points of every leaf are at
+ * consecutive offsets, the points of the tree first. Any offset of the
+ * store obtained before the build is invalidated.
+ * Large subtrees (and the splits of their kd-arrays) are built by up to
+ * threads threads, the tree does not depend on the number of threads.
 
  * @return
  * 	NULL - If kdArray==NULL or allocations failed or dimensions <= 0 or incrementalCurrentDimension < 0
+ * 	or leafSize < 1 or threads < 1
  * 	or the split method is not one of the values in KDTreeSplitMethod  enum.
- * 	A new KDTreeNode in case of success.
+ * 	A new KDTreeNode (the root of the tree) in case of success.
  */
 KDTreeNode* InitKDTree(SPKDArray kdArray, KDTreeSplitMethod splitMethod,
-		int dimensions, int incrementalCurrentDimension);
+		int dimensions, int incrementalCurrentDimension, int leafSize,
+		int threads);
+
+/**
+ *
+ * Same as InitKDTree without a kd-array: the tree of the size features of
+ * store given by offsets (the first size features if offsets is NULL).
+ * Instead of keeping the points sorted by every coordinate, every node
+ * selects the median of its splitting coordinate only (quickselect), so
+ * the build needs memory for size points instead of dimensions * size.
+ * The tree is the same as the one InitKDTree builds.
+ *
+ * @return
+ * 	NULL - If store==NULL or size<=0 or offsets==NULL and the store holds
+ * 	less than size features or the other arguments are invalid (see
+ * 	InitKDTree) or allocations failed.
+ * 	A new KDTreeNode (the root of the tree) in case of success.
+ */
+KDTreeNode* InitKDTreeSelect(SPFeatureStore store, const int* offsets,
+		int size, KDTreeSplitMethod splitMethod, int dimensions,
+		int incrementalCurrentDimension, int leafSize, int threads);
 
-/** return the dimension we need to work with according to splitMethod parameter **/
+/**
+ * return the dimension we need to work with according to splitMethod parameter,
+ * RANDOM picks randomSeed % dimensions (kdArray is only used by MAX_SPREAD)
+ **/
 int findDimension(SPKDArray kdArray, KDTreeSplitMethod splitMethod,
-		int dimensions, int incrementalCurrentDimension);
+		int dimensions, int incrementalCurrentDimension,
+		unsigned int randomSeed);
 
 /** get the median value according to the given split coordinate. **/
 double getMedianValue(SPKDArray kdArray, int size, int splitCoor);
@@ -47,13 +90,128 @@ bool isLeaf(KDTreeNode* node);
 
 /** getters (KDTreeNode information) **/
 int getDim(KDTreeNode* node);
-double getVal(KDTreeNode* node);
+double getVal(KDTreeNode* node); // the split value rounded down to float
 KDTreeNode* getLeftChild(KDTreeNode* node);
 KDTreeNode* getRightChild(KDTreeNode* node);
-SPPoint getPoint(KDTreeNode* node);
-void destroy(KDTreeNode* node);
+int getPoint(KDTreeNode* node); // the offset of the first point of a leaf
+int getLeafSize(KDTreeNode* node); // the number of points of a leaf
+void destroy(KDTreeNode* node); // frees the whole tree, node must be the root
+
+/**
+ * the number of bytes of the nodes of the tree of root: the nodes are one
+ * array that starts at root and holds no pointers, so these bytes can be
+ * written to a file as is and mapped back by mapKDTree
+ **/
+size_t getTreeBytes(KDTreeNode* root);
+
+/**
+ * the root of a tree whose nodes (written as given by getTreeBytes) are the
+ * bytes at nodes, which must be aligned as a KDTreeNode and stay valid while
+ * the tree is used. The nodes are checked first: every node must be reached
+ * once from the root, split a dimension below dimension, not be deeper than
+ * the search supports and hold offsets below storeSize.
+ * The tree is read only and must not be destroyed.
+ *
+ * @return
+ * 	NULL - If nodes==NULL or the nodes are invalid or allocations failed.
+ * 	The root of the tree in case of success.
+ */
+KDTreeNode* mapKDTree(const char* nodes, size_t bytes, int dimension,
+		int storeSize);
+
+/**
+ * update bpq to include the k similar points (from store) to query by
+ * scanning every point of store (a block at a time if the blocks of store
+ * are built, see spFeatureStoreBuildBlocks), the index of every element in
+ * bpq is the offset of the point in store
+ **/
+void bruteForceNeighbors(SPFeatureStore store, SPBPQueue bpq,
+		SPFeatureQuery query);
 
-/** update bpq to include the k similar points to SPPoint p **/
-void kNearestNeighbors(KDTreeNode* curr, SPBPQueue *bpq, SPPoint p);
+/**
+ * update bpq to include the k similar points (from store) to query,
+ * the index of every element in bpq is the offset of the point in store.
+ * The tree is searched iteratively (an explicit stack of the far subtrees)
+ **/
+void kNearestNeighbors(KDTreeNode* curr, SPFeatureStore store, SPBPQueue *bpq,
+		SPFeatureQuery query);
+
+/**
+ * same as kNearestNeighbors, skipping the features of every image i with
+ * excludedImages[i] (deleted images whose features are still in store),
+ * excludedImages must hold a flag for every image index of store
+ **/
+void kNearestNeighborsExcluding(KDTreeNode* curr, SPFeatureStore store,
+		SPBPQueue *bpq, SPFeatureQuery query, const bool* excludedImages);
+
+/**
+ * the k similar points (from store) to each of the count queries, as
+ * kNearestNeighbors finds them, searched together: the queries that
+ * descend to the same node share its visit and every leaf is scanned for
+ * all the queries that reach it at once, while it is in the cache.
+ * The offsets of the neighbors of query q (nearest first) are stored at
+ * offsets[q * k] to offsets[q * k + k - 1] and their distances at the same
+ * places of distances, -1 and HUGE_VAL fill the places of the missing ones.
+ *
+ * @return
+ * 	false - If an argument is NULL or count<=0 or k<=0 or allocations
+ * 	failed (the output is not filled).
+ * 	true in case of success.
+ **/
+bool kNearestNeighborsBatch(KDTreeNode* curr, SPFeatureStore store,
+		SPFeatureQuery* queries, int count, int k, int* offsets,
+		double* distances);
+
+/**
+ * update bpq to include (approximately) the k similar points (from store) to
+ * query by a best-bin-first search (Beis & Lowe): the unexplored subtrees
+ * are kept in a priority queue by the distance from query to their cells and
+ * the closest one is searched next, until maxChecks points were checked
+ * (the leaf that reaches the budget is scanned whole) or no cell can hold a
+ * closer point. With a budget of at least the size of the tree the result is
+ * the one of kNearestNeighbors.
+ * The index of every element in bpq is the offset of the point in store.
+ * Nothing is done if maxChecks <= 0.
+ **/
+void bestBinFirstNeighbors(KDTreeNode* curr, SPFeatureStore store,
+		SPBPQueue *bpq, SPFeatureQuery query, int maxChecks);
+
+/**
+ * Builds trees randomized kd-trees over the first size features of store.
+ * At every node the splitting dimension is drawn at random from the
+ * dimensions of the largest variance of the points of the node (estimated
+ * from a sample of them, by a fixed seed so the same store always gives
+ * the same trees), the points are split at the median as in
+ * InitKDTreeSelect. The features of the store are reordered to the leaf
+ * order of the first tree, the other trees keep the offsets of their
+ * points, so a tree costs its nodes and one int per point.
+ *
+ * @return
+ * 	NULL - If store==NULL or size<=0 or the store holds less than size
+ * 	features or trees<1 or leafSize<1 or threads<1 or allocations failed.
+ * 	A new KDForest in case of success.
+ */
+KDForest* InitKDForest(SPFeatureStore store, int size, int trees,
+		int leafSize, int threads);
+
+/**
+ * same as bestBinFirstNeighbors for all the trees of forest together: one
+ * priority queue of branches and one budget of maxChecks points for all
+ * the trees. A point found by several trees enters bpq once.
+ **/
+void kdForestNeighbors(KDForest* forest, SPFeatureStore store, SPBPQueue *bpq,
+		SPFeatureQuery query, int maxChecks);
+
+/** frees all the trees of forest **/
+void destroyKDForest(KDForest* forest);
+
+/**
+ * empty candidates (filled by kNearestNeighbors) into bpq, ordered by the
+ * exact distance of every candidate to query (see
+ * spFeatureStoreQueryExactDistance). Used to rerank the candidates found
+ * in a quantized store.
+ **/
+void rerankNeighbors(SPFeatureStore store, SPFeatureQuery query,
+		SPBPQueue candidates, SPBPQueue bpq);
 
 #endif /* KDTREENODE_H_ */
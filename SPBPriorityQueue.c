@@ -10,27 +10,97 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "SPBPriorityQueue.h"
 #include "SPListElement.h"
-#include "SPList.h"
 
+/*
+ * The elements are a binary max-heap (by value and then by index), so the
+ * biggest is elements[0]. The lowest ones are taken by sorting the heap in
+ * decreasing order, which is still a heap with the lowest element last, and
+ * removing from the end until the next enqueue.
+ */
 struct sp_bp_queue_t {
-	SPList list;
+	SPBPQueueElement* elements;
+	int size;
+	int capacity; // the number of elements allocated
 	int maxSize;
+	bool isSorted; // elements are in decreasing order
 };
 
+/** true if a comes before b, by value and then by index **/
+static bool elementBefore(const SPBPQueueElement* a,
+		const SPBPQueueElement* b) {
+	return a->value < b->value || (a->value == b->value && a->index < b->index);
+}
+
+/** moves elements[position] up the heap while its parent comes before it **/
+static void siftUp(SPBPQueueElement* elements, int position) {
+	SPBPQueueElement moved = elements[position];
+	while (position > 0) {
+		int parent = (position - 1) / 2;
+		if (!elementBefore(&elements[parent], &moved))
+			break;
+		elements[position] = elements[parent];
+		position = parent;
+	}
+	elements[position] = moved;
+}
+
+/** moves elements[position] down the heap of size elements while a child comes after it **/
+static void siftDown(SPBPQueueElement* elements, int size, int position) {
+	SPBPQueueElement moved = elements[position];
+	int child = 2 * position + 1;
+	while (child < size) {
+		if (child + 1 < size
+				&& elementBefore(&elements[child], &elements[child + 1]))
+			child++;
+		if (!elementBefore(&moved, &elements[child]))
+			break;
+		elements[position] = elements[child];
+		position = child;
+		child = 2 * position + 1;
+	}
+	elements[position] = moved;
+}
+
+/** sorts the heap in decreasing order, the lowest element is last **/
+static void sortQueue(SPBPQueue source) {
+	SPBPQueueElement* elements = source->elements;
+	SPBPQueueElement swap;
+	if (source->isSorted)
+		return;
+	// heap sort to increasing order, then reversed
+	for (int last = source->size - 1; last > 0; last--) {
+		swap = elements[0];
+		elements[0] = elements[last];
+		elements[last] = swap;
+		siftDown(elements, last, 0);
+	}
+	for (int i = 0, j = source->size - 1; i < j; i++, j--) {
+		swap = elements[i];
+		elements[i] = elements[j];
+		elements[j] = swap;
+	}
+	source->isSorted = true;
+}
+
 SPBPQueue spBPQueueCreate(int maxSize) {
 	if (maxSize <= 0)
 		return NULL;
 	SPBPQueue queue = (SPBPQueue) malloc(sizeof(*queue));
 	if (queue == NULL)
 		return NULL;
-	queue->list = spListCreate();
-	if (queue->list == NULL) {
+	queue->elements = (SPBPQueueElement*) malloc(
+			maxSize * sizeof(SPBPQueueElement));
+	if (queue->elements == NULL) {
 		spBPQueueDestroy(queue);
 		return NULL;
 	}
+	queue->size = 0;
+	queue->capacity = maxSize;
 	queue->maxSize = maxSize;
+	queue->isSorted = true;
 	return queue;
 }
 
@@ -40,18 +110,21 @@ SPBPQueue spBPQueueCopy(SPBPQueue source) {
 	SPBPQueue copyQueue = (SPBPQueue) malloc(sizeof(*copyQueue));
 	if (copyQueue == NULL)
 		return NULL;
-	copyQueue->list = spListCopy(source->list);
-	if (copyQueue->list == NULL) {
+	*copyQueue = *source;
+	copyQueue->elements = (SPBPQueueElement*) malloc(
+			source->capacity * sizeof(SPBPQueueElement));
+	if (copyQueue->elements == NULL) {
 		spBPQueueDestroy(copyQueue);
 		return NULL;
 	}
-	copyQueue->maxSize = source->maxSize;
+	memcpy(copyQueue->elements, source->elements,
+			source->size * sizeof(SPBPQueueElement));
 	return copyQueue;
 }
 
 void spBPQueueDestroy(SPBPQueue source) {
 	if (source != NULL) {
-		spListDestroy(source->list);
+		free(source->elements);
 		free(source);
 	}
 	return;
@@ -59,16 +132,17 @@ void spBPQueueDestroy(SPBPQueue source) {
 
 void spBPQueueClear(SPBPQueue source) {
 	if (source != NULL) {
-		spListClear(source->list);
+		source->size = 0;
+		source->isSorted = true;
+		source->maxSize = 0;
 	}
-	source->maxSize = 0;
 	return;
 }
 
 int spBPQueueSize(SPBPQueue source) {
 	if (source == NULL)
 		return -1;
-	return spListGetSize(source->list);
+	return source->size;
 }
 
 int spBPQueueGetMaxSize(SPBPQueue source) {
@@ -80,73 +154,44 @@ int spBPQueueGetMaxSize(SPBPQueue source) {
 SP_BPQUEUE_MSG spBPQueueEnqueue(SPBPQueue source, SPListElement element) {
 	if (source == NULL || element == NULL)
 		return SP_BPQUEUE_INVALID_ARGUMENT;
-	SPListElement copyElement = spListElementCopy(element);
-	if (copyElement == NULL)
-		return SP_BPQUEUE_OUT_OF_MEMORY;
+	return spBPQueueEnqueueValue(source, spListElementGetIndex(element),
+			spListElementGetValue(element));
+}
+
+SP_BPQUEUE_MSG spBPQueueEnqueueValue(SPBPQueue source, int index,
+		double value) {
+	SPBPQueueElement element;
+	if (source == NULL)
+		return SP_BPQUEUE_INVALID_ARGUMENT;
+	element.index = index;
+	element.value = value;
 
 	//Case1 : queue isn't full
-	if ((spListGetSize(source->list)) < (source->maxSize)) {
-		SP_LIST_FOREACH(SPListElement, e, source->list)
-		{
-
-			/* we will add the new element before e only if e is
-			 * bigger than the new element
-			 */
-			if (spListElementCompare(e, copyElement) >= 1) {
-				spListInsertBeforeCurrent(source->list, copyElement);
-				spListElementDestroy(copyElement);
-
-				return SP_BPQUEUE_SUCCESS;
-			}
-		}
-		/* The value of the new element is the biggest
-		 * (according to value+index)
-		 */
-		spListInsertLast(source->list, copyElement);
-		spListElementDestroy(copyElement);
+	if (source->size < source->maxSize) {
+		source->elements[source->size] = element;
+		siftUp(source->elements, source->size);
+		source->size++;
+		source->isSorted = source->size == 1;
 		return SP_BPQUEUE_SUCCESS;
 	}
 
-	//Case2 : queue is full
-
-	else {
-		/* maybe we don't need to go over all the queue's elements because
-		 * the new element is the biggest and the queue is full so we
-		 * don't need to insert the new element to the queue
-		 */
-		SPListElement last = spBPQueuePeekLast(source);
-		if (spListElementCompare(copyElement, last) >= 0) {
-			spListElementDestroy(copyElement);
-			spListElementDestroy(last);
-			return SP_BPQUEUE_SUCCESS;
-		}
-		// therefore the loop must stop somewhere
-		else {
-			spListElementDestroy(last);
-			SP_LIST_FOREACH(SPListElement, e, source->list)
-			{
-				if (spListElementCompare(e, copyElement) >= 1) {
-					spListInsertBeforeCurrent(source->list, copyElement);
-					spListGetLast(source->list);
-					spListRemoveCurrent(source->list);
-					spListElementDestroy(copyElement);
-
-					return SP_BPQUEUE_SUCCESS;
-				}
-			}
-		}
-	}
-	// shouldn't get here
-	return SP_BPQUEUE_EMPTY;
+	//Case2 : queue is full, the new element replaces the biggest unless
+	// it is the biggest itself (according to value+index)
+	if (source->size == 0 || !elementBefore(&element, &source->elements[0]))
+		return SP_BPQUEUE_SUCCESS;
+	source->elements[0] = element;
+	siftDown(source->elements, source->size, 0);
+	source->isSorted = false;
+	return SP_BPQUEUE_SUCCESS;
 }
 
 SP_BPQUEUE_MSG spBPQueueDequeue(SPBPQueue source) {
 	if (source == NULL)
 		return SP_BPQUEUE_INVALID_ARGUMENT;
-	if ((spListGetSize(source->list)) == 0)
+	if (source->size == 0)
 		return SP_BPQUEUE_EMPTY;
-	spListGetFirst(source->list);
-	spListRemoveCurrent(source->list);
+	sortQueue(source);
+	source->size--;
 
 	return SP_BPQUEUE_SUCCESS;
 }
@@ -154,32 +199,33 @@ SP_BPQUEUE_MSG spBPQueueDequeue(SPBPQueue source) {
 SPListElement spBPQueuePeek(SPBPQueue source) {
 	if (source == NULL)
 		return NULL;
-	if ((spListGetSize(source->list)) == 0)
+	if (source->size == 0)
 		return NULL;
+	sortQueue(source);
 
-	SPListElement copy = spListElementCopy(spListGetFirst(source->list));
-	return copy;
+	SPBPQueueElement* lowest = &source->elements[source->size - 1];
+	return spListElementCreate(lowest->index, lowest->value);
 }
 
 SPListElement spBPQueuePeekLast(SPBPQueue source) {
 	if (source == NULL)
 		return NULL;
-	if ((spListGetSize(source->list)) == 0)
+	if (source->size == 0)
 		return NULL;
-	spListGetLast(source->list);
 
-	SPListElement copy = spListElementCopy(spListGetLast(source->list));
-	return copy;
+	return spListElementCreate(source->elements[0].index,
+			source->elements[0].value);
 }
 
 double spBPQueueMinValue(SPBPQueue source) {
 
 	if (source == NULL)
 		return -1;
-	if ((spListGetSize(source->list)) == 0)
+	if (source->size == 0)
 		return -1;
+	sortQueue(source);
 
-	return spListElementGetValue(spListGetFirst(source->list));
+	return source->elements[source->size - 1].value;
 
 }
 
@@ -187,37 +233,75 @@ double spBPQueueMaxValue(SPBPQueue source) {
 
 	if (source == NULL)
 		return -1;
-	if ((spListGetSize(source->list)) == 0)
+	if (source->size == 0)
 		return -1;
 
-	return spListElementGetValue(spListGetLast(source->list));
+	return source->elements[0].value;
 
 }
 
 bool spBPQueueIsEmpty(SPBPQueue source) {
 	assert(source != NULL);
-	return ((spListGetSize(source->list)) == 0);
+	return source->size == 0;
 }
 
 bool spBPQueueIsFull(SPBPQueue source) {
 	assert(source != NULL);
-	return (spListGetSize(source->list) == source->maxSize);
+	return source->size == source->maxSize;
 }
 int spBPQueueIndexOfMinValue(SPBPQueue source) {
-	int index;
 	if (source == NULL)
 		return -1;
-	if ((spListGetSize(source->list)) == 0)
-		return -1;
-	index = spListElementGetIndex(spListGetFirst(source->list));
-	if (spBPQueueDequeue(source) != SP_BPQUEUE_SUCCESS) {
+	if (source->size == 0)
 		return -1;
+	sortQueue(source);
+	source->size--;
+	return source->elements[source->size].index;
+}
+
+const SPBPQueueElement* spBPQueueGetElements(SPBPQueue source) {
+	if (source == NULL)
+		return NULL;
+	return source->elements;
+}
+
+void spBPQueueReset(SPBPQueue source) {
+	if (source != NULL) {
+		source->size = 0;
+		source->isSorted = true;
 	}
-	return index;
 }
 
 void spBPQueueSetSize(SPBPQueue source, int size) {
 	if (source == NULL)
 		return;
+	if (size > source->capacity) {
+		SPBPQueueElement* elements = (SPBPQueueElement*) realloc(source->elements,
+				size * sizeof(SPBPQueueElement));
+		if (elements == NULL) { // bounded by the elements already allocated
+			size = source->capacity;
+		} else {
+			source->elements = elements;
+			source->capacity = size;
+		}
+	}
 	source->maxSize = size;
 }
+
+bool spBPQueueContains(SPBPQueue source, SPListElement element) {
+	if (element == NULL)
+		return false;
+	return spBPQueueContainsValue(source, spListElementGetIndex(element),
+			spListElementGetValue(element));
+}
+
+bool spBPQueueContainsValue(SPBPQueue source, int index, double value) {
+	if (source == NULL)
+		return false;
+	for (int i = 0; i < source->size; i++) {
+		if (source->elements[i].index == index
+				&& source->elements[i].value == value)
+			return true;
+	}
+	return false;
+}
@@ -6,8 +6,9 @@
  * SP Bounded Priority Queue summary
  *
  * Implements a queue container type.
- * The queue contains a list and capacity which bounds the numbers of elements in the list
- * please refer to SPList.h for usage.
+ * The queue keeps (index, value) pairs by value in an array allocated when
+ * it is created, as a binary max-heap bounded by its capacity, so enqueueing
+ * doesn't allocate and the maximum value is known at once.
  * The queue decide whether to add a new element based on the value and the index of a new element,
  * remembering the fact that the queue has an upper bound of the number of elements - capacity 
  *
@@ -20,6 +21,7 @@
  *   spBPQueueSize              - Returns the number of elements in the queue.
  *   spBPQueueGetMaxSize        - Returns the maximum capacity of the queue
  *   spBPQueueEnqueue           - Inserts an element to the queue
+ *   spBPQueueEnqueueValue      - Inserts an (index, value) pair to the queue
  *   spBPQueueDequeue           - Removes the element with the lowest value
  *   spBPQueuePeek              - Returns the element with the lowest value
  *   spBPQueuePeekLast          - Returns the element with the highest value
@@ -27,12 +29,22 @@
  *   spBPQueueMaxValue          - Returns the maximum value in the queue
  *   spBPQueueIsEmpty           - Returns true if the queue is empty, false if not
  *   spBPQueueIsFull	        - Return true if the queue is full, false if not
+ *   spBPQueueContains          - Return true if the queue holds an equal element
+ *   spBPQueueContainsValue     - Return true if the queue holds an (index, value) pair
+ *   spBPQueueGetElements       - Returns all the elements of the queue at once
+ *   spBPQueueReset             - Removes all elements, keeping the maximum capacity
  *
  */
 
 /** type used to define Bounded priority queue **/
 typedef struct sp_bp_queue_t* SPBPQueue;
 
+/** an element of the queue, as spBPQueueGetElements returns them **/
+typedef struct sp_bp_queue_element_t {
+	int index;
+	double value;
+} SPBPQueueElement;
+
 /** type for error reporting **/
 typedef enum sp_bp_queue_msg_t {
 	SP_BPQUEUE_OUT_OF_MEMORY,
@@ -56,21 +68,21 @@ SPBPQueue spBPQueueCreate(int maxSize);
 /**
  * creates a copy of a given queue
  *
- *The new copy will contain the same list as the list in the source queue and the
+ *The new copy will contain the same elements as the source queue and the
  *same capacity as the capacity of the source queue
  *
  *
  * @param source The target queue to copy
  * @return
  * NULL if a NULL was sent or a memory allocation failed.
- * A queue contain the same list and capacity as the source queue
+ * A queue contain the same elements and capacity as the source queue
  */
 SPBPQueue spBPQueueCopy(SPBPQueue source);
 
 /**
  * Destroys a queue.
  * All memory allocation associated with the queue will be freed,
- * include the list and the elements of the list
+ * include the elements of the queue
  *
  * @param source the target queue which will be freed.
  * 			   if source is NULL, then nothing is done
@@ -106,7 +118,7 @@ int spBPQueueGetMaxSize(SPBPQueue source);
 
 /**
  *
- *Inserts a NEW COPY (must be allocated) element to the queue
+ *Inserts a copy of element to the queue
  *
  * Adds a new element to the queue in the right place according
  * to the value and the index, if the queue is full and the value of
@@ -121,13 +133,25 @@ int spBPQueueGetMaxSize(SPBPQueue source);
  * inserted
  * @return
  * SP_BPQUEUE_INVALID_ARGUMENT if a NULL was sent as source or element
- * SP_BPQUEUE_OUT_OF_MEMORY if an allocation failed
  * SP_BPQUEUE_SUCCESS the element has been inserted successfully or
  * the element is too big (according to value + index)
- * SP_BPQUEUE_EMPTY we shoudn't get the message never
  *
  */
 SP_BPQUEUE_MSG spBPQueueEnqueue(SPBPQueue source, SPListElement element);
+/**
+ * Same as spBPQueueEnqueue for the element with the given index and value,
+ * without creating it. Nothing is allocated.
+ *
+ * @param source The queue source for which to add an element
+ * @param index The index of the element
+ * @param value The value of the element
+ * @return
+ * SP_BPQUEUE_INVALID_ARGUMENT if a NULL was sent as source
+ * SP_BPQUEUE_SUCCESS the element has been inserted successfully or
+ * the element is too big (according to value + index)
+ */
+SP_BPQUEUE_MSG spBPQueueEnqueueValue(SPBPQueue source, int index,
+		double value);
 
 /**
  * removes the element with the lowest value
@@ -226,7 +250,51 @@ bool spBPQueueIsFull(SPBPQueue source);
  */
 int spBPQueueIndexOfMinValue(SPBPQueue source);
 
-/** set new size for the bpq **/
+/** set new size for the bpq, the array grows if size is bigger than it **/
 void spBPQueueSetSize(SPBPQueue source, int size);
 
+/**
+ * returns true if the queue holds an element equal to element (the same
+ * index and value), false if not
+ *
+ * @param source - The source queue
+ * @param element - The element to look for
+ * @return
+ * false if source or element is NULL or no element of the queue is equal to element
+ * true otherwise
+ */
+bool spBPQueueContains(SPBPQueue source, SPListElement element);
+
+/**
+ * returns true if the queue holds an element with the given index and
+ * value, as spBPQueueContains without an element to allocate
+ *
+ * @param source - The source queue
+ * @param index - The index to look for
+ * @param value - The value to look for
+ * @return
+ * false if source is NULL or no element of the queue has index and value
+ * true otherwise
+ */
+bool spBPQueueContainsValue(SPBPQueue source, int index, double value);
+
+/**
+ * returns the elements of the queue, spBPQueueSize of them, in no
+ * particular order and without removing them. Nothing is copied, the array
+ * belongs to the queue and is valid until the queue is changed.
+ *
+ * @param source - The source queue
+ * @return
+ * NULL if a NULL was sent as source
+ * the elements of the queue otherwise
+ */
+const SPBPQueueElement* spBPQueueGetElements(SPBPQueue source);
+/**
+ * removes all elements from the queue in O(1), unlike spBPQueueClear the
+ * maximum capacity is kept
+ *
+ * @param source - The source queue, if source is NULL nothing is done
+ */
+void spBPQueueReset(SPBPQueue source);
+
 #endif
@@ -19,6 +19,13 @@
 #define SP_NUM_OF_FEATURES_DEFAULT_VALUE 100
 #define SP_NUM_OF_SIMILAR_IMAGES_DEFAULT_VALUE 1
 #define SP_KNN_DEFAULT_VALUE 1
+#define SP_PQ_SUBSPACES_DEFAULT_VALUE 8
+#define SP_KDTREE_LEAF_SIZE_DEFAULT_VALUE 16
+#define SP_KDTREE_BUILD_THREADS_DEFAULT_VALUE 1
+#define SP_QUERY_THREADS_DEFAULT_VALUE 1
+#define SP_CONCURRENT_QUERIES_DEFAULT_VALUE 1
+#define SP_KDTREE_MAX_CHECKS_DEFAULT_VALUE 1024
+#define SP_KDFOREST_TREES_DEFAULT_VALUE 4
 #define SP_LOGGER_LEVEL_DEFAULT_VALUE 3
 #define SP_LOGGER_FILENAME_DEFAULT_VALUE "stdout"
 #define MAX_LENGTH 1025
@@ -26,6 +33,11 @@
 #define PCA_DIMENSION_MAX_RANGE 28
 #define LOGGER_LEVEL_MIN_RANGE 1
 #define LOGGER_LEVEL_MAX_RANGE 4
+#define KDTREE_LEAF_SIZE_MAX_RANGE 1024
+#define KDTREE_BUILD_THREADS_MAX_RANGE 64
+#define QUERY_THREADS_MAX_RANGE 64
+#define CONCURRENT_QUERIES_MAX_RANGE 64
+#define KDFOREST_TREES_MAX_RANGE 64
 
 #define FILE_PRINT "File: "
 #define LINE_PRINT "Line: "
@@ -60,6 +72,7 @@ struct sp_config_t {
 	int spNumOfImages;
 	int spPCADimension;
 	char* spPCAFilename;
+	char* spIndexFilename; // empty if the index file is not used
 	int spNumOfFeatures;
 	bool spExtractionMode;
 	int spNumOfSimilarImages;
@@ -68,6 +81,17 @@ struct sp_config_t {
 	bool spMinimalGUI;
 	int spLoggerLevel;
 	char* spLoggerFilename;
+	SPFeatureStorage spFeatureStorage;
+	int spRerankCandidates;
+	int spPQSubspaces;
+	int spKDTreeLeafSize;
+	int spKDTreeBuildThreads;
+	int spQueryThreads;
+	int spConcurrentQueries;
+	KDTreeBuildMethod spKDTreeBuildMethod;
+	KDTreeSearchMethod spKDTreeSearchMethod;
+	int spKDTreeMaxChecks;
+	int spKDForestTrees;
 };
 
 SPConfig config = NULL;
@@ -90,7 +114,13 @@ SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg) {
 			isSpNumOfFeaturesSet = false, isSpExtractionModeSet = false,
 			isSpNumOfSimilarImagesSet = false, isSpKDTreeSplitMethodSet = false,
 			isSpKNNSet = false, isSpMinimalGUISet = false, isSpLoggerLevelSet =
-					false, isSpLoggerFilenameSet = false;
+					false, isSpLoggerFilenameSet = false,
+			isSpFeatureStorageSet = false, isSpRerankCandidatesSet = false,
+			isSpPQSubspacesSet = false, isSpKDTreeLeafSizeSet = false,
+			isSpKDTreeBuildThreadsSet = false, isSpKDTreeBuildMethodSet = false,
+			isSpKDTreeSearchMethodSet = false, isSpKDTreeMaxChecksSet = false,
+			isSpKDForestTreesSet = false, isSpQueryThreadsSet = false,
+			isSpConcurrentQueriesSet = false;
 	assert(msg != NULL);
 	// Allocations
 	config = (SPConfig) malloc(sizeof(*config));
@@ -99,11 +129,13 @@ SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg) {
 	config->spImagesSuffix = (char*) malloc(sizeof(char) * MAX_LENGTH);
 	config->spPCAFilename = (char*) malloc(sizeof(char) * MAX_LENGTH);
 	config->spLoggerFilename = (char*) malloc(sizeof(char) * MAX_LENGTH);
+	config->spIndexFilename = (char*) malloc(sizeof(char) * MAX_LENGTH);
 	partA = (char*) malloc(sizeof(char) * MAX_LENGTH);
 	partB = (char*) malloc(sizeof(char) * MAX_LENGTH);
 	if (config->spImagesDirectory == NULL || config->spImagesPrefix == NULL
 			|| config->spImagesSuffix == NULL || config->spPCAFilename == NULL
-			|| config->spLoggerFilename == NULL || partA == NULL
+			|| config->spLoggerFilename == NULL
+			|| config->spIndexFilename == NULL || partA == NULL
 			|| partB == NULL || config == NULL) {
 		//Allocation failure
 		printf("%s", ALLOCATION_PRINT); // we don't have a logger yet, so print to stdout.
@@ -113,6 +145,7 @@ SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg) {
 		free(partB);
 		return NULL;
 	}
+	config->spIndexFilename[0] = '\0'; // no index file unless it is set
 
 	if (filename == NULL) {
 		*msg = SP_CONFIG_INVALID_ARGUMENT;
@@ -239,7 +272,7 @@ SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg) {
 					if (isANumber(
 							partB) && checkNum >= PCA_DIMENSION_MIN_RANGE && checkNum <= PCA_DIMENSION_MAX_RANGE) {
 						isSpPCADimensionSet = true;
-						config->spNumOfImages = checkNum;
+						config->spPCADimension = checkNum;
 					} else {
 						printf("%s%s\n", FILE_PRINT, filename);
 						printf("%s%d\n", LINE_PRINT, k);
@@ -254,6 +287,8 @@ SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg) {
 				} else if (strcmp(partA, "spPCAFilename") == 0) {
 					isSpPCAFilenameSet = true;
 					strcpy(config->spPCAFilename, partB);
+				} else if (strcmp(partA, "spIndexFilename") == 0) {
+					strcpy(config->spIndexFilename, partB);
 				} else if (strcmp(partA, "spNumOfFeatures") == 0) {
 					// check if partB is a positive number
 					checkNum = atoi(partB);
@@ -384,6 +419,211 @@ SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg) {
 				} else if (strcmp(partA, "spLoggerFilename") == 0) {
 					isSpLoggerFilenameSet = true;
 					strcpy(config->spLoggerFilename, partB);
+				} else if (strcmp(partA, "spFeatureStorage") == 0) {
+					if (strcmp(partB, "DOUBLE") == 0) {
+						isSpFeatureStorageSet = true;
+						config->spFeatureStorage = DOUBLE_STORAGE;
+					} else if (strcmp(partB, "FLOAT") == 0) {
+						isSpFeatureStorageSet = true;
+						config->spFeatureStorage = FLOAT_STORAGE;
+					} else if (strcmp(partB, "INT8") == 0) {
+						isSpFeatureStorageSet = true;
+						config->spFeatureStorage = INT8_STORAGE;
+					} else if (strcmp(partB, "PQ") == 0) {
+						isSpFeatureStorageSet = true;
+						config->spFeatureStorage = PQ_STORAGE;
+					} else {
+						printf("%s%s\n", FILE_PRINT, filename);
+						printf("%s%d\n", LINE_PRINT, k);
+						printf("%s", MESSAGE_CONSTRAINT_PRINT);
+						*msg = SP_CONFIG_INVALID_ENUM_STORAGE;
+						fclose(configurationFile);
+						spConfigDestroy(config);
+						free(partA);
+						free(partB);
+						return NULL;
+					}
+				} else if (strcmp(partA, "spRerankCandidates") == 0) {
+					// check if partB is a non negative number
+					checkNum = atoi(partB);
+					if (!isANumber(partB) || checkNum < 0) {
+						printf("%s%s\n", FILE_PRINT, filename);
+						printf("%s%d\n", LINE_PRINT, k);
+						printf("%s", MESSAGE_CONSTRAINT_PRINT);
+						*msg = SP_CONFIG_INVALID_INTEGER;
+						fclose(configurationFile);
+						spConfigDestroy(config);
+						free(partA);
+						free(partB);
+						return NULL;
+					} else {
+						isSpRerankCandidatesSet = true;
+						config->spRerankCandidates = checkNum;
+					}
+				} else if (strcmp(partA, "spPQSubspaces") == 0) {
+					// check if partB is in the range [1,28], a subspace has at least one axis
+					checkNum = atoi(partB);
+					if (isANumber(
+							partB) && checkNum >= 1 && checkNum <= PCA_DIMENSION_MAX_RANGE) {
+						isSpPQSubspacesSet = true;
+						config->spPQSubspaces = checkNum;
+					} else {
+						printf("%s%s\n", FILE_PRINT, filename);
+						printf("%s%d\n", LINE_PRINT, k);
+						printf("%s", MESSAGE_CONSTRAINT_PRINT);
+						*msg = SP_CONFIG_INVALID_INTEGER;
+						fclose(configurationFile);
+						spConfigDestroy(config);
+						free(partA);
+						free(partB);
+						return NULL;
+					}
+				} else if (strcmp(partA, "spKDTreeLeafSize") == 0) {
+					// check if partB is in the range [1,1024]
+					checkNum = atoi(partB);
+					if (isANumber(
+							partB) && checkNum >= 1 && checkNum <= KDTREE_LEAF_SIZE_MAX_RANGE) {
+						isSpKDTreeLeafSizeSet = true;
+						config->spKDTreeLeafSize = checkNum;
+					} else {
+						printf("%s%s\n", FILE_PRINT, filename);
+						printf("%s%d\n", LINE_PRINT, k);
+						printf("%s", MESSAGE_CONSTRAINT_PRINT);
+						*msg = SP_CONFIG_INVALID_INTEGER;
+						fclose(configurationFile);
+						spConfigDestroy(config);
+						free(partA);
+						free(partB);
+						return NULL;
+					}
+				} else if (strcmp(partA, "spKDTreeBuildThreads") == 0) {
+					// check if partB is in the range [1,64]
+					checkNum = atoi(partB);
+					if (isANumber(
+							partB) && checkNum >= 1 && checkNum <= KDTREE_BUILD_THREADS_MAX_RANGE) {
+						isSpKDTreeBuildThreadsSet = true;
+						config->spKDTreeBuildThreads = checkNum;
+					} else {
+						printf("%s%s\n", FILE_PRINT, filename);
+						printf("%s%d\n", LINE_PRINT, k);
+						printf("%s", MESSAGE_CONSTRAINT_PRINT);
+						*msg = SP_CONFIG_INVALID_INTEGER;
+						fclose(configurationFile);
+						spConfigDestroy(config);
+						free(partA);
+						free(partB);
+						return NULL;
+					}
+				} else if (strcmp(partA, "spQueryThreads") == 0) {
+					// check if partB is in the range [1,64]
+					checkNum = atoi(partB);
+					if (isANumber(
+							partB) && checkNum >= 1 && checkNum <= QUERY_THREADS_MAX_RANGE) {
+						isSpQueryThreadsSet = true;
+						config->spQueryThreads = checkNum;
+					} else {
+						printf("%s%s\n", FILE_PRINT, filename);
+						printf("%s%d\n", LINE_PRINT, k);
+						printf("%s", MESSAGE_CONSTRAINT_PRINT);
+						*msg = SP_CONFIG_INVALID_INTEGER;
+						fclose(configurationFile);
+						spConfigDestroy(config);
+						free(partA);
+						free(partB);
+						return NULL;
+					}
+				} else if (strcmp(partA, "spConcurrentQueries") == 0) {
+					// check if partB is in the range [1,64]
+					checkNum = atoi(partB);
+					if (isANumber(
+							partB) && checkNum >= 1 && checkNum <= CONCURRENT_QUERIES_MAX_RANGE) {
+						isSpConcurrentQueriesSet = true;
+						config->spConcurrentQueries = checkNum;
+					} else {
+						printf("%s%s\n", FILE_PRINT, filename);
+						printf("%s%d\n", LINE_PRINT, k);
+						printf("%s", MESSAGE_CONSTRAINT_PRINT);
+						*msg = SP_CONFIG_INVALID_INTEGER;
+						fclose(configurationFile);
+						spConfigDestroy(config);
+						free(partA);
+						free(partB);
+						return NULL;
+					}
+				} else if (strcmp(partA, "spKDTreeBuildMethod") == 0) {
+					if (strcmp(partB, "PRESORT") == 0) {
+						isSpKDTreeBuildMethodSet = true;
+						config->spKDTreeBuildMethod = PRESORT_BUILD;
+					} else if (strcmp(partB, "SELECT") == 0) {
+						isSpKDTreeBuildMethodSet = true;
+						config->spKDTreeBuildMethod = SELECT_BUILD;
+					} else {
+						printf("%s%s\n", FILE_PRINT, filename);
+						printf("%s%d\n", LINE_PRINT, k);
+						printf("%s", MESSAGE_CONSTRAINT_PRINT);
+						*msg = SP_CONFIG_INVALID_ENUM_KDTREE;
+						fclose(configurationFile);
+						spConfigDestroy(config);
+						free(partA);
+						free(partB);
+						return NULL;
+					}
+				} else if (strcmp(partA, "spKDTreeSearchMethod") == 0) {
+					if (strcmp(partB, "EXACT") == 0) {
+						isSpKDTreeSearchMethodSet = true;
+						config->spKDTreeSearchMethod = EXACT_SEARCH;
+					} else if (strcmp(partB, "BEST_BIN_FIRST") == 0) {
+						isSpKDTreeSearchMethodSet = true;
+						config->spKDTreeSearchMethod = BEST_BIN_FIRST_SEARCH;
+					} else if (strcmp(partB, "RANDOMIZED_FOREST") == 0) {
+						isSpKDTreeSearchMethodSet = true;
+						config->spKDTreeSearchMethod = RANDOMIZED_FOREST_SEARCH;
+					} else {
+						printf("%s%s\n", FILE_PRINT, filename);
+						printf("%s%d\n", LINE_PRINT, k);
+						printf("%s", MESSAGE_CONSTRAINT_PRINT);
+						*msg = SP_CONFIG_INVALID_ENUM_KDTREE;
+						fclose(configurationFile);
+						spConfigDestroy(config);
+						free(partA);
+						free(partB);
+						return NULL;
+					}
+				} else if (strcmp(partA, "spKDTreeMaxChecks") == 0) {
+					// check if partB is a positive integer
+					checkNum = atoi(partB);
+					if (isANumber(partB) && checkNum >= 1) {
+						isSpKDTreeMaxChecksSet = true;
+						config->spKDTreeMaxChecks = checkNum;
+					} else {
+						printf("%s%s\n", FILE_PRINT, filename);
+						printf("%s%d\n", LINE_PRINT, k);
+						printf("%s", MESSAGE_CONSTRAINT_PRINT);
+						*msg = SP_CONFIG_INVALID_INTEGER;
+						fclose(configurationFile);
+						spConfigDestroy(config);
+						free(partA);
+						free(partB);
+						return NULL;
+					}
+				} else if (strcmp(partA, "spKDForestTrees") == 0) {
+					// check if partB is in the range [1,64]
+					checkNum = atoi(partB);
+					if (isANumber(
+							partB) && checkNum >= 1 && checkNum <= KDFOREST_TREES_MAX_RANGE) {
+						isSpKDForestTreesSet = true;
+						config->spKDForestTrees = checkNum;
+					} else {
+						printf("%s%s\n", FILE_PRINT, filename);
+						printf("%s%d\n", LINE_PRINT, k);
+						printf("%s", MESSAGE_CONSTRAINT_PRINT);
+						*msg = SP_CONFIG_INVALID_INTEGER;
+						fclose(configurationFile);
+						spConfigDestroy(config);
+						free(partA);
+						free(partB);
+						return NULL;
+					}
 				} else {
 					// In this case the current line is invalid, neither a comment/empty line nor
 					// system parameter configuration.
@@ -485,6 +725,39 @@ SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg) {
 		config->spLoggerFilename = SP_LOGGER_FILENAME_DEFAULT_VALUE;
 
 	}
+	if (!isSpFeatureStorageSet) {
+		config->spFeatureStorage = DOUBLE_STORAGE;
+	}
+	if (!isSpRerankCandidatesSet) {
+		config->spRerankCandidates = 0;
+	}
+	if (!isSpPQSubspacesSet) {
+		config->spPQSubspaces = SP_PQ_SUBSPACES_DEFAULT_VALUE;
+	}
+	if (!isSpKDTreeLeafSizeSet) {
+		config->spKDTreeLeafSize = SP_KDTREE_LEAF_SIZE_DEFAULT_VALUE;
+	}
+	if (!isSpKDTreeBuildThreadsSet) {
+		config->spKDTreeBuildThreads = SP_KDTREE_BUILD_THREADS_DEFAULT_VALUE;
+	}
+	if (!isSpQueryThreadsSet) {
+		config->spQueryThreads = SP_QUERY_THREADS_DEFAULT_VALUE;
+	}
+	if (!isSpConcurrentQueriesSet) {
+		config->spConcurrentQueries = SP_CONCURRENT_QUERIES_DEFAULT_VALUE;
+	}
+	if (!isSpKDTreeBuildMethodSet) {
+		config->spKDTreeBuildMethod = SELECT_BUILD;
+	}
+	if (!isSpKDTreeSearchMethodSet) {
+		config->spKDTreeSearchMethod = EXACT_SEARCH;
+	}
+	if (!isSpKDTreeMaxChecksSet) {
+		config->spKDTreeMaxChecks = SP_KDTREE_MAX_CHECKS_DEFAULT_VALUE;
+	}
+	if (!isSpKDForestTreesSet) {
+		config->spKDForestTrees = SP_KDFOREST_TREES_DEFAULT_VALUE;
+	}
 	free(partA);
 	free(partB);
 	*msg = SP_CONFIG_SUCCESS;
@@ -760,6 +1033,18 @@ SP_CONFIG_MSG spConfigGetPCAPath(char* pcaPath, const SPConfig config) {
 	sprintf(pcaPath, "%s%s", config->spImagesDirectory, config->spPCAFilename);
 	return SP_CONFIG_SUCCESS;
 }
+
+SP_CONFIG_MSG spConfigGetIndexPath(char* indexPath, const SPConfig config) {
+	if (indexPath == NULL || config == NULL) {
+		return SP_CONFIG_INVALID_ARGUMENT;
+	}
+	if (config->spIndexFilename[0] == '\0') {
+		return SP_CONFIG_INVALID_STRING;
+	}
+	sprintf(indexPath, "%s%s", config->spImagesDirectory,
+			config->spIndexFilename);
+	return SP_CONFIG_SUCCESS;
+}
 /**
  * Frees all memory resources associate with config.
  * If config == NULL nothig is done.
@@ -772,6 +1057,7 @@ void spConfigDestroy(SPConfig config) {
 	free(config->spImagesSuffix);
 	free(config->spLoggerFilename);
 	free(config->spPCAFilename);
+	free(config->spIndexFilename);
 	free(config);
 	config = NULL;
 }
@@ -832,3 +1118,95 @@ SP_CONFIG_MSG spConfigGetImageFeatsPath(char* imagePath, const SPConfig config,
 KDTreeSplitMethod spConfigGetSplitMethod(const SPConfig config) {
 	return config->spKDTreeSplitMethod;
 }
+
+KDTreeBuildMethod spConfigGetBuildMethod(const SPConfig config) {
+	return config->spKDTreeBuildMethod;
+}
+
+KDTreeSearchMethod spConfigGetSearchMethod(const SPConfig config) {
+	return config->spKDTreeSearchMethod;
+}
+
+SPFeatureStorage spConfigGetFeatureStorage(const SPConfig config) {
+	return config->spFeatureStorage;
+}
+
+int spConfigGetRerankCandidates(const SPConfig config, SP_CONFIG_MSG* msg) {
+	assert(msg != NULL);
+	if (config == NULL) {
+		*msg = SP_CONFIG_INVALID_ARGUMENT;
+		return -1;
+	}
+	*msg = SP_CONFIG_SUCCESS;
+	return config->spRerankCandidates;
+}
+
+int spConfigGetPQSubspaces(const SPConfig config, SP_CONFIG_MSG* msg) {
+	assert(msg != NULL);
+	if (config == NULL) {
+		*msg = SP_CONFIG_INVALID_ARGUMENT;
+		return -1;
+	}
+	*msg = SP_CONFIG_SUCCESS;
+	return config->spPQSubspaces;
+}
+
+int spConfigGetKDTreeLeafSize(const SPConfig config, SP_CONFIG_MSG* msg) {
+	assert(msg != NULL);
+	if (config == NULL) {
+		*msg = SP_CONFIG_INVALID_ARGUMENT;
+		return -1;
+	}
+	*msg = SP_CONFIG_SUCCESS;
+	return config->spKDTreeLeafSize;
+}
+
+int spConfigGetKDTreeBuildThreads(const SPConfig config, SP_CONFIG_MSG* msg) {
+	assert(msg != NULL);
+	if (config == NULL) {
+		*msg = SP_CONFIG_INVALID_ARGUMENT;
+		return -1;
+	}
+	*msg = SP_CONFIG_SUCCESS;
+	return config->spKDTreeBuildThreads;
+}
+
+int spConfigGetQueryThreads(const SPConfig config, SP_CONFIG_MSG* msg) {
+	assert(msg != NULL);
+	if (config == NULL) {
+		*msg = SP_CONFIG_INVALID_ARGUMENT;
+		return -1;
+	}
+	*msg = SP_CONFIG_SUCCESS;
+	return config->spQueryThreads;
+}
+
+int spConfigGetConcurrentQueries(const SPConfig config, SP_CONFIG_MSG* msg) {
+	assert(msg != NULL);
+	if (config == NULL) {
+		*msg = SP_CONFIG_INVALID_ARGUMENT;
+		return -1;
+	}
+	*msg = SP_CONFIG_SUCCESS;
+	return config->spConcurrentQueries;
+}
+
+int spConfigGetKDTreeMaxChecks(const SPConfig config, SP_CONFIG_MSG* msg) {
+	assert(msg != NULL);
+	if (config == NULL) {
+		*msg = SP_CONFIG_INVALID_ARGUMENT;
+		return -1;
+	}
+	*msg = SP_CONFIG_SUCCESS;
+	return config->spKDTreeMaxChecks;
+}
+
+int spConfigGetKDForestTrees(const SPConfig config, SP_CONFIG_MSG* msg) {
+	assert(msg != NULL);
+	if (config == NULL) {
+		*msg = SP_CONFIG_INVALID_ARGUMENT;
+		return -1;
+	}
+	*msg = SP_CONFIG_SUCCESS;
+	return config->spKDForestTrees;
+}
@@ -23,7 +23,8 @@ typedef enum sp_config_msg_t {
 	SP_CONFIG_SUCCESS,
 	SP_CONFIG_INVALID_CONFIGURATION_FILE,
 	SP_CONFIG_INVALID_BOOLEAN,
-	SP_CONFIG_INVALID_ENUM_KDTREE
+	SP_CONFIG_INVALID_ENUM_KDTREE,
+	SP_CONFIG_INVALID_ENUM_STORAGE
 } SP_CONFIG_MSG;
 
 typedef struct sp_config_t* SPConfig;
@@ -32,6 +33,21 @@ typedef enum KDTreeSplitMethod {
 	RANDOM, MAX_SPREAD, INCREMENTAL
 } KDTreeSplitMethod;
 
+/** how the kd-tree is built (spKDTreeBuildMethod), both build the same tree **/
+typedef enum KDTreeBuildMethod {
+	PRESORT_BUILD, SELECT_BUILD
+} KDTreeBuildMethod;
+
+/** how the kd-tree is searched (spKDTreeSearchMethod) **/
+typedef enum KDTreeSearchMethod {
+	EXACT_SEARCH, BEST_BIN_FIRST_SEARCH, RANDOMIZED_FOREST_SEARCH
+} KDTreeSearchMethod;
+
+/** element type of the stored features (spFeatureStorage) **/
+typedef enum SPFeatureStorage {
+	DOUBLE_STORAGE, FLOAT_STORAGE, INT8_STORAGE, PQ_STORAGE
+} SPFeatureStorage;
+
 /**
  * Creates a new system configuration struct. The configuration struct
  * is initialized based on the configuration file given by 'filename'.
@@ -57,6 +73,7 @@ typedef enum KDTreeSplitMethod {
  *   comment line or system variable line
  * - SP_CONFIG_INVALID_BOOLEAN - if a line in the config file contains invalid boolean
  * - SP_CONFIG_INVALID_ENUM_KDTREE - if a line in the config file contains invalid enum KDTreeSplitMethod
+ *   or KDTreeBuildMethod or KDTreeSearchMethod
  *
  */
 SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg);
@@ -174,6 +191,21 @@ SP_CONFIG_MSG spConfigGetImagePath(char* imagePath, const SPConfig config,
  */
 SP_CONFIG_MSG spConfigGetPCAPath(char* pcaPath, const SPConfig config);
 
+/**
+ * The function stores in indexPath the full path of the index file (the
+ * store and the kd-tree written after a build and mapped by the next runs,
+ * see SPIndexFile.h), i.e spImagesDirectory followed by spIndexFilename.
+ * The index file is only used if spIndexFilename is set.
+ *
+ * @param indexPath - an address to store the result in, it must contain enough space.
+ * @param config - the configuration structure
+ * @return
+ *  - SP_CONFIG_INVALID_ARGUMENT - if indexPath == NULL or config == NULL
+ *  - SP_CONFIG_INVALID_STRING - if spIndexFilename is not set
+ *  - SP_CONFIG_SUCCESS - in case of success
+ */
+SP_CONFIG_MSG spConfigGetIndexPath(char* indexPath, const SPConfig config);
+
 /**
  * Frees all memory resources associate with config. 
  * If config == NULL nothig is done.
@@ -215,4 +247,148 @@ SP_CONFIG_MSG spConfigGetImageFeatsPath(char* imagePath, const SPConfig config,
 int getSpKNN(const SPConfig config, SP_CONFIG_MSG* msg);
 KDTreeSplitMethod spConfigGetSplitMethod(const SPConfig config);
 
+/**
+ * Returns how the kd-tree is built, i.e the value of spKDTreeBuildMethod
+ * (SELECT by default: the median of the splitting coordinate is selected at
+ * every node; PRESORT: the points are sorted by every coordinate once and
+ * the sorted rows are split at every node, dimension times more memory).
+ */
+KDTreeBuildMethod spConfigGetBuildMethod(const SPConfig config);
+
+/**
+ * Returns how the kd-tree is searched, i.e the value of spKDTreeSearchMethod
+ * (EXACT by default; BEST_BIN_FIRST: approximate, at most
+ * spKDTreeMaxChecks points are checked per query feature;
+ * RANDOMIZED_FOREST: as BEST_BIN_FIRST over spKDForestTrees randomized
+ * trees searched together)
+ */
+KDTreeSearchMethod spConfigGetSearchMethod(const SPConfig config);
+
+/**
+ * Returns the number of points a best-bin-first search checks per query
+ * feature, i.e the value of spKDTreeMaxChecks (1024 by default)
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ * @return positive integer in success, negative integer otherwise.
+ *
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetKDTreeMaxChecks(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the number of randomized trees of a RANDOMIZED_FOREST search,
+ * i.e the value of spKDForestTrees (4 by default, 1 to 64)
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ * @return positive integer in success, negative integer otherwise.
+ *
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetKDForestTrees(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the element type the features are stored with, i.e the value of
+ * spFeatureStorage (DOUBLE by default, FLOAT keeps float32 coordinates,
+ * INT8 keeps 8-bit quantization codes, PQ keeps product quantization codes).
+ */
+SPFeatureStorage spConfigGetFeatureStorage(const SPConfig config);
+
+/**
+ * Returns the number of candidates gathered from the quantized index and
+ * reranked by their exact distance, i.e the value of spRerankCandidates
+ * (0 by default, no reranking). It is only used with INT8 or PQ storage.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ * @return positive integer in success, negative integer otherwise.
+ *
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetRerankCandidates(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the number of subspaces of the product quantization, i.e the
+ * value of spPQSubspaces (8 by default). Every feature of a PQ storage is
+ * kept as one byte per subspace.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ * @return positive integer in success, negative integer otherwise.
+ *
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetPQSubspaces(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the largest number of points kept in one leaf of the kd-tree,
+ * i.e the value of spKDTreeLeafSize (16 by default, 1 to 1024). The points
+ * of a leaf are scanned one after the other.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ * @return positive integer in success, negative integer otherwise.
+ *
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetKDTreeLeafSize(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the number of threads that build the kd-tree, i.e the value of
+ * spKDTreeBuildThreads (1 by default, 1 to 64). The tree is the same for
+ * any number of threads.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ * @return positive integer in success, negative integer otherwise.
+ *
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetKDTreeBuildThreads(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the number of threads that search the features of one query
+ * image, i.e the value of spQueryThreads (1 by default, 1 to 64). Every
+ * thread votes into its own histogram, so the hits are the same for any
+ * number of threads.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ * @return positive integer in success, negative integer otherwise.
+ *
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetQueryThreads(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the number of query images served at once, i.e the value of
+ * spConcurrentQueries (1 by default, 1 to 64). That many image paths are
+ * read, every image is searched by its own thread in the shared index, and
+ * the results are printed in the order the paths were read.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ * @return positive integer in success, negative integer otherwise.
+ *
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetConcurrentQueries(const SPConfig config, SP_CONFIG_MSG* msg);
+
 #endif /* SPCONFIG_H_ */
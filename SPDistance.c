@@ -0,0 +1,643 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <math.h>
+#include "SPDistance.h"
+#include "SPDistanceFixed.h"
+#include "SPDistanceKernels.h"
+
+typedef float (*SPL2UInt8Kernel)(const float*, const unsigned char*,
+		const float*, int, double);
+typedef void (*SPL2BlockKernel)(const double*, const double*, int, double,
+		double*);
+typedef void (*SPL2FloatBlockKernel)(const float*, const float*, int, double,
+		float*);
+
+static double resolveL2Kernel(const double* p, const double* q, int dim,
+		double bound);
+static float resolveL2FloatKernel(const float* p, const float* q, int dim,
+		double bound);
+static float resolveL2UInt8Kernel(const float* q, const unsigned char* codes,
+		const float* weights, int dim, double bound);
+static void resolveL2BlockKernel(const double* q, const double* block,
+		int dim, double bound, double* distances);
+static void resolveL2FloatBlockKernel(const float* q, const float* block,
+		int dim, double bound, float* distances);
+
+// the kernels used by spL2SquaredDistance(Float), chosen on the first call
+static SPL2Kernel l2Kernel = resolveL2Kernel;
+static SPL2FloatKernel l2FloatKernel = resolveL2FloatKernel;
+static SPL2UInt8Kernel l2UInt8Kernel = resolveL2UInt8Kernel;
+static SPL2BlockKernel l2BlockKernel = resolveL2BlockKernel;
+static SPL2FloatBlockKernel l2FloatBlockKernel = resolveL2FloatBlockKernel;
+static SP_DISTANCE_KERNEL chosenKernel = SP_DISTANCE_SCALAR;
+static bool isInitialized = false;
+
+/*
+ * The row kernels (l2Scalar, l2SSE2, ...) are in SPDistanceKernels.h, the
+ * other kernels here follow the same bound and lane rules.
+ */
+
+static float l2UInt8Scalar(const float* q, const unsigned char* codes,
+		const float* weights, int dim, double bound) {
+	float lanes[SP_DISTANCE_LANES] = { 0 };
+	int i = 0;
+	for (; i + SP_DISTANCE_LANES <= dim; i += SP_DISTANCE_LANES) {
+		for (int j = 0; j < SP_DISTANCE_LANES; j++) {
+			float diff = q[i + j] - (float) codes[i + j];
+			lanes[j] += weights[i + j] * (diff * diff);
+		}
+		if (i + SP_DISTANCE_LANES < dim && bound < HUGE_VAL) {
+			float partial = reduceFloatLanes(lanes);
+			if (partial > bound)
+				return partial;
+		}
+	}
+	for (int j = 0; i < dim; i++, j++) {
+		float diff = q[i] - (float) codes[i];
+		lanes[j] += weights[i] * (diff * diff);
+	}
+	return reduceFloatLanes(lanes);
+}
+
+/*
+ * The block kernels score a query against SP_DISTANCE_BLOCK points stored
+ * dimension-major (coordinate i of point j at block[i * SP_DISTANCE_BLOCK + j]).
+ * Every point still gets its own eight running sums, coordinate i goes to
+ * sum (i % 8), so a block distance is exactly the distance of the row
+ * kernels. The bound abandons the block once all its points are above it.
+ */
+
+static void l2BlockScalar(const double* q, const double* block, int dim,
+		double bound, double* distances) {
+	for (int j = 0; j < SP_DISTANCE_BLOCK; j++) {
+		double lanes[SP_DISTANCE_LANES] = { 0 };
+		bool abandoned = false;
+		int i = 0;
+		for (; i + SP_DISTANCE_LANES <= dim && !abandoned; i +=
+				SP_DISTANCE_LANES) {
+			for (int k = 0; k < SP_DISTANCE_LANES; k++) {
+				double diff = block[(i + k) * SP_DISTANCE_BLOCK + j] - q[i + k];
+				lanes[k] += diff * diff;
+			}
+			if (i + SP_DISTANCE_LANES < dim && bound < HUGE_VAL)
+				abandoned = reduceLanes(lanes) > bound;
+		}
+		for (int k = 0; i < dim && !abandoned; i++, k++) {
+			double diff = block[i * SP_DISTANCE_BLOCK + j] - q[i];
+			lanes[k] += diff * diff;
+		}
+		distances[j] = reduceLanes(lanes);
+	}
+}
+
+static void l2FloatBlockScalar(const float* q, const float* block, int dim,
+		double bound, float* distances) {
+	for (int j = 0; j < SP_DISTANCE_BLOCK; j++) {
+		float lanes[SP_DISTANCE_LANES] = { 0 };
+		bool abandoned = false;
+		int i = 0;
+		for (; i + SP_DISTANCE_LANES <= dim && !abandoned; i +=
+				SP_DISTANCE_LANES) {
+			for (int k = 0; k < SP_DISTANCE_LANES; k++) {
+				float diff = block[(i + k) * SP_DISTANCE_BLOCK + j] - q[i + k];
+				lanes[k] += diff * diff;
+			}
+			if (i + SP_DISTANCE_LANES < dim && bound < HUGE_VAL)
+				abandoned = reduceFloatLanes(lanes) > bound;
+		}
+		for (int k = 0; i < dim && !abandoned; i++, k++) {
+			float diff = block[i * SP_DISTANCE_BLOCK + j] - q[i];
+			lanes[k] += diff * diff;
+		}
+		distances[j] = reduceFloatLanes(lanes);
+	}
+}
+
+#ifdef SP_DISTANCE_X86
+
+__attribute__((target("avx512f")))
+static inline double reduceAVX512(__m512d sum) {
+	__m256d s4 = _mm256_add_pd(_mm512_castpd512_pd256(sum),
+			_mm512_extractf64x4_pd(sum, 1));
+	__m128d s2 = _mm_add_pd(_mm256_castpd256_pd128(s4),
+			_mm256_extractf128_pd(s4, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(s2, _mm_unpackhi_pd(s2, s2)));
+}
+
+__attribute__((target("avx512f")))
+static double l2AVX512(const double* p, const double* q, int dim,
+		double bound) {
+	__m512d sum = _mm512_setzero_pd();
+	int i = 0;
+	for (; i + SP_DISTANCE_LANES <= dim; i += SP_DISTANCE_LANES) {
+		__m512d d = _mm512_sub_pd(_mm512_loadu_pd(p + i),
+				_mm512_loadu_pd(q + i));
+		sum = _mm512_add_pd(sum, _mm512_mul_pd(d, d));
+		if (i + SP_DISTANCE_LANES < dim && bound < HUGE_VAL) {
+			double partial = reduceAVX512(sum);
+			if (partial > bound)
+				return partial;
+		}
+	}
+	if (i < dim) {
+		__mmask8 mask = (__mmask8) ((1u << (dim - i)) - 1);
+		__m512d d = _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, p + i),
+				_mm512_maskz_loadu_pd(mask, q + i));
+		sum = _mm512_add_pd(sum, _mm512_mul_pd(d, d));
+	}
+	return reduceAVX512(sum);
+}
+
+/** the first n (0 <= n < 8) codes as the low bytes of a 64-bit integer **/
+static inline long long loadCodesTail(const unsigned char* codes, int n) {
+	unsigned long long value = 0;
+	for (int j = n - 1; j >= 0; j--)
+		value = (value << 8) | codes[j];
+	return (long long) value;
+}
+
+/*
+ * The uint8 kernels widen eight codes to floats and keep the query in
+ * float, so the query is never quantized (asymmetric distance). The lanes
+ * after the tail get a zero weight and add nothing.
+ */
+
+__attribute__((target("sse2")))
+static inline __m128 weightedSquareSSE2(__m128 q, __m128 codes,
+		__m128 weights) {
+	__m128 d = _mm_sub_ps(q, codes);
+	return _mm_mul_ps(weights, _mm_mul_ps(d, d));
+}
+
+__attribute__((target("sse2")))
+static float l2UInt8SSE2(const float* q, const unsigned char* codes,
+		const float* weights, int dim, double bound) {
+	__m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+	__m128i zero = _mm_setzero_si128();
+	int i = 0;
+	for (; i + SP_DISTANCE_LANES <= dim; i += SP_DISTANCE_LANES) {
+		__m128i c16 = _mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i*) (codes + i)), zero);
+		sum0 = _mm_add_ps(sum0,
+				weightedSquareSSE2(_mm_loadu_ps(q + i),
+						_mm_cvtepi32_ps(_mm_unpacklo_epi16(c16, zero)),
+						_mm_loadu_ps(weights + i)));
+		sum1 = _mm_add_ps(sum1,
+				weightedSquareSSE2(_mm_loadu_ps(q + i + 4),
+						_mm_cvtepi32_ps(_mm_unpackhi_epi16(c16, zero)),
+						_mm_loadu_ps(weights + i + 4)));
+		if (i + SP_DISTANCE_LANES < dim && bound < HUGE_VAL) {
+			float partial = reduceFloatSSE2(_mm_add_ps(sum0, sum1));
+			if (partial > bound)
+				return partial;
+		}
+	}
+	if (i < dim) {
+		int rest0 = dim - i < 4 ? dim - i : 4, rest1 = dim - i - rest0;
+		__m128i c16 = _mm_unpacklo_epi8(
+				_mm_set_epi64x(0, loadCodesTail(codes + i, dim - i)), zero);
+		sum0 = _mm_add_ps(sum0,
+				weightedSquareSSE2(loadPartialSSE2(q + i, rest0),
+						_mm_cvtepi32_ps(_mm_unpacklo_epi16(c16, zero)),
+						loadPartialSSE2(weights + i, rest0)));
+		sum1 = _mm_add_ps(sum1,
+				weightedSquareSSE2(loadPartialSSE2(q + i + 4, rest1),
+						_mm_cvtepi32_ps(_mm_unpackhi_epi16(c16, zero)),
+						loadPartialSSE2(weights + i + 4, rest1)));
+	}
+	return reduceFloatSSE2(_mm_add_ps(sum0, sum1));
+}
+
+/** also used in place of an AVX-512 kernel, as l2FloatAVX2 **/
+__attribute__((target("avx2")))
+static float l2UInt8AVX2(const float* q, const unsigned char* codes,
+		const float* weights, int dim, double bound) {
+	__m256 sum = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + SP_DISTANCE_LANES <= dim; i += SP_DISTANCE_LANES) {
+		__m256 c = _mm256_cvtepi32_ps(
+				_mm256_cvtepu8_epi32(
+						_mm_loadl_epi64((const __m128i*) (codes + i))));
+		__m256 d = _mm256_sub_ps(_mm256_loadu_ps(q + i), c);
+		sum = _mm256_add_ps(sum,
+				_mm256_mul_ps(_mm256_loadu_ps(weights + i),
+						_mm256_mul_ps(d, d)));
+		if (i + SP_DISTANCE_LANES < dim && bound < HUGE_VAL) {
+			float partial = reduceFloatAVX2(sum);
+			if (partial > bound)
+				return partial;
+		}
+	}
+	if (i < dim) {
+		__m256i mask = tailMaskAVX2(dim - i);
+		__m256 c = _mm256_cvtepi32_ps(
+				_mm256_cvtepu8_epi32(
+						_mm_set_epi64x(0, loadCodesTail(codes + i, dim - i))));
+		__m256 d = _mm256_sub_ps(_mm256_maskload_ps(q + i, mask), c);
+		sum = _mm256_add_ps(sum,
+				_mm256_mul_ps(_mm256_maskload_ps(weights + i, mask),
+						_mm256_mul_ps(d, d)));
+	}
+	return reduceFloatAVX2(sum);
+}
+
+/*
+ * The vector block kernels keep one register per running sum, every lane of
+ * it belongs to another point, and go over the block in passes of as many
+ * points as a register holds (so the eight sums stay in registers).
+ */
+
+#define SP_BLOCK_REDUCE(add, s) add(add(add(s[0], s[4]), add(s[2], s[6])), \
+		add(add(s[1], s[5]), add(s[3], s[7])))
+
+/*
+ * The body of a vector block kernel for the points of one pass, from j:
+ * VEC holds the points of the pass, LOAD loads them at a given coordinate,
+ * SET1 broadcasts a query coordinate and ABOVE is true if all the points of
+ * the pass are above limit.
+ */
+#define SP_BLOCK_PASS(VEC, LOAD, SET1, SUB, ADD, MUL, ZERO, ABOVE, STORE) { \
+	VEC sum[SP_DISTANCE_LANES]; \
+	bool abandoned = false; \
+	int i = 0, k = 0; \
+	for (k = 0; k < SP_DISTANCE_LANES; k++) \
+		sum[k] = ZERO(); \
+	for (; i + SP_DISTANCE_LANES <= dim && !abandoned; i += SP_DISTANCE_LANES) { \
+		for (k = 0; k < SP_DISTANCE_LANES; k++) { \
+			VEC d = SUB(LOAD(block + (i + k) * SP_DISTANCE_BLOCK + j), \
+					SET1(q[i + k])); \
+			sum[k] = ADD(sum[k], MUL(d, d)); \
+		} \
+		if (i + SP_DISTANCE_LANES < dim && bound < HUGE_VAL) \
+			abandoned = ABOVE(SP_BLOCK_REDUCE(ADD, sum)); \
+	} \
+	for (k = 0; i < dim && !abandoned; i++, k++) { \
+		VEC d = SUB(LOAD(block + i * SP_DISTANCE_BLOCK + j), SET1(q[i])); \
+		sum[k] = ADD(sum[k], MUL(d, d)); \
+	} \
+	STORE(distances + j, SP_BLOCK_REDUCE(ADD, sum)); \
+}
+
+#define SP_ABOVE_SSE2(s) (_mm_movemask_pd(_mm_cmpgt_pd(s, limit)) == 0x3)
+#define SP_ABOVE_AVX2(s) \
+	(_mm256_movemask_pd(_mm256_cmp_pd(s, limit, _CMP_GT_OQ)) == 0xF)
+#define SP_ABOVE_FLOAT_SSE2(s) (_mm_movemask_ps(_mm_cmpgt_ps(s, limit)) == 0xF)
+#define SP_ABOVE_FLOAT_AVX2(s) \
+	(_mm256_movemask_ps(_mm256_cmp_ps(s, limit, _CMP_GT_OQ)) == 0xFF)
+
+__attribute__((target("sse2")))
+static void l2BlockSSE2(const double* q, const double* block, int dim,
+		double bound, double* distances) {
+	__m128d limit = _mm_set1_pd(bound);
+	for (int j = 0; j < SP_DISTANCE_BLOCK; j += 2)
+		SP_BLOCK_PASS(__m128d, _mm_loadu_pd, _mm_set1_pd, _mm_sub_pd,
+				_mm_add_pd, _mm_mul_pd, _mm_setzero_pd, SP_ABOVE_SSE2,
+				_mm_storeu_pd)
+}
+
+__attribute__((target("avx2")))
+static void l2BlockAVX2(const double* q, const double* block, int dim,
+		double bound, double* distances) {
+	__m256d limit = _mm256_set1_pd(bound);
+	for (int j = 0; j < SP_DISTANCE_BLOCK; j += 4)
+		SP_BLOCK_PASS(__m256d, _mm256_loadu_pd, _mm256_set1_pd,
+				_mm256_sub_pd, _mm256_add_pd, _mm256_mul_pd,
+				_mm256_setzero_pd, SP_ABOVE_AVX2, _mm256_storeu_pd)
+}
+
+/*
+ * A float compared with (float) bound is above it only if it is above bound
+ * (bound is rounded to the nearest float), so the float block kernels
+ * abandon a pass only when the scalar one would.
+ */
+
+__attribute__((target("sse2")))
+static void l2FloatBlockSSE2(const float* q, const float* block, int dim,
+		double bound, float* distances) {
+	__m128 limit = _mm_set1_ps((float) bound);
+	for (int j = 0; j < SP_DISTANCE_BLOCK; j += 4)
+		SP_BLOCK_PASS(__m128, _mm_loadu_ps, _mm_set1_ps, _mm_sub_ps,
+				_mm_add_ps, _mm_mul_ps, _mm_setzero_ps, SP_ABOVE_FLOAT_SSE2,
+				_mm_storeu_ps)
+}
+
+/** a single pass, the eight points fit in one register **/
+__attribute__((target("avx2")))
+static void l2FloatBlockAVX2(const float* q, const float* block, int dim,
+		double bound, float* distances) {
+	__m256 limit = _mm256_set1_ps((float) bound);
+	const int j = 0;
+	SP_BLOCK_PASS(__m256, _mm256_loadu_ps, _mm256_set1_ps, _mm256_sub_ps,
+			_mm256_add_ps, _mm256_mul_ps, _mm256_setzero_ps,
+			SP_ABOVE_FLOAT_AVX2, _mm256_storeu_ps)
+}
+
+#endif /* SP_DISTANCE_X86 */
+
+static SPL2Kernel getKernelFunction(SP_DISTANCE_KERNEL kernel) {
+#ifdef SP_DISTANCE_X86
+	switch (kernel) {
+	case SP_DISTANCE_SSE2:
+		return l2SSE2;
+	case SP_DISTANCE_AVX2:
+		return l2AVX2;
+	case SP_DISTANCE_AVX512:
+		return l2AVX512;
+	default:
+		return l2Scalar;
+	}
+#else
+	(void) kernel;
+	return l2Scalar;
+#endif
+}
+
+static SPL2UInt8Kernel getUInt8KernelFunction(SP_DISTANCE_KERNEL kernel) {
+#ifdef SP_DISTANCE_X86
+	switch (kernel) {
+	case SP_DISTANCE_SSE2:
+		return l2UInt8SSE2;
+	case SP_DISTANCE_AVX2:
+	case SP_DISTANCE_AVX512:
+		return l2UInt8AVX2;
+	default:
+		return l2UInt8Scalar;
+	}
+#else
+	(void) kernel;
+	return l2UInt8Scalar;
+#endif
+}
+
+/** the block kernels, the AVX-512 slot uses the AVX2 ones **/
+static SPL2BlockKernel getBlockKernelFunction(SP_DISTANCE_KERNEL kernel) {
+#ifdef SP_DISTANCE_X86
+	switch (kernel) {
+	case SP_DISTANCE_SSE2:
+		return l2BlockSSE2;
+	case SP_DISTANCE_AVX2:
+	case SP_DISTANCE_AVX512:
+		return l2BlockAVX2;
+	default:
+		return l2BlockScalar;
+	}
+#else
+	(void) kernel;
+	return l2BlockScalar;
+#endif
+}
+
+static SPL2FloatBlockKernel getFloatBlockKernelFunction(
+		SP_DISTANCE_KERNEL kernel) {
+#ifdef SP_DISTANCE_X86
+	switch (kernel) {
+	case SP_DISTANCE_SSE2:
+		return l2FloatBlockSSE2;
+	case SP_DISTANCE_AVX2:
+	case SP_DISTANCE_AVX512:
+		return l2FloatBlockAVX2;
+	default:
+		return l2FloatBlockScalar;
+	}
+#else
+	(void) kernel;
+	return l2FloatBlockScalar;
+#endif
+}
+
+static SPL2FloatKernel getFloatKernelFunction(SP_DISTANCE_KERNEL kernel) {
+#ifdef SP_DISTANCE_X86
+	switch (kernel) {
+	case SP_DISTANCE_SSE2:
+		return l2FloatSSE2;
+	case SP_DISTANCE_AVX2:
+	case SP_DISTANCE_AVX512:
+		return l2FloatAVX2;
+	default:
+		return l2FloatScalar;
+	}
+#else
+	(void) kernel;
+	return l2FloatScalar;
+#endif
+}
+
+bool spDistanceKernelSupported(SP_DISTANCE_KERNEL kernel) {
+	if (kernel == SP_DISTANCE_SCALAR)
+		return true;
+#ifdef SP_DISTANCE_X86
+	__builtin_cpu_init();
+	switch (kernel) {
+	case SP_DISTANCE_SSE2:
+		return __builtin_cpu_supports("sse2");
+	case SP_DISTANCE_AVX2:
+		return __builtin_cpu_supports("avx2");
+	case SP_DISTANCE_AVX512:
+		return __builtin_cpu_supports("avx512f");
+	default:
+		return false;
+	}
+#else
+	return false;
+#endif
+}
+
+void spDistanceInit() {
+	if (isInitialized)
+		return;
+	// AVX-512 is not chosen by default, for the short rows of the feature
+	// store its wider reduction and the lower clock cost more than it saves
+	if (spDistanceKernelSupported(SP_DISTANCE_AVX2))
+		chosenKernel = SP_DISTANCE_AVX2;
+	else if (spDistanceKernelSupported(SP_DISTANCE_SSE2))
+		chosenKernel = SP_DISTANCE_SSE2;
+	else
+		chosenKernel = SP_DISTANCE_SCALAR;
+	l2Kernel = getKernelFunction(chosenKernel);
+	l2FloatKernel = getFloatKernelFunction(chosenKernel);
+	l2UInt8Kernel = getUInt8KernelFunction(chosenKernel);
+	l2BlockKernel = getBlockKernelFunction(chosenKernel);
+	l2FloatBlockKernel = getFloatBlockKernelFunction(chosenKernel);
+	isInitialized = true;
+}
+
+SPL2Kernel spDistanceGetKernelFunction(int dim) {
+	assert(dim > 0);
+	spDistanceInit();
+	SPL2Kernel kernel = spDistanceFixedKernel(chosenKernel, dim);
+	return kernel != NULL ? kernel : l2Kernel;
+}
+
+SPL2FloatKernel spDistanceGetFloatKernelFunction(int dim) {
+	assert(dim > 0);
+	spDistanceInit();
+	SPL2FloatKernel kernel = spDistanceFixedFloatKernel(chosenKernel, dim);
+	return kernel != NULL ? kernel : l2FloatKernel;
+}
+
+bool spDistanceHasFixedKernel(int dim) {
+	spDistanceInit();
+	return spDistanceFixedKernel(chosenKernel, dim) != NULL;
+}
+
+SP_DISTANCE_KERNEL spDistanceGetKernel() {
+	spDistanceInit();
+	return chosenKernel;
+}
+
+const char* spDistanceKernelName(SP_DISTANCE_KERNEL kernel) {
+	switch (kernel) {
+	case SP_DISTANCE_SSE2:
+		return "SSE2";
+	case SP_DISTANCE_AVX2:
+		return "AVX2";
+	case SP_DISTANCE_AVX512:
+		return "AVX-512";
+	default:
+		return "scalar";
+	}
+}
+
+/** first call of spL2SquaredDistance, chooses the kernel and forwards to it **/
+static double resolveL2Kernel(const double* p, const double* q, int dim,
+		double bound) {
+	spDistanceInit();
+	return l2Kernel(p, q, dim, bound);
+}
+
+/** first call of spL2SquaredDistanceFloat, chooses the kernel and forwards to it **/
+static float resolveL2FloatKernel(const float* p, const float* q, int dim,
+		double bound) {
+	spDistanceInit();
+	return l2FloatKernel(p, q, dim, bound);
+}
+
+/** first call of spL2SquaredDistanceUInt8, chooses the kernel and forwards to it **/
+static float resolveL2UInt8Kernel(const float* q, const unsigned char* codes,
+		const float* weights, int dim, double bound) {
+	spDistanceInit();
+	return l2UInt8Kernel(q, codes, weights, dim, bound);
+}
+
+/** first call of spL2SquaredDistanceBlock, chooses the kernel and forwards to it **/
+static void resolveL2BlockKernel(const double* q, const double* block,
+		int dim, double bound, double* distances) {
+	spDistanceInit();
+	l2BlockKernel(q, block, dim, bound, distances);
+}
+
+/** first call of spL2SquaredDistanceFloatBlock, chooses the kernel and forwards to it **/
+static void resolveL2FloatBlockKernel(const float* q, const float* block,
+		int dim, double bound, float* distances) {
+	spDistanceInit();
+	l2FloatBlockKernel(q, block, dim, bound, distances);
+}
+
+double spL2SquaredDistance(const double* p, const double* q, int dim) {
+	assert(p != NULL && q != NULL && dim > 0);
+	return l2Kernel(p, q, dim, HUGE_VAL);
+}
+
+double spL2SquaredDistanceBounded(const double* p, const double* q, int dim,
+		double bound) {
+	assert(p != NULL && q != NULL && dim > 0);
+	return l2Kernel(p, q, dim, bound);
+}
+
+double spL2SquaredDistanceKernel(SP_DISTANCE_KERNEL kernel, const double* p,
+		const double* q, int dim) {
+	assert(p != NULL && q != NULL && dim > 0);
+	assert(spDistanceKernelSupported(kernel));
+	return getKernelFunction(kernel)(p, q, dim, HUGE_VAL);
+}
+
+float spL2SquaredDistanceFloat(const float* p, const float* q, int dim) {
+	assert(p != NULL && q != NULL && dim > 0);
+	return l2FloatKernel(p, q, dim, HUGE_VAL);
+}
+
+float spL2SquaredDistanceFloatBounded(const float* p, const float* q, int dim,
+		double bound) {
+	assert(p != NULL && q != NULL && dim > 0);
+	return l2FloatKernel(p, q, dim, bound);
+}
+
+float spL2SquaredDistanceFloatKernel(SP_DISTANCE_KERNEL kernel,
+		const float* p, const float* q, int dim) {
+	assert(p != NULL && q != NULL && dim > 0);
+	assert(spDistanceKernelSupported(kernel));
+	return getFloatKernelFunction(kernel)(p, q, dim, HUGE_VAL);
+}
+
+float spL2SquaredDistanceUInt8(const float* q, const unsigned char* codes,
+		const float* weights, int dim) {
+	assert(q != NULL && codes != NULL && weights != NULL && dim > 0);
+	return l2UInt8Kernel(q, codes, weights, dim, HUGE_VAL);
+}
+
+float spL2SquaredDistanceUInt8Bounded(const float* q,
+		const unsigned char* codes, const float* weights, int dim,
+		double bound) {
+	assert(q != NULL && codes != NULL && weights != NULL && dim > 0);
+	return l2UInt8Kernel(q, codes, weights, dim, bound);
+}
+
+float spL2SquaredDistanceUInt8Kernel(SP_DISTANCE_KERNEL kernel,
+		const float* q, const unsigned char* codes, const float* weights,
+		int dim) {
+	assert(q != NULL && codes != NULL && weights != NULL && dim > 0);
+	assert(spDistanceKernelSupported(kernel));
+	return getUInt8KernelFunction(kernel)(q, codes, weights, dim, HUGE_VAL);
+}
+
+void spL2SquaredDistanceBlock(const double* q, const double* block, int dim,
+		double bound, double* distances) {
+	assert(q != NULL && block != NULL && distances != NULL && dim > 0);
+	l2BlockKernel(q, block, dim, bound, distances);
+}
+
+void spL2SquaredDistanceBlockKernel(SP_DISTANCE_KERNEL kernel,
+		const double* q, const double* block, int dim, double* distances) {
+	assert(q != NULL && block != NULL && distances != NULL && dim > 0);
+	assert(spDistanceKernelSupported(kernel));
+	getBlockKernelFunction(kernel)(q, block, dim, HUGE_VAL, distances);
+}
+
+void spL2SquaredDistanceFloatBlock(const float* q, const float* block,
+		int dim, double bound, float* distances) {
+	assert(q != NULL && block != NULL && distances != NULL && dim > 0);
+	l2FloatBlockKernel(q, block, dim, bound, distances);
+}
+
+void spL2SquaredDistanceFloatBlockKernel(SP_DISTANCE_KERNEL kernel,
+		const float* q, const float* block, int dim, float* distances) {
+	assert(q != NULL && block != NULL && distances != NULL && dim > 0);
+	assert(spDistanceKernelSupported(kernel));
+	getFloatBlockKernelFunction(kernel)(q, block, dim, HUGE_VAL, distances);
+}
+
+float spPQDistance(const float* lut, const unsigned char* codes,
+		int subspaces) {
+	return spPQDistanceBounded(lut, codes, subspaces, HUGE_VAL);
+}
+
+float spPQDistanceBounded(const float* lut, const unsigned char* codes,
+		int subspaces, double bound) {
+	float sum[4] = { 0 }; // independent sums hide the latency of the loads
+	int s = 0;
+	assert(lut != NULL && codes != NULL && subspaces > 0);
+	for (; s + 4 <= subspaces; s += 4) {
+		sum[0] += lut[s * SP_PQ_CENTROIDS + codes[s]];
+		sum[1] += lut[(s + 1) * SP_PQ_CENTROIDS + codes[s + 1]];
+		sum[2] += lut[(s + 2) * SP_PQ_CENTROIDS + codes[s + 2]];
+		sum[3] += lut[(s + 3) * SP_PQ_CENTROIDS + codes[s + 3]];
+		if ((s & 4) != 0 && s + 4 < subspaces && bound < HUGE_VAL
+				&& (sum[0] + sum[2]) + (sum[1] + sum[3]) > bound)
+			return (sum[0] + sum[2]) + (sum[1] + sum[3]);
+	}
+	for (; s < subspaces; s++)
+		sum[s & 3] += lut[s * SP_PQ_CENTROIDS + codes[s]];
+	return (sum[0] + sum[2]) + (sum[1] + sum[3]);
+}
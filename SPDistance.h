@@ -0,0 +1,329 @@
+#ifndef SPDISTANCE_H_
+#define SPDISTANCE_H_
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * SP Distance summary
+ *
+ * Vectorized L2-squared distance kernels over raw double or float
+ * coordinate arrays, and asymmetric kernels between a float query and
+ * uint8 quantization codes.
+ * A scalar kernel and SSE2/AVX2/AVX-512 kernels are available. The best
+ * of the scalar, SSE2 and AVX2 kernels supported by the running CPU is
+ * chosen once (by CPUID) and used by every later call, the AVX-512 kernel
+ * is only used through spL2SquaredDistanceKernel.
+ *
+ * All the kernels sum the squared differences in the same order: eight
+ * running sums, coordinate i is added to sum (i % 8), and the eight sums
+ * are reduced in a fixed tree. Therefore every kernel returns exactly the
+ * same (bit-compatible) result for the same input. The float kernels sum
+ * in float with the same order, the AVX-512 slot uses the AVX2 float kernel
+ * since eight float sums fill a single 256-bit register.
+ *
+ * The following functions are supported:
+ *
+ * spDistanceInit				- Chooses the kernel for the running CPU
+ * spDistanceGetKernel			- Returns the chosen kernel
+ * spDistanceKernelName			- Returns a printable name of a kernel
+ * spDistanceKernelSupported	- Checks if the CPU can run a kernel
+ * spDistanceGetKernelFunction	- The chosen double kernel for a given dimension
+ * spDistanceGetFloatKernelFunction - The chosen float kernel for a given dimension
+ * spL2SquaredDistance			- L2 squared distance using the chosen kernel
+ * spL2SquaredDistanceBounded	- L2 squared distance that stops above a bound
+ * spL2SquaredDistanceKernel	- L2 squared distance using a given kernel
+ * spL2SquaredDistanceFloat		- Float L2 squared distance using the chosen kernel
+ * spL2SquaredDistanceFloatBounded - Float L2 squared distance that stops above a bound
+ * spL2SquaredDistanceFloatKernel - Float L2 squared distance using a given kernel
+ * spL2SquaredDistanceUInt8		- Weighted distance between a float query and uint8 codes
+ * spL2SquaredDistanceUInt8Bounded - The same distance, abandoned above a bound
+ * spL2SquaredDistanceUInt8Kernel - The same distance using a given kernel
+ * spL2SquaredDistanceBlock		- L2 squared distances of a query to a block of points
+ * spL2SquaredDistanceBlockKernel - The same distances using a given kernel
+ * spL2SquaredDistanceFloatBlock - Float L2 squared distances of a query to a block
+ * spL2SquaredDistanceFloatBlockKernel - The same distances using a given kernel
+ * spPQDistance					- Product quantization distance from a lookup table
+ * spPQDistanceBounded			- The same distance, abandoned above a bound
+ *
+ */
+
+/** Number of running sums every kernel keeps **/
+#define SP_DISTANCE_LANES 8
+
+/** Number of points in a block of the block kernels **/
+#define SP_DISTANCE_BLOCK 8
+
+/** Number of centroids of every product quantization subspace **/
+#define SP_PQ_CENTROIDS 256
+
+/** type used to identify a distance kernel **/
+typedef enum sp_distance_kernel_t {
+	SP_DISTANCE_SCALAR,
+	SP_DISTANCE_SSE2,
+	SP_DISTANCE_AVX2,
+	SP_DISTANCE_AVX512
+} SP_DISTANCE_KERNEL;
+
+/**
+ * A double kernel: the L2-squared distance between the dim coordinates of
+ * p and q, abandoned above bound (see spL2SquaredDistanceBounded)
+ */
+typedef double (*SPL2Kernel)(const double* p, const double* q, int dim,
+		double bound);
+
+/** A float kernel, see SPL2Kernel **/
+typedef float (*SPL2FloatKernel)(const float* p, const float* q, int dim,
+		double bound);
+
+/**
+ * Chooses the kernel used by spL2SquaredDistance for the running CPU. Calling it
+ * more than once has no effect. If it is not called, the kernel is chosen
+ * on the first call to spL2SquaredDistance.
+ */
+void spDistanceInit();
+
+/**
+ * @return
+ * The kernel used by spL2SquaredDistance
+ */
+SP_DISTANCE_KERNEL spDistanceGetKernel();
+
+/**
+ * @return
+ * A printable name of kernel
+ */
+const char* spDistanceKernelName(SP_DISTANCE_KERNEL kernel);
+
+/**
+ * @return
+ * true if the running CPU supports kernel, false otherwise
+ */
+bool spDistanceKernelSupported(SP_DISTANCE_KERNEL kernel);
+
+/**
+ * Returns the kernel used by spL2SquaredDistanceBounded, specialized for
+ * rows of dim coordinates if such a kernel exists (see SPDistanceFixed).
+ * The kernel returns the same results as spL2SquaredDistanceBounded, but
+ * it must only be called with dim coordinates.
+ *
+ * @param dim - The number of coordinates of every call of the kernel
+ * @assert dim > 0
+ * @return
+ * The kernel for dim
+ */
+SPL2Kernel spDistanceGetKernelFunction(int dim);
+
+/**
+ * Same as spDistanceGetKernelFunction for the float kernels.
+ */
+SPL2FloatKernel spDistanceGetFloatKernelFunction(int dim);
+
+/**
+ * @return
+ * true if spDistanceGetKernelFunction returns a kernel specialized for dim,
+ * false otherwise
+ */
+bool spDistanceHasFixedKernel(int dim);
+
+/**
+ * Calculates the L2-squared distance between p and q using the chosen kernel.
+ *
+ * @param p - The first coordinates array
+ * @param q - The second coordinates array
+ * @param dim - The number of coordinates in p and q
+ * @assert p != NULL AND q != NULL AND dim > 0
+ * @return
+ * The L2-Squared distance between p and q
+ */
+double spL2SquaredDistance(const double* p, const double* q, int dim);
+
+/**
+ * Calculates the L2-squared distance between p and q using the chosen kernel,
+ * giving up as soon as the distance is known to be greater than bound.
+ * Every eight coordinates the squared differences summed so far are compared
+ * with bound, since PCA coordinates come by decreasing variance most of the
+ * distance is usually known after the first ones.
+ *
+ * @param p - The first coordinates array
+ * @param q - The second coordinates array
+ * @param dim - The number of coordinates in p and q
+ * @param bound - The largest distance the caller is interested in
+ * @assert p != NULL AND q != NULL AND dim > 0
+ * @return
+ * The L2-Squared distance between p and q (the same value as
+ * spL2SquaredDistance) if it is not greater than bound, otherwise some
+ * value greater than bound
+ */
+double spL2SquaredDistanceBounded(const double* p, const double* q, int dim,
+		double bound);
+
+/**
+ * Calculates the L2-squared distance between p and q using kernel.
+ *
+ * @assert p != NULL AND q != NULL AND dim > 0
+ * @assert the running CPU supports kernel
+ * @return
+ * The L2-Squared distance between p and q
+ */
+double spL2SquaredDistanceKernel(SP_DISTANCE_KERNEL kernel, const double* p,
+		const double* q, int dim);
+
+/**
+ * Calculates the L2-squared distance between the float arrays p and q
+ * using the chosen kernel.
+ *
+ * @param p - The first coordinates array
+ * @param q - The second coordinates array
+ * @param dim - The number of coordinates in p and q
+ * @assert p != NULL AND q != NULL AND dim > 0
+ * @return
+ * The L2-Squared distance between p and q
+ */
+float spL2SquaredDistanceFloat(const float* p, const float* q, int dim);
+
+/**
+ * Same as spL2SquaredDistanceBounded for the float arrays p and q.
+ *
+ * @assert p != NULL AND q != NULL AND dim > 0
+ * @return
+ * The value of spL2SquaredDistanceFloat if it is not greater than bound,
+ * otherwise some value greater than bound
+ */
+float spL2SquaredDistanceFloatBounded(const float* p, const float* q, int dim,
+		double bound);
+
+/**
+ * Calculates the L2-squared distance between the float arrays p and q
+ * using kernel.
+ *
+ * @assert p != NULL AND q != NULL AND dim > 0
+ * @assert the running CPU supports kernel
+ * @return
+ * The L2-Squared distance between p and q
+ */
+float spL2SquaredDistanceFloatKernel(SP_DISTANCE_KERNEL kernel,
+		const float* p, const float* q, int dim);
+
+/**
+ * Calculates the asymmetric squared distance between a float query and a
+ * row of uint8 codes, using the chosen kernel:
+ * weights_0 * (q_0 - codes_0)^2 + ... + weights_{dim-1} * (q_{dim-1} - codes_{dim-1})^2
+ * The query is given in code units (a query coordinate x is passed as
+ * (x - offset) / scale) and weights holds the squared scales, so the result
+ * is the L2-squared distance between x and the decoded codes. The sum uses
+ * the same lanes as the float kernels.
+ *
+ * @param q - The query, in code units
+ * @param codes - The quantization codes
+ * @param weights - The weight of every coordinate
+ * @param dim - The number of coordinates
+ * @assert q != NULL AND codes != NULL AND weights != NULL AND dim > 0
+ * @return
+ * The weighted squared distance between q and codes
+ */
+float spL2SquaredDistanceUInt8(const float* q, const unsigned char* codes,
+		const float* weights, int dim);
+
+/**
+ * Same as spL2SquaredDistanceUInt8, but gives up as soon as the distance is
+ * known to be greater than bound (see spL2SquaredDistanceBounded).
+ *
+ * @return
+ * The value of spL2SquaredDistanceUInt8 if it is not greater than bound,
+ * otherwise some value greater than bound
+ */
+float spL2SquaredDistanceUInt8Bounded(const float* q,
+		const unsigned char* codes, const float* weights, int dim,
+		double bound);
+
+/**
+ * Same as spL2SquaredDistanceUInt8 using kernel.
+ *
+ * @assert the running CPU supports kernel
+ */
+float spL2SquaredDistanceUInt8Kernel(SP_DISTANCE_KERNEL kernel,
+		const float* q, const unsigned char* codes, const float* weights,
+		int dim);
+
+/**
+ * Calculates the L2-squared distances between the query q and a block of
+ * SP_DISTANCE_BLOCK points stored dimension-major: coordinate i of point j
+ * is block[i * SP_DISTANCE_BLOCK + j]. Every lane of the vector kernels
+ * handles another point, so the coordinates of the block are streamed
+ * once. Every distance is exactly the one spL2SquaredDistance returns for
+ * the point and q.
+ *
+ * @param q - The coordinates of the query
+ * @param block - The dim * SP_DISTANCE_BLOCK coordinates of the points
+ * @param dim - The number of coordinates of q and of every point
+ * @param bound - The largest distance the caller is interested in, once all
+ * 				  the points of a pass of the kernel are known to be above it
+ * 				  the rest of their coordinates are skipped
+ * @param distances - SP_DISTANCE_BLOCK values to store the distances in
+ * @assert q != NULL AND block != NULL AND distances != NULL AND dim > 0
+ * After the call distances[j] is the distance of point j if it is not greater than bound,
+ * otherwise some value greater than bound
+ */
+void spL2SquaredDistanceBlock(const double* q, const double* block, int dim,
+		double bound, double* distances);
+
+/**
+ * Same as spL2SquaredDistanceBlock using kernel, without a bound.
+ *
+ * @assert the running CPU supports kernel
+ */
+void spL2SquaredDistanceBlockKernel(SP_DISTANCE_KERNEL kernel,
+		const double* q, const double* block, int dim, double* distances);
+
+/**
+ * Same as spL2SquaredDistanceBlock for float coordinates, every distance is
+ * the one spL2SquaredDistanceFloat returns.
+ */
+void spL2SquaredDistanceFloatBlock(const float* q, const float* block,
+		int dim, double bound, float* distances);
+
+/**
+ * Same as spL2SquaredDistanceFloatBlock using kernel, without a bound.
+ *
+ * @assert the running CPU supports kernel
+ */
+void spL2SquaredDistanceFloatBlockKernel(SP_DISTANCE_KERNEL kernel,
+		const float* q, const float* block, int dim, float* distances);
+
+/**
+ * Calculates the asymmetric product quantization distance between a query
+ * and a row of codes, one code per subspace:
+ * lut[0][codes_0] + lut[1][codes_1] + ... + lut[subspaces-1][codes_{subspaces-1}]
+ * where lut[s][c] (stored at lut[s * SP_PQ_CENTROIDS + c]) is the L2-squared
+ * distance between the query and centroid c of subspace s.
+ *
+ * @param lut - The lookup table of the query, subspaces * SP_PQ_CENTROIDS values
+ * @param codes - The centroid of every subspace
+ * @param subspaces - The number of subspaces
+ * @assert lut != NULL AND codes != NULL AND subspaces > 0
+ * @return
+ * The sum of the looked up distances
+ */
+float spPQDistance(const float* lut, const unsigned char* codes,
+		int subspaces);
+
+/**
+ * Same as spPQDistance, but gives up as soon as the distance is known to be
+ * greater than bound (checked every eight subspaces).
+ *
+ * @return
+ * The value of spPQDistance if it is not greater than bound, otherwise
+ * some value greater than bound
+ */
+float spPQDistanceBounded(const float* lut, const unsigned char* codes,
+		int subspaces, double bound);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPDISTANCE_H_ */
@@ -0,0 +1,88 @@
+#include <cassert>
+#include <cstddef>
+#include "SPDistanceFixed.h"
+#include "SPDistanceKernels.h"
+
+/*
+ * Every fixed kernel calls the kernel of SPDistanceKernels.h it is named
+ * after with the template parameter Dim in place of dim. That kernel is
+ * inlined, its loops run a constant number of times and the tail (Dim % 8
+ * coordinates) is known at compile time, so the compiler unrolls the
+ * blocks and drops the tail branches.
+ */
+
+namespace {
+
+/**
+ * defines NAME<Dim>, the kernel KERNEL (of type T) for Dim coordinates,
+ * compiled with the attributes TARGET of KERNEL
+ */
+#define SP_FIXED_KERNEL(NAME, KERNEL, T, TARGET) \
+	template<int Dim> TARGET \
+	T NAME(const T* p, const T* q, int dim, double bound) { \
+		(void) dim; \
+		assert(dim == Dim); \
+		return KERNEL(p, q, Dim, bound); \
+	}
+
+SP_FIXED_KERNEL(fixedScalar, l2Scalar, double, )
+SP_FIXED_KERNEL(fixedFloatScalar, l2FloatScalar, float, )
+
+#ifdef SP_DISTANCE_X86
+
+SP_FIXED_KERNEL(fixedSSE2, l2SSE2, double, __attribute__((target("sse2"))))
+SP_FIXED_KERNEL(fixedAVX2, l2AVX2, double, __attribute__((target("avx2"))))
+SP_FIXED_KERNEL(fixedFloatSSE2, l2FloatSSE2, float,
+		__attribute__((target("sse2"))))
+SP_FIXED_KERNEL(fixedFloatAVX2, l2FloatAVX2, float,
+		__attribute__((target("avx2"))))
+
+/** the kernels of every instruction set, in SP_DISTANCE_KERNEL order **/
+#define SP_FIXED_KERNELS(D) { fixedScalar<D>, fixedSSE2<D>, fixedAVX2<D> }
+#define SP_FIXED_FLOAT_KERNELS(D) { fixedFloatScalar<D>, fixedFloatSSE2<D>, \
+	fixedFloatAVX2<D> }
+const int KERNELS = 3;
+
+#else
+
+#define SP_FIXED_KERNELS(D) { fixedScalar<D> }
+#define SP_FIXED_FLOAT_KERNELS(D) { fixedFloatScalar<D> }
+const int KERNELS = 1;
+
+#endif /* SP_DISTANCE_X86 */
+
+#define SP_FIXED_TABLE(KERNELS_OF) { KERNELS_OF(10), KERNELS_OF(11), \
+	KERNELS_OF(12), KERNELS_OF(13), KERNELS_OF(14), KERNELS_OF(15), \
+	KERNELS_OF(16), KERNELS_OF(17), KERNELS_OF(18), KERNELS_OF(19), \
+	KERNELS_OF(20), KERNELS_OF(21), KERNELS_OF(22), KERNELS_OF(23), \
+	KERNELS_OF(24), KERNELS_OF(25), KERNELS_OF(26), KERNELS_OF(27), \
+	KERNELS_OF(28) }
+
+const int DIMS = SP_DISTANCE_FIXED_MAX_DIM - SP_DISTANCE_FIXED_MIN_DIM + 1;
+
+const SPL2Kernel fixedKernels[DIMS][KERNELS] =
+		SP_FIXED_TABLE(SP_FIXED_KERNELS);
+
+const SPL2FloatKernel fixedFloatKernels[DIMS][KERNELS] =
+		SP_FIXED_TABLE(SP_FIXED_FLOAT_KERNELS);
+
+/** the row of dim in the tables, -1 if the kernel or dim has no fixed kernel **/
+int tableIndex(SP_DISTANCE_KERNEL kernel, int dim) {
+	if (dim < SP_DISTANCE_FIXED_MIN_DIM || dim > SP_DISTANCE_FIXED_MAX_DIM
+			|| static_cast<int>(kernel) < 0
+			|| static_cast<int>(kernel) >= KERNELS)
+		return -1;
+	return dim - SP_DISTANCE_FIXED_MIN_DIM;
+}
+
+}
+
+SPL2Kernel spDistanceFixedKernel(SP_DISTANCE_KERNEL kernel, int dim) {
+	int index = tableIndex(kernel, dim);
+	return index < 0 ? NULL : fixedKernels[index][kernel];
+}
+
+SPL2FloatKernel spDistanceFixedFloatKernel(SP_DISTANCE_KERNEL kernel, int dim) {
+	int index = tableIndex(kernel, dim);
+	return index < 0 ? NULL : fixedFloatKernels[index][kernel];
+}
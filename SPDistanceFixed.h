@@ -0,0 +1,52 @@
+#ifndef SPDISTANCEFIXED_H_
+#define SPDISTANCEFIXED_H_
+
+#include "SPDistance.h"
+
+/**
+ * SP Distance Fixed summary
+ *
+ * The distance kernels of SPDistance instantiated (as C++ templates) for
+ * every PCA dimension allowed by SPConfig, so the number of coordinates is
+ * a compile-time constant: the loops are fully unrolled and the tail loads
+ * are chosen at compile time. The kernels sum in the same order as the ones
+ * of SPDistance, so they return exactly the same results.
+ *
+ * A fixed kernel must only be called with the dimension it was chosen for,
+ * the dim argument is ignored.
+ *
+ * The following functions are supported:
+ *
+ * spDistanceFixedKernel		- The double kernel for a given dimension
+ * spDistanceFixedFloatKernel	- The float kernel for a given dimension
+ *
+ */
+
+/** The smallest dimension a fixed kernel exists for **/
+#define SP_DISTANCE_FIXED_MIN_DIM 10
+/** The largest dimension a fixed kernel exists for **/
+#define SP_DISTANCE_FIXED_MAX_DIM 28
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @param kernel - The instruction set of the kernel
+ * @param dim - The number of coordinates the kernel will be called with
+ * @return
+ * The double kernel of the given instruction set specialized for dim, or
+ * NULL if there is none (dim is out of range or kernel is SP_DISTANCE_AVX512)
+ */
+SPL2Kernel spDistanceFixedKernel(SP_DISTANCE_KERNEL kernel, int dim);
+
+/**
+ * Same as spDistanceFixedKernel for the float kernels.
+ */
+SPL2FloatKernel spDistanceFixedFloatKernel(SP_DISTANCE_KERNEL kernel, int dim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPDISTANCEFIXED_H_ */
@@ -0,0 +1,293 @@
+#ifndef SPDISTANCEKERNELS_H_
+#define SPDISTANCEKERNELS_H_
+
+#include <math.h>
+#include "SPDistance.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SP_DISTANCE_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * SP Distance Kernels summary
+ *
+ * The double and float row kernels of SPDistance, written once for both of
+ * their users: SPDistance calls them with the dimension of the call and
+ * SPDistanceFixed with a compile-time constant one, so the copy inlined
+ * there unrolls the blocks and drops the tail branches. Only SPDistance.c
+ * and SPDistanceFixed.cpp include this header.
+ *
+ */
+
+/*
+ * Every kernel gets a bound. After each block of eight coordinates (if more
+ * coordinates are left) the running sums are reduced as if the rest of the
+ * coordinates were zero. The sums only grow, so once that partial distance
+ * is greater than bound the full distance is too and the partial one is
+ * returned. Otherwise the result is the full distance, unchanged by the
+ * checks. An unbounded call passes HUGE_VAL and skips the reductions.
+ */
+
+/** every kernel is inlined into its caller, where dim may be a constant **/
+#define SP_KERNEL static inline __attribute__((always_inline))
+
+SP_KERNEL double reduceLanes(const double* lanes) {
+	return ((lanes[0] + lanes[4]) + (lanes[2] + lanes[6]))
+			+ ((lanes[1] + lanes[5]) + (lanes[3] + lanes[7]));
+}
+
+SP_KERNEL float reduceFloatLanes(const float* lanes) {
+	return ((lanes[0] + lanes[4]) + (lanes[2] + lanes[6]))
+			+ ((lanes[1] + lanes[5]) + (lanes[3] + lanes[7]));
+}
+
+SP_KERNEL double l2Scalar(const double* p, const double* q, int dim,
+		double bound) {
+	double lanes[SP_DISTANCE_LANES] = { 0 };
+	int i = 0;
+	for (; i + SP_DISTANCE_LANES <= dim; i += SP_DISTANCE_LANES) {
+		for (int j = 0; j < SP_DISTANCE_LANES; j++) {
+			double diff = p[i + j] - q[i + j];
+			lanes[j] += diff * diff;
+		}
+		if (i + SP_DISTANCE_LANES < dim && bound < HUGE_VAL) {
+			double partial = reduceLanes(lanes);
+			if (partial > bound)
+				return partial;
+		}
+	}
+	for (int j = 0; i < dim; i++, j++) {
+		double diff = p[i] - q[i];
+		lanes[j] += diff * diff;
+	}
+	return reduceLanes(lanes);
+}
+
+SP_KERNEL float l2FloatScalar(const float* p, const float* q, int dim,
+		double bound) {
+	float lanes[SP_DISTANCE_LANES] = { 0 };
+	int i = 0;
+	for (; i + SP_DISTANCE_LANES <= dim; i += SP_DISTANCE_LANES) {
+		for (int j = 0; j < SP_DISTANCE_LANES; j++) {
+			float diff = p[i + j] - q[i + j];
+			lanes[j] += diff * diff;
+		}
+		if (i + SP_DISTANCE_LANES < dim && bound < HUGE_VAL) {
+			float partial = reduceFloatLanes(lanes);
+			if (partial > bound)
+				return partial;
+		}
+	}
+	for (int j = 0; i < dim; i++, j++) {
+		float diff = p[i] - q[i];
+		lanes[j] += diff * diff;
+	}
+	return reduceFloatLanes(lanes);
+}
+
+#ifdef SP_DISTANCE_X86
+
+/*
+ * The vector kernels keep the eight running sums in registers. The last
+ * (dim % 8) coordinates are loaded with the missing lanes set to zero, and
+ * adding zero leaves a running sum unchanged, so the result is the same as
+ * the one of the scalar kernels.
+ */
+
+__attribute__((target("sse2")))
+SP_KERNEL double reduceSSE2(const __m128d* sum) {
+	__m128d s = _mm_add_pd(_mm_add_pd(sum[0], sum[2]),
+			_mm_add_pd(sum[1], sum[3]));
+	return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+__attribute__((target("sse2")))
+SP_KERNEL double l2SSE2(const double* p, const double* q, int dim,
+		double bound) {
+	__m128d sum[SP_DISTANCE_LANES / 2];
+	int i = 0;
+	for (int j = 0; j < SP_DISTANCE_LANES / 2; j++)
+		sum[j] = _mm_setzero_pd();
+	for (; i + SP_DISTANCE_LANES <= dim; i += SP_DISTANCE_LANES) {
+		for (int j = 0; j < SP_DISTANCE_LANES / 2; j++) {
+			__m128d d = _mm_sub_pd(_mm_loadu_pd(p + i + 2 * j),
+					_mm_loadu_pd(q + i + 2 * j));
+			sum[j] = _mm_add_pd(sum[j], _mm_mul_pd(d, d));
+		}
+		if (i + SP_DISTANCE_LANES < dim && bound < HUGE_VAL) {
+			double partial = reduceSSE2(sum);
+			if (partial > bound)
+				return partial;
+		}
+	}
+	for (int j = 0; i < dim; i += 2, j++) {
+		__m128d d;
+		if (i + 1 < dim)
+			d = _mm_sub_pd(_mm_loadu_pd(p + i), _mm_loadu_pd(q + i));
+		else
+			d = _mm_sub_pd(_mm_load_sd(p + i), _mm_load_sd(q + i));
+		sum[j] = _mm_add_pd(sum[j], _mm_mul_pd(d, d));
+	}
+	return reduceSSE2(sum);
+}
+
+__attribute__((target("avx2")))
+SP_KERNEL double reduceAVX2(__m256d sum0, __m256d sum1) {
+	__m256d s4 = _mm256_add_pd(sum0, sum1);
+	__m128d s2 = _mm_add_pd(_mm256_castpd256_pd128(s4),
+			_mm256_extractf128_pd(s4, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(s2, _mm_unpackhi_pd(s2, s2)));
+}
+
+/** the first n (0 < n < 4) doubles of p, the other lanes are zero **/
+__attribute__((target("avx2")))
+SP_KERNEL __m256d loadTailAVX2(const double* p, int n) {
+	return _mm256_maskload_pd(p,
+			_mm256_set_epi64x(0, n > 2 ? -1 : 0, n > 1 ? -1 : 0, -1));
+}
+
+__attribute__((target("avx2")))
+SP_KERNEL double l2AVX2(const double* p, const double* q, int dim,
+		double bound) {
+	__m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+	int i = 0;
+	for (; i + SP_DISTANCE_LANES <= dim; i += SP_DISTANCE_LANES) {
+		__m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(p + i),
+				_mm256_loadu_pd(q + i));
+		__m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(p + i + 4),
+				_mm256_loadu_pd(q + i + 4));
+		sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(d0, d0));
+		sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(d1, d1));
+		if (i + SP_DISTANCE_LANES < dim && bound < HUGE_VAL) {
+			double partial = reduceAVX2(sum0, sum1);
+			if (partial > bound)
+				return partial;
+		}
+	}
+	int rest = dim - i;
+	if (rest >= 4) {
+		__m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(p + i),
+				_mm256_loadu_pd(q + i));
+		sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(d0, d0));
+		if (rest > 4) {
+			__m256d d1 = _mm256_sub_pd(loadTailAVX2(p + i + 4, rest - 4),
+					loadTailAVX2(q + i + 4, rest - 4));
+			sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(d1, d1));
+		}
+	} else if (rest > 0) {
+		__m256d d0 = _mm256_sub_pd(loadTailAVX2(p + i, rest),
+				loadTailAVX2(q + i, rest));
+		sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(d0, d0));
+	}
+	return reduceAVX2(sum0, sum1);
+}
+
+/**
+ * loads the first n (0 <= n <= 4) floats of p and zeros the other lanes,
+ * the tails are loaded straight to registers since a copy through a small
+ * stack array stalls on store forwarding
+ */
+__attribute__((target("sse2")))
+SP_KERNEL __m128 loadPartialSSE2(const float* p, int n) {
+	switch (n) {
+	case 0:
+		return _mm_setzero_ps();
+	case 1:
+		return _mm_load_ss(p);
+	case 2:
+		return _mm_castsi128_ps(_mm_loadl_epi64((const __m128i*) p));
+	case 3:
+		return _mm_movelh_ps(
+				_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*) p)),
+				_mm_load_ss(p + 2));
+	default:
+		return _mm_loadu_ps(p);
+	}
+}
+
+/** lane j of s holds the sums of lanes j and j + 4 of l2FloatScalar **/
+__attribute__((target("sse2")))
+SP_KERNEL float reduceFloatSSE2(__m128 s) {
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+}
+
+__attribute__((target("sse2")))
+SP_KERNEL float l2FloatSSE2(const float* p, const float* q, int dim,
+		double bound) {
+	__m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+	int i = 0;
+	for (; i + SP_DISTANCE_LANES <= dim; i += SP_DISTANCE_LANES) {
+		__m128 d0 = _mm_sub_ps(_mm_loadu_ps(p + i), _mm_loadu_ps(q + i));
+		__m128 d1 = _mm_sub_ps(_mm_loadu_ps(p + i + 4),
+				_mm_loadu_ps(q + i + 4));
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(d0, d0));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(d1, d1));
+		if (i + SP_DISTANCE_LANES < dim && bound < HUGE_VAL) {
+			float partial = reduceFloatSSE2(_mm_add_ps(sum0, sum1));
+			if (partial > bound)
+				return partial;
+		}
+	}
+	if (i < dim) {
+		int rest0 = dim - i < 4 ? dim - i : 4, rest1 = dim - i - rest0;
+		__m128 d0 = _mm_sub_ps(loadPartialSSE2(p + i, rest0),
+				loadPartialSSE2(q + i, rest0));
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(d0, d0));
+		if (rest1 > 0) {
+			__m128 d1 = _mm_sub_ps(loadPartialSSE2(p + i + 4, rest1),
+					loadPartialSSE2(q + i + 4, rest1));
+			sum1 = _mm_add_ps(sum1, _mm_mul_ps(d1, d1));
+		}
+	}
+	return reduceFloatSSE2(_mm_add_ps(sum0, sum1));
+}
+
+__attribute__((target("avx2")))
+SP_KERNEL float reduceFloatAVX2(__m256 sum) {
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(sum),
+			_mm256_extractf128_ps(sum, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+}
+
+/** the mask of the first n (0 < n < 8) lanes of a float register **/
+__attribute__((target("avx2")))
+SP_KERNEL __m256i tailMaskAVX2(int n) {
+	return _mm256_set_epi32(n > 7 ? -1 : 0, n > 6 ? -1 : 0, n > 5 ? -1 : 0,
+			n > 4 ? -1 : 0, n > 3 ? -1 : 0, n > 2 ? -1 : 0, n > 1 ? -1 : 0,
+			-1);
+}
+
+/*
+ * The eight float sums fit in a single 256-bit register, so this kernel is
+ * also used in place of an AVX-512 one.
+ */
+__attribute__((target("avx2")))
+SP_KERNEL float l2FloatAVX2(const float* p, const float* q, int dim,
+		double bound) {
+	__m256 sum = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + SP_DISTANCE_LANES <= dim; i += SP_DISTANCE_LANES) {
+		__m256 d = _mm256_sub_ps(_mm256_loadu_ps(p + i),
+				_mm256_loadu_ps(q + i));
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(d, d));
+		if (i + SP_DISTANCE_LANES < dim && bound < HUGE_VAL) {
+			float partial = reduceFloatAVX2(sum);
+			if (partial > bound)
+				return partial;
+		}
+	}
+	if (i < dim) {
+		__m256i mask = tailMaskAVX2(dim - i);
+		__m256 d = _mm256_sub_ps(_mm256_maskload_ps(p + i, mask),
+				_mm256_maskload_ps(q + i, mask));
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(d, d));
+	}
+	return reduceFloatAVX2(sum);
+}
+
+#endif /* SP_DISTANCE_X86 */
+
+#endif /* SPDISTANCEKERNELS_H_ */
@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SPDynamicIndex.h"
+#include "KDTreeNode.h"
+#include "SPDistance.h"
+#include "SPLogger.h"
+
+#define SP_DYNAMIC_INDEX_MIN_CAPACITY 16
+
+/** a store of features and the static tree built over it **/
+typedef struct sp_dynamic_index_run_t {
+	SPFeatureStore store;
+	KDTreeNode* root;
+	int deleted; // features of deleted images still in store
+} SPDynamicIndexRun;
+
+struct sp_dynamic_index_t {
+	SPFeatureStore model; // empty, every run is created like it
+	KDTreeSplitMethod splitMethod;
+	int leafSize;
+	int threads;
+	SPDynamicIndexRun* runs; // the largest first
+	int runCount;
+	int runCapacity;
+	int* imageRuns; // the run of the features of every image, -1 if none
+	int* imageFeatures; // the number of features of every image
+	bool* deleted; // the deleted images whose features are still in a run
+	int imageCapacity;
+	int size; // features of the images in the index
+};
+
+/** the number of features of the images of run that are not deleted **/
+static int liveSize(const SPDynamicIndexRun* run) {
+	return spFeatureStoreGetSize(run->store) - run->deleted;
+}
+
+/** grows the arrays of the images so they hold imageIndex, false on failure **/
+static bool reserveImages(SPDynamicIndex index, int imageIndex) {
+	int capacity = index->imageCapacity;
+	if (imageIndex < capacity)
+		return true;
+	if (capacity < SP_DYNAMIC_INDEX_MIN_CAPACITY)
+		capacity = SP_DYNAMIC_INDEX_MIN_CAPACITY;
+	while (capacity <= imageIndex)
+		capacity *= 2;
+	int* imageRuns = (int*) realloc(index->imageRuns, capacity * sizeof(int));
+	if (imageRuns != NULL)
+		index->imageRuns = imageRuns;
+	int* imageFeatures = (int*) realloc(index->imageFeatures,
+			capacity * sizeof(int));
+	if (imageFeatures != NULL)
+		index->imageFeatures = imageFeatures;
+	bool* deleted = (bool*) realloc(index->deleted, capacity * sizeof(bool));
+	if (deleted != NULL)
+		index->deleted = deleted;
+	if (imageRuns == NULL || imageFeatures == NULL || deleted == NULL)
+		return false;
+	for (int i = index->imageCapacity; i < capacity; i++) {
+		index->imageRuns[i] = -1;
+		index->imageFeatures[i] = 0;
+		index->deleted[i] = false;
+	}
+	index->imageCapacity = capacity;
+	return true;
+}
+
+/** the tree of the features of store (and their blocks), NULL on failure **/
+static KDTreeNode* buildRun(SPDynamicIndex index, SPFeatureStore store) {
+	int dimension = spFeatureStoreGetDimension(store);
+	KDTreeNode* root = InitKDTreeSelect(store, NULL,
+			spFeatureStoreGetSize(store), index->splitMethod, dimension,
+			dimension, index->leafSize, index->threads);
+	// leaves of a block or more are scanned with the block kernels
+	if (root != NULL && index->leafSize >= SP_DISTANCE_BLOCK
+			&& (spFeatureStoreGetStorage(store) == DOUBLE_STORAGE
+					|| spFeatureStoreGetStorage(store) == FLOAT_STORAGE)
+			&& spFeatureStoreBuildBlocks(store) != SP_FEATURE_STORE_SUCCESS) {
+		spLoggerPrintWarning("Distance blocks not built, leaves are scanned per point",
+				__FILE__, __func__, __LINE__);
+	}
+	return root;
+}
+
+/** records run as the run of the images of its features **/
+static void assignRun(SPDynamicIndex index, int run) {
+	SPFeatureStore store = index->runs[run].store;
+	int size = spFeatureStoreGetSize(store);
+	for (int offset = 0; offset < size; offset++)
+		index->imageRuns[spFeatureStoreGetIndex(store, offset)] = run;
+}
+
+/**
+ * replaces the runs first to last by one run of the features of their
+ * images that are not deleted, the deleted images leave the index (a run
+ * left without features is removed). false if an allocation failed, the
+ * runs are unchanged then.
+ **/
+static bool rebuildRuns(SPDynamicIndex index, int first, int last) {
+	SPFeatureStore store = NULL;
+	KDTreeNode* root = NULL;
+	int live = 0;
+	for (int run = first; run <= last; run++)
+		live += liveSize(&index->runs[run]);
+	if (live > 0) {
+		store = spFeatureStoreCreateLike(index->model, live);
+		if (store == NULL)
+			return false;
+		for (int run = first; run <= last; run++) {
+			SPFeatureStore source = index->runs[run].store;
+			int size = spFeatureStoreGetSize(source);
+			for (int offset = 0; offset < size; offset++) {
+				if (index->deleted[spFeatureStoreGetIndex(source, offset)])
+					continue;
+				if (spFeatureStoreAppendFrom(store, source, offset)
+						!= SP_FEATURE_STORE_SUCCESS) {
+					spFeatureStoreDestroy(store);
+					return false;
+				}
+			}
+		}
+		root = buildRun(index, store);
+		if (root == NULL) {
+			spFeatureStoreDestroy(store);
+			return false;
+		}
+	}
+	for (int run = first; run <= last; run++) {
+		SPFeatureStore source = index->runs[run].store;
+		int size = spFeatureStoreGetSize(source);
+		for (int offset = 0; offset < size; offset++) {
+			int image = spFeatureStoreGetIndex(source, offset);
+			if (index->deleted[image]) {
+				index->deleted[image] = false;
+				index->imageRuns[image] = -1;
+				index->imageFeatures[image] = 0;
+			}
+		}
+		destroy(index->runs[run].root);
+		spFeatureStoreDestroy(source);
+	}
+	int next = first;
+	if (store != NULL) {
+		index->runs[first].store = store;
+		index->runs[first].root = root;
+		index->runs[first].deleted = 0;
+		next++;
+	}
+	memmove(index->runs + next, index->runs + last + 1,
+			(index->runCount - last - 1) * sizeof(SPDynamicIndexRun));
+	index->runCount -= last + 1 - next;
+	for (int run = first; run < index->runCount; run++)
+		assignRun(index, run);
+	return true;
+}
+
+/**
+ * merges the last runs while a run holds at least half as many features as
+ * the one before it, false if an allocation failed
+ **/
+static bool mergeRuns(SPDynamicIndex index) {
+	int run = index->runCount - 1;
+	while (run > 0) {
+		if (2 * liveSize(&index->runs[run])
+				< liveSize(&index->runs[run - 1])) {
+			run--;
+			continue;
+		}
+		if (!rebuildRuns(index, run - 1, run))
+			return false;
+		// the merged run is compared with the one before it next
+		run = run - 1 < index->runCount - 1 ? run - 1 : index->runCount - 1;
+	}
+	return true;
+}
+
+/** adds store and its tree as the last run, false if an allocation failed **/
+static bool addRun(SPDynamicIndex index, SPFeatureStore store,
+		KDTreeNode* root) {
+	if (index->runCount == index->runCapacity) {
+		int capacity = index->runCapacity < SP_DYNAMIC_INDEX_MIN_CAPACITY ?
+				SP_DYNAMIC_INDEX_MIN_CAPACITY : 2 * index->runCapacity;
+		SPDynamicIndexRun* runs = (SPDynamicIndexRun*) realloc(index->runs,
+				capacity * sizeof(SPDynamicIndexRun));
+		if (runs == NULL)
+			return false;
+		index->runs = runs;
+		index->runCapacity = capacity;
+	}
+	index->runs[index->runCount].store = store;
+	index->runs[index->runCount].root = root;
+	index->runs[index->runCount].deleted = 0;
+	index->runCount++;
+	return true;
+}
+
+SPDynamicIndex spDynamicIndexCreate(SPFeatureStore store,
+		KDTreeSplitMethod splitMethod, int leafSize, int threads) {
+	SPDynamicIndex index = NULL;
+	KDTreeNode* root = NULL;
+	if (store == NULL || leafSize < 1 || threads < 1) {
+		spLoggerPrintError("Invalid arguments", __FILE__, __func__, __LINE__);
+		spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	index = (SPDynamicIndex) calloc(1, sizeof(*index));
+	if (index == NULL) {
+		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
+		spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	index->splitMethod = splitMethod;
+	index->leafSize = leafSize;
+	index->threads = threads;
+	index->model = spFeatureStoreCreateLike(store, 0);
+	int size = spFeatureStoreGetSize(store);
+	bool created = index->model != NULL;
+	for (int offset = 0; created && offset < size; offset++)
+		created = reserveImages(index, spFeatureStoreGetIndex(store, offset));
+	if (created && size > 0) {
+		root = buildRun(index, store);
+		created = root != NULL && addRun(index, store, root);
+	}
+	if (!created) {
+		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
+		destroy(root);
+		spFeatureStoreDestroy(store);
+		spDynamicIndexDestroy(index);
+		return NULL;
+	}
+	if (size == 0) {
+		spFeatureStoreDestroy(store);
+	} else {
+		for (int offset = 0; offset < size; offset++)
+			index->imageFeatures[spFeatureStoreGetIndex(store, offset)]++;
+		assignRun(index, 0);
+		index->size = size;
+	}
+	return index;
+}
+
+void spDynamicIndexDestroy(SPDynamicIndex index) {
+	if (index == NULL)
+		return;
+	for (int run = 0; run < index->runCount; run++) {
+		destroy(index->runs[run].root);
+		spFeatureStoreDestroy(index->runs[run].store);
+	}
+	spFeatureStoreDestroy(index->model);
+	free(index->runs);
+	free(index->imageRuns);
+	free(index->imageFeatures);
+	free(index->deleted);
+	free(index);
+}
+
+SP_DYNAMIC_INDEX_MSG spDynamicIndexInsert(SPDynamicIndex index,
+		int imageIndex, SPPoint* features, int numOfFeatures) {
+	if (index == NULL || imageIndex < 0 || features == NULL
+			|| numOfFeatures <= 0
+			|| spDynamicIndexHasImage(index, imageIndex))
+		return SP_DYNAMIC_INDEX_INVALID_ARGUMENT;
+	int dimension = spFeatureStoreGetDimension(index->model);
+	for (int i = 0; i < numOfFeatures; i++) {
+		if (features[i] == NULL
+				|| spPointGetDimension(features[i]) != dimension)
+			return SP_DYNAMIC_INDEX_INVALID_ARGUMENT;
+	}
+	if (!reserveImages(index, imageIndex))
+		return SP_DYNAMIC_INDEX_OUT_OF_MEMORY;
+	// the tombstone covers the old features, they must go first
+	if (index->deleted[imageIndex]
+			&& !rebuildRuns(index, index->imageRuns[imageIndex],
+					index->imageRuns[imageIndex]))
+		return SP_DYNAMIC_INDEX_OUT_OF_MEMORY;
+	SPFeatureStore store = spFeatureStoreCreateLike(index->model,
+			numOfFeatures);
+	if (store == NULL)
+		return SP_DYNAMIC_INDEX_OUT_OF_MEMORY;
+	for (int i = 0; i < numOfFeatures; i++) {
+		SP_FEATURE_STORE_MSG msg = spFeatureStoreAppend(store,
+				spPointGetData(features[i]), imageIndex);
+		if (msg != SP_FEATURE_STORE_SUCCESS) {
+			spFeatureStoreDestroy(store);
+			return msg == SP_FEATURE_STORE_OUT_OF_MEMORY ?
+					SP_DYNAMIC_INDEX_OUT_OF_MEMORY :
+					SP_DYNAMIC_INDEX_INVALID_ARGUMENT;
+		}
+	}
+	KDTreeNode* root = buildRun(index, store);
+	if (root == NULL || !addRun(index, store, root)) {
+		destroy(root);
+		spFeatureStoreDestroy(store);
+		return SP_DYNAMIC_INDEX_OUT_OF_MEMORY;
+	}
+	index->imageRuns[imageIndex] = index->runCount - 1;
+	index->imageFeatures[imageIndex] = numOfFeatures;
+	index->size += numOfFeatures;
+	// the image is in, unmerged runs are only searched slower
+	if (!mergeRuns(index)) {
+		spLoggerPrintWarning("Runs not merged", __FILE__, __func__, __LINE__);
+	}
+	return SP_DYNAMIC_INDEX_SUCCESS;
+}
+
+SP_DYNAMIC_INDEX_MSG spDynamicIndexDelete(SPDynamicIndex index,
+		int imageIndex) {
+	if (!spDynamicIndexHasImage(index, imageIndex))
+		return SP_DYNAMIC_INDEX_INVALID_ARGUMENT;
+	index->deleted[imageIndex] = true;
+	index->runs[index->imageRuns[imageIndex]].deleted +=
+			index->imageFeatures[imageIndex];
+	index->size -= index->imageFeatures[imageIndex];
+	return SP_DYNAMIC_INDEX_SUCCESS;
+}
+
+SP_DYNAMIC_INDEX_MSG spDynamicIndexCompact(SPDynamicIndex index) {
+	if (index == NULL)
+		return SP_DYNAMIC_INDEX_INVALID_ARGUMENT;
+	// from the last run, a removed run only moves the runs after it
+	for (int run = index->runCount - 1; run >= 0; run--) {
+		if (index->runs[run].deleted > 0 && !rebuildRuns(index, run, run))
+			return SP_DYNAMIC_INDEX_OUT_OF_MEMORY;
+	}
+	return mergeRuns(index) ?
+			SP_DYNAMIC_INDEX_SUCCESS : SP_DYNAMIC_INDEX_OUT_OF_MEMORY;
+}
+
+SP_DYNAMIC_INDEX_MSG spDynamicIndexNeighbors(SPDynamicIndex index,
+		SPPoint feature, SPBPQueue bpq) {
+	if (index == NULL || feature == NULL || bpq == NULL
+			|| spPointGetDimension(feature)
+					!= spFeatureStoreGetDimension(index->model))
+		return SP_DYNAMIC_INDEX_INVALID_ARGUMENT;
+	// every run is encoded as the model, one query fits them all
+	SPFeatureQuery query = spFeatureStorePrepareQuery(index->model, feature);
+	SPBPQueue neighbors = spBPQueueCreate(spBPQueueGetMaxSize(bpq));
+	if (query == NULL || neighbors == NULL) {
+		spFeatureQueryDestroy(query);
+		spBPQueueDestroy(neighbors);
+		return SP_DYNAMIC_INDEX_OUT_OF_MEMORY;
+	}
+	for (int run = 0; run < index->runCount; run++) {
+		SPFeatureStore store = index->runs[run].store;
+		if (liveSize(&index->runs[run]) == 0)
+			continue;
+		kNearestNeighborsExcluding(index->runs[run].root, store, &neighbors,
+				query, index->deleted);
+		// the offsets of the run become the images of the features, the
+		// enqueue can't fail since bpq != NULL
+		const SPBPQueueElement* elements = spBPQueueGetElements(neighbors);
+		for (int i = 0; i < spBPQueueSize(neighbors); i++)
+			spBPQueueEnqueueValue(bpq,
+					spFeatureStoreGetIndex(store, elements[i].index),
+					elements[i].value);
+		spBPQueueReset(neighbors);
+	}
+	spFeatureQueryDestroy(query);
+	spBPQueueDestroy(neighbors);
+	return SP_DYNAMIC_INDEX_SUCCESS;
+}
+
+int spDynamicIndexGetSize(SPDynamicIndex index) {
+	if (index == NULL)
+		return -1;
+	return index->size;
+}
+
+bool spDynamicIndexHasImage(SPDynamicIndex index, int imageIndex) {
+	return index != NULL && imageIndex >= 0
+			&& imageIndex < index->imageCapacity
+			&& index->imageRuns[imageIndex] >= 0 && !index->deleted[imageIndex];
+}
@@ -0,0 +1,160 @@
+#ifndef SPDYNAMICINDEX_H_
+#define SPDYNAMICINDEX_H_
+
+#include <stdbool.h>
+#include "SPPoint.h"
+#include "SPConfig.h"
+#include "SPFeatureStore.h"
+#include "SPBPriorityQueue.h"
+
+/**
+ * SP Dynamic Index summary
+ *
+ * A kd-tree index of the features of an image collection that images are
+ * inserted into and deleted from without building the whole tree again
+ * (the logarithmic method of Bentley & Saxe). The features are kept in
+ * runs, every run is a store with its own static tree (see
+ * InitKDTreeSelect) and holds all the features of the images it covers.
+ *
+ * An inserted image becomes a new run of its own features, then the last
+ * two runs are merged (their features copied to one store and the tree of
+ * the merged run built) while the last run holds at least half as many
+ * features as the one before it. The runs shrink geometrically, so there
+ * are O(log n) of them and a feature is copied O(log n) times overall: the
+ * amortized cost of an insert grows with the size of the image, not of the
+ * collection.
+ *
+ * A deleted image is only marked (a tombstone), its features stay in their
+ * run and are skipped by the search. They are dropped when their run is
+ * merged or by spDynamicIndexCompact.
+ *
+ * The runs are searched one after the other by kNearestNeighbors, so the
+ * neighbors are the exact nearest features of the images in the index.
+ *
+ * The following functions are supported:
+ *
+ * spDynamicIndexCreate		- Creates an index of the features of a store
+ * spDynamicIndexDestroy	- Free all resources associated with an index
+ * spDynamicIndexInsert		- Inserts the features of an image
+ * spDynamicIndexDelete		- Deletes the features of an image
+ * spDynamicIndexCompact	- Drops the features of the deleted images
+ * spDynamicIndexNeighbors	- The nearest features to a point
+ * spDynamicIndexGetSize	- A getter of the number of features in the index
+ * spDynamicIndexHasImage	- Checks if the features of an image are in the index
+ *
+ */
+
+/** type used to define the dynamic index **/
+typedef struct sp_dynamic_index_t* SPDynamicIndex;
+
+/** type for error reporting **/
+typedef enum sp_dynamic_index_msg_t {
+	SP_DYNAMIC_INDEX_OUT_OF_MEMORY,
+	SP_DYNAMIC_INDEX_INVALID_ARGUMENT,
+	SP_DYNAMIC_INDEX_SUCCESS
+} SP_DYNAMIC_INDEX_MSG;
+
+/**
+ * Creates an index of the features of store. store is consumed: its
+ * features become the first run of the index (their tree is built here,
+ * which reorders them) and every run is created like it (see
+ * spFeatureStoreCreateLike), so store may be empty to only give the layout
+ * of the features. The trees of the runs are built as InitKDTreeSelect
+ * builds them, with the given split method, leaf size and threads.
+ *
+ * @param store - The features of the first images, not a mapped store
+ * @param splitMethod - The split method of the trees
+ * @param leafSize - The largest number of features of a leaf
+ * @param threads - The number of threads that build a tree
+ * @return
+ * NULL in case allocation failure occurred OR store == NULL OR store is
+ * mapped OR leafSize < 1 OR threads < 1 (store is destroyed)
+ * Otherwise, the new index is returned
+ */
+SPDynamicIndex spDynamicIndexCreate(SPFeatureStore store,
+		KDTreeSplitMethod splitMethod, int leafSize, int threads);
+
+/**
+ * Free all memory allocation associated with index,
+ * if index is NULL nothing happens.
+ */
+void spDynamicIndexDestroy(SPDynamicIndex index);
+
+/**
+ * Inserts the features of the image imageIndex into index, the index of
+ * every feature (in the store of its run) is imageIndex. If the image was
+ * deleted and its features were not dropped yet, their run is compacted
+ * first.
+ *
+ * @param index - The target index
+ * @param imageIndex - The index of the image
+ * @param features - The features of the image
+ * @param numOfFeatures - The number of features
+ * @return
+ * SP_DYNAMIC_INDEX_INVALID_ARGUMENT if index == NULL or imageIndex < 0 or
+ * features == NULL or numOfFeatures <= 0 or the dimension of a feature
+ * differs from the dimension of the index or the image is in the index
+ * or the features can't be stored (an INT8 store without a quantizer)
+ * SP_DYNAMIC_INDEX_OUT_OF_MEMORY if an allocation failed, the index is
+ * unchanged
+ * SP_DYNAMIC_INDEX_SUCCESS otherwise
+ */
+SP_DYNAMIC_INDEX_MSG spDynamicIndexInsert(SPDynamicIndex index,
+		int imageIndex, SPPoint* features, int numOfFeatures);
+
+/**
+ * Deletes the features of the image imageIndex from index. The features
+ * are marked and skipped by spDynamicIndexNeighbors until they are dropped.
+ *
+ * @return
+ * SP_DYNAMIC_INDEX_INVALID_ARGUMENT if index == NULL or the image is not
+ * in the index
+ * SP_DYNAMIC_INDEX_SUCCESS otherwise
+ */
+SP_DYNAMIC_INDEX_MSG spDynamicIndexDelete(SPDynamicIndex index,
+		int imageIndex);
+
+/**
+ * Drops the features of the deleted images: every run that holds some of
+ * them is built again from its other features.
+ *
+ * @return
+ * SP_DYNAMIC_INDEX_INVALID_ARGUMENT if index == NULL
+ * SP_DYNAMIC_INDEX_OUT_OF_MEMORY if an allocation failed, the runs that
+ * were not built again keep their deleted features
+ * SP_DYNAMIC_INDEX_SUCCESS otherwise
+ */
+SP_DYNAMIC_INDEX_MSG spDynamicIndexCompact(SPDynamicIndex index);
+
+/**
+ * Updates bpq to include the nearest features of index to feature. The
+ * index of every element in bpq is the index of the image of the feature
+ * and its value the distance, as spFeatureStoreQueryDistance gives it.
+ *
+ * @return
+ * SP_DYNAMIC_INDEX_INVALID_ARGUMENT if index == NULL or feature == NULL or
+ * bpq == NULL or the dimension of feature differs from the dimension of
+ * the index
+ * SP_DYNAMIC_INDEX_OUT_OF_MEMORY if an allocation failed
+ * SP_DYNAMIC_INDEX_SUCCESS otherwise
+ */
+SP_DYNAMIC_INDEX_MSG spDynamicIndexNeighbors(SPDynamicIndex index,
+		SPPoint feature, SPBPQueue bpq);
+
+/**
+ * A getter for the number of features in the index
+ *
+ * @return
+ * -1 if index == NULL, otherwise the number of features of the images in
+ * the index (the features of the deleted images are not counted)
+ */
+int spDynamicIndexGetSize(SPDynamicIndex index);
+
+/**
+ * @return
+ * true if index != NULL and the features of the image imageIndex are in
+ * the index (inserted and not deleted), false otherwise
+ */
+bool spDynamicIndexHasImage(SPDynamicIndex index, int imageIndex);
+
+#endif /* SPDYNAMICINDEX_H_ */
@@ -0,0 +1,991 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include "SPFeatureStore.h"
+#include "SPPoint.h"
+#include "SPDistance.h"
+
+#define SP_FEATURE_STORE_MIN_CAPACITY 64
+#define SP_FEATURE_STORE_MAX_CODE 255
+#define SP_PQ_KMEANS_ITERATIONS 20
+#define SP_PQ_MAX_TRAINING_FEATURES (64 * SP_PQ_CENTROIDS)
+// the ints of the header of a written store (see spFeatureStoreWrite)
+#define SP_FEATURE_STORE_HEADER_INTS 8
+
+struct sp_feature_store_t {
+	int dimension;
+	SPFeatureStorage storage; // element type of the coordinates
+	size_t rowBytes; // number of bytes between two consecutive rows
+	int size;
+	int capacity;
+	void* block; // the allocation returned by malloc
+	char* data; // block aligned to SP_FEATURE_STORE_ALIGNMENT
+	int* indexes; // image index of every feature
+	double* quantOffsets; // INT8_STORAGE: coordinate = offset + scale * code
+	double* quantScales;
+	float* quantWeights; // INT8_STORAGE: the squared scales
+	float* exact; // INT8_STORAGE/PQ_STORAGE: float copy of every feature, or NULL
+	int pqSubspaces; // PQ_STORAGE: number of codes in every row
+	int* pqStarts; // PQ_STORAGE: first axis of every subspace (and dim at the end)
+	int* pqAxisSubspace; // PQ_STORAGE: the subspace of every axis
+	float* pqCentroids; // PQ_STORAGE: the centroids of subspace s start at SP_PQ_CENTROIDS * pqStarts[s]
+	SPL2Kernel l2Kernel; // DOUBLE_STORAGE: the kernel chosen for the dimension
+	SPL2FloatKernel l2FloatKernel; // FLOAT_STORAGE and the exact rows: the same
+	void* blocksBlock; // the allocation of blocks, NULL if they are not built
+	char* blocks; // dimension-major copy of every SP_DISTANCE_BLOCK features
+	bool mapped; // the arrays point into a mapped file, only blocksBlock is owned
+};
+
+struct sp_feature_query_t {
+	int dimension;
+	double* coor; // coordinates rounded to the element type of the store
+	float* floatCoor; // float copy of the query for FLOAT_STORAGE or the exact rows
+	float* codeCoor; // the query in code units for INT8_STORAGE
+	float* lut; // PQ_STORAGE: the distance to every centroid of every subspace
+};
+
+/** the size in bytes of one coordinate of the given storage **/
+static size_t elementSize(SPFeatureStorage storage) {
+	switch (storage) {
+	case FLOAT_STORAGE:
+		return sizeof(float);
+	case INT8_STORAGE:
+		return sizeof(unsigned char);
+	default:
+		return sizeof(double);
+	}
+}
+
+/** rounds a row up to a multiple of SP_FEATURE_STORE_ROW_ALIGNMENT bytes **/
+static size_t calculateRowBytes(int dim, SPFeatureStorage storage) {
+	size_t bytes = dim * elementSize(storage);
+	return ((bytes + SP_FEATURE_STORE_ROW_ALIGNMENT - 1)
+			/ SP_FEATURE_STORE_ROW_ALIGNMENT) * SP_FEATURE_STORE_ROW_ALIGNMENT;
+}
+
+/** allocates a zeroed coordinates block aligned to SP_FEATURE_STORE_ALIGNMENT **/
+static char* allocAlignedBlock(size_t bytes, void** block) {
+	*block = calloc(1, bytes + SP_FEATURE_STORE_ALIGNMENT);
+	if (*block == NULL)
+		return NULL;
+	uintptr_t address = (uintptr_t) *block;
+	address = (address + SP_FEATURE_STORE_ALIGNMENT - 1)
+			& ~(uintptr_t) (SP_FEATURE_STORE_ALIGNMENT - 1);
+	return (char*) address;
+}
+
+/** the address of the row of the feature at offset **/
+static void* getRow(SPFeatureStore store, int offset) {
+	return store->data + (size_t) offset * store->rowBytes;
+}
+
+/** grows the store so it can hold at least capacity features **/
+static SP_FEATURE_STORE_MSG reserve(SPFeatureStore store, int capacity) {
+	void* block = NULL;
+	char* data = NULL;
+	int* indexes = NULL;
+	if (capacity <= store->capacity)
+		return SP_FEATURE_STORE_SUCCESS;
+	if (store->exact != NULL) {
+		float* exact = (float*) realloc(store->exact,
+				(size_t) capacity * store->dimension * sizeof(float));
+		if (exact == NULL)
+			return SP_FEATURE_STORE_OUT_OF_MEMORY;
+		store->exact = exact;
+	}
+	data = allocAlignedBlock((size_t) capacity * store->rowBytes, &block);
+	if (data == NULL)
+		return SP_FEATURE_STORE_OUT_OF_MEMORY;
+	indexes = (int*) realloc(store->indexes, capacity * sizeof(int));
+	if (indexes == NULL) {
+		free(block);
+		return SP_FEATURE_STORE_OUT_OF_MEMORY;
+	}
+	if (store->size > 0)
+		memcpy(data, store->data, (size_t) store->size * store->rowBytes);
+	free(store->block);
+	store->block = block;
+	store->data = data;
+	store->indexes = indexes;
+	store->capacity = capacity;
+	return SP_FEATURE_STORE_SUCCESS;
+}
+
+/** allocates an empty store whose rows are rowBytes bytes apart **/
+static SPFeatureStore createStore(int dim, int capacity,
+		SPFeatureStorage storage, size_t rowBytes) {
+	SPFeatureStore store = (SPFeatureStore) malloc(sizeof(*store));
+	if (store == NULL)
+		return NULL;
+	store->dimension = dim;
+	store->storage = storage;
+	store->rowBytes = rowBytes;
+	store->size = 0;
+	store->capacity = 0;
+	store->block = NULL;
+	store->data = NULL;
+	store->indexes = NULL;
+	store->quantOffsets = NULL;
+	store->quantScales = NULL;
+	store->quantWeights = NULL;
+	store->exact = NULL;
+	store->pqSubspaces = 0;
+	store->pqStarts = NULL;
+	store->pqAxisSubspace = NULL;
+	store->pqCentroids = NULL;
+	// the kernels specialized for the dimension, chosen once per store
+	store->l2Kernel = spDistanceGetKernelFunction(dim);
+	store->l2FloatKernel = spDistanceGetFloatKernelFunction(dim);
+	store->blocksBlock = NULL;
+	store->blocks = NULL;
+	store->mapped = false;
+	if (capacity < SP_FEATURE_STORE_MIN_CAPACITY)
+		capacity = SP_FEATURE_STORE_MIN_CAPACITY;
+	if (reserve(store, capacity) != SP_FEATURE_STORE_SUCCESS) {
+		spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	return store;
+}
+
+SPFeatureStore spFeatureStoreCreate(int dim, int capacity,
+		SPFeatureStorage storage) {
+	if (dim <= 0 || capacity < 0
+			|| (storage != DOUBLE_STORAGE && storage != FLOAT_STORAGE
+					&& storage != INT8_STORAGE))
+		return NULL;
+	return createStore(dim, capacity, storage,
+			calculateRowBytes(dim, storage));
+}
+
+SPFeatureStore spFeatureStoreCreateLike(SPFeatureStore model, int capacity) {
+	if (model == NULL || capacity < 0)
+		return NULL;
+	SPFeatureStore store = createStore(model->dimension, capacity,
+			model->storage, model->rowBytes);
+	if (store == NULL)
+		return NULL;
+	size_t dim = model->dimension;
+	if (model->storage == INT8_STORAGE && model->quantOffsets != NULL
+			&& spFeatureStoreSetQuantization(store, model->quantOffsets,
+					model->quantScales, model->exact != NULL)
+					!= SP_FEATURE_STORE_SUCCESS) {
+		spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	if (model->storage == PQ_STORAGE) {
+		store->pqSubspaces = model->pqSubspaces;
+		store->pqStarts = (int*) malloc(
+				(model->pqSubspaces + 1) * sizeof(int));
+		store->pqAxisSubspace = (int*) malloc(dim * sizeof(int));
+		store->pqCentroids = (float*) malloc(
+				SP_PQ_CENTROIDS * dim * sizeof(float));
+		if (model->exact != NULL)
+			store->exact = (float*) malloc(
+					(size_t) store->capacity * dim * sizeof(float));
+		if (store->pqStarts == NULL || store->pqAxisSubspace == NULL
+				|| store->pqCentroids == NULL
+				|| (model->exact != NULL && store->exact == NULL)) {
+			spFeatureStoreDestroy(store);
+			return NULL;
+		}
+		memcpy(store->pqStarts, model->pqStarts,
+				(model->pqSubspaces + 1) * sizeof(int));
+		memcpy(store->pqAxisSubspace, model->pqAxisSubspace,
+				dim * sizeof(int));
+		memcpy(store->pqCentroids, model->pqCentroids,
+				SP_PQ_CENTROIDS * dim * sizeof(float));
+	}
+	return store;
+}
+
+void spFeatureStoreDestroy(SPFeatureStore store) {
+	if (store != NULL && store->mapped) {
+		free(store->blocksBlock);
+		free(store);
+	} else if (store != NULL) {
+		free(store->block);
+		free(store->indexes);
+		free(store->quantOffsets);
+		free(store->quantScales);
+		free(store->quantWeights);
+		free(store->exact);
+		free(store->pqStarts);
+		free(store->pqAxisSubspace);
+		free(store->pqCentroids);
+		free(store->blocksBlock);
+		free(store);
+	}
+}
+
+SP_FEATURE_STORE_MSG spFeatureStoreSetQuantization(SPFeatureStore store,
+		const double* offsets, const double* scales, bool keepExact) {
+	if (store == NULL || offsets == NULL || scales == NULL
+			|| store->storage != INT8_STORAGE || store->size > 0
+			|| store->quantOffsets != NULL || store->mapped)
+		return SP_FEATURE_STORE_INVALID_ARGUMENT;
+	for (int i = 0; i < store->dimension; i++) {
+		if (!(scales[i] > 0))
+			return SP_FEATURE_STORE_INVALID_ARGUMENT;
+	}
+	size_t dim = store->dimension;
+	store->quantOffsets = (double*) malloc(dim * sizeof(double));
+	store->quantScales = (double*) malloc(dim * sizeof(double));
+	store->quantWeights = (float*) malloc(dim * sizeof(float));
+	if (keepExact)
+		store->exact = (float*) malloc(
+				(size_t) store->capacity * dim * sizeof(float));
+	if (store->quantOffsets == NULL || store->quantScales == NULL
+			|| store->quantWeights == NULL
+			|| (keepExact && store->exact == NULL)) {
+		free(store->quantOffsets);
+		free(store->quantScales);
+		free(store->quantWeights);
+		free(store->exact);
+		store->quantOffsets = NULL;
+		store->quantScales = NULL;
+		store->quantWeights = NULL;
+		store->exact = NULL;
+		return SP_FEATURE_STORE_OUT_OF_MEMORY;
+	}
+	memcpy(store->quantOffsets, offsets, dim * sizeof(double));
+	memcpy(store->quantScales, scales, dim * sizeof(double));
+	for (size_t i = 0; i < dim; i++)
+		store->quantWeights[i] = (float) (scales[i] * scales[i]);
+	return SP_FEATURE_STORE_SUCCESS;
+}
+
+/** makes room for one more feature and returns its offset, -1 on failure **/
+static int appendRow(SPFeatureStore store, int index) {
+	if (store->blocks != NULL) { // the blocks no longer cover every feature
+		free(store->blocksBlock);
+		store->blocksBlock = NULL;
+		store->blocks = NULL;
+	}
+	if (store->size == store->capacity) {
+		if (reserve(store, 2 * store->capacity) != SP_FEATURE_STORE_SUCCESS)
+			return -1;
+	}
+	store->indexes[store->size] = index;
+	store->size++;
+	return store->size - 1;
+}
+
+/** the nearest of the first k centroids (of len values each) to x **/
+static int nearestCentroid(const float* centroids, int k, int len,
+		const float* x) {
+	int best = 0;
+	float bestDistance = HUGE_VAL;
+	for (int c = 0; c < k; c++) {
+		float distance = 0;
+		for (int j = 0; j < len; j++) {
+			float diff = centroids[c * len + j] - x[j];
+			distance += diff * diff;
+		}
+		if (distance < bestDistance) {
+			bestDistance = distance;
+			best = c;
+		}
+	}
+	return best;
+}
+
+/**
+ * stores the codes of the nearest centroids to row (dim floats) as the
+ * feature at offset of a PQ_STORAGE store, and row as its float copy
+ **/
+static void setCodes(SPFeatureStore store, int offset, const float* row) {
+	unsigned char* codes = (unsigned char*) getRow(store, offset);
+	for (int s = 0; s < store->pqSubspaces; s++) {
+		int start = store->pqStarts[s];
+		codes[s] = (unsigned char) nearestCentroid(
+				store->pqCentroids + SP_PQ_CENTROIDS * start, SP_PQ_CENTROIDS,
+				store->pqStarts[s + 1] - start, row + start);
+	}
+	if (store->exact != NULL)
+		memcpy(store->exact + (size_t) offset * store->dimension, row,
+				store->dimension * sizeof(float));
+}
+
+/**
+ * Lloyd's k-means of the n training features (rows of dim floats) restricted
+ * to the len axes from start. The centroids are seeded with features spread
+ * evenly over the training set, so the result does not depend on rand().
+ * If n < SP_PQ_CENTROIDS the centroids repeat, so every code is valid.
+ */
+static bool trainSubspace(const float* train, int n, int dim, int start,
+		int len, float* centroids) {
+	int k = n < SP_PQ_CENTROIDS ? n : SP_PQ_CENTROIDS;
+	int* assignment = (int*) malloc(n * sizeof(int));
+	int* counts = (int*) malloc(k * sizeof(int));
+	double* sums = (double*) malloc((size_t) k * len * sizeof(double));
+	if (assignment == NULL || counts == NULL || sums == NULL) {
+		free(assignment);
+		free(counts);
+		free(sums);
+		return false;
+	}
+	for (int c = 0; c < k; c++)
+		memcpy(centroids + c * len,
+				train + ((size_t) c * n / k) * dim + start,
+				len * sizeof(float));
+	for (int i = 0; i < n; i++)
+		assignment[i] = -1;
+	for (int iteration = 0; iteration < SP_PQ_KMEANS_ITERATIONS; iteration++) {
+		bool changed = false;
+		memset(counts, 0, k * sizeof(int));
+		memset(sums, 0, (size_t) k * len * sizeof(double));
+		for (int i = 0; i < n; i++) {
+			const float* x = train + (size_t) i * dim + start;
+			int c = nearestCentroid(centroids, k, len, x);
+			if (c != assignment[i]) {
+				assignment[i] = c;
+				changed = true;
+			}
+			counts[c]++;
+			for (int j = 0; j < len; j++)
+				sums[c * len + j] += x[j];
+		}
+		if (!changed)
+			break;
+		for (int c = 0; c < k; c++) {
+			if (counts[c] == 0) // an empty cluster keeps its centroid
+				continue;
+			for (int j = 0; j < len; j++)
+				centroids[c * len + j] = (float) (sums[c * len + j] / counts[c]);
+		}
+	}
+	for (int c = k; c < SP_PQ_CENTROIDS; c++)
+		memcpy(centroids + c * len, centroids + (c % k) * len,
+				len * sizeof(float));
+	free(assignment);
+	free(counts);
+	free(sums);
+	return true;
+}
+
+SPFeatureStore spFeatureStoreCreateProductQuantized(SPFeatureStore source,
+		int subspaces, bool keepExact) {
+	if (source == NULL || source->size <= 0 || subspaces <= 0
+			|| subspaces > source->dimension
+			|| (source->storage != DOUBLE_STORAGE
+					&& source->storage != FLOAT_STORAGE))
+		return NULL;
+	int n = source->size, dim = source->dimension;
+	int trainSize = n < SP_PQ_MAX_TRAINING_FEATURES ?
+			n : SP_PQ_MAX_TRAINING_FEATURES;
+	// a row holds only the codes, the kernels never load it as a vector
+	SPFeatureStore store = createStore(dim, n, PQ_STORAGE, subspaces);
+	if (store == NULL)
+		return NULL;
+	store->pqSubspaces = subspaces;
+	store->pqStarts = (int*) malloc((subspaces + 1) * sizeof(int));
+	store->pqAxisSubspace = (int*) malloc(dim * sizeof(int));
+	store->pqCentroids = (float*) malloc(
+			(size_t) SP_PQ_CENTROIDS * dim * sizeof(float));
+	if (keepExact)
+		store->exact = (float*) malloc(
+				(size_t) store->capacity * dim * sizeof(float));
+	float* train = (float*) malloc((size_t) trainSize * dim * sizeof(float));
+	float* row = (float*) malloc(dim * sizeof(float));
+	if (store->pqStarts == NULL || store->pqAxisSubspace == NULL
+			|| store->pqCentroids == NULL || (keepExact && store->exact == NULL)
+			|| train == NULL || row == NULL) {
+		free(train);
+		free(row);
+		spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	// the subspaces split the axes as evenly as possible
+	for (int s = 0; s <= subspaces; s++)
+		store->pqStarts[s] = s * dim / subspaces;
+	for (int s = 0; s < subspaces; s++) {
+		for (int i = store->pqStarts[s]; i < store->pqStarts[s + 1]; i++)
+			store->pqAxisSubspace[i] = s;
+	}
+	// train on features spread evenly over the source (every image)
+	for (int t = 0; t < trainSize; t++) {
+		int offset = (int) ((size_t) t * n / trainSize);
+		for (int i = 0; i < dim; i++)
+			train[(size_t) t * dim + i] = (float) spFeatureStoreGetAxisCoor(
+					source, offset, i);
+	}
+	for (int s = 0; s < subspaces; s++) {
+		int start = store->pqStarts[s];
+		if (!trainSubspace(train, trainSize, dim, start,
+				store->pqStarts[s + 1] - start,
+				store->pqCentroids + SP_PQ_CENTROIDS * start)) {
+			free(train);
+			free(row);
+			spFeatureStoreDestroy(store);
+			return NULL;
+		}
+	}
+	free(train);
+	for (int offset = 0; offset < n; offset++) {
+		int target = appendRow(store, source->indexes[offset]);
+		for (int i = 0; i < dim; i++)
+			row[i] = (float) spFeatureStoreGetAxisCoor(source, offset, i);
+		setCodes(store, target, row);
+	}
+	free(row);
+	return store;
+}
+
+/** the nearest code of value in the given axis, values out of range are clamped **/
+static unsigned char quantize(SPFeatureStore store, int axis, double value) {
+	double code = floor(
+			(value - store->quantOffsets[axis]) / store->quantScales[axis]
+					+ 0.5);
+	if (code < 0)
+		return 0;
+	if (code > SP_FEATURE_STORE_MAX_CODE)
+		return SP_FEATURE_STORE_MAX_CODE;
+	return (unsigned char) code;
+}
+
+/** stores value as the axis coordinate of the feature at offset **/
+static void setAxisCoor(SPFeatureStore store, int offset, int axis,
+		double value) {
+	void* row = getRow(store, offset);
+	switch (store->storage) {
+	case FLOAT_STORAGE:
+		((float*) row)[axis] = (float) value;
+		break;
+	case INT8_STORAGE:
+		((unsigned char*) row)[axis] = quantize(store, axis, value);
+		if (store->exact != NULL)
+			store->exact[(size_t) offset * store->dimension + axis] =
+					(float) value;
+		break;
+	default:
+		((double*) row)[axis] = value;
+		break;
+	}
+}
+
+SP_FEATURE_STORE_MSG spFeatureStoreAppend(SPFeatureStore store,
+		const double* data, int index) {
+	if (store == NULL || data == NULL || index < 0
+			|| (store->storage == INT8_STORAGE && store->quantOffsets == NULL)
+			|| store->mapped)
+		return SP_FEATURE_STORE_INVALID_ARGUMENT;
+	int offset = appendRow(store, index);
+	if (offset < 0)
+		return SP_FEATURE_STORE_OUT_OF_MEMORY;
+	if (store->storage == PQ_STORAGE) {
+		float row[store->dimension];
+		for (int i = 0; i < store->dimension; i++)
+			row[i] = (float) data[i];
+		setCodes(store, offset, row);
+		return SP_FEATURE_STORE_SUCCESS;
+	}
+	for (int i = 0; i < store->dimension; i++)
+		setAxisCoor(store, offset, i, data[i]);
+	return SP_FEATURE_STORE_SUCCESS;
+}
+
+SP_FEATURE_STORE_MSG spFeatureStoreAppendFloat(SPFeatureStore store,
+		const float* data, int index) {
+	if (store == NULL || data == NULL || index < 0
+			|| (store->storage == INT8_STORAGE && store->quantOffsets == NULL)
+			|| store->mapped)
+		return SP_FEATURE_STORE_INVALID_ARGUMENT;
+	int offset = appendRow(store, index);
+	if (offset < 0)
+		return SP_FEATURE_STORE_OUT_OF_MEMORY;
+	if (store->storage == PQ_STORAGE) {
+		setCodes(store, offset, data);
+		return SP_FEATURE_STORE_SUCCESS;
+	}
+	for (int i = 0; i < store->dimension; i++)
+		setAxisCoor(store, offset, i, data[i]);
+	return SP_FEATURE_STORE_SUCCESS;
+}
+
+SP_FEATURE_STORE_MSG spFeatureStoreAppendPoint(SPFeatureStore store,
+		SPPoint point) {
+	if (store == NULL || point == NULL
+			|| spPointGetDimension(point) != store->dimension)
+		return SP_FEATURE_STORE_INVALID_ARGUMENT;
+	return spFeatureStoreAppend(store, spPointGetData(point),
+			spPointGetIndex(point));
+}
+
+SP_FEATURE_STORE_MSG spFeatureStoreAppendFrom(SPFeatureStore store,
+		SPFeatureStore source, int offset) {
+	if (store == NULL || source == NULL || offset < 0
+			|| offset >= source->size || store->mapped
+			|| store->dimension != source->dimension
+			|| store->storage != source->storage
+			|| store->rowBytes != source->rowBytes
+			|| (store->exact != NULL && source->exact == NULL))
+		return SP_FEATURE_STORE_INVALID_ARGUMENT;
+	int target = appendRow(store, source->indexes[offset]);
+	if (target < 0)
+		return SP_FEATURE_STORE_OUT_OF_MEMORY;
+	memcpy(getRow(store, target), getRow(source, offset), store->rowBytes);
+	if (store->exact != NULL)
+		memcpy(store->exact + (size_t) target * store->dimension,
+				source->exact + (size_t) offset * source->dimension,
+				store->dimension * sizeof(float));
+	return SP_FEATURE_STORE_SUCCESS;
+}
+
+int spFeatureStoreGetSize(SPFeatureStore store) {
+	if (store == NULL)
+		return -1;
+	return store->size;
+}
+
+int spFeatureStoreGetDimension(SPFeatureStore store) {
+	if (store == NULL)
+		return -1;
+	return store->dimension;
+}
+
+SPFeatureStorage spFeatureStoreGetStorage(SPFeatureStore store) {
+	assert(store != NULL);
+	return store->storage;
+}
+
+int spFeatureStoreGetIndex(SPFeatureStore store, int offset) {
+	assert(store != NULL && offset >= 0 && offset < store->size);
+	return store->indexes[offset];
+}
+
+double spFeatureStoreGetAxisCoor(SPFeatureStore store, int offset, int axis) {
+	assert(store != NULL && offset >= 0 && offset < store->size);
+	assert(axis >= 0 && axis < store->dimension);
+	const void* row = getRow(store, offset);
+	switch (store->storage) {
+	case FLOAT_STORAGE:
+		return ((const float*) row)[axis];
+	case INT8_STORAGE:
+		return store->quantOffsets[axis]
+				+ store->quantScales[axis] * ((const unsigned char*) row)[axis];
+	case PQ_STORAGE: {
+		// the axis of the centroid of its subspace
+		int s = store->pqAxisSubspace[axis];
+		int start = store->pqStarts[s];
+		int len = store->pqStarts[s + 1] - start;
+		return store->pqCentroids[SP_PQ_CENTROIDS * start
+				+ ((const unsigned char*) row)[s] * len + axis - start];
+	}
+	default:
+		return ((const double*) row)[axis];
+	}
+}
+
+const void* spFeatureStoreGetRow(SPFeatureStore store, int offset) {
+	assert(store != NULL && offset >= 0 && offset < store->size);
+	return getRow(store, offset);
+}
+
+SPFeatureQuery spFeatureStorePrepareQuery(SPFeatureStore store, SPPoint p) {
+	if (store == NULL || p == NULL
+			|| spPointGetDimension(p) != store->dimension)
+		return NULL;
+	SPFeatureQuery query = (SPFeatureQuery) malloc(sizeof(*query));
+	if (query == NULL)
+		return NULL;
+	bool needFloat = store->storage == FLOAT_STORAGE || store->exact != NULL;
+	bool needCode = store->storage == INT8_STORAGE;
+	bool needLut = store->storage == PQ_STORAGE;
+	query->dimension = store->dimension;
+	query->coor = (double*) malloc(store->dimension * sizeof(double));
+	query->floatCoor = NULL;
+	query->codeCoor = NULL;
+	query->lut = NULL;
+	if (needFloat)
+		query->floatCoor = (float*) malloc(store->dimension * sizeof(float));
+	if (needCode)
+		query->codeCoor = (float*) malloc(store->dimension * sizeof(float));
+	if (needLut)
+		query->lut = (float*) malloc(
+				(size_t) store->pqSubspaces * SP_PQ_CENTROIDS * sizeof(float));
+	if (query->coor == NULL || (needFloat && query->floatCoor == NULL)
+			|| (needCode && query->codeCoor == NULL)
+			|| (needLut && query->lut == NULL)) {
+		spFeatureQueryDestroy(query);
+		return NULL;
+	}
+	const double* data = spPointGetData(p);
+	for (int i = 0; i < store->dimension; i++) {
+		query->coor[i] = data[i];
+		if (needFloat)
+			query->floatCoor[i] = (float) data[i];
+		if (store->storage == FLOAT_STORAGE) {
+			// the tree compares the query with the stored (float) values
+			query->coor[i] = query->floatCoor[i];
+		}
+		if (needCode) {
+			// the query keeps its precision, only the features are quantized
+			query->codeCoor[i] = (float) ((data[i] - store->quantOffsets[i])
+					/ store->quantScales[i]);
+		}
+	}
+	for (int s = 0; needLut && s < store->pqSubspaces; s++) {
+		// computed once per query, a leaf then costs one lookup per subspace
+		int start = store->pqStarts[s];
+		int len = store->pqStarts[s + 1] - start;
+		const float* centroids = store->pqCentroids + SP_PQ_CENTROIDS * start;
+		for (int c = 0; c < SP_PQ_CENTROIDS; c++) {
+			float distance = 0;
+			for (int j = 0; j < len; j++) {
+				float diff = centroids[c * len + j] - (float) data[start + j];
+				distance += diff * diff;
+			}
+			query->lut[s * SP_PQ_CENTROIDS + c] = distance;
+		}
+	}
+	return query;
+}
+
+void spFeatureQueryDestroy(SPFeatureQuery query) {
+	if (query != NULL) {
+		free(query->coor);
+		free(query->floatCoor);
+		free(query->codeCoor);
+		free(query->lut);
+		free(query);
+	}
+}
+
+double spFeatureQueryGetAxisCoor(SPFeatureQuery query, int axis) {
+	assert(query != NULL && axis >= 0 && axis < query->dimension);
+	return query->coor[axis];
+}
+
+double spFeatureStoreQueryDistance(SPFeatureStore store, int offset,
+		SPFeatureQuery query) {
+	return spFeatureStoreQueryDistanceBounded(store, offset, query, HUGE_VAL);
+}
+
+double spFeatureStoreQueryDistanceBounded(SPFeatureStore store, int offset,
+		SPFeatureQuery query, double bound) {
+	assert(store != NULL && query != NULL);
+	assert(offset >= 0 && offset < store->size);
+	assert(query->dimension == store->dimension);
+	switch (store->storage) {
+	case FLOAT_STORAGE:
+		return store->l2FloatKernel((const float*) getRow(store, offset),
+				query->floatCoor, store->dimension, bound);
+	case INT8_STORAGE:
+		return spL2SquaredDistanceUInt8Bounded(query->codeCoor,
+				(const unsigned char*) getRow(store, offset),
+				store->quantWeights, store->dimension, bound);
+	case PQ_STORAGE:
+		return spPQDistanceBounded(query->lut,
+				(const unsigned char*) getRow(store, offset),
+				store->pqSubspaces, bound);
+	default:
+		return store->l2Kernel((const double*) getRow(store, offset),
+				query->coor, store->dimension, bound);
+	}
+}
+
+/** checks that order is a permutation of 0 to size - 1 **/
+static bool isPermutation(const int* order, int size) {
+	bool* seen = (bool*) calloc(size, sizeof(bool));
+	bool valid = seen != NULL;
+	for (int i = 0; valid && i < size; i++) {
+		valid = order[i] >= 0 && order[i] < size && !seen[order[i]];
+		if (valid)
+			seen[order[i]] = true;
+	}
+	free(seen);
+	return valid;
+}
+
+SP_FEATURE_STORE_MSG spFeatureStorePermute(SPFeatureStore store,
+		const int* order) {
+	if (store == NULL || order == NULL || store->mapped)
+		return SP_FEATURE_STORE_INVALID_ARGUMENT;
+	if (store->size == 0)
+		return SP_FEATURE_STORE_SUCCESS;
+	if (!isPermutation(order, store->size))
+		return SP_FEATURE_STORE_INVALID_ARGUMENT;
+	size_t exactBytes = store->dimension * sizeof(float);
+	bool* placed = (bool*) calloc(store->size, sizeof(bool));
+	char* row = (char*) malloc(store->rowBytes);
+	float* exact = (float*) malloc(exactBytes);
+	if (placed == NULL || row == NULL || exact == NULL) {
+		free(placed);
+		free(row);
+		free(exact);
+		return SP_FEATURE_STORE_OUT_OF_MEMORY;
+	}
+	// in place, one cycle of the permutation at a time: every feature of
+	// the cycle moves to the offset that takes it, the first one last
+	for (int start = 0; start < store->size; start++) {
+		if (placed[start])
+			continue;
+		int index = store->indexes[start];
+		memcpy(row, getRow(store, start), store->rowBytes);
+		if (store->exact != NULL)
+			memcpy(exact, store->exact + (size_t) start * store->dimension,
+					exactBytes);
+		int offset = start;
+		while (order[offset] != start) {
+			int from = order[offset];
+			memcpy(getRow(store, offset), getRow(store, from), store->rowBytes);
+			store->indexes[offset] = store->indexes[from];
+			if (store->exact != NULL)
+				memcpy(store->exact + (size_t) offset * store->dimension,
+						store->exact + (size_t) from * store->dimension,
+						exactBytes);
+			placed[offset] = true;
+			offset = from;
+		}
+		memcpy(getRow(store, offset), row, store->rowBytes);
+		store->indexes[offset] = index;
+		if (store->exact != NULL)
+			memcpy(store->exact + (size_t) offset * store->dimension, exact,
+					exactBytes);
+		placed[offset] = true;
+	}
+	free(placed);
+	free(row);
+	free(exact);
+	if (store->blocks != NULL)
+		return spFeatureStoreBuildBlocks(store);
+	return SP_FEATURE_STORE_SUCCESS;
+}
+
+SP_FEATURE_STORE_MSG spFeatureStoreBuildBlocks(SPFeatureStore store) {
+	void* blocksBlock = NULL;
+	char* blocks = NULL;
+	if (store == NULL || store->size == 0
+			|| (store->storage != DOUBLE_STORAGE
+					&& store->storage != FLOAT_STORAGE))
+		return SP_FEATURE_STORE_INVALID_ARGUMENT;
+	int dim = store->dimension;
+	int count = (store->size + SP_DISTANCE_BLOCK - 1) / SP_DISTANCE_BLOCK;
+	size_t blockSize = (size_t) dim * SP_DISTANCE_BLOCK;
+	blocks = allocAlignedBlock(
+			count * blockSize * elementSize(store->storage), &blocksBlock);
+	if (blocks == NULL)
+		return SP_FEATURE_STORE_OUT_OF_MEMORY;
+	// the points after the last feature stay zero
+	for (int offset = 0; offset < store->size; offset++) {
+		size_t first = (offset / SP_DISTANCE_BLOCK) * blockSize
+				+ offset % SP_DISTANCE_BLOCK;
+		const void* row = getRow(store, offset);
+		for (int i = 0; i < dim; i++) {
+			if (store->storage == FLOAT_STORAGE)
+				((float*) blocks)[first + i * SP_DISTANCE_BLOCK] =
+						((const float*) row)[i];
+			else
+				((double*) blocks)[first + i * SP_DISTANCE_BLOCK] =
+						((const double*) row)[i];
+		}
+	}
+	free(store->blocksBlock);
+	store->blocksBlock = blocksBlock;
+	store->blocks = blocks;
+	return SP_FEATURE_STORE_SUCCESS;
+}
+
+bool spFeatureStoreHasBlocks(SPFeatureStore store) {
+	return store != NULL && store->blocks != NULL;
+}
+
+void spFeatureStoreQueryDistanceBlock(SPFeatureStore store, int block,
+		SPFeatureQuery query, double bound, double* distances) {
+	assert(store != NULL && store->blocks != NULL && query != NULL);
+	assert(block >= 0 && block * SP_DISTANCE_BLOCK < store->size);
+	assert(distances != NULL);
+	size_t first = (size_t) block * store->dimension * SP_DISTANCE_BLOCK;
+	if (store->storage == FLOAT_STORAGE) {
+		float floatDistances[SP_DISTANCE_BLOCK];
+		spL2SquaredDistanceFloatBlock(query->floatCoor,
+				(const float*) store->blocks + first, store->dimension, bound,
+				floatDistances);
+		for (int j = 0; j < SP_DISTANCE_BLOCK; j++)
+			distances[j] = floatDistances[j];
+	} else {
+		spL2SquaredDistanceBlock(query->coor,
+				(const double*) store->blocks + first, store->dimension,
+				bound, distances);
+	}
+}
+
+double spFeatureStoreQueryExactDistance(SPFeatureStore store, int offset,
+		SPFeatureQuery query) {
+	assert(store != NULL && query != NULL);
+	assert(offset >= 0 && offset < store->size);
+	assert(query->dimension == store->dimension);
+	if (store->exact != NULL)
+		return store->l2FloatKernel(
+				store->exact + (size_t) offset * store->dimension,
+				query->floatCoor, store->dimension, HUGE_VAL);
+	return spFeatureStoreQueryDistance(store, offset, query);
+}
+
+/** the number of blocks of store and the bytes of each **/
+static size_t blocksBytes(SPFeatureStore store) {
+	size_t count = (store->size + SP_DISTANCE_BLOCK - 1) / SP_DISTANCE_BLOCK;
+	return count * store->dimension * SP_DISTANCE_BLOCK
+			* elementSize(store->storage);
+}
+
+/**
+ * writes bytes from source to file, after zeros up to the next multiple
+ * of SP_FEATURE_STORE_ALIGNMENT (counted from the start of the file)
+ **/
+static bool writeSection(FILE* file, const void* source, size_t bytes) {
+	static const char zeros[SP_FEATURE_STORE_ALIGNMENT] = { 0 };
+	long position = ftell(file);
+	if (position < 0)
+		return false;
+	size_t padding = (SP_FEATURE_STORE_ALIGNMENT
+			- position % SP_FEATURE_STORE_ALIGNMENT)
+			% SP_FEATURE_STORE_ALIGNMENT;
+	return fwrite(zeros, 1, padding, file) == padding
+			&& fwrite(source, 1, bytes, file) == bytes;
+}
+
+/**
+ * the address of a section of bytes bytes written by writeSection at
+ * *offset of the length bytes at base, *offset is moved after it. NULL if
+ * the section does not fit.
+ **/
+static char* mapSection(const char* base, size_t length, size_t* offset,
+		size_t bytes) {
+	size_t start = (*offset + SP_FEATURE_STORE_ALIGNMENT - 1)
+			/ SP_FEATURE_STORE_ALIGNMENT * SP_FEATURE_STORE_ALIGNMENT;
+	if (start > length || bytes > length - start)
+		return NULL;
+	*offset = start + bytes;
+	return (char*) base + start;
+}
+
+SP_FEATURE_STORE_MSG spFeatureStoreWrite(SPFeatureStore store, FILE* file) {
+	int header[SP_FEATURE_STORE_HEADER_INTS];
+	if (store == NULL || file == NULL)
+		return SP_FEATURE_STORE_INVALID_ARGUMENT;
+	size_t size = store->size;
+	size_t dim = store->dimension;
+	header[0] = store->dimension;
+	header[1] = store->storage;
+	header[2] = (int) store->rowBytes;
+	header[3] = store->size;
+	header[4] = store->pqSubspaces;
+	header[5] = store->quantOffsets != NULL;
+	header[6] = store->exact != NULL;
+	header[7] = store->blocks != NULL;
+	bool written = writeSection(file, header, sizeof(header))
+			&& writeSection(file, store->data, size * store->rowBytes)
+			&& writeSection(file, store->indexes, size * sizeof(int));
+	if (written && store->quantOffsets != NULL)
+		written = writeSection(file, store->quantOffsets, dim * sizeof(double))
+				&& writeSection(file, store->quantScales, dim * sizeof(double))
+				&& writeSection(file, store->quantWeights, dim * sizeof(float));
+	if (written && store->exact != NULL)
+		written = writeSection(file, store->exact, size * dim * sizeof(float));
+	if (written && store->storage == PQ_STORAGE)
+		written = writeSection(file, store->pqStarts,
+				(store->pqSubspaces + 1) * sizeof(int))
+				&& writeSection(file, store->pqAxisSubspace, dim * sizeof(int))
+				&& writeSection(file, store->pqCentroids,
+						SP_PQ_CENTROIDS * dim * sizeof(float));
+	if (written && store->blocks != NULL)
+		written = writeSection(file, store->blocks, blocksBytes(store));
+	return written ? SP_FEATURE_STORE_SUCCESS : SP_FEATURE_STORE_WRITE_ERROR;
+}
+
+SPFeatureStore spFeatureStoreMap(const char* base, size_t length,
+		size_t* offset) {
+	int header[SP_FEATURE_STORE_HEADER_INTS];
+	const char* section = NULL;
+	if (base == NULL || offset == NULL)
+		return NULL;
+	section = mapSection(base, length, offset, sizeof(header));
+	if (section == NULL)
+		return NULL;
+	memcpy(header, section, sizeof(header));
+	int dim = header[0];
+	SPFeatureStorage storage = (SPFeatureStorage) header[1];
+	int subspaces = header[4];
+	if (dim <= 0 || header[3] < 0
+			|| (storage != DOUBLE_STORAGE && storage != FLOAT_STORAGE
+					&& storage != INT8_STORAGE && storage != PQ_STORAGE)
+			|| (storage == PQ_STORAGE && (subspaces <= 0 || subspaces > dim))
+			|| (size_t) header[2] != (storage == PQ_STORAGE ?
+					(size_t) subspaces : calculateRowBytes(dim, storage))
+			|| (header[5] && storage != INT8_STORAGE)
+			|| (header[7] && storage != DOUBLE_STORAGE
+					&& storage != FLOAT_STORAGE))
+		return NULL;
+	SPFeatureStore store = (SPFeatureStore) malloc(sizeof(*store));
+	if (store == NULL)
+		return NULL;
+	size_t size = header[3];
+	store->dimension = dim;
+	store->storage = storage;
+	store->rowBytes = header[2];
+	store->size = header[3];
+	store->capacity = header[3];
+	store->block = NULL;
+	store->quantOffsets = NULL;
+	store->quantScales = NULL;
+	store->quantWeights = NULL;
+	store->exact = NULL;
+	store->pqSubspaces = storage == PQ_STORAGE ? subspaces : 0;
+	store->pqStarts = NULL;
+	store->pqAxisSubspace = NULL;
+	store->pqCentroids = NULL;
+	store->l2Kernel = spDistanceGetKernelFunction(dim);
+	store->l2FloatKernel = spDistanceGetFloatKernelFunction(dim);
+	store->blocksBlock = NULL;
+	store->blocks = NULL;
+	store->mapped = true;
+	store->data = mapSection(base, length, offset, size * store->rowBytes);
+	store->indexes = (int*) mapSection(base, length, offset,
+			size * sizeof(int));
+	bool valid = store->data != NULL && store->indexes != NULL;
+	if (valid && header[5]) {
+		store->quantOffsets = (double*) mapSection(base, length, offset,
+				dim * sizeof(double));
+		store->quantScales = (double*) mapSection(base, length, offset,
+				dim * sizeof(double));
+		store->quantWeights = (float*) mapSection(base, length, offset,
+				dim * sizeof(float));
+		valid = store->quantOffsets != NULL && store->quantScales != NULL
+				&& store->quantWeights != NULL;
+	}
+	if (valid && header[6]) {
+		store->exact = (float*) mapSection(base, length, offset,
+				size * dim * sizeof(float));
+		valid = store->exact != NULL;
+	}
+	if (valid && storage == PQ_STORAGE) {
+		store->pqStarts = (int*) mapSection(base, length, offset,
+				(subspaces + 1) * sizeof(int));
+		store->pqAxisSubspace = (int*) mapSection(base, length, offset,
+				dim * sizeof(int));
+		store->pqCentroids = (float*) mapSection(base, length, offset,
+				(size_t) SP_PQ_CENTROIDS * dim * sizeof(float));
+		valid = store->pqStarts != NULL && store->pqAxisSubspace != NULL
+				&& store->pqCentroids != NULL;
+		// the codes index the centroids through the subspace of every axis
+		for (int s = 0; valid && s <= subspaces; s++)
+			valid = store->pqStarts[s] == s * dim / subspaces;
+		for (int i = 0; valid && i < dim; i++)
+			valid = store->pqAxisSubspace[i] >= 0
+					&& store->pqAxisSubspace[i] < subspaces;
+	}
+	if (valid && header[7]) {
+		store->blocks = mapSection(base, length, offset, blocksBytes(store));
+		valid = store->blocks != NULL;
+	}
+	if (!valid || (storage == INT8_STORAGE && !header[5])) {
+		free(store);
+		return NULL;
+	}
+	return store;
+}
@@ -0,0 +1,459 @@
+#ifndef SPFEATURESTORE_H_
+#define SPFEATURESTORE_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "SPPoint.h"
+#include "SPConfig.h"
+
+/**
+ * SP Feature Store summary
+ *
+ * Holds the features of the whole image collection in a single contiguous,
+ * cache-line aligned block of coordinates together with a parallel array
+ * of image indexes. The coordinates are stored as double or, to halve the
+ * memory of the index, as float (see SPFeatureStorage). Every feature is referenced by its integer offset in
+ * the store (0 <= offset < size) instead of by a separately allocated
+ * SPPoint, so the KD-array and the KD-tree only keep int offsets.
+ *
+ * Every row is padded with zeros up to a multiple of
+ * SP_FEATURE_STORE_ROW_ALIGNMENT bytes, so each row starts on an aligned
+ * address and vector kernels never straddle two rows.
+ *
+ * With INT8_STORAGE every coordinate is kept as an 8-bit code of a per
+ * dimension affine quantizer (coordinate = offset + scale * code), which
+ * must be set by spFeatureStoreSetQuantization before the first append.
+ * The query is not quantized, so the distances are asymmetric: the exact
+ * query against the decoded features. A float copy of the features can be
+ * kept to rerank the candidates by their exact distance.
+ *
+ * With PQ_STORAGE (product quantization) the axes are split into subspaces
+ * and every feature is kept as the index of the nearest of SP_PQ_CENTROIDS
+ * centroids in every subspace, one byte per subspace. The centroids are
+ * trained by k-means on the features of a DOUBLE or FLOAT store, see
+ * spFeatureStoreCreateProductQuantized. A query is compared with the codes
+ * through a lookup table of its distances to every centroid.
+ *
+ * A DOUBLE or FLOAT store can also keep a dimension-major copy of its
+ * features in blocks of SP_DISTANCE_BLOCK consecutive offsets, so a query
+ * is scored against a whole block by one call of the block kernels of
+ * SPDistance (see spFeatureStoreBuildBlocks).
+ *
+ * A query point is compared with the stored features through an
+ * SPFeatureQuery, a copy of the point converted once to the element type
+ * of the store, so the distance kernels never convert coordinates.
+ *
+ * The following functions are supported:
+ *
+ * spFeatureStoreCreate			- Creates a new empty store
+ * spFeatureStoreDestroy		- Free all resources associated with a store
+ * spFeatureStoreCreateProductQuantized - Creates a PQ store from a store
+ * spFeatureStoreCreateLike		- Creates an empty store with the layout of a store
+ * spFeatureStoreSetQuantization - Sets the quantizer of an INT8 store
+ * spFeatureStoreAppend			- Appends a feature to the store
+ * spFeatureStoreAppendFloat	- Appends a feature given as floats to the store
+ * spFeatureStoreAppendPoint	- Appends an SPPoint to the store
+ * spFeatureStoreAppendFrom		- Appends a feature of a store created alike
+ * spFeatureStoreGetSize		- A getter of the number of features in the store
+ * spFeatureStoreGetDimension	- A getter of the dimension of the features
+ * spFeatureStoreGetStorage		- A getter of the element type of the coordinates
+ * spFeatureStoreGetIndex		- A getter of the image index of a feature
+ * spFeatureStoreGetAxisCoor	- A getter of a given coordinate of a feature
+ * spFeatureStoreGetRow			- A getter of the coordinates row of a feature
+ * spFeatureStorePrepareQuery	- Creates a query for a point
+ * spFeatureQueryDestroy		- Free all resources associated with a query
+ * spFeatureQueryGetAxisCoor	- A getter of a given coordinate of a query
+ * spFeatureStoreQueryDistance	- The L2 squared distance between a feature and a query
+ * spFeatureStoreQueryDistanceBounded - The same distance, abandoned above a bound
+ * spFeatureStoreQueryExactDistance - The distance to the unquantized feature
+ * spFeatureStorePermute		- Reorders the features of the store
+ * spFeatureStoreBuildBlocks	- Builds the dimension-major blocks of the features
+ * spFeatureStoreHasBlocks		- Checks if the blocks are built
+ * spFeatureStoreQueryDistanceBlock - The distances between a block and a query
+ * spFeatureStoreWrite			- Writes the store to a binary file
+ * spFeatureStoreMap			- A read-only store over a written store in memory
+ *
+ */
+
+/** Alignment (in bytes) of the coordinates block **/
+#define SP_FEATURE_STORE_ALIGNMENT 64
+/** Alignment (in bytes) of every row inside the coordinates block **/
+#define SP_FEATURE_STORE_ROW_ALIGNMENT 32
+
+/** type used to define the feature store **/
+typedef struct sp_feature_store_t* SPFeatureStore;
+
+/** type used to define a query prepared for a feature store **/
+typedef struct sp_feature_query_t* SPFeatureQuery;
+
+/** type for error reporting **/
+typedef enum sp_feature_store_msg_t {
+	SP_FEATURE_STORE_OUT_OF_MEMORY,
+	SP_FEATURE_STORE_INVALID_ARGUMENT,
+	SP_FEATURE_STORE_WRITE_ERROR,
+	SP_FEATURE_STORE_SUCCESS
+} SP_FEATURE_STORE_MSG;
+
+/**
+ * Allocates a new empty store for features of dimension dim.
+ *
+ * @param dim - The dimension of every feature in the store
+ * @param capacity - The number of features to reserve room for, the store
+ * 					 grows on demand when more features are appended
+ * @param storage - The element type the coordinates are kept in
+ * @return
+ * NULL in case allocation failure occurred OR dim <= 0 OR capacity < 0
+ * OR storage is not DOUBLE_STORAGE, FLOAT_STORAGE or INT8_STORAGE
+ * Otherwise, the new store is returned
+ */
+SPFeatureStore spFeatureStoreCreate(int dim, int capacity,
+		SPFeatureStorage storage);
+
+/**
+ * Creates a PQ_STORAGE store holding the features of source (in the same
+ * offsets, with the same image indexes). The axes are split into subspaces
+ * contiguous ranges of (almost) equal length and the centroids of every
+ * subspace are trained by k-means on up to 16384 features of source, spread
+ * evenly over it. The training is deterministic.
+ * Features appended to the new store are encoded with these centroids.
+ *
+ * @param source - The store holding the exact features
+ * @param subspaces - The number of subspaces (bytes of every feature)
+ * @param keepExact - If true, a float copy of every feature is kept as well,
+ * 					  for spFeatureStoreQueryExactDistance
+ * @return
+ * NULL in case allocation failure occurred OR source == NULL OR source is
+ * empty OR the storage of source is not DOUBLE_STORAGE or FLOAT_STORAGE OR
+ * subspaces <= 0 OR subspaces > dim(source)
+ * Otherwise, the new store is returned
+ */
+SPFeatureStore spFeatureStoreCreateProductQuantized(SPFeatureStore source,
+		int subspaces, bool keepExact);
+
+/**
+ * Allocates a new empty store with the layout of model: the same dimension
+ * and storage, the same quantizer (INT8_STORAGE) or centroids (PQ_STORAGE),
+ * and a float copy of the features if model keeps one. A feature of one
+ * store is encoded as in every store created like it, and a query prepared
+ * for one of them (see spFeatureStorePrepareQuery) is valid for all.
+ *
+ * @param model - The store whose layout is copied, its features are not
+ * @param capacity - The number of features to reserve room for
+ * @return
+ * NULL in case allocation failure occurred OR model == NULL OR capacity < 0
+ * Otherwise, the new store is returned
+ */
+SPFeatureStore spFeatureStoreCreateLike(SPFeatureStore model, int capacity);
+
+/**
+ * Free all memory allocation associated with store,
+ * if store is NULL nothing happens.
+ */
+void spFeatureStoreDestroy(SPFeatureStore store);
+
+/**
+ * Sets the quantizer of an INT8_STORAGE store. Coordinate i of every appended
+ * feature is kept as the nearest code of offsets[i] + scales[i] * code,
+ * 0 <= code <= 255 (values out of range are clamped).
+ *
+ * @param store - The target store
+ * @param offsets - The dim(store) values decoded from code 0
+ * @param scales - The dim(store) steps between two consecutive codes
+ * @param keepExact - If true, a float copy of every feature is kept as well,
+ * 					  for spFeatureStoreQueryExactDistance
+ * @return
+ * SP_FEATURE_STORE_INVALID_ARGUMENT if store == NULL or offsets == NULL or
+ * scales == NULL or the storage of store is not INT8_STORAGE or store is not
+ * empty or its quantizer was already set or some scale is not positive
+ * SP_FEATURE_STORE_OUT_OF_MEMORY if an allocation failure occurred
+ * SP_FEATURE_STORE_SUCCESS otherwise
+ */
+SP_FEATURE_STORE_MSG spFeatureStoreSetQuantization(SPFeatureStore store,
+		const double* offsets, const double* scales, bool keepExact);
+
+/**
+ * Appends a new feature to the end of the store. The offset of the new
+ * feature is the size of the store before the call. The coordinates are
+ * converted to the element type of the store (encoded with the centroids
+ * of a PQ_STORAGE store).
+ *
+ * @param store - The target store
+ * @param data - The dim coordinates of the feature
+ * @param index - The index of the image the feature belongs to
+ * @return
+ * SP_FEATURE_STORE_INVALID_ARGUMENT if store == NULL or data == NULL or index < 0
+ * or store is an INT8_STORAGE store without a quantizer or a mapped store
+ * SP_FEATURE_STORE_OUT_OF_MEMORY if growing the store failed
+ * SP_FEATURE_STORE_SUCCESS otherwise
+ */
+SP_FEATURE_STORE_MSG spFeatureStoreAppend(SPFeatureStore store,
+		const double* data, int index);
+
+/**
+ * Same as spFeatureStoreAppend, for coordinates given as floats.
+ */
+SP_FEATURE_STORE_MSG spFeatureStoreAppendFloat(SPFeatureStore store,
+		const float* data, int index);
+
+/**
+ * Appends the coordinates and the index of point to the end of the store.
+ *
+ * @return
+ * SP_FEATURE_STORE_INVALID_ARGUMENT if store == NULL or point == NULL or
+ * the dimension of point differs from the dimension of the store
+ * SP_FEATURE_STORE_OUT_OF_MEMORY if growing the store failed
+ * SP_FEATURE_STORE_SUCCESS otherwise
+ */
+SP_FEATURE_STORE_MSG spFeatureStoreAppendPoint(SPFeatureStore store,
+		SPPoint point);
+
+/**
+ * Appends the feature at offset of source (its coordinates as stored, the
+ * float copy if store keeps one, and its image index) to the end of store.
+ * The feature is copied, not encoded again, so source must be created like
+ * store (see spFeatureStoreCreateLike) or be the store it was created like.
+ *
+ * @return
+ * SP_FEATURE_STORE_INVALID_ARGUMENT if store == NULL or source == NULL or
+ * offset is out of range or the layouts of the stores differ (dimension,
+ * storage, row size, or store keeps a float copy and source does not)
+ * or store is a mapped store
+ * SP_FEATURE_STORE_OUT_OF_MEMORY if growing the store failed
+ * SP_FEATURE_STORE_SUCCESS otherwise
+ */
+SP_FEATURE_STORE_MSG spFeatureStoreAppendFrom(SPFeatureStore store,
+		SPFeatureStore source, int offset);
+
+/**
+ * A getter for the number of features in the store
+ *
+ * @return
+ * -1 if store == NULL, otherwise the number of features
+ */
+int spFeatureStoreGetSize(SPFeatureStore store);
+
+/**
+ * A getter for the dimension of the features in the store
+ *
+ * @return
+ * -1 if store == NULL, otherwise the dimension
+ */
+int spFeatureStoreGetDimension(SPFeatureStore store);
+
+/**
+ * A getter for the element type of the coordinates in the store
+ *
+ * @assert store != NULL
+ * @return
+ * The storage the store was created with
+ */
+SPFeatureStorage spFeatureStoreGetStorage(SPFeatureStore store);
+
+/**
+ * A getter for the image index of a feature
+ *
+ * @param store - The source store
+ * @param offset - The offset of the feature
+ * @assert store != NULL && 0 <= offset < size(store)
+ * @return
+ * The index of the image the feature belongs to
+ */
+int spFeatureStoreGetIndex(SPFeatureStore store, int offset);
+
+/**
+ * A getter for specific coordinate value of a feature
+ *
+ * @param store - The source store
+ * @param offset - The offset of the feature
+ * @param axis - The coordinate which its value will be retrieved
+ * @assert store != NULL && 0 <= offset < size(store) && 0 <= axis < dim(store)
+ * @return
+ * The value of the given coordinate (decoded, for INT8_STORAGE and PQ_STORAGE)
+ */
+double spFeatureStoreGetAxisCoor(SPFeatureStore store, int offset, int axis);
+
+/**
+ * A getter for the coordinates row of a feature. The row is aligned to
+ * SP_FEATURE_STORE_ROW_ALIGNMENT bytes and holds dim(store) coordinates of
+ * the element type of the store (double, float or uint8 codes) followed by
+ * zero padding. A row of a PQ_STORAGE store holds only the code of every
+ * subspace and is not aligned.
+ *
+ * @param store - The source store
+ * @param offset - The offset of the feature
+ * @assert store != NULL && 0 <= offset < size(store)
+ * @return
+ * A pointer to the coordinates of the feature, it is owned by the store
+ * and valid until the next append
+ */
+const void* spFeatureStoreGetRow(SPFeatureStore store, int offset);
+
+/**
+ * Creates a query for p that can be compared with the features of store.
+ * The coordinates of p are converted to the element type of the store.
+ *
+ * @param store - The store the query will be compared with
+ * @param p - The query point
+ * @return
+ * NULL in case allocation failure occurred OR store == NULL OR p == NULL OR
+ * dim(p) != dim(store)
+ * Otherwise, the new query is returned
+ */
+SPFeatureQuery spFeatureStorePrepareQuery(SPFeatureStore store, SPPoint p);
+
+/**
+ * Free all memory allocation associated with query,
+ * if query is NULL nothing happens.
+ */
+void spFeatureQueryDestroy(SPFeatureQuery query);
+
+/**
+ * A getter for specific coordinate value of a query, rounded to the
+ * element type of the store the query was prepared for (INT8_STORAGE and
+ * PQ_STORAGE queries keep the exact coordinates).
+ *
+ * @assert query != NULL && 0 <= axis < dim(query)
+ * @return
+ * The value of the given coordinate
+ */
+double spFeatureQueryGetAxisCoor(SPFeatureQuery query, int axis);
+
+/**
+ * Calculates the L2-squared distance between the feature at offset and
+ * query, using the double, float, uint8 or lookup table kernel of SPDistance
+ * (the double and float kernels are specialized for the dimension of store).
+ *
+ * @param store - The source store
+ * @param offset - The offset of the feature
+ * @param query - A query prepared for store
+ * @assert store != NULL && query != NULL && 0 <= offset < size(store)
+ * @return
+ * The L2-Squared distance between the feature and the query
+ */
+double spFeatureStoreQueryDistance(SPFeatureStore store, int offset,
+		SPFeatureQuery query);
+
+/**
+ * Same as spFeatureStoreQueryDistance, but gives up as soon as the distance
+ * is known to be greater than bound (see spL2SquaredDistanceBounded).
+ *
+ * @return
+ * The L2-Squared distance between the feature and the query if it is not
+ * greater than bound, otherwise some value greater than bound
+ */
+double spFeatureStoreQueryDistanceBounded(SPFeatureStore store, int offset,
+		SPFeatureQuery query, double bound);
+
+/**
+ * Calculates the L2-squared distance between query and the unquantized
+ * feature at offset. For an INT8_STORAGE or PQ_STORAGE store that keeps a
+ * float copy of its features the copy is used, otherwise it is the same as
+ * spFeatureStoreQueryDistance.
+ *
+ * @assert store != NULL && query != NULL && 0 <= offset < size(store)
+ * @return
+ * The L2-Squared distance between the exact feature and the query
+ */
+double spFeatureStoreQueryExactDistance(SPFeatureStore store, int offset,
+		SPFeatureQuery query);
+
+/**
+ * Reorders the features of store so that the feature at offset i is the
+ * one that was at offset order[i] (coordinates, image index and exact copy
+ * move together). Used to place the points of every kd-tree leaf at
+ * consecutive offsets. Any offset obtained before the call is invalidated.
+ * The features are moved in place, one cycle of order at a time, so no
+ * second copy of the store is allocated. The blocks are rebuilt if they
+ * were built.
+ *
+ * @param store - The target store
+ * @param order - A permutation of 0 to size(store) - 1
+ * @return
+ * SP_FEATURE_STORE_INVALID_ARGUMENT if store == NULL or order == NULL or
+ * order is not a permutation of the offsets of store (store is unchanged)
+ * SP_FEATURE_STORE_OUT_OF_MEMORY if an allocation failure occurred
+ * SP_FEATURE_STORE_SUCCESS otherwise
+ */
+SP_FEATURE_STORE_MSG spFeatureStorePermute(SPFeatureStore store,
+		const int* order);
+
+/**
+ * Builds the dimension-major copy of the features: block b holds the
+ * features at offsets b * SP_DISTANCE_BLOCK to b * SP_DISTANCE_BLOCK +
+ * SP_DISTANCE_BLOCK - 1 (the points after the last feature are zero).
+ * The blocks double the memory of the coordinates, and they are dropped by
+ * the next append.
+ *
+ * @param store - The target store
+ * @return
+ * SP_FEATURE_STORE_INVALID_ARGUMENT if store == NULL or store is empty or
+ * the storage of store is not DOUBLE_STORAGE or FLOAT_STORAGE
+ * SP_FEATURE_STORE_OUT_OF_MEMORY if an allocation failure occurred
+ * SP_FEATURE_STORE_SUCCESS otherwise
+ */
+SP_FEATURE_STORE_MSG spFeatureStoreBuildBlocks(SPFeatureStore store);
+
+/**
+ * @return
+ * true if the blocks of store are built (and up to date), false otherwise
+ */
+bool spFeatureStoreHasBlocks(SPFeatureStore store);
+
+/**
+ * Calculates the L2-squared distances between query and the features of a
+ * block, using the block kernels of SPDistance.
+ *
+ * @param store - The source store
+ * @param block - The index of the block
+ * @param query - A query prepared for store
+ * @param bound - The largest distance the caller is interested in
+ * @param distances - SP_DISTANCE_BLOCK values to store the distances in,
+ * 					  the values of the points after the last feature are
+ * 					  meaningless
+ * @assert store != NULL && spFeatureStoreHasBlocks(store) && query != NULL
+ * && distances != NULL && 0 <= block * SP_DISTANCE_BLOCK < size(store)
+ * After the call distances[j] is the value of spFeatureStoreQueryDistance
+ * for the feature at offset block * SP_DISTANCE_BLOCK + j if it is not
+ * greater than bound, otherwise some value greater than bound
+ */
+void spFeatureStoreQueryDistanceBlock(SPFeatureStore store, int block,
+		SPFeatureQuery query, double bound, double* distances);
+
+/**
+ * Writes store at the current position of file: a small header, then every
+ * array of the store (rows, image indexes, quantizer, exact copy, PQ
+ * codebooks and blocks, those that exist) as is, each one starting at a
+ * multiple of SP_FEATURE_STORE_ALIGNMENT bytes from the start of the file.
+ * The file holds no pointers and can be mapped back by spFeatureStoreMap
+ * on a machine of the same byte order.
+ *
+ * @param store - The source store
+ * @param file - A binary file open for writing
+ * @return
+ * SP_FEATURE_STORE_INVALID_ARGUMENT if store == NULL or file == NULL
+ * SP_FEATURE_STORE_WRITE_ERROR if writing to file failed
+ * SP_FEATURE_STORE_SUCCESS otherwise
+ */
+SP_FEATURE_STORE_MSG spFeatureStoreWrite(SPFeatureStore store, FILE* file);
+
+/**
+ * Creates a store over a store written by spFeatureStoreWrite, without
+ * copying it: the arrays of the store point into base. base must be
+ * aligned to SP_FEATURE_STORE_ALIGNMENT (as a mapped file is) and stay
+ * valid until the store is destroyed. The store is read only: appends,
+ * spFeatureStoreSetQuantization and spFeatureStorePermute fail, and
+ * spFeatureStoreDestroy frees only what the store allocated itself.
+ *
+ * @param base - The start of the written file in memory
+ * @param length - The number of bytes at base
+ * @param offset - The offset of the written store from base, moved after
+ * 				   it on success
+ * @return
+ * NULL if base == NULL or offset == NULL or the written store is invalid
+ * or does not fit in length bytes, or an allocation failed.
+ * The mapped store otherwise.
+ */
+SPFeatureStore spFeatureStoreMap(const char* base, size_t length,
+		size_t* offset);
+
+#endif /* SPFEATURESTORE_H_ */
@@ -18,6 +18,9 @@ using namespace std;
 #define PCA_MEAN_STR "mean"
 #define PCA_EIGEN_VEC_STR "e_vectors"
 #define PCA_EIGEN_VAL_STR "e_values"
+#define PCA_QUANT_OFFSETS_STR "q_offsets"
+#define PCA_QUANT_SCALES_STR "q_scales"
+#define QUANT_MAX_CODE 255
 #define STRING_LENGTH 1024
 #define WARNING_MSG_LENGTH 2048
 
@@ -98,6 +101,22 @@ void sp::ImageProc::getFeatures(vector<Mat>& images, Mat& features) {
 	}
 }
 
+void sp::ImageProc::computeQuantization(const Mat& projected) {
+	Mat points;
+	projected.convertTo(points, CV_64F);
+	quantOffsets = Mat(1, pcaDim, CV_64F);
+	quantScales = Mat(1, pcaDim, CV_64F);
+	for (int j = 0; j < pcaDim; j++) {
+		double minVal = 0, maxVal = 0;
+		if (points.rows > 0 && j < points.cols)
+			minMaxLoc(points.col(j), &minVal, &maxVal);
+		quantOffsets.at<double>(0, j) = minVal;
+		// a constant coordinate still needs a positive step
+		quantScales.at<double>(0, j) =
+				maxVal > minVal ? (maxVal - minVal) / QUANT_MAX_CODE : 1;
+	}
+}
+
 void sp::ImageProc::preprocess(const SPConfig config) {
 	try {
 		vector<Mat> images;
@@ -106,6 +125,7 @@ void sp::ImageProc::preprocess(const SPConfig config) {
 		getImagesMat(images, config);
 		getFeatures(images, features);
 		pca = PCA(features, Mat(), CV_PCA_DATA_AS_ROW, pcaDim);
+		computeQuantization(pca.project(features));
 		if (spConfigGetPCAPath(pcaPath, config) != SP_CONFIG_SUCCESS) {
 			spLoggerPrintError(PCA_FILE_NOT_RESOLVED, __FILE__, __func__,
 			__LINE__);
@@ -115,6 +135,8 @@ void sp::ImageProc::preprocess(const SPConfig config) {
 		fs << PCA_EIGEN_VEC_STR << pca.eigenvectors;
 		fs << PCA_EIGEN_VAL_STR << pca.eigenvalues;
 		fs << PCA_MEAN_STR << pca.mean;
+		fs << PCA_QUANT_OFFSETS_STR << quantOffsets;
+		fs << PCA_QUANT_SCALES_STR << quantScales;
 		fs.release();
 	} catch (...) {
 		spLoggerPrintError(GENERAL_ERROR_MSG, __FILE__, __func__, __LINE__);
@@ -140,6 +162,11 @@ void sp::ImageProc::initPCAFromFile(const SPConfig config) {
 	fs[PCA_EIGEN_VEC_STR] >> pca.eigenvectors;
 	fs[PCA_EIGEN_VAL_STR] >> pca.eigenvalues;
 	fs[PCA_MEAN_STR] >> pca.mean;
+	// missing in PCA files written before the quantization was added
+	if (!fs[PCA_QUANT_OFFSETS_STR].empty() && !fs[PCA_QUANT_SCALES_STR].empty()) {
+		fs[PCA_QUANT_OFFSETS_STR] >> quantOffsets;
+		fs[PCA_QUANT_SCALES_STR] >> quantScales;
+	}
 	fs.release();
 }
 
@@ -164,7 +191,7 @@ sp::ImageProc::ImageProc(const SPConfig config) {
 }
 
 SPPoint* sp::ImageProc::getImageFeatures(const char* imagePath, int index,
-		int* numOfFeats) {
+		int* numOfFeats) const {
 	vector<KeyPoint> keypoints;
 	Mat descriptor, img, points;
 	double* pcaSift = NULL;
@@ -206,6 +233,18 @@ SPPoint* sp::ImageProc::getImageFeatures(const char* imagePath, int index,
 	return resPoints;
 }
 
+bool sp::ImageProc::getQuantization(double* offsets, double* scales, int dim) {
+	if (!offsets || !scales || quantOffsets.empty() || quantScales.empty()
+			|| quantOffsets.cols != dim || quantScales.cols != dim) {
+		return false;
+	}
+	for (int j = 0; j < dim; j++) {
+		offsets[j] = quantOffsets.at<double>(0, j);
+		scales[j] = quantScales.at<double>(0, j);
+	}
+	return true;
+}
+
 void sp::ImageProc::showImage(const char* imgPath) {
 	if (minimalGui) {
 		Mat img = imread(imgPath, cv::IMREAD_COLOR);
@@ -21,11 +21,14 @@ private:
 	int numOfImages;
 	int numOfFeatures;
 	cv::PCA pca;
+	cv::Mat quantOffsets; // per dimension minimum of the projected features
+	cv::Mat quantScales; // per dimension step of the 8-bit quantization
 	bool minimalGui;
 	void initFromConfig(const SPConfig);
 	void getImagesMat(std::vector<cv::Mat>&, const SPConfig);
 	void getFeatures(std::vector<cv::Mat>&,
 			cv::Mat&);
+	void computeQuantization(const cv::Mat& projected);
 	void preprocess(const SPConfig config);
 	void initPCAFromFile(const SPConfig config);
 public:
@@ -49,8 +52,23 @@ public:
 	 * @return
 	 * An array of the actual features extracted. NULL is returned in case of
 	 * an error.
+	 * The object is not changed, several threads may extract features at once.
 	 */
-	SPPoint* getImageFeatures(const char* imagePath,int index,int* numOfFeats);
+	SPPoint* getImageFeatures(const char* imagePath,int index,int* numOfFeats) const;
+
+	/**
+	 * Copies the 8-bit quantization of the PCA features, computed from the
+	 * range of the features of the images in extraction mode and saved in
+	 * the PCA file. Coordinate i is quantized as offsets[i] + scales[i] * code.
+	 *
+	 * @param offsets - an array of dim elements to store the offsets in
+	 * @param scales - an array of dim elements to store the scales in
+	 * @param dim - the PCA dimension
+	 * @return
+	 * false if the PCA file has no quantization or its dimension is not dim,
+	 * true otherwise
+	 */
+	bool getQuantization(double* offsets, double* scales, int dim);
 
 	/**
 	 *	Displays the image given by imagePath. Notice that this function works
@@ -0,0 +1,217 @@
+#define _POSIX_C_SOURCE 200112L // mmap
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "SPIndexFile.h"
+#include "SPLogger.h"
+
+#define SP_INDEX_FILE_MAGIC "SPCBIRIX"
+#define SP_INDEX_FILE_MAGIC_BYTES 8
+#define SP_INDEX_FILE_BYTE_ORDER 0x01020304
+// the ints of the header after the magic, the last one is the number of images
+#define SP_INDEX_FILE_HEADER_INTS 13
+#define SP_INDEX_FILE_TEMP_SUFFIX ".tmp"
+#define MAX_LENGTH 1025
+
+struct sp_index_file_t {
+	void* mapping; // the whole file
+	size_t length;
+	SPFeatureStore store; // points into mapping
+	KDTreeNode* root; // points into mapping
+	int numOfImages;
+};
+
+/**
+ * the header of an index file built with config, after the magic: the
+ * version, the byte order, the sizes of the types and the configuration.
+ * The number of images (the last int) is left 0.
+ **/
+static void fillHeader(int* header, const SPConfig config) {
+	SP_CONFIG_MSG msg = SP_CONFIG_SUCCESS;
+	SPFeatureStorage storage = spConfigGetFeatureStorage(config);
+	header[0] = SP_INDEX_FILE_VERSION;
+	header[1] = SP_INDEX_FILE_BYTE_ORDER;
+	header[2] = (int) sizeof(int);
+	header[3] = (int) sizeof(double);
+	header[4] = (int) sizeof(size_t);
+	header[5] = spConfigGetNumOfImages(config, &msg);
+	header[6] = spConfigGetPCADim(config, &msg);
+	header[7] = storage;
+	header[8] = storage == PQ_STORAGE ?
+			spConfigGetPQSubspaces(config, &msg) : 0;
+	header[9] = spConfigGetKDTreeLeafSize(config, &msg);
+	header[10] = spConfigGetSplitMethod(config);
+	header[11] = (storage == INT8_STORAGE || storage == PQ_STORAGE)
+			&& spConfigGetRerankCandidates(config, &msg) > 0;
+	header[12] = 0;
+}
+
+bool spIndexFileWrite(const char* path, const SPConfig config,
+		SPFeatureStore store, KDTreeNode* root, int numOfImages) {
+	static const char zeros[SP_FEATURE_STORE_ALIGNMENT] = { 0 };
+	int header[SP_INDEX_FILE_HEADER_INTS];
+	char tempPath[MAX_LENGTH];
+	if (path == NULL || config == NULL || store == NULL || root == NULL
+			|| strlen(path) + strlen(SP_INDEX_FILE_TEMP_SUFFIX) >= MAX_LENGTH) {
+		spLoggerPrintError("Invalid arguments", __FILE__, __func__, __LINE__);
+		return false;
+	}
+	size_t treeBytes = getTreeBytes(root);
+	fillHeader(header, config);
+	header[SP_INDEX_FILE_HEADER_INTS - 1] = numOfImages;
+	sprintf(tempPath, "%s%s", path, SP_INDEX_FILE_TEMP_SUFFIX);
+	FILE* file = fopen(tempPath, "wb");
+	if (file == NULL) {
+		spLoggerPrintError("The index file couldn't be created", __FILE__,
+				__func__, __LINE__);
+		return false;
+	}
+	bool written = fwrite(SP_INDEX_FILE_MAGIC, 1, SP_INDEX_FILE_MAGIC_BYTES,
+			file) == SP_INDEX_FILE_MAGIC_BYTES
+			&& fwrite(header, sizeof(int), SP_INDEX_FILE_HEADER_INTS, file)
+					== SP_INDEX_FILE_HEADER_INTS
+			&& fwrite(&treeBytes, sizeof(size_t), 1, file) == 1
+			&& spFeatureStoreWrite(store, file) == SP_FEATURE_STORE_SUCCESS;
+	// the nodes start at a multiple of the store alignment as well
+	long position = written ? ftell(file) : -1;
+	if (position >= 0) {
+		size_t padding = (SP_FEATURE_STORE_ALIGNMENT
+				- position % SP_FEATURE_STORE_ALIGNMENT)
+				% SP_FEATURE_STORE_ALIGNMENT;
+		written = fwrite(zeros, 1, padding, file) == padding
+				&& fwrite(root, 1, treeBytes, file) == treeBytes;
+	}
+	if (fclose(file) != 0 || position < 0 || !written
+			|| rename(tempPath, path) != 0) {
+		spLoggerPrintError("Writing the index file failed", __FILE__, __func__,
+				__LINE__);
+		remove(tempPath);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * the store and the tree of the mapped file of indexFile, checked against
+ * the header expected for config. false (with an info message) if the
+ * file cannot be used.
+ **/
+static bool readIndexFile(SPIndexFile indexFile, const SPConfig config) {
+	int expected[SP_INDEX_FILE_HEADER_INTS];
+	int header[SP_INDEX_FILE_HEADER_INTS];
+	size_t treeBytes = 0;
+	const char* base = (const char*) indexFile->mapping;
+	size_t offset = SP_INDEX_FILE_MAGIC_BYTES + sizeof(header)
+			+ sizeof(treeBytes);
+	if (indexFile->length < offset
+			|| memcmp(base, SP_INDEX_FILE_MAGIC, SP_INDEX_FILE_MAGIC_BYTES)
+					!= 0) {
+		spLoggerPrintInfo("The index file is not an index file, ignored");
+		return false;
+	}
+	memcpy(header, base + SP_INDEX_FILE_MAGIC_BYTES, sizeof(header));
+	memcpy(&treeBytes, base + SP_INDEX_FILE_MAGIC_BYTES + sizeof(header),
+			sizeof(treeBytes));
+	fillHeader(expected, config);
+	if (memcmp(header, expected, 5 * sizeof(int)) != 0) {
+		spLoggerPrintInfo(
+				"The index file has another version or byte order, ignored");
+		return false;
+	}
+	if (memcmp(header, expected, sizeof(header) - sizeof(int)) != 0) {
+		spLoggerPrintInfo(
+				"The index file was built with another configuration, ignored");
+		return false;
+	}
+	indexFile->numOfImages = header[SP_INDEX_FILE_HEADER_INTS - 1];
+	indexFile->store = spFeatureStoreMap(base, indexFile->length, &offset);
+	bool valid = indexFile->store != NULL
+			&& spFeatureStoreGetDimension(indexFile->store)
+					== expected[6]
+			&& spFeatureStoreGetStorage(indexFile->store)
+					== (SPFeatureStorage) expected[7];
+	// the hits are counted in an array of spNumOfImages images
+	int size = valid ? spFeatureStoreGetSize(indexFile->store) : 0;
+	for (int i = 0; valid && i < size; i++) {
+		int index = spFeatureStoreGetIndex(indexFile->store, i);
+		valid = index >= 0 && index < expected[5];
+	}
+	offset = (offset + SP_FEATURE_STORE_ALIGNMENT - 1)
+			/ SP_FEATURE_STORE_ALIGNMENT * SP_FEATURE_STORE_ALIGNMENT;
+	if (valid) {
+		valid = offset <= indexFile->length
+				&& treeBytes <= indexFile->length - offset;
+	}
+	if (valid) {
+		indexFile->root = mapKDTree(base + offset, treeBytes, expected[6],
+				size);
+		valid = indexFile->root != NULL;
+	}
+	if (!valid)
+		spLoggerPrintInfo("The index file is corrupted, ignored");
+	return valid;
+}
+
+SPIndexFile spIndexFileMap(const char* path, const SPConfig config) {
+	struct stat status;
+	if (path == NULL || config == NULL)
+		return NULL;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL; // not built yet
+	if (fstat(fd, &status) != 0 || status.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+	SPIndexFile indexFile = (SPIndexFile) malloc(sizeof(*indexFile));
+	if (indexFile == NULL) {
+		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
+		close(fd);
+		return NULL;
+	}
+	indexFile->length = (size_t) status.st_size;
+	indexFile->store = NULL;
+	indexFile->root = NULL;
+	indexFile->numOfImages = 0;
+	indexFile->mapping = mmap(NULL, indexFile->length, PROT_READ, MAP_SHARED,
+			fd, 0);
+	close(fd); // the mapping keeps the file
+	if (indexFile->mapping == MAP_FAILED) {
+		spLoggerPrintInfo("The index file couldn't be mapped, ignored");
+		free(indexFile);
+		return NULL;
+	}
+	if (!readIndexFile(indexFile, config)) {
+		spIndexFileDestroy(indexFile);
+		return NULL;
+	}
+	return indexFile;
+}
+
+SPFeatureStore spIndexFileGetStore(SPIndexFile indexFile) {
+	assert(indexFile != NULL);
+	return indexFile->store;
+}
+
+KDTreeNode* spIndexFileGetTree(SPIndexFile indexFile) {
+	assert(indexFile != NULL);
+	return indexFile->root;
+}
+
+int spIndexFileGetNumOfImages(SPIndexFile indexFile) {
+	assert(indexFile != NULL);
+	return indexFile->numOfImages;
+}
+
+void spIndexFileDestroy(SPIndexFile indexFile) {
+	if (indexFile == NULL)
+		return;
+	spFeatureStoreDestroy(indexFile->store);
+	munmap(indexFile->mapping, indexFile->length);
+	free(indexFile);
+}
@@ -0,0 +1,110 @@
+#ifndef SPINDEXFILE_H_
+#define SPINDEXFILE_H_
+
+#include <stdbool.h>
+#include "SPConfig.h"
+#include "SPFeatureStore.h"
+#include "KDTreeNode.h"
+
+/**
+ * SP Index File summary
+ *
+ * Persists the feature store and the kd-tree built over it to one binary
+ * file, so a later run maps the file and answers queries without reading
+ * the .feats files and building the tree again.
+ *
+ * The file starts with a versioned header that records the configuration
+ * the index was built with (number of images, PCA dimension, storage, PQ
+ * subspaces, leaf size, split method and whether the exact features are
+ * kept), followed by the store (see spFeatureStoreWrite) and the nodes of
+ * the tree (see getTreeBytes). Nothing in the file is a pointer, so it is
+ * used in place: spIndexFileMap maps it read only and the store and the
+ * tree point into the mapping. Pages are loaded by the first queries that
+ * touch them.
+ *
+ * An index file is only used if it matches the configuration, otherwise
+ * it is ignored (and rewritten after the next build). It does not record
+ * the .feats files it was built from: it must be deleted when they change
+ * outside the extraction mode.
+ *
+ * The following functions are supported:
+ *
+ * spIndexFileWrite			- Writes a store and its tree to an index file
+ * spIndexFileMap			- Maps an index file that matches a configuration
+ * spIndexFileGetStore		- A getter of the mapped store
+ * spIndexFileGetTree		- A getter of the root of the mapped tree
+ * spIndexFileGetNumOfImages - A getter of the number of images with features
+ * spIndexFileDestroy		- Unmaps an index file
+ *
+ */
+
+/** The version of the index file format, files of other versions are ignored **/
+#define SP_INDEX_FILE_VERSION 1
+
+/** type used to define a mapped index file **/
+typedef struct sp_index_file_t* SPIndexFile;
+
+/**
+ * Writes store and the tree of root (built over store, see InitKDTree) to
+ * the file at path. The file is written next to path first and renamed
+ * over it once complete, so an interrupted write never leaves a truncated
+ * index behind.
+ *
+ * @param path - The path of the index file
+ * @param config - The configuration the store and the tree were built with
+ * @param store - The feature store
+ * @param root - The root of the tree built over store
+ * @param numOfImages - The number of images that have features in store
+ * @return
+ * false if an argument is NULL or writing failed (an error is printed)
+ * true otherwise
+ */
+bool spIndexFileWrite(const char* path, const SPConfig config,
+		SPFeatureStore store, KDTreeNode* root, int numOfImages);
+
+/**
+ * Maps the index file at path, read only. The store and the tree of the
+ * file are checked before they are used.
+ *
+ * @param path - The path of the index file
+ * @param config - The configuration of the current run
+ * @return
+ * NULL if the file does not exist or cannot be mapped, is not an index
+ * file of this version and byte order, was built with another
+ * configuration or is corrupted (an info message says why).
+ * The mapped index file otherwise.
+ */
+SPIndexFile spIndexFileMap(const char* path, const SPConfig config);
+
+/**
+ * @param indexFile - The source index file
+ * @assert indexFile != NULL
+ * @return
+ * The store of the index file, it is valid until spIndexFileDestroy
+ */
+SPFeatureStore spIndexFileGetStore(SPIndexFile indexFile);
+
+/**
+ * @param indexFile - The source index file
+ * @assert indexFile != NULL
+ * @return
+ * The root of the tree of the index file, it is valid until
+ * spIndexFileDestroy and must not be destroyed by destroy
+ */
+KDTreeNode* spIndexFileGetTree(SPIndexFile indexFile);
+
+/**
+ * @param indexFile - The source index file
+ * @assert indexFile != NULL
+ * @return
+ * The number of images that have features in the store of the index file
+ */
+int spIndexFileGetNumOfImages(SPIndexFile indexFile);
+
+/**
+ * Destroys the store of indexFile and unmaps the file.
+ * If indexFile == NULL nothing is done.
+ */
+void spIndexFileDestroy(SPIndexFile indexFile);
+
+#endif /* SPINDEXFILE_H_ */
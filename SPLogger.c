@@ -2,12 +2,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 //File open mode
 #define SP_LOGGER_OPEN_MODE "w"
 
 // Global variable holding the logger
 SPLogger logger = NULL;
+// Keeps the lines of a message together when several threads print
+static pthread_mutex_t printLock = PTHREAD_MUTEX_INITIALIZER;
 
 struct sp_logger_t {
 	FILE* outputChannel; //The logger file
@@ -50,6 +53,25 @@ void spLoggerDestroy() {
 	logger = NULL;
 }
 
+/** prints a message with its title and location, under printLock **/
+static SP_LOGGER_MSG printMessage(const char* title, const char* msg,
+		const char* file, const char* function, const int line) {
+	SP_LOGGER_MSG result = SP_LOGGER_WRITE_FAIL;
+	pthread_mutex_lock(&printLock);
+	if (fprintf((*logger).outputChannel, "%s", title) >= 0
+			&& fprintf((*logger).outputChannel, "%s%s%s", "- file: ", file,
+					"\n") >= 0
+			&& fprintf((*logger).outputChannel, "%s%s%s", "- function: ",
+					function, "\n") >= 0
+			&& fprintf((*logger).outputChannel, "%s%d%s", "- line: ", line,
+					"\n") >= 0
+			&& fprintf((*logger).outputChannel, "%s%s%s", "- message: ", msg,
+					"\n") >= 0)
+		result = SP_LOGGER_SUCCESS;
+	pthread_mutex_unlock(&printLock);
+	return result;
+}
+
 SP_LOGGER_MSG spLoggerPrintError(const char* msg, const char* file,
 		const char* function, const int line) {
 
@@ -58,20 +80,7 @@ SP_LOGGER_MSG spLoggerPrintError(const char* msg, const char* file,
 	if (msg == NULL || function == NULL || file == NULL || line < 0)
 		return SP_LOGGER_INVAlID_ARGUMENT;
 
-	if (fprintf((*logger).outputChannel, "%s", "---ERROR---\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-	if (fprintf((*logger).outputChannel, "%s%s%s", "- file: ", file, "\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-	if (fprintf((*logger).outputChannel, "%s%s%s", "- function: ", function,
-			"\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-	if (fprintf((*logger).outputChannel, "%s%d%s", "- line: ", line, "\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-	if (fprintf((*logger).outputChannel, "%s%s%s", "- message: ", msg, "\n")
-			< 0)
-		return SP_LOGGER_WRITE_FAIL;
-
-	return SP_LOGGER_SUCCESS;
+	return printMessage("---ERROR---\n", msg, file, function, line);
 }
 
 SP_LOGGER_MSG spLoggerPrintWarning(const char* msg, const char* file,
@@ -84,23 +93,11 @@ SP_LOGGER_MSG spLoggerPrintWarning(const char* msg, const char* file,
 	if ((*logger).level == SP_LOGGER_ERROR_LEVEL)
 		return SP_LOGGER_SUCCESS;
 
-	if (fprintf((*logger).outputChannel, "%s", "---WARNING---\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-	if (fprintf((*logger).outputChannel, "%s%s%s", "- file: ", file, "\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-	if (fprintf((*logger).outputChannel, "%s%s%s", "- function: ", function,
-			"\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-	if (fprintf((*logger).outputChannel, "%s%d%s", "- line: ", line, "\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-	if (fprintf((*logger).outputChannel, "%s%s%s", "- message: ", msg, "\n")
-			< 0)
-		return SP_LOGGER_WRITE_FAIL;
-
-	return SP_LOGGER_SUCCESS;
+	return printMessage("---WARNING---\n", msg, file, function, line);
 }
 
 SP_LOGGER_MSG spLoggerPrintInfo(const char* msg) {
+	SP_LOGGER_MSG result = SP_LOGGER_WRITE_FAIL;
 
 	if (!logger)
 		return SP_LOGGER_UNDIFINED;
@@ -110,13 +107,13 @@ SP_LOGGER_MSG spLoggerPrintInfo(const char* msg) {
 			|| (*logger).level == SP_LOGGER_WARNING_ERROR_LEVEL)
 		return SP_LOGGER_SUCCESS;
 
-	if (fprintf((*logger).outputChannel, "%s", "---INFO---\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-	if (fprintf((*logger).outputChannel, "%s%s%s", "- message: ", msg, "\n")
-			< 0)
-		return SP_LOGGER_WRITE_FAIL;
-
-	return SP_LOGGER_SUCCESS;
+	pthread_mutex_lock(&printLock);
+	if (fprintf((*logger).outputChannel, "%s", "---INFO---\n") >= 0
+			&& fprintf((*logger).outputChannel, "%s%s%s", "- message: ", msg,
+					"\n") >= 0)
+		result = SP_LOGGER_SUCCESS;
+	pthread_mutex_unlock(&printLock);
+	return result;
 }
 
 SP_LOGGER_MSG spLoggerPrintDebug(const char* msg, const char* file,
@@ -131,31 +128,20 @@ SP_LOGGER_MSG spLoggerPrintDebug(const char* msg, const char* file,
 			|| (*logger).level == SP_LOGGER_INFO_WARNING_ERROR_LEVEL)
 		return SP_LOGGER_SUCCESS;
 
-	if (fprintf((*logger).outputChannel, "%s", "---DEBUG---\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-	if (fprintf((*logger).outputChannel, "%s%s%s", "- file: ", file, "\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-	if (fprintf((*logger).outputChannel, "%s%s%s", "- function: ", function,
-			"\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-	if (fprintf((*logger).outputChannel, "%s%d%s", "- line: ", line, "\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-	if (fprintf((*logger).outputChannel, "%s%s%s", "- message: ", msg, "\n")
-			< 0)
-		return SP_LOGGER_WRITE_FAIL;
-
-	return SP_LOGGER_SUCCESS;
+	return printMessage("---DEBUG---\n", msg, file, function, line);
 }
 
 SP_LOGGER_MSG spLoggerPrintMsg(const char* msg) {
+	SP_LOGGER_MSG result = SP_LOGGER_SUCCESS;
 
 	if (!logger)
 		return SP_LOGGER_UNDIFINED;
 	if (msg == NULL)
 		return SP_LOGGER_INVAlID_ARGUMENT;
 
+	pthread_mutex_lock(&printLock);
 	if (fprintf((*logger).outputChannel, "%s%s", msg, "\n") < 0)
-		return SP_LOGGER_WRITE_FAIL;
-
-	return SP_LOGGER_SUCCESS;
+		result = SP_LOGGER_WRITE_FAIL;
+	pthread_mutex_unlock(&printLock);
+	return result;
 }
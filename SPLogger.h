@@ -13,6 +13,10 @@
  * 	
  * The logger supports another printing function which can be called at any level
  * The user must destroy the logger at end of usage
+ *
+ * The print functions may be called by several threads at once, the lines of
+ * one message are never mixed with those of another. The logger must not be
+ * created or destroyed while other threads print.
  *	
  * The following functions are supported:
  * spLoggerCreate 		- Creates and initializes the logger
@@ -7,6 +7,7 @@
 
 #include <stdio.h>
 #include "SPPoint.h"
+#include "SPDistance.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <math.h>
@@ -129,6 +130,20 @@ double spPointGetAxisCoor(SPPoint point, int axis) {
 	return (*point).data[axis];
 }
 
+/**
+ * A getter for the coordinates array of the point
+ *
+ * @param point - The source point
+ * @assert point != NULL
+ * @return
+ * A pointer to the dim(point) coordinates of the point, it is owned by
+ * the point and must not be freed
+ */
+const double* spPointGetData(SPPoint point) {
+	assert(point!=NULL);
+	return (*point).data;
+}
+
 /**
  * Calculates the L2-squared distance between p and q.
  * The L2-squared distance is defined as:
@@ -143,12 +158,7 @@ double spPointGetAxisCoor(SPPoint point, int axis) {
 
 double spPointL2SquaredDistance(SPPoint p, SPPoint q) {
 	assert(p!=NULL && q!=NULL&& (p->dimension)==(q->dimension));
-	double distance = 0;
-	int i;
-	for (i = 0; i < (*p).dimension; i++)
-		distance += (double) ((*p).data[i] - (*q).data[i])
-				* (double) ((*p).data[i] - (*q).data[i]);
-	return distance;
+	return spL2SquaredDistance((*p).data, (*q).data, (*p).dimension);
 
 }
 
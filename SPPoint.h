@@ -15,6 +15,7 @@
  * spPointGetDimension		- A getter of the dimension of a point
  * spPointGetIndex			- A getter of the index of a point
  * spPointGetAxisCoor		- A getter of a given coordinate of the point
+ * spPointGetData			- A getter of the coordinates array of the point
  * spPointL2SquaredDistance	- Calculates the L2 squared distance between two points
  *
  */
@@ -99,6 +100,17 @@ int spPointGetIndex(SPPoint point);
  */
 double spPointGetAxisCoor(SPPoint point, int axis);
 
+/**
+ * A getter for the coordinates array of the point
+ *
+ * @param point - The source point
+ * @assert point != NULL
+ * @return
+ * A pointer to the dim(point) coordinates of the point, it is owned by
+ * the point and must not be freed
+ */
+const double* spPointGetData(SPPoint point);
+
 /**
  * Calculates the L2-squared distance between p and q.
  * The L2-squared distance is defined as:
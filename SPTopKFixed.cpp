@@ -0,0 +1,52 @@
+#include <cstddef>
+#include "SPTopKFixed.h"
+
+/*
+ * The slots are sorted, so the slots the new point comes before are a
+ * suffix: slot i takes slot i - 1 if the point comes before slot i - 1,
+ * the point itself if it comes before slot i only, and is kept otherwise.
+ * Every slot is written from the old values of its own and the previous
+ * slot, going down from the last, so the loop has no data dependent branch.
+ */
+
+namespace {
+
+/** true if (distanceA, offsetA) comes before (distanceB, offsetB) **/
+inline bool before(double distanceA, int offsetA, double distanceB,
+		int offsetB) {
+	return distanceA < distanceB
+			|| (distanceA == distanceB && offsetA < offsetB);
+}
+
+template<int K>
+void insertFixed(int* offsets, double* distances, int offset,
+		double distance) {
+	if (!before(distance, offset, distances[K - 1], offsets[K - 1]))
+		return;
+	bool beforeNext = true; // the point comes before slot i (it enters)
+	for (int i = K - 1; i > 0; i--) {
+		bool beforePrevious = before(distance, offset, distances[i - 1],
+				offsets[i - 1]);
+		int keptOffset = beforeNext ? offset : offsets[i];
+		double keptDistance = beforeNext ? distance : distances[i];
+		offsets[i] = beforePrevious ? offsets[i - 1] : keptOffset;
+		distances[i] = beforePrevious ? distances[i - 1] : keptDistance;
+		beforeNext = beforePrevious;
+	}
+	offsets[0] = beforeNext ? offset : offsets[0];
+	distances[0] = beforeNext ? distance : distances[0];
+}
+
+const SPTopKInsert fixedInserts[SP_TOP_K_FIXED_MAX_K] = { insertFixed<1>,
+		insertFixed<2>, insertFixed<3>, insertFixed<4>, insertFixed<5>,
+		insertFixed<6>, insertFixed<7>, insertFixed<8>, insertFixed<9>,
+		insertFixed<10>, insertFixed<11>, insertFixed<12>, insertFixed<13>,
+		insertFixed<14>, insertFixed<15>, insertFixed<16> };
+
+}
+
+SPTopKInsert spTopKFixedInsert(int k) {
+	if (k < 1 || k > SP_TOP_K_FIXED_MAX_K)
+		return NULL;
+	return fixedInserts[k - 1];
+}
@@ -0,0 +1,50 @@
+#ifndef SPTOPKFIXED_H_
+#define SPTOPKFIXED_H_
+
+/**
+ * SP Top K Fixed summary
+ *
+ * Collectors of the k nearest points instantiated (as C++ templates) for
+ * every k from 1 to SP_TOP_K_FIXED_MAX_K, so the number of slots is a
+ * compile-time constant: the insertion is fully unrolled and every slot is
+ * chosen with a select instead of a branch. For k = 1 it is a running
+ * minimum.
+ *
+ * The k nearest are kept in two arrays of k slots, sorted by distance and
+ * then by offset (the order of an SPBPQueue). An empty slot holds offset
+ * -1 and distance HUGE_VAL, so the last distance is the largest one that
+ * can still enter.
+ *
+ * The following functions are supported:
+ *
+ * spTopKFixedInsert	- The collector for a given k
+ *
+ */
+
+/** The largest k a fixed collector exists for **/
+#define SP_TOP_K_FIXED_MAX_K 16
+
+/**
+ * Inserts (offset, distance) into the k nearest given by offsets and
+ * distances, if it comes before the last of them. The last one is dropped.
+ */
+typedef void (*SPTopKInsert)(int* offsets, double* distances, int offset,
+		double distance);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @param k - The number of nearest points the collector will keep
+ * @return
+ * The collector specialized for k, or NULL if there is none (k is out of
+ * the range 1 to SP_TOP_K_FIXED_MAX_K)
+ */
+SPTopKInsert spTopKFixedInsert(int k);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPTOPKFIXED_H_ */
@@ -1,20 +1,96 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <pthread.h>
 #include "SPImageProc.h"
 extern "C" {
 #include "SPPoint.h"
+#include "SPDistance.h"
+#include "SPFeatureStore.h"
 #include "SPLogger.h"
 #include "SPConfig.h"
 #include "main_aux.h"
 #include "KDArray.h"
 #include "KDTreeNode.h"
 #include "SPBPriorityQueue.h"
+#include "SPIndexFile.h"
 
 }
 #define MAX_LENGTH 1025
+#define MAX_CONCURRENT_QUERIES 64
 using namespace sp;
 
+/** what the threads serving the queries share, none of them changes it **/
+typedef struct QueryServer {
+	const ImageProc* imagePro;
+	const QuerySearch* search;
+	int numOfImages;
+	int spNumOfSimilarImages;
+	int queryThreads; // the threads searching the features of one query
+} QueryServer;
+
+/** a query image and its results, served by one thread **/
+typedef struct QueryJob {
+	const QueryServer* server;
+	char* query; // the path of the query image
+	int* indexesOfBestCandidates; // decreasing order (i.e the best is first And so on)
+	bool served; // false if the query image couldn't be searched
+} QueryJob;
+
+/** searches the query image of job, only the job is changed **/
+static void* serveQuery(void* arg) {
+	QueryJob* job = (QueryJob*) arg;
+	const QueryServer* server = job->server;
+	int numOfFeats = 0;
+	job->served = false;
+	SPPoint* featuresOfQuery = server->imagePro->getImageFeatures(job->query,
+			server->numOfImages, &numOfFeats);
+	if (featuresOfQuery == NULL) {
+		spLoggerPrintWarning("Invalid query", __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	Hits * arrayOfHits = (Hits *) malloc(
+			server->numOfImages * sizeof(*arrayOfHits)); // contains a index for every image and the number of hits for that image.
+	if (arrayOfHits == NULL) {
+		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
+	} else {
+		initializeArray(arrayOfHits, server->numOfImages); //fill with zeros
+		job->served = updateArrayOfHitsParallel(arrayOfHits,
+				server->numOfImages, server->search, featuresOfQuery,
+				numOfFeats, server->queryThreads);
+		if (job->served)
+			calculateTheBestIndexes(job->indexesOfBestCandidates, arrayOfHits,
+					server->spNumOfSimilarImages, server->numOfImages);
+		else
+			spLoggerPrintWarning("Query not searched", __FILE__, __func__,
+					__LINE__);
+	}
+	free(arrayOfHits);
+	for (int i = 0; i < numOfFeats; i++)
+		spPointDestroy(featuresOfQuery[i]);
+	free(featuresOfQuery);
+	return NULL;
+}
+
+/** serves the numOfJobs queries of jobs at once, each by its own thread **/
+static void serveQueries(QueryJob* jobs, int numOfJobs) {
+	pthread_t workers[MAX_CONCURRENT_QUERIES];
+	bool started[MAX_CONCURRENT_QUERIES];
+	for (int j = 0; j < numOfJobs; j++) {
+		// the query of a thread that failed to start is served by this one
+		started[j] = j > 0
+				&& pthread_create(&workers[j], NULL, serveQuery, &jobs[j]) == 0;
+	}
+	for (int j = 0; j < numOfJobs; j++) {
+		if (!started[j])
+			serveQuery(&jobs[j]);
+	}
+	for (int j = 1; j < numOfJobs; j++) {
+		if (started[j])
+			pthread_join(workers[j], NULL);
+	}
+}
+
 int main(int argc, char** argv) {
 	SP_CONFIG_MSG msg = SP_CONFIG_SUCCESS;
 	char extensionFeats[] = ".feats";
@@ -51,6 +127,13 @@ int main(int argc, char** argv) {
 		spConfigDestroy(config);
 		exit(0);
 	}
+	spDistanceInit(); // choose the distance kernel once, before any search
+	char kernelMessage[MAX_LENGTH];
+	sprintf(kernelMessage, "%s %s%s", "Distance kernel:",
+			spDistanceKernelName(spDistanceGetKernel()),
+			spDistanceHasFixedKernel(spConfigGetPCADim(config, &msg)) ?
+					", specialized for spPCADimension" : "");
+	spLoggerPrintInfo(kernelMessage);
 	int numOfImages = spConfigGetNumOfImages(config, &msg);
 	int totalNumberOfFeatures = 0, numOfFeats = 0;
 	int dimension = spConfigGetPCADim(config, &msg);
@@ -64,7 +147,7 @@ int main(int argc, char** argv) {
 	}
 	char* imagePath = (char*) malloc(sizeof(char) * MAX_LENGTH); // for example: "./images/img10.png"
 	char* imageFeatsExtensionPath = (char*) malloc(sizeof(char) * MAX_LENGTH); // for example: "./images/img10.feats"
-	SPPoint* arr = NULL; // contain total number of points from all images
+	SPFeatureStore store = NULL; // contain total number of points from all images
 	if (imagePath == NULL || imageFeatsExtensionPath == NULL) {
 		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
 		freeResources(imagePath, imageFeatsExtensionPath, NULL, NULL, NULL);
@@ -73,8 +156,61 @@ int main(int argc, char** argv) {
 		exit(0);
 	}
 	ImageProc imagePro(config);
-	if (spConfigIsExtractionMode(config, &msg)) { // we should be in extractionMode to write feats files
-		int j = 0;
+	// the 8-bit quantization of the features, only used by INT8 storage
+	double* quantOffsets = (double*) malloc(sizeof(double) * dimension);
+	double* quantScales = (double*) malloc(sizeof(double) * dimension);
+	bool hasQuantization = quantOffsets != NULL && quantScales != NULL
+			&& imagePro.getQuantization(quantOffsets, quantScales, dimension);
+	if (spConfigGetFeatureStorage(config) == INT8_STORAGE && !hasQuantization) {
+		spLoggerPrintError(
+				"Error : INT8 storage requires a PCA file with quantization",
+				__FILE__, __func__, __LINE__);
+		free(quantOffsets);
+		free(quantScales);
+		freeResources(imagePath, imageFeatsExtensionPath, NULL, NULL, NULL);
+		spConfigDestroy(config);
+		spLoggerDestroy();
+		exit(0);
+	}
+	// a valid index file replaces reading the features and building the tree
+	char indexPath[MAX_LENGTH];
+	bool useIndexFile = spConfigGetSearchMethod(config)
+			!= RANDOMIZED_FOREST_SEARCH
+			&& spConfigGetIndexPath(indexPath, config) == SP_CONFIG_SUCCESS;
+	SPIndexFile indexFile = NULL;
+	if (useIndexFile && !spConfigIsExtractionMode(config, &msg))
+		indexFile = spIndexFileMap(indexPath, config);
+	if (indexFile != NULL) {
+		spLoggerPrintInfo("Index file mapped");
+		store = spIndexFileGetStore(indexFile);
+		totalNumberOfFeatures = spFeatureStoreGetSize(store);
+		actualNumberOfImages = spIndexFileGetNumOfImages(indexFile);
+
+		// if we don't have enough images then quit
+		if (actualNumberOfImages < spNumOfSimilarImages) {
+			spLoggerPrintError(
+					"actual number of images is smaller than the number of similar images we were asked to present",
+					__FILE__, __func__, __LINE__);
+			free(quantOffsets);
+			free(quantScales);
+			freeResources(imagePath, imageFeatsExtensionPath, NULL, NULL, NULL);
+			spIndexFileDestroy(indexFile);
+			spConfigDestroy(config);
+			spLoggerDestroy();
+			exit(0);
+		}
+	} else if (spConfigIsExtractionMode(config, &msg)) { // we should be in extractionMode to write feats files
+		store = createFeatureStore(dimension,
+				numOfImages * spConfigGetNumOfFeatures(config, &msg), config,
+				quantOffsets, quantScales);
+		if (store == NULL) {
+			spLoggerPrintError("Allocation Failure", __FILE__, __func__,
+					__LINE__);
+			freeResources(imagePath, imageFeatsExtensionPath, NULL, NULL, NULL);
+			spConfigDestroy(config);
+			spLoggerDestroy();
+			exit(0);
+		}
 		for (int i = 0; i < numOfImages; i++) {
 			msg = spConfigGetImagePath(imagePath, config, i);
 			if (msg != SP_CONFIG_SUCCESS) {
@@ -88,6 +224,7 @@ int main(int argc, char** argv) {
 							__FILE__, __func__, __LINE__);
 				freeResources(imagePath, imageFeatsExtensionPath, NULL, NULL,
 				NULL);
+				spFeatureStoreDestroy(store);
 				spConfigDestroy(config);
 				spLoggerDestroy();
 				exit(0);
@@ -106,6 +243,7 @@ int main(int argc, char** argv) {
 							__FILE__, __func__, __LINE__);
 				freeResources(imagePath, imageFeatsExtensionPath, NULL, NULL,
 				NULL);
+				spFeatureStoreDestroy(store);
 				spConfigDestroy(config);
 				spLoggerDestroy();
 				exit(0);
@@ -114,18 +252,20 @@ int main(int argc, char** argv) {
 					&numOfFeats);
 			if (points != NULL) {
 				actualNumberOfImages++;
-				totalNumberOfFeatures += numOfFeats;
+				// written before the points are destroyed, the store may
+				// keep them quantized
 				createFeatsFileForImage(points, i, numOfFeats,
 						imageFeatsExtensionPath);
-				arr = (SPPoint*) realloc(arr,
-						totalNumberOfFeatures * sizeof(*arr));
-
-				j = totalNumberOfFeatures - numOfFeats;
 				for (int k = 0; k < numOfFeats; k++) {
-					arr[j] = spPointCopy(points[k]);
-					j++;
+					if (spFeatureStoreAppendPoint(store, points[k])
+							!= SP_FEATURE_STORE_SUCCESS) {
+						spLoggerPrintError("Error while storing a feature",
+								__FILE__, __func__, __LINE__);
+					}
+					spPointDestroy(points[k]);
 				}
 				free(points);
+				totalNumberOfFeatures = spFeatureStoreGetSize(store);
 			}
 		}
 		// if we don't have enough images then quit
@@ -134,15 +274,16 @@ int main(int argc, char** argv) {
 					"actual number of images is smaller than the number of similar images we were asked to present",
 					__FILE__, __func__, __LINE__);
 			freeResources(imagePath, imageFeatsExtensionPath, NULL, NULL, NULL);
+			spFeatureStoreDestroy(store);
 			spConfigDestroy(config);
 			spLoggerDestroy();
 			exit(0);
 		}
 
 	} else {
-		arr = ExtractFeaturesFromFiles(numOfImages, imageFeatsExtensionPath,
+		store = ExtractFeaturesFromFiles(numOfImages, imageFeatsExtensionPath,
 				extensionFeats, &totalNumberOfFeatures, &msg, config,
-				&actualNumberOfImages);
+				&actualNumberOfImages, quantOffsets, quantScales, dimension);
 
 		// if we don't have enough images then quit
 		if (actualNumberOfImages < spNumOfSimilarImages) {
@@ -150,124 +291,158 @@ int main(int argc, char** argv) {
 					"actual number of images is smaller than the number of similar images we were asked to present",
 					__FILE__, __func__, __LINE__);
 			freeResources(imagePath, imageFeatsExtensionPath, NULL, NULL, NULL);
+			spFeatureStoreDestroy(store);
 			spConfigDestroy(config);
 			spLoggerDestroy();
 			exit(0);
 		}
 	}
-	KDTreeNode* kdTreeNode = InitKDTree(Init(arr, totalNumberOfFeatures),
-			spConfigGetSplitMethod(config), dimension, dimension);
-	for (int i = 0; i < totalNumberOfFeatures; i++)
-		spPointDestroy(arr[i]);
-	free(arr);
-	if (kdTreeNode == NULL) {
+	free(quantOffsets); // copied into the store
+	free(quantScales);
+	if (indexFile == NULL)
+		store = compressFeatureStore(store, config); // only for PQ storage
+	if (store == NULL) {
+		freeResources(imagePath, imageFeatsExtensionPath, NULL, NULL, NULL);
+		spConfigDestroy(config);
+		spLoggerDestroy();
+		exit(0);
+	}
+	int leafSize = spConfigGetKDTreeLeafSize(config, &msg);
+	int buildThreads = spConfigGetKDTreeBuildThreads(config, &msg);
+	KDTreeNode* kdTreeNode = NULL;
+	KDForest* kdForest = NULL; // instead of kdTreeNode for a RANDOMIZED_FOREST search
+	if (indexFile != NULL) {
+		kdTreeNode = spIndexFileGetTree(indexFile);
+	} else if (spConfigGetSearchMethod(config) == RANDOMIZED_FOREST_SEARCH) {
+		kdForest = InitKDForest(store, totalNumberOfFeatures,
+				spConfigGetKDForestTrees(config, &msg), leafSize, buildThreads);
+	} else if (spConfigGetBuildMethod(config) == SELECT_BUILD) {
+		kdTreeNode = InitKDTreeSelect(store, NULL, totalNumberOfFeatures,
+				spConfigGetSplitMethod(config), spFeatureStoreGetDimension(store),
+				spFeatureStoreGetDimension(store), leafSize, buildThreads);
+	} else {
+		kdTreeNode = InitKDTree(Init(store, NULL, totalNumberOfFeatures),
+				spConfigGetSplitMethod(config), spFeatureStoreGetDimension(store),
+				spFeatureStoreGetDimension(store), leafSize, buildThreads);
+	}
+	if (kdTreeNode == NULL && kdForest == NULL) {
 		spLoggerPrintError("kdTree node = NULL", __FILE__, __func__, __LINE__);
 		freeResources(imagePath, imageFeatsExtensionPath, NULL, NULL, NULL);
+		spFeatureStoreDestroy(store);
 		spConfigDestroy(config);
 		spLoggerDestroy();
 		exit(0);
 	}
-	SPBPQueue bpq = NULL;
-	SPPoint *featuresOfQuery = NULL;
+	// leaves of a block or more are scanned with the block kernels
+	if (indexFile == NULL && leafSize >= SP_DISTANCE_BLOCK
+			&& (spFeatureStoreGetStorage(store) == DOUBLE_STORAGE
+					|| spFeatureStoreGetStorage(store) == FLOAT_STORAGE)
+			&& spFeatureStoreBuildBlocks(store) != SP_FEATURE_STORE_SUCCESS) {
+		spLoggerPrintWarning("Distance blocks not built, leaves are scanned per point",
+				__FILE__, __func__, __LINE__);
+	}
+	// written once built, with the blocks, the next runs map it
+	if (useIndexFile && indexFile == NULL
+			&& spIndexFileWrite(indexPath, config, store, kdTreeNode,
+					actualNumberOfImages))
+		spLoggerPrintInfo("Index file written");
 	char* candidatePath = (char*) malloc(sizeof(char) * MAX_LENGTH);
-	Hits * arrayOfHits = NULL; // contains a index for every image and the number of hits for that image.
+	int concurrentQueries = spConfigGetConcurrentQueries(config, &msg);
+	// the queries served at once, every one with its path and results
+	QueryJob* jobs = (QueryJob*) malloc(concurrentQueries * sizeof(*jobs));
+	char* queries = (char*) malloc(
+			(size_t) concurrentQueries * MAX_LENGTH * sizeof(char));
 	int * indexesOfBestCandidates = (int *) malloc(
-			sizeof(int) * spNumOfSimilarImages); // decreasing order (i.e the best is first And so on)
-	if (indexesOfBestCandidates == NULL || candidatePath == NULL) {
+			(size_t) concurrentQueries * spNumOfSimilarImages * sizeof(int));
+	if (jobs == NULL || queries == NULL || indexesOfBestCandidates == NULL
+			|| candidatePath == NULL) {
 		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
 		freeResources(imagePath, imageFeatsExtensionPath, candidatePath,
-				indexesOfBestCandidates, NULL);
-		destroy(kdTreeNode);
+				indexesOfBestCandidates, queries);
+		free(jobs);
+		destroySearchIndex(kdTreeNode, kdForest, store, indexFile);
 		spConfigDestroy(config);
 		spLoggerDestroy();
-		spBPQueueDestroy(bpq);
 		exit(0);
 	}
 	int spKNN = getSpKNN(config, &msg);
-	bpq = spBPQueueCreate(spKNN);
-	if (bpq == NULL) {
-		spLoggerPrintError("Error while creating bpq", __FILE__, __func__,
-		__LINE__);
-		freeResources(imagePath, imageFeatsExtensionPath, candidatePath,
-				indexesOfBestCandidates, NULL);
-		destroy(kdTreeNode);
-		spConfigDestroy(config);
-		spLoggerDestroy();
-		exit(0);
+	int rerankCandidates = 0;
+	if (spFeatureStoreGetStorage(store) == INT8_STORAGE
+			|| spFeatureStoreGetStorage(store) == PQ_STORAGE)
+		rerankCandidates = spConfigGetRerankCandidates(config, &msg);
+	if (rerankCandidates > 0 && rerankCandidates < spKNN)
+		rerankCandidates = spKNN;
+	int maxChecks = 0; // exact search
+	if (spConfigGetSearchMethod(config) != EXACT_SEARCH)
+		maxChecks = spConfigGetKDTreeMaxChecks(config, &msg);
+	// every query thread creates its own bpq (and candidates)
+	QuerySearch search;
+	search.kdTreeNode = kdTreeNode;
+	search.kdForest = kdForest;
+	search.store = store;
+	search.spKNN = spKNN;
+	search.rerankCandidates = rerankCandidates;
+	search.maxChecks = maxChecks;
+	QueryServer server;
+	server.imagePro = &imagePro;
+	server.search = &search;
+	server.numOfImages = numOfImages;
+	server.spNumOfSimilarImages = spNumOfSimilarImages;
+	server.queryThreads = spConfigGetQueryThreads(config, &msg);
+	for (int j = 0; j < concurrentQueries; j++) {
+		jobs[j].server = &server;
+		jobs[j].query = queries + (size_t) j * MAX_LENGTH;
+		jobs[j].indexesOfBestCandidates = indexesOfBestCandidates
+				+ (size_t) j * spNumOfSimilarImages;
 	}
-	// Query part
-	char* query = (char*) malloc(MAX_LENGTH * sizeof(char));
-	printf("%s", "Please enter an image path:\n");
-	fflush(NULL);
-	scanf("%s", query);
-	fflush(NULL);
+	// Query part, up to concurrentQueries paths are read and served at once
 	char terminateString[] = "<>";
-	while (strcmp(query, terminateString) != 0) {
-		featuresOfQuery = imagePro.getImageFeatures(query, numOfImages,
-				&numOfFeats);
-		if (featuresOfQuery == NULL) {
-			spLoggerPrintWarning("Invalid query", __FILE__, __func__, __LINE__);
+	bool terminated = false;
+	while (!terminated) {
+		int numOfJobs = 0;
+		while (!terminated && numOfJobs < concurrentQueries) {
 			printf("%s", "Please enter an image path:\n");
 			fflush(NULL);
-			scanf("%s", query);
+			terminated = scanf("%s", jobs[numOfJobs].query) != 1
+					|| strcmp(jobs[numOfJobs].query, terminateString) == 0;
 			fflush(NULL);
-			continue;
+			if (!terminated)
+				numOfJobs++;
 		}
-		arrayOfHits = (Hits *) malloc(numOfImages * sizeof(*arrayOfHits));
-		if (arrayOfHits == NULL) {
-			spLoggerPrintError("Allocation Failure", __FILE__, __func__,
-			__LINE__);
-			freeResources(imagePath, imageFeatsExtensionPath, candidatePath,
-					indexesOfBestCandidates, query);
-			destroy(kdTreeNode);
-			spConfigDestroy(config);
-			spLoggerDestroy();
-			spBPQueueDestroy(bpq);
-			exit(0);
-		}
-		initializeArray(arrayOfHits, numOfImages); //fill with zeros
-		for (int i = 0; i < numOfFeats; i++) {
-			kNearestNeighbors(kdTreeNode, &bpq, featuresOfQuery[i]); // update bpq to contain k nearest neighbors
-			updateArrayOfHits(arrayOfHits, bpq);
-			spBPQueueClear(bpq);
-			spBPQueueSetSize(bpq, spKNN);
-		}
-		calculateTheBestIndexes(indexesOfBestCandidates, arrayOfHits,
-				spNumOfSimilarImages, numOfImages);
-		free(arrayOfHits);
-
-		if (spConfigMinimalGui(config, &msg)) {
-			//check msg and act accordingly
-			for (int i = 0; i < spNumOfSimilarImages; i++) {
-				msg = spConfigGetImagePath(candidatePath, config,
-						indexesOfBestCandidates[i]);
+		serveQueries(jobs, numOfJobs);
+		// the results are shown in the order the paths were read
+		for (int j = 0; j < numOfJobs; j++) {
+			if (!jobs[j].served)
+				continue;
+			if (spConfigMinimalGui(config, &msg)) {
 				//check msg and act accordingly
-				imagePro.showImage(candidatePath);
-			}
-		} else {
-			printf("%s %s %s", "Best candidates for -", query, "- are:\n");
-			fflush(NULL);
-			for (int i = 0; i < spNumOfSimilarImages; i++) {
-				msg = spConfigGetImagePath(candidatePath, config,
-						indexesOfBestCandidates[i]);
-				printf("%s%s", candidatePath, "\n");
+				for (int i = 0; i < spNumOfSimilarImages; i++) {
+					msg = spConfigGetImagePath(candidatePath, config,
+							jobs[j].indexesOfBestCandidates[i]);
+					//check msg and act accordingly
+					imagePro.showImage(candidatePath);
+				}
+			} else {
+				printf("%s %s %s", "Best candidates for -", jobs[j].query,
+						"- are:\n");
 				fflush(NULL);
+				for (int i = 0; i < spNumOfSimilarImages; i++) {
+					msg = spConfigGetImagePath(candidatePath, config,
+							jobs[j].indexesOfBestCandidates[i]);
+					printf("%s%s", candidatePath, "\n");
+					fflush(NULL);
+				}
 			}
 		}
-		free(featuresOfQuery);
-		printf("%s", "Please enter an image path:\n");
-		fflush(NULL);
-		scanf("%s", query);
-		fflush(NULL);
 	}
 	printf("%s", "Exiting...\n");
 	fflush(NULL);
 	// free all resources
 	freeResources(imagePath, imageFeatsExtensionPath, candidatePath,
-			indexesOfBestCandidates, query);
-	destroy(kdTreeNode);
+			indexesOfBestCandidates, queries);
+	free(jobs);
+	destroySearchIndex(kdTreeNode, kdForest, store, indexFile);
 	spConfigDestroy(config);
 	spLoggerDestroy();
-	spBPQueueDestroy(bpq);
 	return 0;
 }
@@ -16,14 +16,31 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 
 #define MAX_LENGTH 1025
+#define QUERY_MAX_THREADS 64
+
+/** the features of a query image searched by one thread **/
+typedef struct QueryTask {
+	const QuerySearch* search;
+	SPPoint* features;
+	int numOfFeats;
+	Hits* hits; // the votes of this thread only
+	int numOfImages;
+	bool succeeded;
+} QueryTask;
 
 void createFeatsFileForImage(SPPoint* points, int index, int numOfFeats,
 		char* fileName) {
 
 	int pointDimension = 0;
 	FILE * fp = fopen(fileName, "w");
+	if (fp == NULL) {
+		spLoggerPrintError("Can't open the feats file", __FILE__, __func__,
+				__LINE__);
+		return;
+	}
 
 	// stores the info in the following order:
 	// 1.index of image
@@ -45,15 +62,60 @@ void createFeatsFileForImage(SPPoint* points, int index, int numOfFeats,
 	fclose(fp);
 }
 
-SPPoint* ExtractFeaturesFromFiles(int numOfImages,
+SPFeatureStore createFeatureStore(int dim, int capacity, SPConfig config,
+		const double* quantOffsets, const double* quantScales) {
+	SP_CONFIG_MSG msg = SP_CONFIG_SUCCESS;
+	SPFeatureStorage storage = spConfigGetFeatureStorage(config);
+	if (storage == PQ_STORAGE) // compressed once all the features are stored
+		storage = FLOAT_STORAGE;
+	SPFeatureStore store = spFeatureStoreCreate(dim, capacity, storage);
+	if (store == NULL || storage != INT8_STORAGE)
+		return store;
+	if (quantOffsets == NULL || quantScales == NULL) {
+		spLoggerPrintError("Missing quantization of the INT8 storage",
+				__FILE__, __func__, __LINE__);
+		spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	// the exact features are only needed to rerank the candidates
+	if (spFeatureStoreSetQuantization(store, quantOffsets, quantScales,
+			spConfigGetRerankCandidates(config, &msg) > 0)
+			!= SP_FEATURE_STORE_SUCCESS) {
+		spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	return store;
+}
+
+SPFeatureStore compressFeatureStore(SPFeatureStore store, SPConfig config) {
+	SP_CONFIG_MSG msg = SP_CONFIG_SUCCESS;
+	SPFeatureStore compressed = NULL;
+	if (store == NULL || spConfigGetFeatureStorage(config) != PQ_STORAGE)
+		return store;
+	compressed = spFeatureStoreCreateProductQuantized(store,
+			spConfigGetPQSubspaces(config, &msg),
+			spConfigGetRerankCandidates(config, &msg) > 0);
+	if (compressed == NULL)
+		spLoggerPrintError(
+				"Product quantization failed (spPQSubspaces > spPCADimension?)",
+				__FILE__, __func__, __LINE__);
+	spFeatureStoreDestroy(store);
+	return compressed;
+}
+
+SPFeatureStore ExtractFeaturesFromFiles(int numOfImages,
 		char* imageFeatsExtensionPath, char* extensionFeats,
 		int* totalNumberOfFeatures, SP_CONFIG_MSG* msg, SPConfig config,
-		int* actualNumberOfImages) {
-	SPPoint* arr = NULL;
+		int* actualNumberOfImages, const double* quantOffsets,
+		const double* quantScales, int expectedDim) {
+	SPFeatureStore store = NULL;
+	SPFeatureStorage storage = spConfigGetFeatureStorage(config);
+	double* arrValuesPoint = NULL;
+	float* arrFloatValuesPoint = NULL; // used instead of arrValuesPoint for FLOAT_STORAGE
+	SP_FEATURE_STORE_MSG storeMsg = SP_FEATURE_STORE_SUCCESS;
 	int dimension = 0;
 	int index = 0;
 	int numOfFeats = 0;
-	int indexArray = 0;
 	for (int i = 0; i < numOfImages; i++) {
 		*msg = spConfigGetImageFeatsPath(imageFeatsExtensionPath, config, i,
 				extensionFeats);
@@ -66,24 +128,76 @@ SPPoint* ExtractFeaturesFromFiles(int numOfImages,
 		}
 		fscanf(fp, "%d\n", &index);
 		fscanf(fp, "%d\n", &numOfFeats);
-		*totalNumberOfFeatures += numOfFeats;
-		arr = (SPPoint*) realloc(arr, *totalNumberOfFeatures * sizeof(*arr));
 		for (int j = 0; j < numOfFeats; j++) {
 			fscanf(fp, "%d\n", &dimension); // get the dimension from the current point
 			fscanf(fp, "%d\n", &index); // get the index from the current point
-			double * arrValuesPoint = (double*) malloc(
-					sizeof(double) * numOfFeats);
-			for (int k = 0; k < dimension - 1; k++) {
-				fscanf(fp, " %lg", &arrValuesPoint[k]); // get the double array from the current point
+			if (store == NULL) {
+				if (storage == INT8_STORAGE && dimension != expectedDim) {
+					spLoggerPrintError(
+							"Features dimension doesn't match the quantization",
+							__FILE__, __func__, __LINE__);
+					fclose(fp);
+					*totalNumberOfFeatures = 0;
+					return NULL;
+				}
+				// the first point decides the dimension of the store
+				store = createFeatureStore(dimension, numOfFeats, config,
+						quantOffsets, quantScales);
+				arrValuesPoint = (double*) malloc(sizeof(double) * dimension);
+				arrFloatValuesPoint = (float*) malloc(sizeof(float) * dimension);
+				if (store == NULL || arrValuesPoint == NULL
+						|| arrFloatValuesPoint == NULL) {
+					spLoggerPrintError("Allocation Failure", __FILE__,
+							__func__, __LINE__);
+					spFeatureStoreDestroy(store);
+					free(arrValuesPoint);
+					free(arrFloatValuesPoint);
+					fclose(fp);
+					*totalNumberOfFeatures = 0;
+					return NULL;
+				}
+			}
+			if (dimension != spFeatureStoreGetDimension(store)) {
+				spLoggerPrintWarning("Point with a different dimension skipped",
+						__FILE__, __func__, __LINE__);
+				fscanf(fp, "%*[^\n]\n");
+				continue;
+			}
+			if (spFeatureStoreGetStorage(store) == FLOAT_STORAGE) {
+				// read straight into floats, the values are never widened
+				for (int k = 0; k < dimension - 1; k++) {
+					fscanf(fp, " %g", &arrFloatValuesPoint[k]);
+				}
+				fscanf(fp, "%g\n", &arrFloatValuesPoint[dimension - 1]);
+				storeMsg = spFeatureStoreAppendFloat(store, arrFloatValuesPoint,
+						i);
+			} else {
+				for (int k = 0; k < dimension - 1; k++) {
+					fscanf(fp, " %lg", &arrValuesPoint[k]); // get the double array from the current point
+				}
+				fscanf(fp, "%lg\n", &arrValuesPoint[dimension - 1]);
+				storeMsg = spFeatureStoreAppend(store, arrValuesPoint, i);
+			}
+			if (storeMsg != SP_FEATURE_STORE_SUCCESS) {
+				spLoggerPrintError("Allocation Failure", __FILE__, __func__,
+				__LINE__);
+				spFeatureStoreDestroy(store);
+				free(arrValuesPoint);
+				free(arrFloatValuesPoint);
+				fclose(fp);
+				*totalNumberOfFeatures = 0;
+				return NULL;
 			}
-			fscanf(fp, "%lg\n", &arrValuesPoint[dimension - 1]);
-			arr[indexArray] = spPointCreate(arrValuesPoint, dimension, i);
-			indexArray++;
 		}
 		*actualNumberOfImages = *actualNumberOfImages + 1;
 		fclose(fp);
 	}
-	return arr;
+	free(arrValuesPoint);
+	free(arrFloatValuesPoint);
+	*totalNumberOfFeatures = spFeatureStoreGetSize(store);
+	if (*totalNumberOfFeatures < 0)
+		*totalNumberOfFeatures = 0;
+	return store;
 }
 
 void initializeArray(Hits * arrayOfHits, int size) {
@@ -93,13 +207,177 @@ void initializeArray(Hits * arrayOfHits, int size) {
 	}
 }
 
-void updateArrayOfHits(Hits * arrayOfHits, SPBPQueue bpq) {
+void updateArrayOfHits(Hits * arrayOfHits, SPBPQueue bpq, SPFeatureStore store) {
 	int size = spBPQueueSize(bpq);
+	const SPBPQueueElement* neighbors = spBPQueueGetElements(bpq);
 	int index = 0;
 	for (int i = 0; i < size; i++) {
-		index = spBPQueueIndexOfMinValue(bpq);
+		index = spFeatureStoreGetIndex(store, neighbors[i].index);
 		arrayOfHits[index].hitsValue += 1;
 	}
+	spBPQueueReset(bpq);
+}
+
+bool updateArrayOfHitsBatch(Hits * arrayOfHits, KDTreeNode* kdTreeNode,
+		SPFeatureStore store, SPPoint* featuresOfQuery, int numOfFeats,
+		SPBPQueue candidates, SPBPQueue bpq) {
+	int spKNN = spBPQueueGetMaxSize(bpq);
+	int k = candidates != NULL ? spBPQueueGetMaxSize(candidates) : spKNN;
+	int count = 0;
+	SPFeatureQuery* queries = (SPFeatureQuery*) malloc(
+			numOfFeats * sizeof(SPFeatureQuery));
+	int* offsets = (int*) malloc((size_t) numOfFeats * k * sizeof(int));
+	double* distances = (double*) malloc(
+			(size_t) numOfFeats * k * sizeof(double));
+	bool searched = queries != NULL && offsets != NULL && distances != NULL;
+	for (int i = 0; searched && i < numOfFeats; i++) {
+		// converted once to the element type of the store
+		queries[count] = spFeatureStorePrepareQuery(store, featuresOfQuery[i]);
+		if (queries[count] == NULL)
+			spLoggerPrintWarning("Query feature skipped", __FILE__, __func__,
+					__LINE__);
+		else
+			count++;
+	}
+	if (searched && count > 0)
+		searched = kNearestNeighborsBatch(kdTreeNode, store, queries, count, k,
+				offsets, distances);
+	for (int q = 0; searched && q < count; q++) {
+		for (int i = 0; i < k && offsets[(size_t) q * k + i] >= 0; i++) {
+			int offset = offsets[(size_t) q * k + i];
+			if (candidates == NULL) {
+				arrayOfHits[spFeatureStoreGetIndex(store, offset)].hitsValue +=
+						1;
+				continue;
+			}
+			// cannot fail, candidates is not NULL here
+			spBPQueueEnqueueValue(candidates, offset,
+					distances[(size_t) q * k + i]);
+		}
+		if (candidates != NULL) {
+			rerankNeighbors(store, queries[q], candidates, bpq);
+			updateArrayOfHits(arrayOfHits, bpq, store);
+		}
+	}
+	for (int q = 0; q < count; q++)
+		spFeatureQueryDestroy(queries[q]);
+	free(queries);
+	free(offsets);
+	free(distances);
+	return searched;
+}
+
+/** vote for the nearest features to features, bpq (and candidates) are left empty **/
+static void searchFeatures(const QuerySearch* search, SPPoint* features,
+		int numOfFeats, SPBPQueue candidates, SPBPQueue bpq, Hits* hits) {
+	// the exact search shares the tree walk between all the features
+	if (search->kdForest == NULL && search->maxChecks <= 0
+			&& updateArrayOfHitsBatch(hits, search->kdTreeNode, search->store,
+					features, numOfFeats, candidates, bpq))
+		return;
+	for (int i = 0; i < numOfFeats; i++) {
+		// converted once to the element type of the store
+		SPFeatureQuery featureQuery = spFeatureStorePrepareQuery(search->store,
+				features[i]);
+		if (featureQuery == NULL) {
+			spLoggerPrintWarning("Query feature skipped", __FILE__, __func__,
+					__LINE__);
+			continue;
+		}
+		// with candidates, gather them by the quantized distance and
+		// keep the k nearest by the exact distance
+		SPBPQueue* neighbors = candidates != NULL ? &candidates : &bpq;
+		if (search->kdForest != NULL) {
+			kdForestNeighbors(search->kdForest, search->store, neighbors,
+					featureQuery, search->maxChecks);
+		} else if (search->maxChecks > 0) {
+			bestBinFirstNeighbors(search->kdTreeNode, search->store, neighbors,
+					featureQuery, search->maxChecks);
+		} else {
+			kNearestNeighbors(search->kdTreeNode, search->store, neighbors,
+					featureQuery); // update bpq to contain k nearest neighbors
+		}
+		if (candidates != NULL)
+			rerankNeighbors(search->store, featureQuery, candidates, bpq);
+		spFeatureQueryDestroy(featureQuery);
+		updateArrayOfHits(hits, bpq, search->store);
+	}
+}
+
+static void* runQueryTask(void* arg) {
+	QueryTask* task = (QueryTask*) arg;
+	const QuerySearch* search = task->search;
+	SPBPQueue bpq = spBPQueueCreate(search->spKNN);
+	SPBPQueue candidates = NULL;
+	if (search->rerankCandidates > 0)
+		candidates = spBPQueueCreate(search->rerankCandidates);
+	task->succeeded = bpq != NULL
+			&& (search->rerankCandidates <= 0 || candidates != NULL);
+	if (task->succeeded) {
+		initializeArray(task->hits, task->numOfImages);
+		searchFeatures(search, task->features, task->numOfFeats, candidates,
+				bpq, task->hits);
+	}
+	spBPQueueDestroy(bpq);
+	spBPQueueDestroy(candidates);
+	return NULL;
+}
+
+bool updateArrayOfHitsParallel(Hits * arrayOfHits, int numOfImages,
+		const QuerySearch* search, SPPoint* featuresOfQuery, int numOfFeats,
+		int threads) {
+	QueryTask tasks[QUERY_MAX_THREADS];
+	pthread_t workers[QUERY_MAX_THREADS];
+	bool started[QUERY_MAX_THREADS];
+	bool succeeded = true;
+	if (threads > numOfFeats)
+		threads = numOfFeats;
+	if (threads > QUERY_MAX_THREADS)
+		threads = QUERY_MAX_THREADS;
+	if (threads < 1)
+		threads = 1;
+	Hits* hits = (Hits*) malloc(
+			(size_t) threads * numOfImages * sizeof(*hits));
+	if (hits == NULL) {
+		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
+		return false;
+	}
+
+	// every thread searches a contiguous range of the features
+	for (int t = 0; t < threads; t++) {
+		int first = (int) ((long long) t * numOfFeats / threads);
+		int last = (int) ((long long) (t + 1) * numOfFeats / threads);
+		tasks[t].search = search;
+		tasks[t].features = featuresOfQuery + first;
+		tasks[t].numOfFeats = last - first;
+		tasks[t].hits = hits + (size_t) t * numOfImages;
+		tasks[t].numOfImages = numOfImages;
+		tasks[t].succeeded = false;
+		// the features of a thread that failed to start are searched by this one
+		started[t] = t > 0
+				&& pthread_create(&workers[t], NULL, runQueryTask, &tasks[t])
+						== 0;
+	}
+	for (int t = 0; t < threads; t++) {
+		if (!started[t])
+			runQueryTask(&tasks[t]);
+	}
+	for (int t = 1; t < threads; t++) {
+		if (started[t])
+			pthread_join(workers[t], NULL);
+		succeeded = succeeded && tasks[t].succeeded;
+	}
+	succeeded = succeeded && tasks[0].succeeded;
+
+	// the votes of all the threads are summed once every thread is done
+	for (int t = 0; succeeded && t < threads; t++) {
+		for (int i = 0; i < numOfImages; i++)
+			arrayOfHits[i].hitsValue += tasks[t].hits[i].hitsValue;
+	}
+	if (!succeeded)
+		spLoggerPrintError("Allocation Failure", __FILE__, __func__, __LINE__);
+	free(hits);
+	return succeeded;
 }
 
 void calculateTheBestIndexes(int *IndexesOfBestCandidates, Hits * arrayOfHits,
@@ -138,3 +416,14 @@ void freeResources(char* imagePath, char* imageFeatsExtensionPath,
 	if (query != NULL)
 		free(query);
 }
+
+void destroySearchIndex(KDTreeNode* kdTreeNode, KDForest* kdForest,
+		SPFeatureStore store, SPIndexFile indexFile) {
+	if (indexFile != NULL) { // the tree and the store point into the file
+		spIndexFileDestroy(indexFile);
+		return;
+	}
+	destroy(kdTreeNode);
+	destroyKDForest(kdForest);
+	spFeatureStoreDestroy(store);
+}
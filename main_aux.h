@@ -10,18 +10,34 @@
 
 #include <stdbool.h>
 #include "SPPoint.h"
+#include "SPFeatureStore.h"
 #include "SPConfig.h"
 #include "SPBPriorityQueue.h"
+#include "KDTreeNode.h"
+#include "SPIndexFile.h"
 
 typedef struct Hits {
 	int index;
 	int hitsValue;
 } Hits;
 
+/** the index the features of a query image are searched in, and how **/
+typedef struct QuerySearch {
+	KDTreeNode* kdTreeNode; // NULL when kdForest is searched
+	KDForest* kdForest; // NULL when kdTreeNode is searched
+	SPFeatureStore store;
+	int spKNN; // the number of nearest features voting for their image
+	int rerankCandidates; // gathered by the quantized distance, 0 if none
+	int maxChecks; // 0 for the exact search
+} QuerySearch;
+
 /*
  * stores each of these features to a file which will be located
  * in the directory given by spImagesDirectory.
  *
+ * The exact extracted coordinates are written, not the rows of the feature
+ * store, which may be quantized.
+ *
  * @param points - the array of features
  * @param index - the index of the image
  * @param numOfFeats - the actual features extracted
@@ -31,17 +47,68 @@ typedef struct Hits {
 void createFeatsFileForImage(SPPoint* points, int index, int numOfFeats,
 		char* fileName);
 
-/** extract the array of points from the feats files **/
-SPPoint* ExtractFeaturesFromFiles(int numOfImages,
+/**
+ * create an empty feature store with the element type given by
+ * spFeatureStorage of config (float for PQ storage). For INT8 storage the quantizer is set from
+ * quantOffsets and quantScales (dim values each), and the exact features
+ * are kept as well when spRerankCandidates of config is positive.
+ * NULL is returned on allocation failure or if the quantizer is missing.
+ **/
+SPFeatureStore createFeatureStore(int dim, int capacity, SPConfig config,
+		const double* quantOffsets, const double* quantScales);
+
+/**
+ * for PQ storage, replace store (created by createFeatureStore, it is kept
+ * as float until all the features are appended) by its product quantized
+ * copy, store is destroyed. For other storages store is returned as is.
+ * NULL is returned if the compression failed.
+ **/
+SPFeatureStore compressFeatureStore(SPFeatureStore store, SPConfig config);
+
+/**
+ * extract the points from the feats files into a new feature store,
+ * the features of every image are appended as one contiguous range and
+ * kept with the element type given by spFeatureStorage of config
+ * (quantOffsets and quantScales are used for INT8 storage, their
+ * dimension is expectedDim).
+ * NULL is returned if no feature could be read or on allocation failure.
+ **/
+SPFeatureStore ExtractFeaturesFromFiles(int numOfImages,
 		char* imageFeatsExtensionPath, char* extensionFeats,
 		int* totalNumberOfFeatures, SP_CONFIG_MSG* msg, SPConfig config,
-		int* actualNumberOfImages);
+		int* actualNumberOfImages, const double* quantOffsets,
+		const double* quantScales, int expectedDim);
 
 /** initiate array of hits (for the images) with zeros. **/
 void initializeArray(Hits * arrayOfHits, int size);
 
-/** update array of hits according to the bpq **/
-void updateArrayOfHits(Hits * arrayOfHits, SPBPQueue bpq);
+/** update array of hits according to the bpq (of offsets in store), bpq is emptied **/
+void updateArrayOfHits(Hits * arrayOfHits, SPBPQueue bpq, SPFeatureStore store);
+
+/**
+ * update array of hits with the nearest features to all the features of a
+ * query image, searched at once (see kNearestNeighborsBatch) for the size
+ * of bpq nearest of every feature. With candidates (a quantized store), the
+ * batch finds the candidates of every feature, which are reranked into bpq
+ * as for a single feature.
+ * false is returned if an allocation failed, arrayOfHits is unchanged then.
+ **/
+bool updateArrayOfHitsBatch(Hits * arrayOfHits, KDTreeNode* kdTreeNode,
+		SPFeatureStore store, SPPoint* featuresOfQuery, int numOfFeats,
+		SPBPQueue candidates, SPBPQueue bpq);
+
+/**
+ * update array of hits (of numOfImages images) with the nearest features to
+ * all the features of a query image, searched as given by search. The
+ * features are split between up to threads threads, every thread has its
+ * own bpq and votes into its own array of hits, and the arrays are summed
+ * into arrayOfHits once all the threads are done, so the hits are the same
+ * for any number of threads.
+ * false is returned if an allocation failed, arrayOfHits is unchanged then.
+ **/
+bool updateArrayOfHitsParallel(Hits * arrayOfHits, int numOfImages,
+		const QuerySearch* search, SPPoint* featuresOfQuery, int numOfFeats,
+		int threads);
 
 /** calculate the most similar images indexes **/
 void calculateTheBestIndexes(int *IndexesOfBestCandidates, Hits * arrayOfHits,
@@ -51,4 +118,11 @@ void freeResources(char* imagePath, char* imageFeatsExtensionPath,
 
 int cmpHitsFunc(const void* a, const void* b);
 
+/**
+ * frees the kd-tree, the forest and the store, or the index file they were
+ * mapped from if indexFile is not NULL. NULL arguments are ignored.
+ **/
+void destroySearchIndex(KDTreeNode* kdTreeNode, KDForest* kdForest,
+		SPFeatureStore store, SPIndexFile indexFile);
+
 #endif /* MAIN_AUX_H_ */
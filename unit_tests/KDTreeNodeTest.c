@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <math.h>
+#include "unit_test_util.h"
+#include "../KDTreeNode.h"
+#include "../KDArray.h"
+#include "../SPFeatureStore.h"
+#include "../SPBPriorityQueue.h"
+#include "../SPPoint.h"
+#include "../SPConfig.h"
+#include "../SPDistance.h"
+
+/*
+ * Checks the searches of the kd-tree and of the randomized forest against
+ * bruteForceNeighbors, which scans every feature of the store. Two results
+ * agree if they hold the same distances and every index is a distinct
+ * feature at its distance, so ties may be broken either way.
+ */
+
+#define TEST_SIZE 3000
+#define TEST_DIM 13
+#define TEST_NUM_OF_IMAGES 50
+#define TEST_NUM_OF_QUERIES 40
+#define TEST_KNN 5
+#define TEST_SMALL_BUDGET 64
+#define TEST_FOREST_TREES 4
+
+static double randomCoor() {
+	return (rand() / (double) RAND_MAX) * 200.0 - 100.0;
+}
+
+static SPPoint randomPoint(int index) {
+	double data[TEST_DIM];
+	for (int i = 0; i < TEST_DIM; i++)
+		data[i] = randomCoor();
+	return spPointCreate(data, TEST_DIM, index);
+}
+
+/** a store of TEST_SIZE random features of TEST_NUM_OF_IMAGES images **/
+static SPFeatureStore createRandomStore(SPFeatureStorage storage) {
+	double offsets[TEST_DIM], scales[TEST_DIM];
+	SPFeatureStore store = spFeatureStoreCreate(TEST_DIM, TEST_SIZE, storage);
+	if (store == NULL)
+		return NULL;
+	for (int i = 0; i < TEST_DIM; i++) {
+		offsets[i] = -100.0;
+		scales[i] = 200.0 / 255;
+	}
+	if (storage == INT8_STORAGE
+			&& spFeatureStoreSetQuantization(store, offsets, scales, false)
+					!= SP_FEATURE_STORE_SUCCESS) {
+		spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	for (int i = 0; i < TEST_SIZE; i++) {
+		SPPoint point = randomPoint(i % TEST_NUM_OF_IMAGES);
+		SP_FEATURE_STORE_MSG msg = spFeatureStoreAppendPoint(store, point);
+		spPointDestroy(point);
+		if (msg != SP_FEATURE_STORE_SUCCESS) {
+			spFeatureStoreDestroy(store);
+			return NULL;
+		}
+	}
+	return store;
+}
+
+static SPFeatureQuery* createRandomQueries(SPFeatureStore store) {
+	SPFeatureQuery* queries = (SPFeatureQuery*) malloc(
+			sizeof(SPFeatureQuery) * TEST_NUM_OF_QUERIES);
+	if (queries == NULL)
+		return NULL;
+	for (int q = 0; q < TEST_NUM_OF_QUERIES; q++) {
+		SPPoint point = randomPoint(0);
+		queries[q] = spFeatureStorePrepareQuery(store, point);
+		spPointDestroy(point);
+	}
+	return queries;
+}
+
+static void destroyQueries(SPFeatureQuery* queries) {
+	for (int q = 0; q < TEST_NUM_OF_QUERIES; q++)
+		spFeatureQueryDestroy(queries[q]);
+	free(queries);
+}
+
+static int compareDoubles(const void* a, const void* b) {
+	double x = *(const double*) a, y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * true if the count neighbors (offsets, distances) are distinct features of
+ * store at those distances from query, and their sorted distances are
+ * expected (the sorted distances of the reference)
+ **/
+static bool isValidResult(SPFeatureStore store, SPFeatureQuery query,
+		const int* offsets, const double* distances, int count,
+		const double* expected) {
+	double sorted[TEST_KNN];
+	for (int i = 0; i < count; i++) {
+		if (offsets[i] < 0 || offsets[i] >= spFeatureStoreGetSize(store)
+				|| spFeatureStoreQueryDistance(store, offsets[i], query)
+						!= distances[i])
+			return false;
+		for (int j = 0; j < i; j++) {
+			if (offsets[j] == offsets[i])
+				return false;
+		}
+		sorted[i] = distances[i];
+	}
+	qsort(sorted, count, sizeof(double), compareDoubles);
+	for (int i = 0; i < count; i++) {
+		if (expected != NULL && sorted[i] != expected[i])
+			return false;
+	}
+	return true;
+}
+
+/** the elements of bpq as offsets and distances, bpq is emptied **/
+static int takeNeighbors(SPBPQueue bpq, int* offsets, double* distances) {
+	const SPBPQueueElement* elements = spBPQueueGetElements(bpq);
+	int size = spBPQueueSize(bpq);
+	for (int i = 0; i < size; i++) {
+		offsets[i] = elements[i].index;
+		distances[i] = elements[i].value;
+	}
+	spBPQueueReset(bpq);
+	return size;
+}
+
+/** the sorted distances of the k nearest features of store to query **/
+static bool referenceDistances(SPFeatureStore store, SPFeatureQuery query,
+		SPBPQueue bpq, double* expected) {
+	int offsets[TEST_KNN];
+	bruteForceNeighbors(store, bpq, query);
+	int size = takeNeighbors(bpq, offsets, expected);
+	if (size != TEST_KNN || !isValidResult(store, query, offsets, expected,
+			size, NULL))
+		return false;
+	qsort(expected, size, sizeof(double), compareDoubles);
+	return true;
+}
+
+/** every search of a tree of store against the brute force search **/
+static bool checkTree(KDTreeNode* root, SPFeatureStore store) {
+	int offsets[TEST_KNN * TEST_NUM_OF_QUERIES];
+	double distances[TEST_KNN * TEST_NUM_OF_QUERIES];
+	double expected[TEST_KNN * TEST_NUM_OF_QUERIES];
+	SPFeatureQuery* queries = createRandomQueries(store);
+	SPBPQueue bpq = spBPQueueCreate(TEST_KNN);
+	bool result = root != NULL && queries != NULL && bpq != NULL
+			&& kNearestNeighborsBatch(root, store, queries,
+					TEST_NUM_OF_QUERIES, TEST_KNN, offsets, distances);
+	for (int q = 0; q < TEST_NUM_OF_QUERIES && result; q++) {
+		int* queryOffsets = offsets + q * TEST_KNN;
+		double* queryDistances = distances + q * TEST_KNN;
+		double* queryExpected = expected + q * TEST_KNN;
+		result = referenceDistances(store, queries[q], bpq, queryExpected)
+				&& isValidResult(store, queries[q], queryOffsets,
+						queryDistances, TEST_KNN, queryExpected);
+		// the exact search
+		kNearestNeighbors(root, store, &bpq, queries[q]);
+		result = result
+				&& takeNeighbors(bpq, queryOffsets, queryDistances) == TEST_KNN
+				&& isValidResult(store, queries[q], queryOffsets,
+						queryDistances, TEST_KNN, queryExpected);
+		// best-bin-first with a budget of the whole tree is exact
+		bestBinFirstNeighbors(root, store, &bpq, queries[q], TEST_SIZE);
+		result = result
+				&& takeNeighbors(bpq, queryOffsets, queryDistances) == TEST_KNN
+				&& isValidResult(store, queries[q], queryOffsets,
+						queryDistances, TEST_KNN, queryExpected);
+		// with a small budget only the features found must be valid
+		bestBinFirstNeighbors(root, store, &bpq, queries[q],
+				TEST_SMALL_BUDGET);
+		result = result
+				&& takeNeighbors(bpq, queryOffsets, queryDistances) == TEST_KNN
+				&& isValidResult(store, queries[q], queryOffsets,
+						queryDistances, TEST_KNN, NULL);
+	}
+	spBPQueueDestroy(bpq);
+	if (queries != NULL)
+		destroyQueries(queries);
+	return result;
+}
+
+static bool treeSearchTest() {
+	const SPFeatureStorage storages[] = { DOUBLE_STORAGE, FLOAT_STORAGE,
+			INT8_STORAGE };
+	const KDTreeSplitMethod methods[] = { RANDOM, MAX_SPREAD, INCREMENTAL };
+	for (int s = 0; s < 3; s++) {
+		for (int m = 0; m < 3; m++) {
+			SPFeatureStore store = createRandomStore(storages[s]);
+			ASSERT_TRUE(store != NULL);
+			KDTreeNode* root = InitKDTreeSelect(store, NULL, TEST_SIZE,
+					methods[m], TEST_DIM, TEST_DIM, 1, 1);
+			bool result = checkTree(root, store);
+			destroy(root);
+			spFeatureStoreDestroy(store);
+			ASSERT_TRUE(result);
+		}
+	}
+	return true;
+}
+
+/** the presorted build, several threads and leaves scanned by blocks **/
+static bool treeLeavesTest() {
+	const SPFeatureStorage storages[] = { DOUBLE_STORAGE, FLOAT_STORAGE };
+	for (int s = 0; s < 2; s++) {
+		SPFeatureStore store = createRandomStore(storages[s]);
+		ASSERT_TRUE(store != NULL);
+		KDTreeNode* root = InitKDTree(Init(store, NULL, TEST_SIZE), MAX_SPREAD,
+				TEST_DIM, TEST_DIM, 2 * SP_DISTANCE_BLOCK, 4);
+		bool result = checkTree(root, store);
+		result = result
+				&& spFeatureStoreBuildBlocks(store) == SP_FEATURE_STORE_SUCCESS
+				&& checkTree(root, store);
+		destroy(root);
+		spFeatureStoreDestroy(store);
+		ASSERT_TRUE(result);
+	}
+	return true;
+}
+
+static bool forestSearchTest() {
+	int offsets[TEST_KNN];
+	double distances[TEST_KNN], expected[TEST_KNN];
+	SPFeatureStore store = createRandomStore(FLOAT_STORAGE);
+	ASSERT_TRUE(store != NULL);
+	KDForest* forest = InitKDForest(store, TEST_SIZE, TEST_FOREST_TREES,
+			SP_DISTANCE_BLOCK, 2);
+	SPFeatureQuery* queries = createRandomQueries(store);
+	SPBPQueue bpq = spBPQueueCreate(TEST_KNN);
+	bool result = forest != NULL && queries != NULL && bpq != NULL;
+	for (int q = 0; q < TEST_NUM_OF_QUERIES && result; q++) {
+		result = referenceDistances(store, queries[q], bpq, expected);
+		// a budget of every point of every tree is exact
+		kdForestNeighbors(forest, store, &bpq, queries[q],
+				TEST_SIZE * TEST_FOREST_TREES);
+		result = result && takeNeighbors(bpq, offsets, distances) == TEST_KNN
+				&& isValidResult(store, queries[q], offsets, distances,
+						TEST_KNN, expected);
+		kdForestNeighbors(forest, store, &bpq, queries[q], TEST_SMALL_BUDGET);
+		result = result && takeNeighbors(bpq, offsets, distances) == TEST_KNN
+				&& isValidResult(store, queries[q], offsets, distances,
+						TEST_KNN, NULL);
+	}
+	spBPQueueDestroy(bpq);
+	if (queries != NULL)
+		destroyQueries(queries);
+	destroyKDForest(forest);
+	spFeatureStoreDestroy(store);
+	ASSERT_TRUE(result);
+	return true;
+}
+
+int main() {
+	int failedTests = 0;
+	srand(0);
+	RUN_TEST(treeSearchTest);
+	RUN_TEST(treeLeavesTest);
+	RUN_TEST(forestSearchTest);
+	return failedTests;
+}
@@ -0,0 +1,321 @@
+#include <stdlib.h>
+#include "unit_test_util.h"
+#include "../SPBPriorityQueue.h"
+#include "../SPListElement.h"
+
+/*
+ * Checks the bounded priority queue against a sorted reference: the
+ * elements enqueued so far sorted by value and then by index, of which the
+ * queue must hold the first maxSize. The values are drawn from a few ones,
+ * so many elements tie and the order of their indexes decides.
+ */
+
+#define TEST_MAX_SIZE 10
+#define TEST_NUM_OF_ELEMENTS 200
+#define TEST_NUM_OF_VALUES 15
+#define TEST_STEPS 2000
+
+/** orders elements by value and then by index, as the queue does **/
+static int compareElements(const void* a, const void* b) {
+	const SPBPQueueElement* x = (const SPBPQueueElement*) a;
+	const SPBPQueueElement* y = (const SPBPQueueElement*) b;
+	if (x->value != y->value)
+		return x->value < y->value ? -1 : 1;
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+/** count elements with the indexes first to first + count - 1 in random order **/
+static void randomElements(SPBPQueueElement* elements, int count, int first) {
+	for (int i = 0; i < count; i++) {
+		elements[i].index = first + i;
+		elements[i].value = 1 + (rand() % TEST_NUM_OF_VALUES) / 2.0;
+	}
+	for (int i = count - 1; i > 0; i--) {
+		int j = rand() % (i + 1);
+		SPBPQueueElement swap = elements[i];
+		elements[i] = elements[j];
+		elements[j] = swap;
+	}
+}
+
+/** enqueues the count elements to bpq, then sorts them as the reference **/
+static bool enqueueAll(SPBPQueue bpq, SPBPQueueElement* elements, int count) {
+	for (int i = 0; i < count; i++)
+		ASSERT_TRUE(spBPQueueEnqueueValue(bpq, elements[i].index,
+				elements[i].value) == SP_BPQUEUE_SUCCESS);
+	qsort(elements, count, sizeof(SPBPQueueElement), compareElements);
+	return true;
+}
+
+/** true if element has the index and value of expected, element is destroyed **/
+static bool isElement(SPListElement element, SPBPQueueElement expected) {
+	bool equal = element != NULL
+			&& spListElementGetIndex(element) == expected.index
+			&& spListElementGetValue(element) == expected.value;
+	spListElementDestroy(element);
+	return equal;
+}
+
+/** checks Size, Peek, PeekLast, MinValue and MaxValue against the sorted elements bpq holds **/
+static bool checkQueue(SPBPQueue bpq, const SPBPQueueElement* held, int count) {
+	ASSERT_TRUE(spBPQueueSize(bpq) == count);
+	ASSERT_TRUE(spBPQueueIsEmpty(bpq) == (count == 0));
+	ASSERT_TRUE(spBPQueueIsFull(bpq) == (count == spBPQueueGetMaxSize(bpq)));
+	if (count == 0) {
+		ASSERT_TRUE(spBPQueuePeek(bpq) == NULL);
+		ASSERT_TRUE(spBPQueuePeekLast(bpq) == NULL);
+		ASSERT_TRUE(spBPQueueMinValue(bpq) == -1);
+		ASSERT_TRUE(spBPQueueMaxValue(bpq) == -1);
+		return true;
+	}
+	ASSERT_TRUE(isElement(spBPQueuePeek(bpq), held[0]));
+	ASSERT_TRUE(isElement(spBPQueuePeekLast(bpq), held[count - 1]));
+	ASSERT_TRUE(spBPQueueMinValue(bpq) == held[0].value);
+	ASSERT_TRUE(spBPQueueMaxValue(bpq) == held[count - 1].value);
+	return true;
+}
+
+/** dequeues all of bpq, which should hold the count first sorted elements **/
+static bool drainQueue(SPBPQueue bpq, const SPBPQueueElement* sorted,
+		int count) {
+	for (int k = 0; k < count; k++) {
+		ASSERT_TRUE(checkQueue(bpq, sorted + k, count - k));
+		ASSERT_TRUE(spBPQueueDequeue(bpq) == SP_BPQUEUE_SUCCESS);
+	}
+	ASSERT_TRUE(checkQueue(bpq, sorted, 0));
+	ASSERT_TRUE(spBPQueueDequeue(bpq) == SP_BPQUEUE_EMPTY);
+	return true;
+}
+
+static bool enqueueTest() {
+	SPBPQueueElement elements[TEST_NUM_OF_ELEMENTS];
+	SPBPQueue bpq = spBPQueueCreate(TEST_MAX_SIZE);
+	ASSERT_TRUE(bpq != NULL);
+	randomElements(elements, TEST_NUM_OF_ELEMENTS, 0);
+	ASSERT_TRUE(enqueueAll(bpq, elements, TEST_NUM_OF_ELEMENTS));
+	ASSERT_TRUE(drainQueue(bpq, elements, TEST_MAX_SIZE));
+	ASSERT_TRUE(spBPQueueEnqueueValue(NULL, 0, 0) == SP_BPQUEUE_INVALID_ARGUMENT);
+	ASSERT_TRUE(spBPQueueEnqueue(bpq, NULL) == SP_BPQUEUE_INVALID_ARGUMENT);
+	spBPQueueDestroy(bpq);
+	return true;
+}
+
+/** all the values are equal, the queue keeps the lowest indexes **/
+static bool tieTest() {
+	SPBPQueueElement elements[TEST_NUM_OF_ELEMENTS];
+	SPBPQueue bpq = spBPQueueCreate(TEST_MAX_SIZE);
+	ASSERT_TRUE(bpq != NULL);
+	randomElements(elements, TEST_NUM_OF_ELEMENTS, 0);
+	for (int i = 0; i < TEST_NUM_OF_ELEMENTS; i++)
+		elements[i].value = 1.5;
+	ASSERT_TRUE(enqueueAll(bpq, elements, TEST_NUM_OF_ELEMENTS));
+	for (int i = 0; i < TEST_MAX_SIZE; i++)
+		ASSERT_TRUE(elements[i].index == i);
+	ASSERT_TRUE(drainQueue(bpq, elements, TEST_MAX_SIZE));
+	spBPQueueDestroy(bpq);
+	return true;
+}
+
+/**
+ * random enqueues and dequeues, the queue is checked after each against
+ * the sorted elements it should hold
+ */
+static bool mixedTest() {
+	SPBPQueueElement held[TEST_MAX_SIZE + 1];
+	int count = 0;
+	SPBPQueue bpq = spBPQueueCreate(TEST_MAX_SIZE);
+	ASSERT_TRUE(bpq != NULL);
+	for (int step = 0; step < TEST_STEPS; step++) {
+		if (rand() % 3 == 0) {
+			ASSERT_TRUE(spBPQueueDequeue(bpq) ==
+					(count == 0 ? SP_BPQUEUE_EMPTY : SP_BPQUEUE_SUCCESS));
+			for (int i = 1; i < count; i++)
+				held[i - 1] = held[i];
+			count = count > 0 ? count - 1 : 0;
+		} else {
+			randomElements(held + count, 1, step);
+			ASSERT_TRUE(enqueueAll(bpq, held + count, 1));
+			count++;
+			qsort(held, count, sizeof(SPBPQueueElement), compareElements);
+			count = count > TEST_MAX_SIZE ? TEST_MAX_SIZE : count;
+		}
+		ASSERT_TRUE(checkQueue(bpq, held, count));
+	}
+	ASSERT_TRUE(drainQueue(bpq, held, count));
+	spBPQueueDestroy(bpq);
+	return true;
+}
+
+static bool isFullTest() {
+	SPBPQueue bpq = spBPQueueCreate(TEST_MAX_SIZE);
+	ASSERT_TRUE(bpq != NULL);
+	ASSERT_TRUE(spBPQueueGetMaxSize(bpq) == TEST_MAX_SIZE);
+	for (int i = 0; i < TEST_MAX_SIZE; i++) {
+		ASSERT_FALSE(spBPQueueIsFull(bpq));
+		ASSERT_TRUE(spBPQueueEnqueueValue(bpq, i, i) == SP_BPQUEUE_SUCCESS);
+	}
+	ASSERT_TRUE(spBPQueueIsFull(bpq));
+	ASSERT_TRUE(spBPQueueEnqueueValue(bpq, TEST_MAX_SIZE, TEST_MAX_SIZE)
+			== SP_BPQUEUE_SUCCESS);
+	ASSERT_TRUE(spBPQueueIsFull(bpq));
+	ASSERT_TRUE(spBPQueueSize(bpq) == TEST_MAX_SIZE);
+	ASSERT_TRUE(spBPQueueDequeue(bpq) == SP_BPQUEUE_SUCCESS);
+	ASSERT_FALSE(spBPQueueIsFull(bpq));
+	ASSERT_TRUE(spBPQueueCreate(0) == NULL);
+	spBPQueueDestroy(bpq);
+	return true;
+}
+
+/** a full queue grown by SetSize keeps its elements and takes more **/
+static bool setSizeTest() {
+	SPBPQueueElement first[TEST_NUM_OF_ELEMENTS];
+	SPBPQueueElement all[TEST_MAX_SIZE + TEST_NUM_OF_ELEMENTS];
+	SPBPQueue bpq = spBPQueueCreate(TEST_MAX_SIZE);
+	ASSERT_TRUE(bpq != NULL);
+	randomElements(first, TEST_NUM_OF_ELEMENTS, 0);
+	ASSERT_TRUE(enqueueAll(bpq, first, TEST_NUM_OF_ELEMENTS));
+	spBPQueueSetSize(bpq, 3 * TEST_MAX_SIZE);
+	ASSERT_TRUE(spBPQueueGetMaxSize(bpq) == 3 * TEST_MAX_SIZE);
+	ASSERT_TRUE(checkQueue(bpq, first, TEST_MAX_SIZE));
+	for (int i = 0; i < TEST_MAX_SIZE; i++)
+		all[i] = first[i];
+	randomElements(all + TEST_MAX_SIZE, TEST_NUM_OF_ELEMENTS,
+			TEST_NUM_OF_ELEMENTS);
+	ASSERT_TRUE(enqueueAll(bpq, all + TEST_MAX_SIZE, TEST_NUM_OF_ELEMENTS));
+	qsort(all, TEST_MAX_SIZE + TEST_NUM_OF_ELEMENTS, sizeof(SPBPQueueElement),
+			compareElements);
+	ASSERT_TRUE(drainQueue(bpq, all, 3 * TEST_MAX_SIZE));
+	spBPQueueDestroy(bpq);
+	return true;
+}
+
+/** a copy holds the same elements and changes apart from its source **/
+static bool copyTest() {
+	SPBPQueueElement elements[TEST_NUM_OF_ELEMENTS];
+	SPBPQueueElement lowest = { TEST_NUM_OF_ELEMENTS, 0 };
+	SPBPQueueElement copied[TEST_MAX_SIZE];
+	SPBPQueue bpq = spBPQueueCreate(TEST_MAX_SIZE);
+	ASSERT_TRUE(bpq != NULL);
+	ASSERT_TRUE(spBPQueueCopy(NULL) == NULL);
+	randomElements(elements, TEST_NUM_OF_ELEMENTS, 0);
+	ASSERT_TRUE(enqueueAll(bpq, elements, TEST_NUM_OF_ELEMENTS));
+	SPBPQueue copy = spBPQueueCopy(bpq);
+	ASSERT_TRUE(copy != NULL);
+	ASSERT_TRUE(spBPQueueGetMaxSize(copy) == TEST_MAX_SIZE);
+	ASSERT_TRUE(enqueueAll(copy, &lowest, 1));
+	copied[0] = lowest;
+	for (int i = 1; i < TEST_MAX_SIZE; i++)
+		copied[i] = elements[i - 1];
+	ASSERT_TRUE(drainQueue(copy, copied, TEST_MAX_SIZE));
+	ASSERT_TRUE(drainQueue(bpq, elements, TEST_MAX_SIZE));
+	spBPQueueDestroy(copy);
+	spBPQueueDestroy(bpq);
+	return true;
+}
+
+/** only the elements the queue kept are found, by index and value **/
+static bool containsTest() {
+	SPBPQueueElement elements[TEST_NUM_OF_ELEMENTS];
+	SPBPQueue bpq = spBPQueueCreate(TEST_MAX_SIZE);
+	ASSERT_TRUE(bpq != NULL);
+	randomElements(elements, TEST_NUM_OF_ELEMENTS, 0);
+	ASSERT_TRUE(enqueueAll(bpq, elements, TEST_NUM_OF_ELEMENTS));
+	for (int i = 0; i < TEST_NUM_OF_ELEMENTS; i++) {
+		SPListElement element = spListElementCreate(elements[i].index,
+				elements[i].value);
+		ASSERT_TRUE(spBPQueueContainsValue(bpq, elements[i].index,
+				elements[i].value) == (i < TEST_MAX_SIZE));
+		ASSERT_TRUE(spBPQueueContains(bpq, element) == (i < TEST_MAX_SIZE));
+		ASSERT_FALSE(spBPQueueContainsValue(bpq, elements[i].index,
+				elements[i].value + 100));
+		spListElementDestroy(element);
+	}
+	ASSERT_FALSE(spBPQueueContainsValue(NULL, 0, 0));
+	ASSERT_FALSE(spBPQueueContains(bpq, NULL));
+	spBPQueueDestroy(bpq);
+	return true;
+}
+
+/**
+ * GetElements gives the count sorted elements bpq holds, in no particular
+ * order, so they are sorted and compared
+ */
+static bool checkElements(SPBPQueue bpq, const SPBPQueueElement* held,
+		int count) {
+	SPBPQueueElement elements[TEST_NUM_OF_ELEMENTS];
+	const SPBPQueueElement* view = spBPQueueGetElements(bpq);
+	ASSERT_TRUE(view != NULL);
+	ASSERT_TRUE(spBPQueueSize(bpq) == count);
+	for (int i = 0; i < count; i++)
+		elements[i] = view[i];
+	qsort(elements, count, sizeof(SPBPQueueElement), compareElements);
+	for (int i = 0; i < count; i++) {
+		ASSERT_TRUE(elements[i].index == held[i].index);
+		ASSERT_TRUE(elements[i].value == held[i].value);
+	}
+	return true;
+}
+
+/** the elements of a filling, a full and a partly dequeued queue **/
+static bool getElementsTest() {
+	SPBPQueueElement elements[TEST_NUM_OF_ELEMENTS];
+	SPBPQueue bpq = spBPQueueCreate(TEST_MAX_SIZE);
+	ASSERT_TRUE(bpq != NULL);
+	ASSERT_TRUE(spBPQueueGetElements(NULL) == NULL);
+	randomElements(elements, TEST_MAX_SIZE / 2, 0);
+	ASSERT_TRUE(enqueueAll(bpq, elements, TEST_MAX_SIZE / 2));
+	ASSERT_TRUE(checkElements(bpq, elements, TEST_MAX_SIZE / 2));
+	randomElements(elements, TEST_NUM_OF_ELEMENTS, 0);
+	spBPQueueReset(bpq);
+	ASSERT_TRUE(enqueueAll(bpq, elements, TEST_NUM_OF_ELEMENTS));
+	ASSERT_TRUE(checkElements(bpq, elements, TEST_MAX_SIZE));
+	for (int k = 1; k <= TEST_MAX_SIZE; k++) {
+		ASSERT_TRUE(spBPQueueDequeue(bpq) == SP_BPQUEUE_SUCCESS);
+		ASSERT_TRUE(checkElements(bpq, elements + k, TEST_MAX_SIZE - k));
+	}
+	spBPQueueDestroy(bpq);
+	return true;
+}
+
+/** a reset queue is empty, keeps its maximum size and fills as a new one **/
+static bool resetTest() {
+	SPBPQueueElement elements[TEST_NUM_OF_ELEMENTS];
+	SPBPQueueElement again[TEST_NUM_OF_ELEMENTS];
+	SPBPQueue bpq = spBPQueueCreate(TEST_MAX_SIZE);
+	SPBPQueue fresh = spBPQueueCreate(TEST_MAX_SIZE);
+	ASSERT_TRUE(bpq != NULL && fresh != NULL);
+	randomElements(elements, TEST_NUM_OF_ELEMENTS, 0);
+	ASSERT_TRUE(enqueueAll(bpq, elements, TEST_NUM_OF_ELEMENTS));
+	spBPQueueReset(bpq);
+	spBPQueueReset(NULL);
+	ASSERT_TRUE(spBPQueueSize(bpq) == 0);
+	ASSERT_TRUE(spBPQueueGetMaxSize(bpq) == TEST_MAX_SIZE);
+	ASSERT_TRUE(checkQueue(bpq, elements, 0));
+	ASSERT_TRUE(checkElements(bpq, elements, 0));
+	randomElements(elements, TEST_NUM_OF_ELEMENTS, TEST_NUM_OF_ELEMENTS);
+	for (int i = 0; i < TEST_NUM_OF_ELEMENTS; i++)
+		again[i] = elements[i];
+	ASSERT_TRUE(enqueueAll(bpq, elements, TEST_NUM_OF_ELEMENTS));
+	ASSERT_TRUE(enqueueAll(fresh, again, TEST_NUM_OF_ELEMENTS));
+	ASSERT_TRUE(checkElements(bpq, elements, TEST_MAX_SIZE));
+	ASSERT_TRUE(drainQueue(bpq, elements, TEST_MAX_SIZE));
+	ASSERT_TRUE(drainQueue(fresh, again, TEST_MAX_SIZE));
+	spBPQueueDestroy(fresh);
+	spBPQueueDestroy(bpq);
+	return true;
+}
+
+int main() {
+	int failedTests = 0;
+	srand(0);
+	RUN_TEST(enqueueTest);
+	RUN_TEST(tieTest);
+	RUN_TEST(mixedTest);
+	RUN_TEST(isFullTest);
+	RUN_TEST(setSizeTest);
+	RUN_TEST(copyTest);
+	RUN_TEST(containsTest);
+	RUN_TEST(getElementsTest);
+	RUN_TEST(resetTest);
+	return failedTests;
+}
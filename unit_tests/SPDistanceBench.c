@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include "../SPDistance.h"
+#include "../SPDistanceFixed.h"
+
+/*
+ * Times every distance kernel the running CPU supports for the PCA
+ * dimensions, in nanoseconds per distance. Every kernel is called through
+ * its spL2SquaredDistance*Kernel entry point (or directly for the fixed
+ * kernels) over the same rows, so the columns of a line compare the
+ * instruction sets and the lines compare the dimensions.
+ */
+
+#define BENCH_ROWS 1024
+#define BENCH_PASSES 100
+#define BENCH_CALLS ((long) BENCH_ROWS * BENCH_PASSES)
+
+typedef enum bench_family_t {
+	BENCH_DOUBLE,
+	BENCH_FIXED_DOUBLE,
+	BENCH_FLOAT,
+	BENCH_FIXED_FLOAT,
+	BENCH_UINT8,
+	BENCH_BLOCK,
+	BENCH_FLOAT_BLOCK,
+	BENCH_NUM_OF_FAMILIES
+} BENCH_FAMILY;
+
+static const char* familyNames[BENCH_NUM_OF_FAMILIES] = { "double",
+		"fixed double", "float", "fixed float", "uint8", "double block",
+		"float block" };
+
+static const SP_DISTANCE_KERNEL kernels[] = { SP_DISTANCE_SCALAR,
+		SP_DISTANCE_SSE2, SP_DISTANCE_AVX2, SP_DISTANCE_AVX512 };
+#define BENCH_NUM_OF_KERNELS (int) (sizeof(kernels) / sizeof(kernels[0]))
+
+static double rows[BENCH_ROWS * SP_DISTANCE_FIXED_MAX_DIM];
+static float floatRows[BENCH_ROWS * SP_DISTANCE_FIXED_MAX_DIM];
+static unsigned char codes[BENCH_ROWS * SP_DISTANCE_FIXED_MAX_DIM];
+static double query[SP_DISTANCE_FIXED_MAX_DIM];
+static float floatQuery[SP_DISTANCE_FIXED_MAX_DIM];
+static float weights[SP_DISTANCE_FIXED_MAX_DIM];
+static float lut[SP_DISTANCE_FIXED_MAX_DIM * SP_PQ_CENTROIDS];
+
+// every result is added here so the calls are not optimized away
+static volatile double sink = 0;
+
+static double nsPerDistance(clock_t start) {
+	return (double) (clock() - start) / CLOCKS_PER_SEC * 1e9 / BENCH_CALLS;
+}
+
+/**
+ * @return
+ * The time of one distance of family with kernel, or a negative value if
+ * there is no such kernel
+ */
+static double benchKernel(BENCH_FAMILY family, SP_DISTANCE_KERNEL kernel,
+		int dim) {
+	SPL2Kernel fixed = spDistanceFixedKernel(kernel, dim);
+	SPL2FloatKernel fixedFloat = spDistanceFixedFloatKernel(kernel, dim);
+	double distances[SP_DISTANCE_BLOCK];
+	float floatDistances[SP_DISTANCE_BLOCK];
+	double sum = 0;
+	if ((family == BENCH_FIXED_DOUBLE && fixed == NULL)
+			|| (family == BENCH_FIXED_FLOAT && fixedFloat == NULL))
+		return -1;
+	clock_t start = clock();
+	for (int pass = 0; pass < BENCH_PASSES; pass++) {
+		for (int r = 0; r < BENCH_ROWS; r += SP_DISTANCE_BLOCK) {
+			for (int j = 0; j < SP_DISTANCE_BLOCK; j++) {
+				int row = (r + j) * dim;
+				switch (family) {
+				case BENCH_DOUBLE:
+					sum += spL2SquaredDistanceKernel(kernel, rows + row, query,
+							dim);
+					break;
+				case BENCH_FIXED_DOUBLE:
+					sum += fixed(rows + row, query, dim, HUGE_VAL);
+					break;
+				case BENCH_FLOAT:
+					sum += spL2SquaredDistanceFloatKernel(kernel,
+							floatRows + row, floatQuery, dim);
+					break;
+				case BENCH_FIXED_FLOAT:
+					sum += fixedFloat(floatRows + row, floatQuery, dim, HUGE_VAL);
+					break;
+				case BENCH_UINT8:
+					sum += spL2SquaredDistanceUInt8Kernel(kernel, floatQuery,
+							codes + row, weights, dim);
+					break;
+				default:
+					break;
+				}
+			}
+			// a block holds the SP_DISTANCE_BLOCK rows starting at r
+			if (family == BENCH_BLOCK) {
+				spL2SquaredDistanceBlockKernel(kernel, query, rows + r * dim,
+						dim, distances);
+				sum += distances[0];
+			} else if (family == BENCH_FLOAT_BLOCK) {
+				spL2SquaredDistanceFloatBlockKernel(kernel, floatQuery,
+						floatRows + r * dim, dim, floatDistances);
+				sum += floatDistances[0];
+			}
+		}
+	}
+	double result = nsPerDistance(start);
+	sink += sum;
+	return result;
+}
+
+static double benchPQ(int subspaces) {
+	double sum = 0;
+	clock_t start = clock();
+	for (int pass = 0; pass < BENCH_PASSES; pass++) {
+		for (int r = 0; r < BENCH_ROWS; r++)
+			sum += spPQDistance(lut, codes + r * subspaces, subspaces);
+	}
+	double result = nsPerDistance(start);
+	sink += sum;
+	return result;
+}
+
+int main() {
+	srand(0);
+	for (int i = 0; i < BENCH_ROWS * SP_DISTANCE_FIXED_MAX_DIM; i++) {
+		rows[i] = rand() / (double) RAND_MAX * 200.0 - 100.0;
+		floatRows[i] = (float) rows[i];
+		codes[i] = (unsigned char) (rand() % 256);
+	}
+	for (int i = 0; i < SP_DISTANCE_FIXED_MAX_DIM; i++) {
+		query[i] = rand() / (double) RAND_MAX * 200.0 - 100.0;
+		floatQuery[i] = (float) (rand() / (double) RAND_MAX * 255.0);
+		weights[i] = (float) (rand() / (double) RAND_MAX);
+	}
+	for (int i = 0; i < SP_DISTANCE_FIXED_MAX_DIM * SP_PQ_CENTROIDS; i++)
+		lut[i] = (float) (rand() / (double) RAND_MAX * 1000.0);
+	printf("chosen kernel: %s, ns per distance\n",
+			spDistanceKernelName(spDistanceGetKernel()));
+	for (int family = 0; family < BENCH_NUM_OF_FAMILIES; family++) {
+		printf("\n%-14s", familyNames[family]);
+		for (int k = 0; k < BENCH_NUM_OF_KERNELS; k++) {
+			if (spDistanceKernelSupported(kernels[k]))
+				printf("%10s", spDistanceKernelName(kernels[k]));
+		}
+		printf("\n");
+		for (int dim = SP_DISTANCE_FIXED_MIN_DIM;
+				dim <= SP_DISTANCE_FIXED_MAX_DIM; dim++) {
+			printf("dim %-10d", dim);
+			for (int k = 0; k < BENCH_NUM_OF_KERNELS; k++) {
+				if (!spDistanceKernelSupported(kernels[k]))
+					continue;
+				double ns = benchKernel((BENCH_FAMILY) family, kernels[k], dim);
+				if (ns < 0)
+					printf("%10s", "-");
+				else
+					printf("%10.2f", ns);
+			}
+			printf("\n");
+		}
+	}
+	printf("\n%-14s\n", "pq");
+	for (int subspaces = SP_DISTANCE_FIXED_MIN_DIM;
+			subspaces <= SP_DISTANCE_FIXED_MAX_DIM; subspaces++)
+		printf("subspaces %-4d%10.2f\n", subspaces, benchPQ(subspaces));
+	return 0;
+}
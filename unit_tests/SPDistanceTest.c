@@ -0,0 +1,326 @@
+#include <stdlib.h>
+#include <math.h>
+#include "unit_test_util.h"
+#include "../SPDistance.h"
+#include "../SPDistanceFixed.h"
+
+/*
+ * Checks every kernel the running CPU supports against the scalar kernel.
+ * The kernels promise bit-compatible results, so the values are compared
+ * with ==. The dimensions cover every tail length (dim % 8) below and
+ * above the PCA dimensions, and the arrays start one element after an
+ * allocation so the vector kernels also load unaligned coordinates.
+ */
+
+#define TEST_MAX_DIM 40
+#define TEST_TRIALS 20
+#define TEST_NUM_OF_BOUNDS 4
+
+static const SP_DISTANCE_KERNEL kernels[] = { SP_DISTANCE_SCALAR,
+		SP_DISTANCE_SSE2, SP_DISTANCE_AVX2, SP_DISTANCE_AVX512 };
+#define TEST_NUM_OF_KERNELS (int) (sizeof(kernels) / sizeof(kernels[0]))
+
+static double randomCoor() {
+	return (rand() / (double) RAND_MAX) * 200.0 - 100.0;
+}
+
+static void randomDoubles(double* values, int n) {
+	for (int i = 0; i < n; i++)
+		values[i] = randomCoor();
+}
+
+static void randomFloats(float* values, int n) {
+	for (int i = 0; i < n; i++)
+		values[i] = (float) randomCoor();
+}
+
+/** true if a bounded result is the exact distance or, above bound, anything above bound **/
+static bool isBoundedResult(double exact, double bound, double result) {
+	return exact <= bound ? result == exact : result > bound;
+}
+
+/** the bounds every bounded kernel is called with, relative to the exact distance **/
+static void fillBounds(double exact, double* bounds) {
+	bounds[0] = exact * 0.25;
+	bounds[1] = exact * 0.75;
+	bounds[2] = exact;
+	bounds[3] = HUGE_VAL;
+}
+
+/** the scalar kernels against plain sums in double **/
+static bool scalarKernelsTest() {
+	double p[TEST_MAX_DIM], q[TEST_MAX_DIM];
+	float pf[TEST_MAX_DIM], qf[TEST_MAX_DIM], qu[TEST_MAX_DIM];
+	float weights[TEST_MAX_DIM];
+	unsigned char codes[TEST_MAX_DIM];
+	for (int dim = 1; dim <= TEST_MAX_DIM; dim++) {
+		double expected = 0, expectedFloat = 0, expectedUInt8 = 0;
+		randomDoubles(p, dim);
+		randomDoubles(q, dim);
+		randomFloats(pf, dim);
+		randomFloats(qf, dim);
+		for (int i = 0; i < dim; i++) {
+			qu[i] = (float) (rand() / (double) RAND_MAX * 255.0);
+			codes[i] = (unsigned char) (rand() % 256);
+			weights[i] = (float) (rand() / (double) RAND_MAX);
+			expected += (p[i] - q[i]) * (p[i] - q[i]);
+			expectedFloat += ((double) pf[i] - qf[i]) * ((double) pf[i] - qf[i]);
+			expectedUInt8 += weights[i] * ((double) qu[i] - codes[i])
+					* ((double) qu[i] - codes[i]);
+		}
+		ASSERT_TRUE(
+				fabs(spL2SquaredDistanceKernel(SP_DISTANCE_SCALAR, p, q, dim) - expected) <= 1e-9 * expected);
+		ASSERT_TRUE(
+				fabs(spL2SquaredDistanceFloatKernel(SP_DISTANCE_SCALAR, pf, qf, dim) - expectedFloat) <= 1e-5 * expectedFloat);
+		ASSERT_TRUE(
+				fabs(spL2SquaredDistanceUInt8Kernel(SP_DISTANCE_SCALAR, qu, codes, weights, dim) - expectedUInt8) <= 1e-5 * expectedUInt8);
+	}
+	return true;
+}
+
+static bool doubleKernelsTest() {
+	double pAlloc[TEST_MAX_DIM + 1], qAlloc[TEST_MAX_DIM + 1];
+	double* p = pAlloc + 1;
+	double* q = qAlloc + 1;
+	double bounds[TEST_NUM_OF_BOUNDS];
+	for (int dim = 1; dim <= TEST_MAX_DIM; dim++) {
+		for (int trial = 0; trial < TEST_TRIALS; trial++) {
+			randomDoubles(p, dim);
+			randomDoubles(q, dim);
+			double exact = spL2SquaredDistanceKernel(SP_DISTANCE_SCALAR, p, q,
+					dim);
+			for (int k = 0; k < TEST_NUM_OF_KERNELS; k++) {
+				if (spDistanceKernelSupported(kernels[k]))
+					ASSERT_TRUE(
+							spL2SquaredDistanceKernel(kernels[k], p, q, dim) == exact);
+			}
+			ASSERT_TRUE(spL2SquaredDistance(p, q, dim) == exact);
+			fillBounds(exact, bounds);
+			for (int b = 0; b < TEST_NUM_OF_BOUNDS; b++)
+				ASSERT_TRUE(
+						isBoundedResult(exact, bounds[b], spL2SquaredDistanceBounded(p, q, dim, bounds[b])));
+		}
+	}
+	return true;
+}
+
+static bool floatKernelsTest() {
+	float pAlloc[TEST_MAX_DIM + 1], qAlloc[TEST_MAX_DIM + 1];
+	float* p = pAlloc + 1;
+	float* q = qAlloc + 1;
+	double bounds[TEST_NUM_OF_BOUNDS];
+	for (int dim = 1; dim <= TEST_MAX_DIM; dim++) {
+		for (int trial = 0; trial < TEST_TRIALS; trial++) {
+			randomFloats(p, dim);
+			randomFloats(q, dim);
+			float exact = spL2SquaredDistanceFloatKernel(SP_DISTANCE_SCALAR, p,
+					q, dim);
+			for (int k = 0; k < TEST_NUM_OF_KERNELS; k++) {
+				if (spDistanceKernelSupported(kernels[k]))
+					ASSERT_TRUE(
+							spL2SquaredDistanceFloatKernel(kernels[k], p, q, dim) == exact);
+			}
+			ASSERT_TRUE(spL2SquaredDistanceFloat(p, q, dim) == exact);
+			fillBounds(exact, bounds);
+			for (int b = 0; b < TEST_NUM_OF_BOUNDS; b++)
+				ASSERT_TRUE(
+						isBoundedResult(exact, bounds[b], spL2SquaredDistanceFloatBounded(p, q, dim, bounds[b])));
+		}
+	}
+	return true;
+}
+
+static bool uint8KernelsTest() {
+	float qAlloc[TEST_MAX_DIM + 1], weightsAlloc[TEST_MAX_DIM + 1];
+	unsigned char codesAlloc[TEST_MAX_DIM + 1];
+	float* q = qAlloc + 1;
+	float* weights = weightsAlloc + 1;
+	unsigned char* codes = codesAlloc + 1;
+	double bounds[TEST_NUM_OF_BOUNDS];
+	for (int dim = 1; dim <= TEST_MAX_DIM; dim++) {
+		for (int trial = 0; trial < TEST_TRIALS; trial++) {
+			for (int i = 0; i < dim; i++) {
+				q[i] = (float) (rand() / (double) RAND_MAX * 300.0 - 20.0);
+				codes[i] = (unsigned char) (rand() % 256);
+				weights[i] = (float) (rand() / (double) RAND_MAX);
+			}
+			float exact = spL2SquaredDistanceUInt8Kernel(SP_DISTANCE_SCALAR, q,
+					codes, weights, dim);
+			for (int k = 0; k < TEST_NUM_OF_KERNELS; k++) {
+				if (spDistanceKernelSupported(kernels[k]))
+					ASSERT_TRUE(
+							spL2SquaredDistanceUInt8Kernel(kernels[k], q, codes, weights, dim) == exact);
+			}
+			ASSERT_TRUE(spL2SquaredDistanceUInt8(q, codes, weights, dim) == exact);
+			fillBounds(exact, bounds);
+			for (int b = 0; b < TEST_NUM_OF_BOUNDS; b++)
+				ASSERT_TRUE(
+						isBoundedResult(exact, bounds[b], spL2SquaredDistanceUInt8Bounded(q, codes, weights, dim, bounds[b])));
+		}
+	}
+	return true;
+}
+
+static bool blockKernelsTest() {
+	double rows[SP_DISTANCE_BLOCK][TEST_MAX_DIM];
+	double blockAlloc[SP_DISTANCE_BLOCK * TEST_MAX_DIM + 1];
+	double qAlloc[TEST_MAX_DIM + 1];
+	double* block = blockAlloc + 1;
+	double* q = qAlloc + 1;
+	double exact[SP_DISTANCE_BLOCK], distances[SP_DISTANCE_BLOCK];
+	for (int dim = 1; dim <= TEST_MAX_DIM; dim++) {
+		for (int trial = 0; trial < TEST_TRIALS; trial++) {
+			randomDoubles(q, dim);
+			for (int j = 0; j < SP_DISTANCE_BLOCK; j++) {
+				randomDoubles(rows[j], dim);
+				for (int i = 0; i < dim; i++)
+					block[i * SP_DISTANCE_BLOCK + j] = rows[j][i];
+				exact[j] = spL2SquaredDistanceKernel(SP_DISTANCE_SCALAR,
+						rows[j], q, dim);
+			}
+			for (int k = 0; k < TEST_NUM_OF_KERNELS; k++) {
+				if (!spDistanceKernelSupported(kernels[k]))
+					continue;
+				spL2SquaredDistanceBlockKernel(kernels[k], q, block, dim,
+						distances);
+				for (int j = 0; j < SP_DISTANCE_BLOCK; j++)
+					ASSERT_TRUE(distances[j] == exact[j]);
+			}
+			// a bound between the distances abandons some of the points
+			double bound = (exact[0] + exact[1]) / 2;
+			spL2SquaredDistanceBlock(q, block, dim, bound, distances);
+			for (int j = 0; j < SP_DISTANCE_BLOCK; j++)
+				ASSERT_TRUE(isBoundedResult(exact[j], bound, distances[j]));
+			spL2SquaredDistanceBlock(q, block, dim, HUGE_VAL, distances);
+			for (int j = 0; j < SP_DISTANCE_BLOCK; j++)
+				ASSERT_TRUE(distances[j] == exact[j]);
+		}
+	}
+	return true;
+}
+
+static bool floatBlockKernelsTest() {
+	float rows[SP_DISTANCE_BLOCK][TEST_MAX_DIM];
+	float blockAlloc[SP_DISTANCE_BLOCK * TEST_MAX_DIM + 1];
+	float qAlloc[TEST_MAX_DIM + 1];
+	float* block = blockAlloc + 1;
+	float* q = qAlloc + 1;
+	float exact[SP_DISTANCE_BLOCK], distances[SP_DISTANCE_BLOCK];
+	for (int dim = 1; dim <= TEST_MAX_DIM; dim++) {
+		for (int trial = 0; trial < TEST_TRIALS; trial++) {
+			randomFloats(q, dim);
+			for (int j = 0; j < SP_DISTANCE_BLOCK; j++) {
+				randomFloats(rows[j], dim);
+				for (int i = 0; i < dim; i++)
+					block[i * SP_DISTANCE_BLOCK + j] = rows[j][i];
+				exact[j] = spL2SquaredDistanceFloatKernel(SP_DISTANCE_SCALAR,
+						rows[j], q, dim);
+			}
+			for (int k = 0; k < TEST_NUM_OF_KERNELS; k++) {
+				if (!spDistanceKernelSupported(kernels[k]))
+					continue;
+				spL2SquaredDistanceFloatBlockKernel(kernels[k], q, block, dim,
+						distances);
+				for (int j = 0; j < SP_DISTANCE_BLOCK; j++)
+					ASSERT_TRUE(distances[j] == exact[j]);
+			}
+			double bound = ((double) exact[0] + exact[1]) / 2;
+			spL2SquaredDistanceFloatBlock(q, block, dim, bound, distances);
+			for (int j = 0; j < SP_DISTANCE_BLOCK; j++)
+				ASSERT_TRUE(isBoundedResult(exact[j], bound, distances[j]));
+			spL2SquaredDistanceFloatBlock(q, block, dim, HUGE_VAL, distances);
+			for (int j = 0; j < SP_DISTANCE_BLOCK; j++)
+				ASSERT_TRUE(distances[j] == exact[j]);
+		}
+	}
+	return true;
+}
+
+static bool fixedKernelsTest() {
+	double pAlloc[TEST_MAX_DIM + 1], qAlloc[TEST_MAX_DIM + 1];
+	float pfAlloc[TEST_MAX_DIM + 1], qfAlloc[TEST_MAX_DIM + 1];
+	double* p = pAlloc + 1;
+	double* q = qAlloc + 1;
+	float* pf = pfAlloc + 1;
+	float* qf = qfAlloc + 1;
+	double bounds[TEST_NUM_OF_BOUNDS];
+	for (int dim = 1; dim <= TEST_MAX_DIM; dim++) {
+		bool isFixed = dim >= SP_DISTANCE_FIXED_MIN_DIM
+				&& dim <= SP_DISTANCE_FIXED_MAX_DIM;
+		ASSERT_TRUE(spDistanceHasFixedKernel(dim) == isFixed);
+		for (int trial = 0; trial < TEST_TRIALS; trial++) {
+			randomDoubles(p, dim);
+			randomDoubles(q, dim);
+			randomFloats(pf, dim);
+			randomFloats(qf, dim);
+			double exact = spL2SquaredDistanceKernel(SP_DISTANCE_SCALAR, p, q,
+					dim);
+			float exactFloat = spL2SquaredDistanceFloatKernel(
+					SP_DISTANCE_SCALAR, pf, qf, dim);
+			ASSERT_TRUE(spDistanceGetKernelFunction(dim)(p, q, dim, HUGE_VAL) == exact);
+			ASSERT_TRUE(
+					spDistanceGetFloatKernelFunction(dim)(pf, qf, dim, HUGE_VAL) == exactFloat);
+			for (int k = 0; k < TEST_NUM_OF_KERNELS; k++) {
+				if (!spDistanceKernelSupported(kernels[k]))
+					continue;
+				SPL2Kernel kernel = spDistanceFixedKernel(kernels[k], dim);
+				SPL2FloatKernel floatKernel = spDistanceFixedFloatKernel(
+						kernels[k], dim);
+				ASSERT_TRUE((kernel != NULL) == (isFixed && kernels[k] != SP_DISTANCE_AVX512));
+				ASSERT_TRUE((floatKernel != NULL) == (kernel != NULL));
+				if (kernel == NULL)
+					continue;
+				fillBounds(exact, bounds);
+				for (int b = 0; b < TEST_NUM_OF_BOUNDS; b++)
+					ASSERT_TRUE(isBoundedResult(exact, bounds[b], kernel(p, q, dim, bounds[b])));
+				fillBounds(exactFloat, bounds);
+				for (int b = 0; b < TEST_NUM_OF_BOUNDS; b++)
+					ASSERT_TRUE(
+							isBoundedResult(exactFloat, bounds[b], floatKernel(pf, qf, dim, bounds[b])));
+			}
+		}
+	}
+	return true;
+}
+
+static bool pqDistanceTest() {
+	static float lut[TEST_MAX_DIM * SP_PQ_CENTROIDS];
+	unsigned char codes[TEST_MAX_DIM];
+	double bounds[TEST_NUM_OF_BOUNDS];
+	for (int i = 0; i < TEST_MAX_DIM * SP_PQ_CENTROIDS; i++)
+		lut[i] = (float) (rand() / (double) RAND_MAX * 1000.0);
+	for (int subspaces = 1; subspaces <= TEST_MAX_DIM; subspaces++) {
+		for (int trial = 0; trial < TEST_TRIALS; trial++) {
+			double expected = 0;
+			for (int s = 0; s < subspaces; s++) {
+				codes[s] = (unsigned char) (rand() % SP_PQ_CENTROIDS);
+				expected += lut[s * SP_PQ_CENTROIDS + codes[s]];
+			}
+			float exact = spPQDistance(lut, codes, subspaces);
+			ASSERT_TRUE(fabs(exact - expected) <= 1e-5 * expected);
+			fillBounds(exact, bounds);
+			for (int b = 0; b < TEST_NUM_OF_BOUNDS; b++)
+				ASSERT_TRUE(
+						isBoundedResult(exact, bounds[b], spPQDistanceBounded(lut, codes, subspaces, bounds[b])));
+		}
+	}
+	return true;
+}
+
+int main() {
+	int failedTests = 0;
+	srand(0);
+	for (int k = 0; k < TEST_NUM_OF_KERNELS; k++)
+		printf("%s kernel: %s\n", spDistanceKernelName(kernels[k]),
+				spDistanceKernelSupported(kernels[k]) ?
+						"tested" : "not supported by this CPU");
+	RUN_TEST(scalarKernelsTest);
+	RUN_TEST(doubleKernelsTest);
+	RUN_TEST(floatKernelsTest);
+	RUN_TEST(uint8KernelsTest);
+	RUN_TEST(blockKernelsTest);
+	RUN_TEST(floatBlockKernelsTest);
+	RUN_TEST(fixedKernelsTest);
+	RUN_TEST(pqDistanceTest);
+	return failedTests;
+}
@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include "unit_test_util.h"
+#include "../SPDynamicIndex.h"
+#include "../KDTreeNode.h"
+#include "../SPFeatureStore.h"
+#include "../SPBPriorityQueue.h"
+#include "../SPPoint.h"
+#include "../SPConfig.h"
+
+/*
+ * Runs random inserts, deletes and compactions on a dynamic index of every
+ * storage. Every few steps the index is checked against bruteForceNeighbors
+ * over a flat store (created like the index) holding the features of the
+ * images that should be in the index.
+ */
+
+#define TEST_DIM 20
+#define TEST_NUM_OF_IMAGES 120
+#define TEST_STEPS 400
+#define TEST_CHECK_EVERY 40
+#define TEST_NUM_OF_QUERIES 30
+#define TEST_KNN 5
+#define TEST_LEAF_SIZE 16
+#define TEST_PQ_SUBSPACES 10
+
+/** a neighbor as the index gives it: the image of the feature and its distance **/
+typedef struct TestNeighbor {
+	double value;
+	int image;
+} TestNeighbor;
+
+static int numOfFeatures(int image) {
+	return 20 + (image * 37) % 60;
+}
+
+/** the features of image, the same ones on every call **/
+static SPPoint* imageFeatures(int image) {
+	unsigned long seed = 1000 + image;
+	double data[TEST_DIM];
+	SPPoint* features = (SPPoint*) malloc(
+			sizeof(SPPoint) * numOfFeatures(image));
+	if (features == NULL)
+		return NULL;
+	for (int f = 0; f < numOfFeatures(image); f++) {
+		for (int j = 0; j < TEST_DIM; j++) {
+			seed = (seed * 1103515245 + 12345) % 2147483648UL;
+			data[j] = (seed >> 16) % 1500 / 10.0;
+		}
+		features[f] = spPointCreate(data, TEST_DIM, image);
+	}
+	return features;
+}
+
+static void destroyFeatures(SPPoint* features, int image) {
+	for (int f = 0; f < numOfFeatures(image); f++)
+		spPointDestroy(features[f]);
+	free(features);
+}
+
+/** appends the features of image to store **/
+static bool appendImage(SPFeatureStore store, int image) {
+	SPPoint* features = imageFeatures(image);
+	bool result = features != NULL;
+	for (int f = 0; result && f < numOfFeatures(image); f++)
+		result = spFeatureStoreAppendPoint(store, features[f])
+				== SP_FEATURE_STORE_SUCCESS;
+	if (features != NULL)
+		destroyFeatures(features, image);
+	return result;
+}
+
+/** a store of the given storage holding the first count images **/
+static SPFeatureStore createFirstImages(SPFeatureStorage storage, int count) {
+	double offsets[TEST_DIM], scales[TEST_DIM];
+	SPFeatureStore store = spFeatureStoreCreate(TEST_DIM, 0,
+			storage == PQ_STORAGE ? FLOAT_STORAGE : storage);
+	if (store == NULL)
+		return NULL;
+	for (int j = 0; j < TEST_DIM; j++) {
+		offsets[j] = 0;
+		scales[j] = 150.0 / 255;
+	}
+	if (storage == INT8_STORAGE
+			&& spFeatureStoreSetQuantization(store, offsets, scales, false)
+					!= SP_FEATURE_STORE_SUCCESS) {
+		spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	for (int i = 0; i < count; i++) {
+		if (!appendImage(store, i)) {
+			spFeatureStoreDestroy(store);
+			return NULL;
+		}
+	}
+	if (storage == PQ_STORAGE) {
+		SPFeatureStore compressed = spFeatureStoreCreateProductQuantized(
+				store, TEST_PQ_SUBSPACES, false);
+		spFeatureStoreDestroy(store);
+		store = compressed;
+	}
+	return store;
+}
+
+static int compareNeighbors(const void* a, const void* b) {
+	const TestNeighbor* x = (const TestNeighbor*) a;
+	const TestNeighbor* y = (const TestNeighbor*) b;
+	if (x->value != y->value)
+		return (x->value > y->value) - (x->value < y->value);
+	return x->image - y->image;
+}
+
+/**
+ * the elements of bpq sorted, as images (the offsets of store are mapped to
+ * their images if store is not NULL), bpq is emptied
+ **/
+static int takeNeighbors(SPBPQueue bpq, SPFeatureStore store,
+		TestNeighbor* neighbors) {
+	const SPBPQueueElement* elements = spBPQueueGetElements(bpq);
+	int size = spBPQueueSize(bpq);
+	for (int i = 0; i < size; i++) {
+		neighbors[i].value = elements[i].value;
+		neighbors[i].image =
+				store == NULL ?
+						elements[i].index :
+						spFeatureStoreGetIndex(store, elements[i].index);
+	}
+	spBPQueueReset(bpq);
+	qsort(neighbors, size, sizeof(TestNeighbor), compareNeighbors);
+	return size;
+}
+
+/** the index against the brute force search over the live images **/
+static bool isIndexOf(SPDynamicIndex index, SPFeatureStore layout,
+		const bool* live) {
+	TestNeighbor found[TEST_KNN], expected[TEST_KNN];
+	double data[TEST_DIM];
+	int size = 0;
+	SPFeatureStore reference = spFeatureStoreCreateLike(layout, 0);
+	SPBPQueue bpq = spBPQueueCreate(TEST_KNN);
+	bool result = reference != NULL && bpq != NULL;
+	for (int i = 0; result && i < TEST_NUM_OF_IMAGES; i++) {
+		result = spDynamicIndexHasImage(index, i) == live[i]
+				&& (!live[i] || appendImage(reference, i));
+		size += live[i] ? numOfFeatures(i) : 0;
+	}
+	result = result && spDynamicIndexGetSize(index) == size;
+	for (int q = 0; result && size > 0 && q < TEST_NUM_OF_QUERIES; q++) {
+		for (int j = 0; j < TEST_DIM; j++)
+			data[j] = rand() % 1500 / 10.0;
+		SPPoint point = spPointCreate(data, TEST_DIM, 0);
+		SPFeatureQuery query = spFeatureStorePrepareQuery(reference, point);
+		result = point != NULL && query != NULL
+				&& spDynamicIndexNeighbors(index, point, bpq)
+						== SP_DYNAMIC_INDEX_SUCCESS;
+		int count = result ? takeNeighbors(bpq, NULL, found) : 0;
+		if (result)
+			bruteForceNeighbors(reference, bpq, query);
+		result = result && takeNeighbors(bpq, reference, expected) == count;
+		for (int i = 0; result && i < count; i++)
+			result = found[i].value == expected[i].value
+					&& found[i].image == expected[i].image;
+		spFeatureQueryDestroy(query);
+		spPointDestroy(point);
+	}
+	spBPQueueDestroy(bpq);
+	spFeatureStoreDestroy(reference);
+	return result;
+}
+
+/** random inserts, deletes and compactions starting from the first half of the images **/
+static bool checkStorage(SPFeatureStorage storage) {
+	bool live[TEST_NUM_OF_IMAGES] = { false };
+	SPFeatureStore first = createFirstImages(storage,
+			TEST_NUM_OF_IMAGES / 2);
+	ASSERT_TRUE(first != NULL);
+	SPFeatureStore layout = spFeatureStoreCreateLike(first, 0);
+	SPDynamicIndex index = spDynamicIndexCreate(first, MAX_SPREAD,
+			TEST_LEAF_SIZE, 1);
+	bool result = layout != NULL && index != NULL;
+	for (int i = 0; i < TEST_NUM_OF_IMAGES / 2; i++)
+		live[i] = true;
+	for (int step = 0; result && step < TEST_STEPS; step++) {
+		int image = rand() % TEST_NUM_OF_IMAGES;
+		int operation = rand() % 10;
+		if (operation < 6) {
+			SPPoint* features = imageFeatures(image);
+			result = features != NULL
+					&& spDynamicIndexInsert(index, image, features,
+							numOfFeatures(image))
+							== (live[image] ?
+									SP_DYNAMIC_INDEX_INVALID_ARGUMENT :
+									SP_DYNAMIC_INDEX_SUCCESS);
+			if (features != NULL)
+				destroyFeatures(features, image);
+			live[image] = true;
+		} else if (operation < 9) {
+			result = spDynamicIndexDelete(index, image)
+					== (live[image] ?
+							SP_DYNAMIC_INDEX_SUCCESS :
+							SP_DYNAMIC_INDEX_INVALID_ARGUMENT);
+			live[image] = false;
+		} else {
+			result = spDynamicIndexCompact(index) == SP_DYNAMIC_INDEX_SUCCESS;
+		}
+		if (result && (step + 1) % TEST_CHECK_EVERY == 0)
+			result = isIndexOf(index, layout, live);
+	}
+	spDynamicIndexDestroy(index);
+	spFeatureStoreDestroy(layout);
+	ASSERT_TRUE(result);
+	return true;
+}
+
+static bool doubleIndexTest() {
+	return checkStorage(DOUBLE_STORAGE);
+}
+
+static bool floatIndexTest() {
+	return checkStorage(FLOAT_STORAGE);
+}
+
+static bool int8IndexTest() {
+	return checkStorage(INT8_STORAGE);
+}
+
+static bool pqIndexTest() {
+	return checkStorage(PQ_STORAGE);
+}
+
+int main() {
+	int failedTests = 0;
+	srand(0);
+	RUN_TEST(doubleIndexTest);
+	RUN_TEST(floatIndexTest);
+	RUN_TEST(int8IndexTest);
+	RUN_TEST(pqIndexTest);
+	return failedTests;
+}
@@ -0,0 +1,43 @@
+#ifndef UNIT_TEST_UTIL_H_
+#define UNIT_TEST_UTIL_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**
+ * Unit test util summary
+ *
+ * Every test is a function returning true if it passed. A failed check
+ * prints its file, line and expression and makes the test return false.
+ * RUN_TEST runs a test, prints its result and counts the failed tests in
+ * the variable failedTests of the caller, main returns that count so that
+ * make test stops at the first failing program.
+ */
+
+#define FAIL(msg) do {\
+		fprintf(stderr,"%s Line %d: %s\n", __FILE__, __LINE__, msg);\
+		return false;\
+	} while(0)
+
+#define ASSERT_TRUE(expression) do { \
+		if(!((expression))) { \
+			FAIL("expression is false :: " #expression); \
+		} \
+	} while (0)
+
+#define ASSERT_FALSE(expression) do { \
+		if((expression)) { \
+			FAIL("expression is true  :: " #expression); \
+		} \
+	} while (0)
+
+#define RUN_TEST(f) do { \
+		if(f()==true){ \
+			printf("%s PASS\n",#f); \
+		} else { \
+			printf("%s FAIL\n",#f); \
+			failedTests++; \
+		} \
+	} while (0)
+
+#endif /* UNIT_TEST_UTIL_H_ */